@@ -0,0 +1,185 @@
+// Round trip check of packSplats() and unpackSplats(): packs seeded scenes,
+// unpacks them and fails if any center, alpha, covariance or SH error goes
+// past the bounds documented in gpuSplat.h.
+//
+//   packed_splat_check [splatCount]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "gpuSplat.h"
+
+// Float rounding of the pack and unpack math, relative
+static const double kRounding = 4.0 * std::numeric_limits<float>::epsilon();
+
+struct SceneSpec {
+  const char* name;
+  float extent;
+  float minScale;  // log uniform between the two
+  float maxScale;
+  float shRange;
+  int cellsPerAxis;
+};
+
+static std::vector<GpuSplat> makeScene(const SceneSpec& spec, size_t count,
+                                       unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::uniform_real_distribution<float> signedUnit(-1.0f, 1.0f);
+  std::normal_distribution<float> normal(0.0f, 1.0f);
+  const float logMin = std::log(spec.minScale);
+  const float logMax = std::log(spec.maxScale);
+  std::vector<GpuSplat> splats(count);
+  for (GpuSplat& splat : splats) {
+    for (int c = 0; c < 3; c++)
+      splat.center[c] = signedUnit(rng) * 0.5f * spec.extent;
+    splat.alpha = unit(rng);
+    glm::vec3 scale;
+    for (int c = 0; c < 3; c++)
+      scale[c] = std::exp(logMin + unit(rng) * (logMax - logMin));
+    const glm::quat q = glm::normalize(
+        glm::quat(normal(rng), normal(rng), normal(rng), normal(rng)));
+    const glm::mat3 rs = glm::mat3_cast(q) *
+                         glm::mat3(scale.x, 0, 0, 0, scale.y, 0, 0, 0, scale.z);
+    const glm::mat3 cov = rs * glm::transpose(rs);
+    splat.covA[0] = cov[0][0];
+    splat.covA[1] = cov[0][1];
+    splat.covA[2] = cov[0][2];
+    splat.covB[0] = cov[1][1];
+    splat.covB[1] = cov[1][2];
+    splat.covB[2] = cov[2][2];
+    splat.padding0 = 0.0f;
+    splat.padding1 = 0.0f;
+    for (int k = 0; k < 16; k++) {
+      // Higher bands get smaller, as in trained scenes
+      const float range = spec.shRange / (float)(1 + k);
+      for (int c = 0; c < 3; c++)
+        splat.sh[k][c] = signedUnit(rng) * range;
+      splat.sh[k][3] = 0.0f;
+    }
+  }
+  return splats;
+}
+
+struct Errors {
+  // Largest error over its bound, passing while <= 1
+  double center = 0.0, alpha = 0.0, covariance = 0.0, dc = 0.0, sh = 0.0;
+  // Largest absolute error, for the report
+  double centerAbs = 0.0, alphaAbs = 0.0, covarianceRel = 0.0, dcAbs = 0.0,
+         shAbs = 0.0;
+};
+
+// Half a quantization step, plus the float rounding of computing the level
+// (up to `levels` steps) and of offset + level * step
+static double quantizationBound(double step, double levels, double offset,
+                                double value) {
+  return 0.5 * step + kRounding * (levels * step + std::fabs(offset) +
+                                   std::fabs(value));
+}
+
+static void track(double error, double bound, double& ratio,
+                  double& largest) {
+  largest = std::max(largest, error);
+  ratio = std::max(ratio, bound > 0.0 ? error / bound
+                                      : (error > 0.0 ? HUGE_VAL : 0.0));
+}
+
+static Errors measure(const std::vector<GpuSplat>& original,
+                      const std::vector<PackedSplat>& packed,
+                      const PackedSplatScene& scene,
+                      const std::vector<GpuSplat>& unpacked) {
+  Errors errors;
+  for (size_t i = 0; i < original.size(); i++) {
+    const GpuSplat& a = original[i];
+    const GpuSplat& b = unpacked[i];
+    const float* cell = &scene.cells[(size_t)packed[i].cell * 4];
+    for (int c = 0; c < 3; c++)
+      track(std::fabs(a.center[c] - b.center[c]),
+            quantizationBound(cell[3] / 65535.0, 65535.0, cell[c],
+                              a.center[c]),
+            errors.center, errors.centerAbs);
+    track(std::fabs(a.alpha - b.alpha),
+          quantizationBound(1.0 / 65535.0, 65535.0, 0.0, a.alpha),
+          errors.alpha, errors.alphaAbs);
+
+    float covarianceMax = 0.0f;
+    for (int c = 0; c < 3; c++)
+      covarianceMax = std::max(
+          covarianceMax, std::max(std::fabs(a.covA[c]), std::fabs(a.covB[c])));
+    // Half float rounding of the largest entry, the others round finer
+    const double covarianceBound =
+        std::ldexp((double)covarianceMax, -11) * (1.0 + kRounding);
+    for (int c = 0; c < 3; c++) {
+      const double errorA = std::fabs(a.covA[c] - b.covA[c]);
+      const double errorB = std::fabs(a.covB[c] - b.covB[c]);
+      double unused = 0.0;
+      track(errorA, covarianceBound, errors.covariance, unused);
+      track(errorB, covarianceBound, errors.covariance, unused);
+      if (covarianceMax > 0.0f)
+        errors.covarianceRel = std::max(
+            errors.covarianceRel, std::max(errorA, errorB) / covarianceMax);
+    }
+
+    for (int c = 0; c < 3; c++)
+      track(std::fabs(a.sh[0][c] - b.sh[0][c]),
+            quantizationBound(scene.shScale[0], 65535.0, scene.shOffset[0],
+                              a.sh[0][c]),
+            errors.dc, errors.dcAbs);
+    for (int k = 1; k < 16; k++)
+      for (int c = 0; c < 3; c++)
+        track(std::fabs(a.sh[k][c] - b.sh[k][c]),
+              quantizationBound(scene.shScale[k], 255.0, scene.shOffset[k],
+                                a.sh[k][c]),
+              errors.sh, errors.shAbs);
+  }
+  return errors;
+}
+
+int main(int argc, char** argv) {
+  const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+  if (count == 0) {
+    std::fprintf(stderr, "usage: packed_splat_check [splatCount]\n");
+    return 2;
+  }
+
+  const SceneSpec specs[] = {
+      {"room", 40.0f, 1e-3f, 1.0f, 2.0f, 64},
+      {"city", 1000.0f, 1e-2f, 20.0f, 4.0f, 128},
+      {"object", 0.5f, 1e-5f, 1e-2f, 1.0f, 1},
+      {"mixed", 100.0f, 1e-6f, 100.0f, 8.0f, 64},
+  };
+
+  bool passed = true;
+  std::printf("%-8s %6s %10s %10s %10s %10s %10s  %s\n", "scene", "cells",
+              "center", "alpha", "cov rel", "dc", "sh", "");
+  for (const SceneSpec& spec : specs) {
+    const std::vector<GpuSplat> splats =
+        makeScene(spec, count, 1234u + (unsigned)spec.cellsPerAxis);
+    std::vector<PackedSplat> packed;
+    PackedSplatScene scene;
+    packSplats(splats.data(), splats.size(), packed, scene, spec.cellsPerAxis);
+    std::vector<GpuSplat> unpacked(splats.size());
+    unpackSplats(packed.data(), packed.size(), scene, unpacked.data());
+
+    const Errors e = measure(splats, packed, scene, unpacked);
+    const bool ok = e.center <= 1.0 && e.alpha <= 1.0 &&
+                    e.covariance <= 1.0 && e.dc <= 1.0 && e.sh <= 1.0;
+    passed = passed && ok;
+    std::printf("%-8s %6d %10.3g %10.3g %10.3g %10.3g %10.3g  %s\n",
+                spec.name, spec.cellsPerAxis, e.centerAbs, e.alphaAbs,
+                e.covarianceRel, e.dcAbs, e.shAbs, ok ? "ok" : "FAILED");
+    if (!ok)
+      std::printf("  over bound by: center %.3g, alpha %.3g, covariance "
+                  "%.3g, dc %.3g, sh %.3g\n",
+                  e.center, e.alpha, e.covariance, e.dc, e.sh);
+  }
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+#ifndef POINTEROCTREE_H
+#define POINTEROCTREE_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Baseline for splatTreeBench: the classic octree with heap allocated
+// children and float bounds per node, built recursively. Same split rule and
+// culling test as SplatTree, so only the memory layout differs.
+class PointerOctree {
+ public:
+  struct Node {
+    glm::vec3 cellMin, cellMax;
+    glm::vec3 boundsMin = glm::vec3(FLT_MAX), boundsMax = glm::vec3(-FLT_MAX);
+    std::vector<std::unique_ptr<Node>> children;
+    uint32_t indexBegin = 0, indexEnd = 0;
+    int depth = 0;
+  };
+
+  PointerOctree(int maxDepth, uint32_t maxLeafSize)
+      : maxDepth(maxDepth), maxLeafSize(maxLeafSize) {}
+
+  void build(const float* _centers, uint32_t splatCount) {
+    centers = _centers;
+    indexes.resize(splatCount);
+    nodeCount = 0;
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for (uint32_t i = 0; i < splatCount; i++) {
+      indexes[i] = i;
+      lo = glm::min(lo, center(i));
+      hi = glm::max(hi, center(i));
+    }
+    const glm::vec3 mid = (lo + hi) * 0.5f;
+    const glm::vec3 extent = hi - lo;
+    const float half = std::max(extent.x, std::max(extent.y, extent.z)) * 0.5f;
+    root.reset(new Node());
+    root->cellMin = mid - half;
+    root->cellMax = mid + half;
+    root->indexEnd = splatCount;
+    buildNode(*root);
+  }
+
+  uint32_t getVisibleIndexes(const glm::mat4& viewProj,
+                             std::vector<uint32_t>& visibleIndexes) const {
+    const glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+    const glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+    const glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+    const glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+    const glm::vec4 planes[5] = {1.2f * row3 + row0, 1.2f * row3 - row0,
+                                 1.2f * row3 + row1, 1.2f * row3 - row1,
+                                 row3 + row2};
+    const size_t base = visibleIndexes.size();
+    std::vector<const Node*> stack = {root.get()};
+    while (!stack.empty()) {
+      const Node* node = stack.back();
+      stack.pop_back();
+      bool outside = false, inside = true;
+      for (const glm::vec4& plane : planes) {
+        const glm::vec3 n(plane);
+        const glm::vec3 positive(n.x >= 0.0f ? node->boundsMax.x : node->boundsMin.x,
+                                 n.y >= 0.0f ? node->boundsMax.y : node->boundsMin.y,
+                                 n.z >= 0.0f ? node->boundsMax.z : node->boundsMin.z);
+        const glm::vec3 negative(n.x >= 0.0f ? node->boundsMin.x : node->boundsMax.x,
+                                 n.y >= 0.0f ? node->boundsMin.y : node->boundsMax.y,
+                                 n.z >= 0.0f ? node->boundsMin.z : node->boundsMax.z);
+        if (glm::dot(n, positive) + plane.w < 0.0f) { outside = true; break; }
+        if (glm::dot(n, negative) + plane.w < 0.0f) inside = false;
+      }
+      if (outside)
+        continue;
+      if (inside || node->children.empty()) {
+        visibleIndexes.insert(visibleIndexes.end(),
+                              indexes.begin() + node->indexBegin,
+                              indexes.begin() + node->indexEnd);
+        continue;
+      }
+      for (auto it = node->children.rbegin(); it != node->children.rend(); ++it)
+        stack.push_back(it->get());
+    }
+    return (uint32_t)(visibleIndexes.size() - base);
+  }
+
+  uint32_t getNodeCount() const { return nodeCount; }
+
+ private:
+  glm::vec3 center(uint32_t i) const {
+    return glm::vec3(centers[3 * i], centers[3 * i + 1], centers[3 * i + 2]);
+  }
+
+  void buildNode(Node& node) {
+    nodeCount++;
+    if (node.indexEnd - node.indexBegin <= maxLeafSize || node.depth >= maxDepth) {
+      for (uint32_t i = node.indexBegin; i < node.indexEnd; i++) {
+        node.boundsMin = glm::min(node.boundsMin, center(indexes[i]));
+        node.boundsMax = glm::max(node.boundsMax, center(indexes[i]));
+      }
+      return;
+    }
+
+    const glm::vec3 split = (node.cellMin + node.cellMax) * 0.5f;
+    auto octantOf = [&](uint32_t index) {
+      const glm::vec3 c = center(index);
+      return (c.x >= split.x ? 1 : 0) | (c.y >= split.y ? 2 : 0) |
+             (c.z >= split.z ? 4 : 0);
+    };
+    uint32_t offsets[9] = {0};
+    for (uint32_t i = node.indexBegin; i < node.indexEnd; i++)
+      offsets[octantOf(indexes[i]) + 1]++;
+    offsets[0] = node.indexBegin;
+    for (int o = 0; o < 8; o++)
+      offsets[o + 1] += offsets[o];
+    uint32_t cursor[8];
+    std::copy(offsets, offsets + 8, cursor);
+    scratch.resize(indexes.size());
+    for (uint32_t i = node.indexBegin; i < node.indexEnd; i++)
+      scratch[cursor[octantOf(indexes[i])]++] = indexes[i];
+    std::copy(scratch.begin() + node.indexBegin, scratch.begin() + node.indexEnd,
+              indexes.begin() + node.indexBegin);
+
+    for (int o = 0; o < 8; o++) {
+      const uint32_t begin = offsets[o], end = offsets[o + 1];
+      if (end == begin)
+        continue;
+      std::unique_ptr<Node> child(new Node());
+      child->cellMin = node.cellMin;
+      child->cellMax = split;
+      if (o & 1) { child->cellMin.x = split.x; child->cellMax.x = node.cellMax.x; }
+      if (o & 2) { child->cellMin.y = split.y; child->cellMax.y = node.cellMax.y; }
+      if (o & 4) { child->cellMin.z = split.z; child->cellMax.z = node.cellMax.z; }
+      child->indexBegin = begin;
+      child->indexEnd = end;
+      child->depth = node.depth + 1;
+      buildNode(*child);
+      node.boundsMin = glm::min(node.boundsMin, child->boundsMin);
+      node.boundsMax = glm::max(node.boundsMax, child->boundsMax);
+      node.children.push_back(std::move(child));
+    }
+  }
+
+  int maxDepth;
+  uint32_t maxLeafSize;
+  const float* centers = nullptr;
+  std::vector<uint32_t> indexes, scratch;
+  std::unique_ptr<Node> root;
+  uint32_t nodeCount = 0;
+};
+
+#endif
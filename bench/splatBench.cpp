@@ -0,0 +1,597 @@
+// Timings of the splat hot paths in isolation: the depth sort and the cull
+// pass along a fixed camera path, packing the sort output to 16 bits (with
+// the image error of each packing), level 1 SplatBuffer decoding and the
+// fill functions, and loading a trained PLY. Scenes are synthetic and
+// seeded, so runs on different machines or commits see the same splats.
+// Results go out as JSON: percentiles of every sample, throughput at the
+// median and the peak resident memory of the process once each scene is
+// done. That peak never goes down, so it covers every scene before too: run
+// one scene per process to compare their footprints.
+//
+//   splat_bench [--sizes 100000,1000000] [--scenes uniform,clustered,planar]
+//               [--runs 5] [--views 64]
+//               [--only sort,cull,pack,decode,fill,load]
+//               [--ply splat_bench.ply] [--out results.json]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#include "indexUpload.h"
+#include "sortEngine.h"
+#include "splatBuffer.h"
+#include "splatBufferWriter.h"
+#include "splatCull.h"
+#include "splatOrder.h"
+#include "splatPly.h"
+#include "splatRasterizer.h"
+#include "timing.h"
+
+// Fixed point scale of positions and view-projection fed to the sort
+static const float kFixedPointScale = 1000.0f;
+static const uint32_t kDistanceMapRange = 1 << 16;
+// DC term of the shader.vs SH basis
+static const float SH_C0 = 0.28209479177387814f;
+// Views rendered to measure the packing error, and their size
+static const int kPackViews = 4;
+static const glm::vec2 kPackViewport(320.0f, 180.0f);
+
+static double percentile(const std::vector<double>& sorted, double p) {
+  const size_t i = (size_t)std::lround(p * (double)(sorted.size() - 1));
+  return sorted[std::min(i, sorted.size() - 1)];
+}
+
+// Peak resident set of the process so far, in MiB, all scenes before
+// included
+static double peakMemoryMB() {
+#if !defined(_WIN32)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+    return (double)usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    return (double)usage.ru_maxrss / 1024.0;
+#endif
+  }
+#endif
+  return 0.0;
+}
+
+static std::vector<std::string> split(const std::string& list) {
+  std::vector<std::string> items;
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ','))
+    if (!item.empty())
+      items.push_back(item);
+  return items;
+}
+
+static const char* const kSceneKinds[] = {"uniform", "clustered", "planar"};
+static const char* const kBenchmarks[] = {"sort",   "cull", "pack",
+                                          "decode", "fill", "load"};
+
+template <size_t N>
+static bool isOneOf(const std::string& name, const char* const (&names)[N]) {
+  return std::find(names, names + N, name) != names + N;
+}
+
+// `kind` is one of kSceneKinds
+static SplatArrays makeScene(const std::string& kind, uint32_t count) {
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> u(-50.0f, 50.0f);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::normal_distribution<float> n(0.0f, 1.0f);
+  SplatArrays splats;
+  splats.resize(count);
+
+  if (kind == "uniform") {
+    for (float& c : splats.centers)
+      c = u(rng);
+  } else if (kind == "clustered") {
+    // Gaussian blobs of very different sizes, closer to a captured scene
+    std::vector<glm::vec4> blobs(64);
+    for (glm::vec4& b : blobs)
+      b = glm::vec4(u(rng), u(rng), u(rng), 0.2f + std::abs(u(rng)) * 0.1f);
+    for (uint32_t i = 0; i < count; i++) {
+      const glm::vec4& b = blobs[i % blobs.size()];
+      for (int a = 0; a < 3; a++)
+        splats.centers[3 * i + a] = b[a] + n(rng) * b.w;
+    }
+  } else {
+    // planar: thin walls and a floor, the worst case for a single depth axis
+    for (uint32_t i = 0; i < count; i++) {
+      float* c = &splats.centers[3 * (size_t)i];
+      const int plane = (int)(i % 4);
+      c[0] = u(rng);
+      c[1] = u(rng);
+      c[2] = u(rng);
+      c[plane % 3] = (plane == 3 ? 20.0f : -20.0f) + n(rng) * 0.05f;
+    }
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    for (int a = 0; a < 3; a++)
+      splats.scales[3 * (size_t)i + a] = 0.01f + 0.2f * unit(rng) * unit(rng);
+    glm::vec4 q(n(rng), n(rng), n(rng), n(rng));
+    q /= std::max(glm::length(q), 1e-6f);
+    for (int a = 0; a < 4; a++)
+      splats.rotations[4 * (size_t)i + a] = q[a];
+    for (int a = 0; a < 4; a++)
+      splats.colors[4 * (size_t)i + a] = (uint8_t)(rng() & 0xff);
+  }
+  return splats;
+}
+
+// Orbit inside the scene looking outwards, the path of splat_tree_bench
+static std::vector<glm::mat4> makeCameraPath(int views) {
+  const glm::mat4 proj =
+      glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+  std::vector<glm::mat4> path;
+  for (int v = 0; v < views; v++) {
+    const float a = 6.2831853f * (float)v / (float)views;
+    const glm::vec3 eye(10.0f * std::cos(a), 2.0f, 10.0f * std::sin(a));
+    const glm::vec3 target = eye + glm::vec3(std::cos(a + 1.0f), -0.1f,
+                                             std::sin(a + 1.0f));
+    path.push_back(proj * glm::lookAt(eye, target, glm::vec3(0, 1, 0)));
+  }
+  return path;
+}
+
+// Binary little endian PLY with degree 3 SH, as written by the trainers
+static bool writePly(const SplatArrays& splats, const std::string& path) {
+  FILE* file = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    fprintf(stderr, "Error: cannot write %s\n", path.c_str());
+    return false;
+  }
+  const uint32_t count = splats.size();
+  std::string header = "ply\nformat binary_little_endian 1.0\nelement vertex " +
+                       std::to_string(count) + "\n";
+  std::vector<std::string> names = {"x", "y", "z", "nx", "ny", "nz"};
+  for (int k = 0; k < 3; k++)
+    names.push_back("f_dc_" + std::to_string(k));
+  for (int k = 0; k < 45; k++)
+    names.push_back("f_rest_" + std::to_string(k));
+  names.push_back("opacity");
+  for (int k = 0; k < 3; k++)
+    names.push_back("scale_" + std::to_string(k));
+  for (int k = 0; k < 4; k++)
+    names.push_back("rot_" + std::to_string(k));
+  for (const std::string& name : names)
+    header += "property float " + name + "\n";
+  header += "end_header\n";
+  std::fwrite(header.data(), 1, header.size(), file);
+
+  const size_t stride = names.size();
+  std::mt19937 rng(11);
+  std::normal_distribution<float> n(0.0f, 0.05f);
+  std::vector<float> records;
+  const uint32_t blockSize = 65536;
+  for (uint32_t begin = 0; begin < count; begin += blockSize) {
+    const uint32_t end = std::min(count, begin + blockSize);
+    records.assign((size_t)(end - begin) * stride, 0.0f);
+    for (uint32_t i = begin; i < end; i++) {
+      float* r = &records[(size_t)(i - begin) * stride];
+      const uint8_t* color = &splats.colors[4 * (size_t)i];
+      for (int a = 0; a < 3; a++) {
+        r[a] = splats.centers[3 * (size_t)i + a];
+        r[6 + a] = ((float)color[a] / 255.0f - 0.5f) / 0.28209479f;
+        r[55 + a] = std::log(splats.scales[3 * (size_t)i + a]);
+      }
+      for (int k = 0; k < 45; k++)
+        r[9 + k] = n(rng);
+      const float alpha =
+          std::min(std::max((float)color[3] / 255.0f, 0.001f), 0.999f);
+      r[54] = std::log(alpha / (1.0f - alpha));
+      for (int a = 0; a < 4; a++)
+        r[58 + a] = splats.rotations[4 * (size_t)i + a];
+    }
+    std::fwrite(records.data(), sizeof(float), records.size(), file);
+  }
+  const bool ok = std::ferror(file) == 0;
+  std::fclose(file);
+  if (!ok)
+    fprintf(stderr, "Error: cannot write %s\n", path.c_str());
+  return ok;
+}
+
+struct BenchResult {
+  std::string name;
+  uint64_t items = 0;  // splats per sample
+  std::vector<double> samples;
+  // Extra values written along the timings
+  std::vector<std::pair<std::string, double>> metrics;
+};
+
+static void writeResult(FILE* out, const BenchResult& result, bool last) {
+  std::vector<double> sorted = result.samples;
+  std::sort(sorted.begin(), sorted.end());
+  const double p50 = percentile(sorted, 0.5);
+  fprintf(out,
+          "        {\"name\": \"%s\", \"samples\": %zu, \"min_ms\": %.4f, "
+          "\"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, "
+          "\"max_ms\": %.4f, \"splats_per_second\": %.0f",
+          result.name.c_str(), sorted.size(), sorted.front(), p50,
+          percentile(sorted, 0.9), percentile(sorted, 0.99), sorted.back(),
+          p50 > 0.0 ? (double)result.items / (p50 / 1000.0) : 0.0);
+  for (const std::pair<std::string, double>& metric : result.metrics)
+    fprintf(out, ", \"%s\": %.4f", metric.first.c_str(), metric.second);
+  fprintf(out, "}%s\n", last ? "" : ",");
+}
+
+static BenchResult benchSort(const SplatArrays& splats,
+                             const std::vector<glm::mat4>& path, int runs) {
+  const uint32_t count = splats.size();
+  std::vector<int> positions(3 * (size_t)count);
+  for (size_t i = 0; i < positions.size(); i++)
+    positions[i] = (int)std::lround(splats.centers[i] * kFixedPointScale);
+  std::vector<uint32_t> indexes(count), out(count);
+  for (uint32_t i = 0; i < count; i++)
+    indexes[i] = i;
+
+  BenchResult result{"sort", count, {}, {}};
+  SortEngine engine;
+  int viewProj[16];
+  for (int r = 0; r < runs; r++)
+    for (const glm::mat4& m : path) {
+      const float* f = &m[0][0];
+      for (int k = 0; k < 16; k++)
+        viewProj[k] = (int)std::lround(f[k] * kFixedPointScale);
+      const Clock::time_point start = Clock::now();
+      engine.sort(indexes.data(), positions.data(), viewProj, out.data(),
+                  kDistanceMapRange, count, count);
+      result.samples.push_back(msSince(start));
+    }
+  return result;
+}
+
+static BenchResult benchCull(const SplatArrays& splats,
+                             const std::vector<glm::mat4>& path, int runs) {
+  // Only the covariance trace matters to the cull, rotations don't change it
+  const uint32_t count = splats.size();
+  std::vector<GpuSplat> gpuSplats(count);
+  for (uint32_t i = 0; i < count; i++) {
+    GpuSplat& splat = gpuSplats[i];
+    splat = GpuSplat();
+    for (int c = 0; c < 3; c++)
+      splat.center[c] = splats.centers[3 * (size_t)i + c];
+    splat.alpha = splats.colors[4 * (size_t)i + 3] / 255.0f;
+    const float* scale = &splats.scales[3 * (size_t)i];
+    splat.covA[0] = scale[0] * scale[0];
+    splat.covB[0] = scale[1] * scale[1];
+    splat.covB[2] = scale[2] * scale[2];
+  }
+
+  BenchResult result{"cull", count, {}, {}};
+  SplatCuller culler;
+  culler.setSplats(gpuSplats.data(), count);
+  SplatCullSettings settings;
+  settings.minRadiusPixels = 0.5f;
+  SplatCamera camera;
+  camera.viewport = glm::vec2(1920.0f, 1080.0f);
+  camera.focal = glm::vec2(0.5f * 1080.0f / std::tan(glm::radians(30.0f)));
+  std::vector<uint32_t> indexes;
+  for (int r = 0; r < runs; r++)
+    for (const glm::mat4& m : path) {
+      camera.projection = m;
+      SplatCullStats stats;
+      culler.cull(camera, settings, indexes, nullptr, 0, &stats);
+      result.samples.push_back(stats.ms);
+    }
+  return result;
+}
+
+// PSNR of the RGB channels, 100 when the images are identical
+static double psnr(const std::vector<uint8_t>& a,
+                   const std::vector<uint8_t>& b) {
+  double squared = 0.0;
+  for (size_t i = 0; i < a.size(); i++)
+    if (i % 4 != 3) {
+      const double d = (double)a[i] - (double)b[i];
+      squared += d * d;
+    }
+  const double mse = squared / (double)(a.size() / 4 * 3);
+  return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 100.0;
+}
+
+// Both packings of the 16-bit sort output, on splats in Hilbert order as
+// they should be stored for it. Each view's front to back order is packed,
+// and the draw order the runs give is rendered in that order and compared
+// with the 32-bit order rendered the same way. Reports the runs (draw
+// calls) per view and the worst PSNR.
+static std::vector<BenchResult> benchPack(const SplatArrays& scene,
+                                          int runs) {
+  SplatArrays splats = scene;
+  sortSplats(splats, SplatCurve::Hilbert);
+  const uint32_t count = splats.size();
+  std::vector<GpuSplat> gpuSplats(count);
+  for (uint32_t i = 0; i < count; i++) {
+    GpuSplat& splat = gpuSplats[i];
+    splat = GpuSplat();
+    for (int c = 0; c < 3; c++) {
+      splat.center[c] = splats.centers[3 * (size_t)i + c];
+      splat.sh[0][c] =
+          (splats.colors[4 * (size_t)i + c] / 255.0f - 0.5f) / SH_C0;
+    }
+    splat.alpha = splats.colors[4 * (size_t)i + 3] / 255.0f;
+    const float* scale = &splats.scales[3 * (size_t)i];
+    splat.covA[0] = scale[0] * scale[0];
+    splat.covB[0] = scale[1] * scale[1];
+    splat.covB[2] = scale[2] * scale[2];
+  }
+
+  const SortIndexPacking packings[2] = {SortIndexPacking::Exact,
+                                        SortIndexPacking::GroupChunks};
+  std::vector<BenchResult> results = {
+      BenchResult{"pack_exact", count, {}, {}},
+      BenchResult{"pack_grouped", count, {}, {}}};
+  double runCounts[2] = {0.0, 0.0};
+  double worstPsnr[2] = {100.0, 100.0};
+
+  SplatRasterizer rasterizer;
+  rasterizer.setBlendInInputOrder(true);
+  std::vector<uint32_t> order(count), drawOrder(count);
+  std::vector<float> depths(count);
+  std::vector<GpuSplat> drawn(count);
+  std::vector<uint8_t> reference, image;
+  std::vector<uint16_t> indexes16;
+  std::vector<SortIndexRun> indexRuns;
+  auto render = [&](const std::vector<uint32_t>& sequence,
+                    const SplatCamera& camera, std::vector<uint8_t>& rgba) {
+    for (uint32_t i = 0; i < count; i++)
+      drawn[i] = gpuSplats[sequence[i]];
+    rasterizer.render(drawn.data(), count, camera, rgba);
+  };
+
+  for (int v = 0; v < kPackViews; v++) {
+    // Inside the scene looking outwards, as makeCameraPath()
+    const float a = 6.2831853f * (float)v / (float)kPackViews;
+    const glm::vec3 eye(10.0f * std::cos(a), 2.0f, 10.0f * std::sin(a));
+    const SplatCamera camera = SplatCamera::lookAt(
+        eye, eye + glm::vec3(std::cos(a + 1.0f), -0.1f, std::sin(a + 1.0f)),
+        kPackViewport, glm::radians(60.0f));
+    for (uint32_t i = 0; i < count; i++) {
+      order[i] = i;
+      depths[i] = (camera.view * glm::vec4(gpuSplats[i].center[0],
+                                           gpuSplats[i].center[1],
+                                           gpuSplats[i].center[2], 1.0f))
+                      .z;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) {
+      return depths[x] < depths[y];
+    });
+    render(order, camera, reference);
+
+    for (int p = 0; p < 2; p++) {
+      for (int r = 0; r < runs; r++) {
+        const Clock::time_point start = Clock::now();
+        packSortedIndexes(order.data(), count, indexes16, indexRuns,
+                          packings[p]);
+        results[p].samples.push_back(msSince(start));
+      }
+      size_t j = 0;
+      for (const SortIndexRun& run : indexRuns)
+        for (uint32_t k = run.first; k < run.first + run.count; k++)
+          drawOrder[j++] = run.base + indexes16[k];
+      render(drawOrder, camera, image);
+      runCounts[p] += (double)indexRuns.size() / kPackViews;
+      worstPsnr[p] = std::min(worstPsnr[p], psnr(reference, image));
+    }
+  }
+  for (int p = 0; p < 2; p++) {
+    results[p].metrics.emplace_back("runs", runCounts[p]);
+    results[p].metrics.emplace_back("psnr_db", worstPsnr[p]);
+  }
+  return results;
+}
+
+static std::vector<BenchResult> benchDecode(const SplatBuffer& buffer,
+                                            bool decode, bool fill,
+                                            int runs) {
+  const uint32_t count = buffer.getSplatCount();
+  std::vector<BenchResult> results;
+  if (decode) {
+    std::vector<float> floats(10 * (size_t)count);
+    std::vector<uint8_t> colors(4 * (size_t)count);
+    SplatSoA soa;
+    for (int c = 0; c < 10; c++) {
+      float* column = &floats[(size_t)c * count];
+      if (c < 3)
+        soa.center[c] = column;
+      else if (c < 6)
+        soa.scale[c - 3] = column;
+      else
+        soa.rotation[c - 6] = column;
+    }
+    for (int c = 0; c < 4; c++)
+      soa.color[c] = &colors[(size_t)c * count];
+    BenchResult result{"decode", count, {}, {}};
+    for (int r = 0; r < runs; r++)
+      result.samples.push_back(buffer.decodeSplats(soa).ms);
+    results.push_back(result);
+  }
+  if (fill) {
+    BenchResult centers{"fill_centers", count, {}, {}};
+    BenchResult scales{"fill_scale_rotation", count, {}, {}};
+    BenchResult covariances{"fill_covariance", count, {}, {}};
+    std::vector<float> a(3 * (size_t)count), b(4 * (size_t)count);
+    std::vector<float> covariance(SplatBuffer::CovarianceSizeFloats *
+                                  (size_t)count);
+    for (int r = 0; r < runs; r++) {
+      Clock::time_point start = Clock::now();
+      buffer.fillSplatCenterArray(a, 0);
+      centers.samples.push_back(msSince(start));
+      start = Clock::now();
+      buffer.fillSplatScaleAndRotationArray(a, b, 0);
+      scales.samples.push_back(msSince(start));
+      start = Clock::now();
+      buffer.fillSplatCovarianceArray(covariance, 0);
+      covariances.samples.push_back(msSince(start));
+    }
+    results.push_back(centers);
+    results.push_back(scales);
+    results.push_back(covariances);
+  }
+  return results;
+}
+
+static bool benchLoad(const SplatArrays& splats, const std::string& path,
+                      int runs, BenchResult& result) {
+  if (!writePly(splats, path))
+    return false;
+  result = BenchResult{"load_ply", splats.size(), {}, {}};
+  std::vector<GpuSplat> loaded;
+  bool ok = true;
+  for (int r = 0; r < runs && ok; r++) {
+    // Fresh vector, so allocation and first touch are part of every sample
+    std::vector<GpuSplat>().swap(loaded);
+    SplatPlyInfo info;
+    ok = loadSplatPly(path, loaded, &info);
+    result.samples.push_back(info.ms);
+  }
+  std::remove(path.c_str());
+  return ok;
+}
+
+static void printUsage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [--sizes 100000,1000000] "
+          "[--scenes uniform,clustered,planar]\n"
+          "         [--runs 5] [--views 64] "
+          "[--only sort,cull,pack,decode,fill,load]\n"
+          "         [--ply splat_bench.ply] [--out results.json]\n",
+          name);
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> sizes = {"100000", "1000000"};
+  std::vector<std::string> scenes(std::begin(kSceneKinds),
+                                  std::end(kSceneKinds));
+  std::vector<std::string> only(std::begin(kBenchmarks), std::end(kBenchmarks));
+  int runs = 5, views = 64;
+  std::string plyPath = "splat_bench.ply";
+  std::string outPath;
+  for (int i = 1; i < argc; i += 2) {
+    const std::string flag = argv[i];
+    if (flag == "--help" || flag == "-h") {
+      printUsage(argv[0]);
+      return 0;
+    }
+    if (i + 1 == argc) {
+      fprintf(stderr, "Error: missing value after %s\n", flag.c_str());
+      printUsage(argv[0]);
+      return 1;
+    }
+    const std::string value = argv[i + 1];
+    if (flag == "--sizes")
+      sizes = split(value);
+    else if (flag == "--scenes")
+      scenes = split(value);
+    else if (flag == "--only")
+      only = split(value);
+    else if (flag == "--runs")
+      runs = std::max(1, std::atoi(value.c_str()));
+    else if (flag == "--views")
+      views = std::max(1, std::atoi(value.c_str()));
+    else if (flag == "--ply")
+      plyPath = value;
+    else if (flag == "--out")
+      outPath = value;
+    else {
+      fprintf(stderr, "Error: unknown option %s\n", flag.c_str());
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  for (const std::string& scene : scenes)
+    if (!isOneOf(scene, kSceneKinds)) {
+      fprintf(stderr, "Error: unknown scene %s\n", scene.c_str());
+      printUsage(argv[0]);
+      return 1;
+    }
+  for (const std::string& name : only)
+    if (!isOneOf(name, kBenchmarks)) {
+      fprintf(stderr, "Error: unknown benchmark %s\n", name.c_str());
+      printUsage(argv[0]);
+      return 1;
+    }
+  auto enabled = [&](const char* name) {
+    return std::find(only.begin(), only.end(), name) != only.end();
+  };
+
+  FILE* out = stdout;
+  if (!outPath.empty() && !(out = std::fopen(outPath.c_str(), "w"))) {
+    fprintf(stderr, "Error: cannot write %s\n", outPath.c_str());
+    return 1;
+  }
+
+  const std::vector<glm::mat4> path = makeCameraPath(views);
+  fprintf(out, "{\n  \"threads\": %d,\n  \"runs\": %d,\n  \"views\": %d,\n",
+          (int)ThreadPool::shared().getThreadCount(), runs, views);
+  fprintf(out, "  \"results\": [\n");
+  bool ok = true;
+  for (size_t s = 0; s < sizes.size(); s++) {
+    const uint32_t count = (uint32_t)std::atol(sizes[s].c_str());
+    for (size_t k = 0; k < scenes.size(); k++) {
+      const std::string& scene = scenes[k];
+      fprintf(stderr, "%s, %u splats\n", scene.c_str(), count);
+      std::vector<BenchResult> results;
+      {
+        const SplatArrays splats = makeScene(scene, count);
+        if (enabled("sort"))
+          results.push_back(benchSort(splats, path, runs));
+        if (enabled("cull"))
+          results.push_back(benchCull(splats, path, runs));
+        if (enabled("pack"))
+          for (const BenchResult& result : benchPack(splats, runs))
+            results.push_back(result);
+        if (enabled("decode") || enabled("fill")) {
+          std::vector<uint8_t> bytes;
+          if (writeSplatBuffer(splats, bytes)) {
+            const SplatBuffer buffer(std::move(bytes));
+            for (const BenchResult& result : benchDecode(
+                     buffer, enabled("decode"), enabled("fill"), runs))
+              results.push_back(result);
+          } else {
+            ok = false;
+          }
+        }
+        if (enabled("load")) {
+          BenchResult result;
+          if (benchLoad(splats, plyPath, runs, result))
+            results.push_back(result);
+          else
+            ok = false;
+        }
+      }
+
+      const bool last = s + 1 == sizes.size() && k + 1 == scenes.size();
+      fprintf(out,
+              "    {\"scene\": \"%s\", \"splats\": %u, "
+              "\"peak_memory_mb_cumulative\": %.1f, "
+              "\"benchmarks\": [\n",
+              scene.c_str(), count, peakMemoryMB());
+      for (size_t r = 0; r < results.size(); r++)
+        writeResult(out, results[r], r + 1 == results.size());
+      fprintf(out, "    ]}%s\n", last ? "" : ",");
+    }
+  }
+  fprintf(out, "  ]\n}\n");
+  if (out != stdout)
+    std::fclose(out);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+// Build and traversal timings of the flat SplatTree against a pointer based
+// octree with the same split rule, then a level of detail cut check.
+//
+//   splat_tree_bench [splatCount] [runs]
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "pointerOctree.h"
+#include "splatTree.h"
+#include "timing.h"
+
+static double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+static std::vector<float> makeScene(const char* kind, uint32_t count) {
+  std::mt19937 rng(7);
+  std::vector<float> centers(3 * (size_t)count);
+  if (kind[0] == 'u') {
+    std::uniform_real_distribution<float> u(-50.0f, 50.0f);
+    for (float& c : centers)
+      c = u(rng);
+  } else {
+    // Gaussian blobs of very different sizes, closer to a captured scene
+    std::uniform_real_distribution<float> u(-50.0f, 50.0f);
+    std::normal_distribution<float> n(0.0f, 1.0f);
+    std::vector<glm::vec4> blobs(64);
+    for (glm::vec4& b : blobs)
+      b = glm::vec4(u(rng), u(rng), u(rng), 0.2f + std::abs(u(rng)) * 0.1f);
+    for (uint32_t i = 0; i < count; i++) {
+      const glm::vec4& b = blobs[i % blobs.size()];
+      for (int a = 0; a < 3; a++)
+        centers[3 * i + a] = b[a] + n(rng) * b.w;
+    }
+  }
+  return centers;
+}
+
+// Orbit inside the scene looking outwards, so every view culls a part
+static std::vector<glm::mat4> makeCameraPath(int views) {
+  const glm::mat4 proj =
+      glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+  std::vector<glm::mat4> path;
+  for (int v = 0; v < views; v++) {
+    const float a = 6.2831853f * (float)v / (float)views;
+    const glm::vec3 eye(10.0f * std::cos(a), 2.0f, 10.0f * std::sin(a));
+    const glm::vec3 target = eye + glm::vec3(std::cos(a + 1.0f), -0.1f,
+                                             std::sin(a + 1.0f));
+    path.push_back(proj * glm::lookAt(eye, target, glm::vec3(0, 1, 0)));
+  }
+  return path;
+}
+
+template <typename Tree>
+static void run(const char* name, Tree& tree, const std::vector<float>& centers,
+                const std::vector<glm::mat4>& path, int runs) {
+  const uint32_t count = (uint32_t)(centers.size() / 3);
+  std::vector<double> build, traverse;
+  std::vector<uint32_t> visible;
+  visible.reserve(count);
+  uint64_t visibleCount = 0;
+  for (int r = 0; r < runs; r++) {
+    Clock::time_point start = Clock::now();
+    tree.build(centers.data(), count);
+    build.push_back(msSince(start));
+
+    visibleCount = 0;
+    start = Clock::now();
+    for (const glm::mat4& viewProj : path) {
+      visible.clear();
+      visibleCount += tree.getVisibleIndexes(viewProj, visible);
+    }
+    traverse.push_back(msSince(start) / (double)path.size());
+  }
+  printf("  %-8s nodes %8u  build %9.2f ms  traverse %7.3f ms/view  visible "
+         "%5.1f%%\n",
+         name, tree.getNodeCount(), median(build), median(traverse),
+         100.0 * (double)visibleCount / ((double)count * (double)path.size()));
+}
+
+// Two blobs either side of the view ray and one far ahead on it, plus one
+// behind the camera that moves the root cell center. The frustum crosses
+// the node holding both side blobs, but the tight bounds of each child miss
+// it, so that node is refined into nothing.
+static std::vector<float> makeGapScene(uint32_t count) {
+  const glm::vec4 blobs[4] = {glm::vec4(-3.0f, 0.0f, 20.0f, 0.2f),
+                              glm::vec4(3.0f, 0.0f, 20.0f, 0.2f),
+                              glm::vec4(0.0f, 0.0f, 200.0f, 0.5f),
+                              glm::vec4(60.0f, 60.0f, -50.0f, 0.5f)};
+  std::mt19937 rng(7);
+  std::normal_distribution<float> n(0.0f, 1.0f);
+  std::vector<float> centers(3 * (size_t)count);
+  for (uint32_t i = 0; i < count; i++)
+    for (int a = 0; a < 3; a++)
+      centers[3 * i + a] = blobs[i % 4][a] + n(rng) * blobs[i % 4].w;
+  return centers;
+}
+
+// With no pixel threshold and no budget limit the cut has to reach every
+// visible leaf, so it must match getVisibleIndexes().
+static bool runLodGap(uint32_t count) {
+  const std::vector<float> centers = makeGapScene(count);
+  SplatTree tree(12, 1024);
+  tree.build(centers.data(), count);
+  std::vector<GpuSplat> splats(count);
+  for (uint32_t i = 0; i < count; i++) {
+    GpuSplat& s = splats[i];
+    s = GpuSplat();
+    for (int a = 0; a < 3; a++)
+      s.center[a] = centers[3 * i + a];
+    s.alpha = 0.5f;
+    s.covA[0] = s.covB[0] = s.covB[2] = 1e-4f;
+  }
+  tree.buildLod(splats.data());
+
+  const glm::mat4 viewProj =
+      glm::perspective(glm::radians(5.0f), 1.0f, 0.1f, 1000.0f) *
+      glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+                  glm::vec3(0, 1, 0));
+  std::vector<uint32_t> visible, lod;
+  const uint32_t visibleCount = tree.getVisibleIndexes(viewProj, visible);
+  const Clock::time_point start = Clock::now();
+  const uint32_t lodCount = tree.getLodIndexes(
+      viewProj, glm::vec3(0.0f), 1000.0f, 0.0f, count, lod);
+  const bool ok = lodCount == visibleCount;
+  printf("lod gap\n  cut %8u  visible %8u  %7.3f ms  %s\n", lodCount,
+         visibleCount, msSince(start), ok ? "ok" : "MISMATCH");
+  return ok;
+}
+
+static void printUsage(const char* name) {
+  fprintf(stderr, "usage: %s [splatCount] [runs], both at least 1\n", name);
+}
+
+// Whole decimal numbers in [1, max] only
+static bool parseCount(const char* text, unsigned long max,
+                       unsigned long& value) {
+  if (!std::isdigit((unsigned char)text[0]))
+    return false;
+  char* end = nullptr;
+  errno = 0;
+  value = std::strtoul(text, &end, 10);
+  return errno == 0 && *end == '\0' && value >= 1 && value <= max;
+}
+
+int main(int argc, char** argv) {
+  unsigned long count = 2000000, runs = 5;
+  if (argc > 1 && (!std::strcmp(argv[1], "--help") ||
+                   !std::strcmp(argv[1], "-h"))) {
+    printUsage(argv[0]);
+    return 0;
+  }
+  if (argc > 3 || (argc > 1 && !parseCount(argv[1], UINT32_MAX, count)) ||
+      (argc > 2 && !parseCount(argv[2], INT_MAX, runs))) {
+    fprintf(stderr, "Error: invalid arguments\n");
+    printUsage(argv[0]);
+    return 1;
+  }
+  const std::vector<glm::mat4> path = makeCameraPath(64);
+
+  printf("%lu splats, %lu runs, %d threads, median times\n", count, runs,
+         (int)ThreadPool::shared().getThreadCount());
+  for (const char* scene : {"uniform", "clustered"}) {
+    const std::vector<float> centers = makeScene(scene, (uint32_t)count);
+    printf("%s\n", scene);
+    SplatTree flat(12, 1024);
+    run("flat", flat, centers, path, (int)runs);
+    PointerOctree pointer(12, 1024);
+    run("pointer", pointer, centers, path, (int)runs);
+  }
+  return runLodGap((uint32_t)std::min<unsigned long>(count, 400000)) ? 0 : 1;
+}
@@ -6,6 +6,7 @@
 
 #include "window.h"
 #include "ops/draw.h"
+#include "ops/profile.h"
 #include "xr/xr.h"
 #include "xr/holoPlay.h"
 
@@ -21,6 +22,9 @@ public:
     virtual void setup() {};
     virtual void update() {};
     virtual void draw() {};
+    // LENTICULAR only: called before the views of each quilt view cluster are drawn,
+    // with the camera index and virtual offset on its central view (see setQuiltViewTolerance())
+    virtual void setupQuiltCluster(const QuiltViewCluster& _cluster) {};
     virtual void close() {};
 
     virtual void windowResized() {};
@@ -74,6 +78,9 @@ public:
     double  time, deltaTime;
     int     frameCount;
 
+    // Draws drawProfileHud() over every frame, see setProfiling()
+    bool    profileHud = false;
+
 protected:
 
     glm::vec4   auto_background_color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
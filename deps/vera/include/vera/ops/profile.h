@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+namespace vera {
+
+// Scoped CPU and GPU timers.
+//
+// CPU scopes write nanosecond timestamps to a ring buffer owned by the
+// calling thread: recording takes no lock and never waits for a reader. At
+// the end of every frame App::loop calls profileFrameEnd(), which drains the
+// rings of all threads, sums the scopes per name into a ProfileFrame and,
+// while a trace is being recorded, keeps the raw events for
+// saveProfileTrace().
+//
+// GPU scopes use GL_TIME_ELAPSED queries when the context supports them.
+// Queries are read back without stalling, so GPU times arrive a few frames
+// after the frame that issued them. GL only times one query at a time: a
+// GPU scope opened inside another one records CPU time only.
+//
+// Scope names must be string literals or otherwise outlive the profiler.
+// App::loop times "update", "draw" and "swap"; apps add their own scopes
+// with VERA_PROFILE(), like the splat viewer's "sort" (SortWorker) and
+// "upload" (IndexUploader::upload()).
+
+struct ProfileStat {
+    std::string name;
+    double      ms      = 0.0;  // summed over every scope of this name
+    uint32_t    count   = 0;
+};
+
+struct ProfileFrame {
+    uint64_t    index   = 0;
+    double      ms      = 0.0;  // since the end of the previous frame
+    std::vector<ProfileStat> cpu;
+
+    // Frame whose GPU times are held in gpu, usually 2 or 3 frames back
+    uint64_t    gpuIndex = 0;
+    std::vector<ProfileStat> gpu;
+
+    // 0 when no scope of that name ran
+    double      getCpuMs(const std::string& _name) const;
+    double      getGpuMs(const std::string& _name) const;
+};
+
+// Off by default; scopes then cost a relaxed atomic load.
+void        setProfiling(bool _enabled);
+bool        isProfiling();
+
+// Steady clock in nanoseconds, the time base of every event
+uint64_t    getProfileTime();
+
+// Name of the calling thread in traces
+void        setProfileThreadName(const std::string& _name);
+
+void        profileEvent(const char* _name, uint64_t _start, uint64_t _end);
+
+// Returns true when a GL query was started and endGpuProfile() must follow
+bool        beginGpuProfile(const char* _name);
+void        endGpuProfile();
+bool        haveGpuProfile();
+
+// Called once per frame after the buffers are swapped
+void        profileFrameEnd();
+const ProfileFrame& getProfileFrame();
+
+// Keeps every event from now on, up to _maxEvents, for saveProfileTrace()
+void        startProfileTrace(size_t _maxEvents = 1 << 20);
+void        stopProfileTrace();
+bool        isProfileTracing();
+// Chrome trace event JSON, for chrome://tracing or ui.perfetto.dev
+bool        saveProfileTrace(const std::string& _path);
+
+// Smoothed CPU and GPU times of the last frames, top left corner at _x, _y
+void        drawProfileHud(float _x = 10.0f, float _y = 10.0f);
+
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* _name, bool _gpu = false);
+    ~ProfileScope();
+
+private:
+    ProfileScope(const ProfileScope&);
+    ProfileScope& operator=(const ProfileScope&);
+
+    const char* m_name;
+    uint64_t    m_start;
+    bool        m_gpu;
+};
+
+}
+
+#define VERA_PROFILE_CONCAT_(A, B) A##B
+#define VERA_PROFILE_CONCAT(A, B) VERA_PROFILE_CONCAT_(A, B)
+#define VERA_PROFILE(NAME) \
+    vera::ProfileScope VERA_PROFILE_CONCAT(profile_scope_, __LINE__)(NAME)
+#define VERA_PROFILE_GPU(NAME) \
+    vera::ProfileScope VERA_PROFILE_CONCAT(profile_scope_, __LINE__)(NAME, true)
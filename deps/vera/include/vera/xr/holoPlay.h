@@ -33,7 +33,29 @@ int  getQuiltTotalViews();
 int  getQuiltCurrentViewIndex();
 Fbo* getQuiltFbo();
 
-void renderQuilt(std::function<void(const QuiltProperties&, glm::vec4&, int&)> _renderFnc, bool _justQuilt = false);
+// Consecutive quilt views whose virtual offset angle lies within the view
+// tolerance of their central view. Work that only depends loosely on the
+// view direction, like depth sorting splats, can be done once per cluster
+// from the central view and reused by all its views.
+struct QuiltViewCluster {
+    int index       = 0;
+    int firstView   = 0;
+    int totalViews  = 1;
+    int centralView = 0;
+};
+
+// Largest angle (in degrees) between a view and the central view of its cluster.
+// The default covers the whole 40 degree view cone, so one cluster per quilt; 0 gives one cluster per view.
+void    setQuiltViewTolerance(float _degrees);
+float   getQuiltViewTolerance();
+int     getQuiltViewClusterCount();
+QuiltViewCluster getQuiltViewCluster(int _viewIndex);
+
+// _clusterFnc (optional) is called once per cluster, before its first view is rendered, with
+// getQuiltCurrentViewIndex() set to the cluster's central view and the camera moved to its virtual offset.
+// Views are drawn with the camera as _renderFnc leaves it, App::orbitControl() sets the offset of each view.
+void renderQuilt(std::function<void(const QuiltProperties&, glm::vec4&, int&)> _renderFnc, bool _justQuilt = false,
+                 std::function<void(const QuiltProperties&, const QuiltViewCluster&)> _clusterFnc = nullptr);
 
 // LENTICULAR Display
 //
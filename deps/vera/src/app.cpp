@@ -28,21 +28,36 @@ void App::loop(double _time, App* _app) {
     _app->frameCount++;
 
     // Update
-    _app->update();
-    updateGL();
+    {
+        VERA_PROFILE("update");
+        _app->update();
+        updateGL();
+    }
 
-    if (_app->auto_background_enabled)
-        clear(_app->auto_background_color);
+    {
+        VERA_PROFILE_GPU("draw");
+        if (_app->auto_background_enabled)
+            clear(_app->auto_background_color);
 
-    if (vera::getWindowStyle() == vera::LENTICULAR) {
-        vera::renderQuilt([&](const vera::QuiltProperties& quilt, glm::vec4& viewport, int &viewIndex) {
+        if (vera::getWindowStyle() == vera::LENTICULAR) {
+            vera::renderQuilt([&](const vera::QuiltProperties& quilt, glm::vec4& viewport, int &viewIndex) {
+                _app->draw();
+            }, false, [&](const vera::QuiltProperties&, const vera::QuiltViewCluster& cluster) {
+                _app->setupQuiltCluster(cluster);
+            });
+        }
+        else
             _app->draw();
-        });
     }
-    else
-        _app->draw();
 
-    renderGL();
+    if (_app->profileHud)
+        drawProfileHud();
+
+    {
+        VERA_PROFILE("swap");
+        renderGL();
+    }
+    profileFrameEnd();
 
     #if defined(__EMSCRIPTEN__)
     return (getXR() == NONE_XR_MODE);
@@ -153,8 +168,11 @@ void App::run(WindowProperties _properties) {
             _app->frameCount++;
 
             // Update
-            _app->update();
-            updateGL();
+            {
+                VERA_PROFILE("update");
+                _app->update();
+                updateGL();
+            }
 
             if (_app->auto_background_enabled)
                 clear(_app->auto_background_color);
@@ -164,6 +182,8 @@ void App::run(WindowProperties _properties) {
             if (cam == nullptr)
                 return;
 
+            const uint64_t draw_start = getProfileTime();
+
             webxr_set_projection_params(cam->getNearClip(), cam->getFarClip());
 
             glm::vec3 cam_pos = cam->getPosition();
@@ -180,7 +200,17 @@ void App::run(WindowProperties _properties) {
                 _app->draw();
             } 
 
-            renderGL();
+            if (isProfiling())
+                profileEvent("draw", draw_start, getProfileTime());
+
+            if (_app->profileHud)
+                drawProfileHud();
+
+            {
+                VERA_PROFILE("swap");
+                renderGL();
+            }
+            profileFrameEnd();
 
             cam->setPosition(cam_pos);
         },
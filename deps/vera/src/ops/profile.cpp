@@ -0,0 +1,408 @@
+#include "vera/ops/profile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "vera/gl/gl.h"
+#include "vera/window.h"
+#include "vera/types/font.h"
+
+// GLES 2 and WebGL 1 only have the EXT flavour, without the entry points
+#if defined(GL_TIME_ELAPSED) && !defined(__EMSCRIPTEN__)
+#define VERA_GPU_PROFILE
+#endif
+
+namespace vera {
+
+// Events per thread between two profileFrameEnd(), older ones are lost
+static const size_t     PROFILE_RING_SIZE = 1 << 14;
+// Frames of GPU queries in flight before the oldest are dropped
+static const size_t     PROFILE_GPU_LATENCY = 8;
+// Weight of the newest frame in the HUD averages
+static const double     PROFILE_HUD_SMOOTHING = 0.1;
+
+struct ProfileEvent {
+    const char* name;
+    uint64_t    start;
+    uint64_t    end;
+};
+
+struct ProfileRing {
+    ProfileRing(uint32_t _thread) : events(PROFILE_RING_SIZE), head(0), tail(0), thread(_thread) {}
+
+    std::vector<ProfileEvent>   events;
+    std::atomic<uint64_t>       head;   // written by the owning thread only
+    uint64_t                    tail;   // read by profileFrameEnd() only
+    uint32_t                    thread;
+    std::string                 name;   // guarded by rings_mutex
+};
+
+struct TraceEvent {
+    const char* name;
+    uint64_t    start;
+    uint64_t    end;
+    uint32_t    thread;
+};
+
+struct GpuQuery {
+    const char* name;
+    uint64_t    start;      // CPU time the query was issued
+    unsigned    id;
+};
+
+struct GpuFrame {
+    uint64_t                index;
+    std::vector<GpuQuery>   queries;
+};
+
+static std::atomic<bool>    profiling(false);
+
+// Rings live until exit so a thread that ends never leaves a dangling one
+static std::mutex           rings_mutex;
+static std::vector< std::shared_ptr<ProfileRing> > rings;
+static thread_local ProfileRing* thread_ring = nullptr;
+
+static ProfileFrame         frame;
+static ProfileFrame         frame_current;
+static uint64_t             frame_last_end = 0;
+
+static bool                 tracing = false;
+static size_t               trace_max_events = 0;
+static std::vector<TraceEvent> trace;
+
+static bool                 gpu_checked = false;
+static bool                 gpu_supported = false;
+static bool                 gpu_active = false;
+static std::deque<GpuFrame> gpu_frames;
+static std::vector<unsigned> gpu_free;
+
+static std::map<std::string, double> hud_cpu;
+static std::map<std::string, double> hud_gpu;
+static double               hud_frame = 0.0;
+static Font*                hud_font = nullptr;
+
+static ProfileRing* getThreadRing() {
+    if (thread_ring == nullptr) {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back( std::make_shared<ProfileRing>( (uint32_t)rings.size() ) );
+        thread_ring = rings.back().get();
+    }
+    return thread_ring;
+}
+
+static void addStat(std::vector<ProfileStat>& _stats, const char* _name, double _ms) {
+    for (size_t i = 0; i < _stats.size(); i++)
+        if (_stats[i].name == _name) {
+            _stats[i].ms += _ms;
+            _stats[i].count++;
+            return;
+        }
+    ProfileStat stat;
+    stat.name = _name;
+    stat.ms = _ms;
+    stat.count = 1;
+    _stats.push_back(stat);
+}
+
+static double findStat(const std::vector<ProfileStat>& _stats, const std::string& _name) {
+    for (size_t i = 0; i < _stats.size(); i++)
+        if (_stats[i].name == _name)
+            return _stats[i].ms;
+    return 0.0;
+}
+
+double ProfileFrame::getCpuMs(const std::string& _name) const { return findStat(cpu, _name); }
+double ProfileFrame::getGpuMs(const std::string& _name) const { return findStat(gpu, _name); }
+
+void setProfiling(bool _enabled) { profiling.store(_enabled, std::memory_order_relaxed); }
+bool isProfiling() { return profiling.load(std::memory_order_relaxed); }
+
+uint64_t getProfileTime() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void setProfileThreadName(const std::string& _name) {
+    ProfileRing* ring = getThreadRing();
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    ring->name = _name;
+}
+
+void profileEvent(const char* _name, uint64_t _start, uint64_t _end) {
+    ProfileRing* ring = getThreadRing();
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ProfileEvent& event = ring->events[head % PROFILE_RING_SIZE];
+    event.name = _name;
+    event.start = _start;
+    event.end = _end;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+bool haveGpuProfile() {
+#if defined(VERA_GPU_PROFILE)
+    if (!gpu_checked) {
+        gpu_checked = true;
+        gpu_supported = haveExtension("GL_ARB_timer_query") || haveExtension("GL_EXT_timer_query");
+    }
+#endif
+    return gpu_supported;
+}
+
+bool beginGpuProfile(const char* _name) {
+#if defined(VERA_GPU_PROFILE)
+    if (gpu_active || !isProfiling() || !haveGpuProfile())
+        return false;
+
+    if (gpu_frames.empty() || gpu_frames.back().index != frame_current.index) {
+        GpuFrame next;
+        next.index = frame_current.index;
+        gpu_frames.push_back(next);
+    }
+
+    GpuQuery query;
+    query.name = _name;
+    query.start = getProfileTime();
+    if (gpu_free.empty()) {
+        GLuint id = 0;
+        glGenQueries(1, &id);
+        query.id = id;
+    }
+    else {
+        query.id = gpu_free.back();
+        gpu_free.pop_back();
+    }
+    glBeginQuery(GL_TIME_ELAPSED, query.id);
+    gpu_frames.back().queries.push_back(query);
+    gpu_active = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void endGpuProfile() {
+#if defined(VERA_GPU_PROFILE)
+    if (!gpu_active)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    gpu_active = false;
+#endif
+}
+
+// Publishes the oldest frames whose queries have all finished
+static void collectGpuFrames() {
+#if defined(VERA_GPU_PROFILE)
+    while (!gpu_frames.empty()) {
+        GpuFrame& oldest = gpu_frames.front();
+        bool ready = true;
+        for (size_t i = 0; ready && i < oldest.queries.size(); i++) {
+            GLuint available = 0;
+            glGetQueryObjectuiv(oldest.queries[i].id, GL_QUERY_RESULT_AVAILABLE, &available);
+            ready = available != 0;
+        }
+
+        if (!ready) {
+            if (gpu_frames.size() <= PROFILE_GPU_LATENCY)
+                return;
+            // Too far behind, give up on this frame
+            for (size_t i = 0; i < oldest.queries.size(); i++)
+                gpu_free.push_back(oldest.queries[i].id);
+            gpu_frames.pop_front();
+            continue;
+        }
+
+        frame.gpuIndex = oldest.index;
+        frame.gpu.clear();
+        for (size_t i = 0; i < oldest.queries.size(); i++) {
+            // 32 bits of nanoseconds, enough for anything shorter than 4s
+            GLuint ns = 0;
+            glGetQueryObjectuiv(oldest.queries[i].id, GL_QUERY_RESULT, &ns);
+            addStat(frame.gpu, oldest.queries[i].name, ns * 1e-6);
+            if (tracing && trace.size() < trace_max_events) {
+                TraceEvent event = { oldest.queries[i].name, oldest.queries[i].start, oldest.queries[i].start + ns, UINT32_MAX };
+                trace.push_back(event);
+            }
+            gpu_free.push_back(oldest.queries[i].id);
+        }
+        gpu_frames.pop_front();
+    }
+#endif
+}
+
+void profileFrameEnd() {
+    const uint64_t now = getProfileTime();
+
+    std::vector<ProfileRing*> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (size_t i = 0; i < rings.size(); i++)
+            snapshot.push_back(rings[i].get());
+    }
+
+    for (size_t r = 0; r < snapshot.size(); r++) {
+        ProfileRing* ring = snapshot[r];
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t from = std::max(ring->tail, head > PROFILE_RING_SIZE ? head - PROFILE_RING_SIZE : 0);
+        std::vector<ProfileEvent> events;
+        events.reserve((size_t)(head - from));
+        for (uint64_t i = from; i < head; i++)
+            events.push_back(ring->events[i % PROFILE_RING_SIZE]);
+
+        // Entries the owner may have overwritten while they were copied
+        const uint64_t written = ring->head.load(std::memory_order_acquire);
+        const uint64_t safe = written > PROFILE_RING_SIZE ? written - PROFILE_RING_SIZE : 0;
+        const size_t skip = (size_t)std::min<uint64_t>(safe > from ? safe - from : 0, events.size());
+        ring->tail = head;
+
+        for (size_t i = skip; i < events.size(); i++) {
+            addStat(frame_current.cpu, events[i].name, (events[i].end - events[i].start) * 1e-6);
+            if (tracing && trace.size() < trace_max_events) {
+                TraceEvent event = { events[i].name, events[i].start, events[i].end, ring->thread };
+                trace.push_back(event);
+            }
+        }
+    }
+
+    frame_current.ms = frame_last_end > 0 ? (now - frame_last_end) * 1e-6 : 0.0;
+    frame_last_end = now;
+
+    // GPU stats stay those of the last frame read back until a newer one is
+    frame.index = frame_current.index;
+    frame.ms = frame_current.ms;
+    frame.cpu.swap(frame_current.cpu);
+    collectGpuFrames();
+
+    frame_current.cpu.clear();
+    frame_current.index++;
+
+    if (isProfiling()) {
+        hud_frame += (frame.ms - hud_frame) * PROFILE_HUD_SMOOTHING;
+        // Scopes that did not run this frame fade out
+        for (size_t i = 0; i < frame.cpu.size(); i++)
+            hud_cpu[frame.cpu[i].name];
+        for (size_t i = 0; i < frame.gpu.size(); i++)
+            hud_gpu[frame.gpu[i].name];
+        for (std::map<std::string, double>::iterator it = hud_cpu.begin(); it != hud_cpu.end(); ++it)
+            it->second += (frame.getCpuMs(it->first) - it->second) * PROFILE_HUD_SMOOTHING;
+        for (std::map<std::string, double>::iterator it = hud_gpu.begin(); it != hud_gpu.end(); ++it)
+            it->second += (frame.getGpuMs(it->first) - it->second) * PROFILE_HUD_SMOOTHING;
+    }
+}
+
+const ProfileFrame& getProfileFrame() { return frame; }
+
+void startProfileTrace(size_t _maxEvents) {
+    trace.clear();
+    trace_max_events = _maxEvents;
+    tracing = true;
+}
+
+void stopProfileTrace() { tracing = false; }
+bool isProfileTracing() { return tracing; }
+
+static void writeJsonString(FILE* _file, const std::string& _text) {
+    fputc('"', _file);
+    for (size_t i = 0; i < _text.size(); i++) {
+        const char c = _text[i];
+        if (c == '"' || c == '\\')
+            fputc('\\', _file);
+        if ((unsigned char)c >= 0x20)
+            fputc(c, _file);
+    }
+    fputc('"', _file);
+}
+
+bool saveProfileTrace(const std::string& _path) {
+    FILE* file = fopen(_path.c_str(), "w");
+    if (file == nullptr) {
+        std::cerr << "Error: can't write profile trace " << _path << std::endl;
+        return false;
+    }
+
+    uint64_t first = trace.empty() ? 0 : trace.front().start;
+    for (size_t i = 0; i < trace.size(); i++)
+        first = std::min(first, trace[i].start);
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (size_t i = 0; i < rings.size(); i++) {
+            const std::string name = rings[i]->name.empty() ? "thread " + std::to_string(i) : rings[i]->name;
+            fprintf(file, "{\"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"name\": \"thread_name\", \"args\": {\"name\": ", rings[i]->thread);
+            writeJsonString(file, name);
+            fprintf(file, "}},\n");
+        }
+    }
+    fprintf(file, "{\"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"name\": \"thread_name\", \"args\": {\"name\": \"GPU\"}}", UINT32_MAX);
+
+    for (size_t i = 0; i < trace.size(); i++) {
+        fprintf(file, ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, \"name\": ",
+                trace[i].thread, (trace[i].start - first) * 1e-3, (trace[i].end - trace[i].start) * 1e-3);
+        writeJsonString(file, trace[i].name);
+        fputc('}', file);
+    }
+    fprintf(file, "\n]}\n");
+
+    const bool ok = ferror(file) == 0;
+    fclose(file);
+    if (!ok)
+        std::cerr << "Error: can't write profile trace " << _path << std::endl;
+    return ok;
+}
+
+void drawProfileHud(float _x, float _y) {
+    if (hud_font == nullptr) {
+        hud_font = new Font();
+        hud_font->loadDefault();
+        hud_font->setAlign(ALIGN_LEFT);
+        hud_font->setAlign(ALIGN_TOP);
+        hud_font->setSize(14.0f);
+    }
+
+    std::vector<std::string> lines;
+    char line[128];
+    if (!isProfiling())
+        lines.push_back("profiling off");
+    else {
+        snprintf(line, sizeof(line), "frame  %6.2f ms  %5.1f fps", hud_frame, hud_frame > 0.0 ? 1000.0 / hud_frame : 0.0);
+        lines.push_back(line);
+        for (std::map<std::string, double>::const_iterator it = hud_cpu.begin(); it != hud_cpu.end(); ++it) {
+            snprintf(line, sizeof(line), "%-8.8s %6.2f ms", it->first.c_str(), it->second);
+            std::map<std::string, double>::const_iterator gpu = hud_gpu.find(it->first);
+            if (gpu != hud_gpu.end())
+                snprintf(line + strlen(line), sizeof(line) - strlen(line), "  gpu %6.2f ms", gpu->second);
+            lines.push_back(line);
+        }
+    }
+
+    const float leading = 18.0f * getPixelDensity();
+    hud_font->setColor(glm::vec4(1.0f, 1.0f, 0.6f, 1.0f));
+    for (size_t i = 0; i < lines.size(); i++)
+        hud_font->render(lines[i], _x, _y + leading * i);
+}
+
+ProfileScope::ProfileScope(const char* _name, bool _gpu) : m_name(_name), m_start(0), m_gpu(false) {
+    if (!isProfiling())
+        return;
+    m_start = getProfileTime();
+    if (_gpu)
+        m_gpu = beginGpuProfile(_name);
+}
+
+ProfileScope::~ProfileScope() {
+    if (m_gpu)
+        endGpuProfile();
+    if (m_start > 0)
+        profileEvent(m_name, m_start, getProfileTime());
+}
+
+}
@@ -3,6 +3,8 @@
 #include "vera/ops/draw.h"
 #include "vera/ops/string.h"
 
+#include <algorithm>
+#include <cmath>
 #include <fstream> 
 
 #include "json.hpp"
@@ -13,6 +15,10 @@ static QuiltProperties  quilt;
 static Fbo              quilt_fbo;
 static Shader           quilt_shader;
 static int              currentViewIndex = 0;
+static float            viewTolerance = 20.0f;
+
+// view cone of the hardware, same as Camera::setVirtualOffset()
+static const float      viewCone = 40.0f;
 
 //  QUILT 
 QuiltProperties::QuiltProperties() {};
@@ -49,7 +55,48 @@ int getQuiltRows() { return quilt.rows; }
 int getQuiltTotalViews() { return quilt.totalViews; }
 int getQuiltCurrentViewIndex() { return currentViewIndex; }
 
-void renderQuilt(std::function<void(const QuiltProperties&, glm::vec4&, int&)> _renderFnc, bool _justQuilt) {
+void  setQuiltViewTolerance(float _degrees) { viewTolerance = std::max(0.0f, _degrees); }
+float getQuiltViewTolerance() { return viewTolerance; }
+
+int getQuiltViewClusterCount() {
+    if (quilt.totalViews <= 1)
+        return 1;
+
+    // views are evenly spread over the cone, so a cluster holds the central
+    // view and up to `reach` views on each side of it
+    float viewAngle = viewCone / float(quilt.totalViews - 1);
+    int reach = int(std::floor(viewTolerance / viewAngle + 1e-4f));
+    int clusterViews = std::min(2 * reach + 1, quilt.totalViews);
+    return (quilt.totalViews + clusterViews - 1) / clusterViews;
+}
+
+QuiltViewCluster getQuiltViewCluster(int _viewIndex) {
+    int total = std::max(1, quilt.totalViews);
+    int clusters = getQuiltViewClusterCount();
+    _viewIndex = std::max(0, std::min(_viewIndex, total - 1));
+
+    // split the views as evenly as possible, the first `total % clusters` clusters take one more
+    int base = total / clusters;
+    int extra = total % clusters;
+    int bigViews = extra * (base + 1);
+
+    QuiltViewCluster cluster;
+    if (_viewIndex < bigViews) {
+        cluster.index = _viewIndex / (base + 1);
+        cluster.firstView = cluster.index * (base + 1);
+        cluster.totalViews = base + 1;
+    }
+    else {
+        cluster.index = extra + (_viewIndex - bigViews) / base;
+        cluster.firstView = bigViews + (cluster.index - extra) * base;
+        cluster.totalViews = base;
+    }
+    cluster.centralView = cluster.firstView + (cluster.totalViews - 1) / 2;
+    return cluster;
+}
+
+void renderQuilt(std::function<void(const QuiltProperties&, glm::vec4&, int&)> _renderFnc, bool _justQuilt,
+                 std::function<void(const QuiltProperties&, const QuiltViewCluster&)> _clusterFnc) {
 
     Camera* cam = getCamera();
     if (!cam)
@@ -105,6 +152,19 @@ void renderQuilt(std::function<void(const QuiltProperties&, glm::vec4&, int&)> _
         glScissor(x, y, qs_viewWidth, qs_viewHeight);
         glm::vec4 vp = glm::vec4(x, y, qs_viewWidth, qs_viewHeight);
 
+        // set up what the views of this cluster share (sorting, buffer bindings, ...) once
+        if (_clusterFnc) {
+            QuiltViewCluster cluster = getQuiltViewCluster(viewIndex);
+            if (cluster.firstView == viewIndex) {
+                currentViewIndex = cluster.centralView;
+                // the camera still holds the offset of the last view drawn, the draw of each view sets its own again
+                Camera* cam = getCamera();
+                if (cam)
+                    cam->setVirtualOffset(1.5, cluster.centralView, quilt.totalViews);
+                _clusterFnc(quilt, cluster);
+            }
+        }
+
         currentViewIndex = viewIndex;
         
         _renderFnc(quilt, vp, viewIndex);
@@ -5,6 +5,9 @@ precision mediump float;
 
 in vec2 position;
 in uint depth_index;
+// Base of the chunk when depth_index is a 16-bit chunk relative index,
+// see packSortedIndexes()
+uniform uint index_base;
 
 struct Splat {
   vec3 center;
@@ -14,10 +17,98 @@ struct Splat {
   vec3 sh[16];
 };
 
+#if defined(PACKED_SPLATS)
+// PackedSplat of src/gpuSplat.h, little endian:
+// bytes 0-5 center, 6-7 alpha, 8-11 cell, 12-23 half covariance,
+// 24-29 DC, 30-74 rest of the SH as bytes, 75 covariance exponent
+struct PackedSplat {
+  uint data[19];
+};
+
+layout(std430, binding=2) readonly buffer splat_buffer {
+  PackedSplat splats[];
+};
+
+// Cell origin xyz and edge length
+layout(std430, binding=3) readonly buffer splat_cells {
+  vec4 cells[];
+};
+
+uniform vec2 sh_range[16];  // offset, scale
+
+uint packedShort(uint i, uint offset) {
+  return (splats[i].data[offset >> 2] >> ((offset & 2u) * 8u)) & 0xffffu;
+}
+
+uint packedByte(uint i, uint offset) {
+  return (splats[i].data[offset >> 2] >> ((offset & 3u) * 8u)) & 0xffu;
+}
+
+Splat loadSplat(uint i) {
+  Splat s;
+  vec4 cell = cells[splats[i].data[2]];
+  s.center = cell.xyz + vec3(packedShort(i, 0u), packedShort(i, 2u),
+                             packedShort(i, 4u)) * (cell.w / 65535.0);
+  s.alpha = float(packedShort(i, 6u)) / 65535.0;
+
+  float cov_scale = exp2(float(int(packedByte(i, 75u)) - 128));
+  vec2 c0 = unpackHalf2x16(splats[i].data[3]) * cov_scale;
+  vec2 c1 = unpackHalf2x16(splats[i].data[4]) * cov_scale;
+  vec2 c2 = unpackHalf2x16(splats[i].data[5]) * cov_scale;
+  s.covA = vec3(c0, c1.x);
+  s.covB = vec3(c1.y, c2);
+
+  s.sh[0] = sh_range[0].x + sh_range[0].y *
+      vec3(packedShort(i, 24u), packedShort(i, 26u), packedShort(i, 28u));
+  for (uint k = 1u; k < 16u; k++) {
+    uint b = 27u + k * 3u;
+    s.sh[k] = sh_range[k].x + sh_range[k].y *
+        vec3(packedByte(i, b), packedByte(i, b + 1u), packedByte(i, b + 2u));
+  }
+  return s;
+}
+#elif defined(SH_CODEBOOK)
+// CodebookSplat of src/shCodebook.h
+struct CodebookSplat {
+  vec3 center;
+  float alpha;
+  vec3 covA;
+  uint sh_index;
+  vec3 covB;
+  vec3 dc;
+};
+
+layout(std430, binding=2) readonly buffer splat_buffer {
+  CodebookSplat splats[];
+};
+
+// ShCodebook::entries, coefficients 1 to 15 of every entry
+layout(std430, binding=4) readonly buffer sh_codebook {
+  vec4 sh_entries[];
+};
+
+Splat loadSplat(uint i) {
+  Splat s;
+  s.center = splats[i].center;
+  s.alpha = splats[i].alpha;
+  s.covA = splats[i].covA;
+  s.covB = splats[i].covB;
+  s.sh[0] = splats[i].dc;
+  uint base = splats[i].sh_index * 15u;
+  for (uint k = 1u; k < 16u; k++)
+    s.sh[k] = sh_entries[base + k - 1u].rgb;
+  return s;
+}
+#else
 layout(std430, binding=2) readonly buffer splat_buffer {
   Splat splats[];
 };
 
+Splat loadSplat(uint i) {
+  return splats[i];
+}
+#endif
+
 uniform mat4 projection, view;
 uniform vec2 focal;
 uniform vec2 viewport;
@@ -55,11 +146,9 @@ const float SH_C3[7] = float[7](
   -0.5900435899266435
 );
 
-vec3 get_rgb(vec3 d) {
+vec3 get_rgb(vec3 d, Splat s) {
     vec3 rgb = vec3(0.5);
 
-    const Splat s = splats[depth_index];
-
     rgb += SH_C0 * s.sh[0];
 
     if (sh_degree >= 1) {
@@ -99,7 +188,7 @@ vec3 get_rgb(vec3 d) {
 }
 
 void main () {
-  const Splat s = splats[depth_index];
+  Splat s = loadSplat(index_base + depth_index);
   vec4 camspace = view * vec4(s.center, 1);
   vec4 pos2d = projection * camspace;
 
@@ -144,7 +233,7 @@ void main () {
   vec2 v2 = min(sqrt(2.0 * lambda2), 1024.0) * vec2(diagonalVector.y, -diagonalVector.x);
 
   vec3 ray_direction = normalize(s.center - cam_pos);
-  vColor.rgb = get_rgb(ray_direction);
+  vColor.rgb = get_rgb(ray_direction, s);
   vColor.a = s.alpha;
   vPosition = position;
 
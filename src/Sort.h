@@ -1,58 +1,39 @@
+#ifndef SORT_H
+#define SORT_H
+
+#if defined(__EMSCRIPTEN__)
 #include <emscripten/emscripten.h>
+#endif
 #include <iostream>
 
+#include "sortEngine.h"
+
 #ifdef __cplusplus
 #define EXTERN extern "C"
 #else
 #define EXTERN
 #endif
 
-extern void sortIndexes(unsigned int* indexes, int* positions, char* sortBuffers, int* viewProj,
-                                             unsigned int* indexesOut, float cameraX, float cameraY,
-                                             float cameraZ, unsigned int distanceMapRange, unsigned int sortCount,
-                                             unsigned int renderCount, unsigned int splatCount) {
-
-    int maxDistance = -2147483640;
-    int minDistance = 2147483640;
-    int* distances = (int*)sortBuffers;
-    for (unsigned int i = 0; i < sortCount; i++) {
-        unsigned int indexOffset = 3 * (unsigned int)indexes[i];
-        int depth =
-            (int)((viewProj[2] * positions[indexOffset] +
-                   viewProj[6] * positions[indexOffset + 1] +
-                   viewProj[10] * positions[indexOffset + 2]));
-        distances[i] = depth;
-        if (depth > maxDistance) maxDistance = depth;
-        if (depth < minDistance) minDistance = depth;
-    }
-
-    float distancesRange = (float)maxDistance - (float)minDistance;
-    float rangeMap = (float)distanceMapRange / distancesRange;
-
-    unsigned int* frequencies = ((unsigned int *)distances) + splatCount;
-
-    for (unsigned int i = 0; i < sortCount; i++) {
-        unsigned int frequenciesIndex = (int)((float)(distances[i] - minDistance) * rangeMap);
-        unsigned int cFreq = frequencies[frequenciesIndex];
-        frequencies[frequenciesIndex] = cFreq + 1;   
-    }
-
-    unsigned int cumulativeFreq = frequencies[0];
-    for (unsigned int i = 1; i < distanceMapRange; i++) {
-        unsigned int freq = frequencies[i];
-        cumulativeFreq += freq;
-        frequencies[i] = cumulativeFreq;
-    }
-
-    for (int i = renderCount - 1; i >= (int)sortCount; i--) {
-        indexesOut[i] = indexes[i];
-    }
-
-    for (int i = (int)sortCount - 1; i >= 0; i--) {
-        unsigned int frequenciesIndex = (int)((float)(distances[i] - minDistance) * rangeMap);
-        unsigned int freq = frequencies[frequenciesIndex];
-        indexesOut[freq - 1] = indexes[i];
-        frequencies[frequenciesIndex] = freq - 1;
-    }
-
+// Compatibility entry point for the original single threaded counting sort.
+// The work is forwarded to SortEngine::shared(), which owns its own depth and
+// histogram scratch memory, so `sortBuffers` and `splatCount` are no longer
+// read. The camera position only matters in coherent mode, where it feeds
+// the camera-delta test (see SortEngine::setCoherent()). Indexes compacted
+// by SplatCuller::cull() skip the splats shader.vs would throw away. cull()
+// rewrites the same index array in place, often with the same count, so in
+// coherent mode call SortEngine::invalidate() when SplatCuller::hasChanged()
+// is set, or the previous order is reused for a different set of splats.
+inline void sortIndexes(unsigned int* indexes, int* positions, char* sortBuffers, int* viewProj,
+                        unsigned int* indexesOut, float cameraX, float cameraY,
+                        float cameraZ, unsigned int distanceMapRange, unsigned int sortCount,
+                        unsigned int renderCount, unsigned int splatCount) {
+    SortEngine& engine = SortEngine::shared();
+    if (engine.isCoherent())
+        engine.sortCoherent(indexes, positions, viewProj, indexesOut, distanceMapRange,
+                            sortCount, renderCount, glm::vec3(cameraX, cameraY, cameraZ));
+    else
+        engine.sort(indexes, positions, viewProj, indexesOut, distanceMapRange,
+                    sortCount, renderCount);
 }
+
+#endif
@@ -0,0 +1,191 @@
+#include "gpuSplat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "halfFloat.h"
+
+// Splats per statistics task
+static const size_t kStatsChunk = 65536;
+// Splats per pack or unpack range
+static const size_t kMinSplatsPerTask = 16384;
+static const int kMaxCellsPerAxis = 128;
+// Largest stored covariance entries land in [2^13, 2^14), well below 65504
+static const int kCovarianceExponent = 14;
+
+struct PackStats {
+  float boundsMin[3];
+  float boundsMax[3];
+  float shMin[16];
+  float shMax[16];
+
+  PackStats() {
+    std::fill(boundsMin, boundsMin + 3, std::numeric_limits<float>::max());
+    std::fill(boundsMax, boundsMax + 3, -std::numeric_limits<float>::max());
+    std::fill(shMin, shMin + 16, std::numeric_limits<float>::max());
+    std::fill(shMax, shMax + 16, -std::numeric_limits<float>::max());
+  }
+
+  void merge(const PackStats& other) {
+    for (int c = 0; c < 3; c++) {
+      boundsMin[c] = std::min(boundsMin[c], other.boundsMin[c]);
+      boundsMax[c] = std::max(boundsMax[c], other.boundsMax[c]);
+    }
+    for (int k = 0; k < 16; k++) {
+      shMin[k] = std::min(shMin[k], other.shMin[k]);
+      shMax[k] = std::max(shMax[k], other.shMax[k]);
+    }
+  }
+};
+
+static uint32_t quantize(float value, float offset, float inverseStep,
+                         uint32_t maxValue) {
+  const float q = (value - offset) * inverseStep + 0.5f;
+  if (!(q > 0.0f))
+    return 0;
+  return q >= (float)maxValue ? maxValue : (uint32_t)q;
+}
+
+static void getCellCoordinates(const float center[3], const float origin[3],
+                               float inverseCellSize, int cellsPerAxis,
+                               int coordinates[3]) {
+  for (int c = 0; c < 3; c++) {
+    const float cell = std::floor((center[c] - origin[c]) * inverseCellSize);
+    coordinates[c] = cell > 0.0f ? std::min((int)cell, cellsPerAxis - 1) : 0;
+  }
+}
+
+void packSplats(const GpuSplat* splats, size_t count,
+                std::vector<PackedSplat>& packed, PackedSplatScene& scene,
+                int cellsPerAxis, ThreadPool& pool) {
+  cellsPerAxis = std::max(1, std::min(cellsPerAxis, kMaxCellsPerAxis));
+  packed.resize(count);
+  scene = PackedSplatScene();
+  if (count == 0)
+    return;
+
+  // Bounds and SH ranges
+  const size_t chunkCount = (count + kStatsChunk - 1) / kStatsChunk;
+  std::vector<PackStats> partial(chunkCount);
+  pool.parallelFor(chunkCount, [&](size_t chunk) {
+    PackStats& stats = partial[chunk];
+    const size_t end = std::min(count, (chunk + 1) * kStatsChunk);
+    for (size_t i = chunk * kStatsChunk; i < end; i++) {
+      const GpuSplat& splat = splats[i];
+      for (int c = 0; c < 3; c++) {
+        stats.boundsMin[c] = std::min(stats.boundsMin[c], splat.center[c]);
+        stats.boundsMax[c] = std::max(stats.boundsMax[c], splat.center[c]);
+      }
+      for (int k = 0; k < 16; k++)
+        for (int c = 0; c < 3; c++) {
+          stats.shMin[k] = std::min(stats.shMin[k], splat.sh[k][c]);
+          stats.shMax[k] = std::max(stats.shMax[k], splat.sh[k][c]);
+        }
+    }
+  });
+  PackStats stats;
+  for (const PackStats& chunkStats : partial)
+    stats.merge(chunkStats);
+
+  float shInverseStep[16];
+  for (int k = 0; k < 16; k++) {
+    const float levels = k == 0 ? 65535.0f : 255.0f;
+    const float range = stats.shMax[k] - stats.shMin[k];
+    scene.shOffset[k] = stats.shMin[k];
+    scene.shScale[k] = range > 0.0f ? range / levels : 0.0f;
+    shInverseStep[k] = range > 0.0f ? levels / range : 0.0f;
+  }
+
+  // Cubic cells over the largest extent, numbered in first use order
+  float extent = 0.0f;
+  for (int c = 0; c < 3; c++)
+    extent = std::max(extent, stats.boundsMax[c] - stats.boundsMin[c]);
+  const float cellSize = extent > 0.0f ? extent / cellsPerAxis : 1.0f;
+  const float inverseCellSize = 1.0f / cellSize;
+  const size_t gridSize = (size_t)cellsPerAxis * cellsPerAxis * cellsPerAxis;
+  std::vector<uint32_t> cellIndex(gridSize, UINT32_MAX);
+  std::vector<uint32_t> splatCells(count);
+  for (size_t i = 0; i < count; i++) {
+    int xyz[3];
+    getCellCoordinates(splats[i].center, stats.boundsMin, inverseCellSize,
+                       cellsPerAxis, xyz);
+    const size_t key = ((size_t)xyz[2] * cellsPerAxis + xyz[1]) * cellsPerAxis +
+                       xyz[0];
+    if (cellIndex[key] == UINT32_MAX) {
+      cellIndex[key] = (uint32_t)(scene.cells.size() / 4);
+      for (int c = 0; c < 3; c++)
+        scene.cells.push_back(stats.boundsMin[c] + xyz[c] * cellSize);
+      scene.cells.push_back(cellSize);
+    }
+    splatCells[i] = cellIndex[key];
+  }
+
+  const float centerInverseStep = 65535.0f * inverseCellSize;
+  pool.parallelForRange(0, count, kMinSplatsPerTask, [&](size_t first,
+                                                         size_t last) {
+    for (size_t i = first; i < last; i++) {
+      const GpuSplat& splat = splats[i];
+      PackedSplat& out = packed[i];
+      out.cell = splatCells[i];
+      const float* origin = &scene.cells[(size_t)out.cell * 4];
+      for (int c = 0; c < 3; c++)
+        out.center[c] = (uint16_t)quantize(splat.center[c], origin[c],
+                                           centerInverseStep, 65535);
+      out.alpha = (uint16_t)quantize(splat.alpha, 0.0f, 65535.0f, 65535);
+      float covarianceMax = 0.0f;
+      for (int c = 0; c < 3; c++)
+        covarianceMax = std::max(
+            covarianceMax,
+            std::max(std::fabs(splat.covA[c]), std::fabs(splat.covB[c])));
+      int exponent = 0;
+      if (covarianceMax > 0.0f && std::isfinite(covarianceMax)) {
+        std::frexp(covarianceMax, &exponent);
+        exponent =
+            std::max(-127, std::min(exponent - kCovarianceExponent, 127));
+      }
+      out.covarianceExponent = (uint8_t)(exponent + 128);
+      for (int c = 0; c < 3; c++) {
+        out.covariance[c] = floatToHalf(std::ldexp(splat.covA[c], -exponent));
+        out.covariance[3 + c] =
+            floatToHalf(std::ldexp(splat.covB[c], -exponent));
+        out.dc[c] = (uint16_t)quantize(splat.sh[0][c], scene.shOffset[0],
+                                       shInverseStep[0], 65535);
+      }
+      for (int k = 1; k < 16; k++)
+        for (int c = 0; c < 3; c++)
+          out.sh[k - 1][c] = (uint8_t)quantize(
+              splat.sh[k][c], scene.shOffset[k], shInverseStep[k], 255);
+    }
+  });
+}
+
+void unpackSplats(const PackedSplat* packed, size_t count,
+                  const PackedSplatScene& scene, GpuSplat* splats,
+                  ThreadPool& pool) {
+  pool.parallelForRange(0, count, kMinSplatsPerTask, [&](size_t first,
+                                                         size_t last) {
+    for (size_t i = first; i < last; i++) {
+      const PackedSplat& in = packed[i];
+      GpuSplat& out = splats[i];
+      const float* cell = &scene.cells[(size_t)in.cell * 4];
+      const float step = cell[3] / 65535.0f;
+      const int exponent = (int)in.covarianceExponent - 128;
+      for (int c = 0; c < 3; c++) {
+        out.center[c] = cell[c] + in.center[c] * step;
+        out.covA[c] = std::ldexp(halfToFloat(in.covariance[c]), exponent);
+        out.covB[c] = std::ldexp(halfToFloat(in.covariance[3 + c]), exponent);
+        out.sh[0][c] = scene.shOffset[0] + in.dc[c] * scene.shScale[0];
+      }
+      out.alpha = in.alpha / 65535.0f;
+      out.padding0 = 0.0f;
+      out.padding1 = 0.0f;
+      out.sh[0][3] = 0.0f;
+      for (int k = 1; k < 16; k++) {
+        for (int c = 0; c < 3; c++)
+          out.sh[k][c] = scene.shOffset[k] + in.sh[k - 1][c] * scene.shScale[k];
+        out.sh[k][3] = 0.0f;
+      }
+    }
+  });
+}
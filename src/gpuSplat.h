@@ -0,0 +1,69 @@
+#ifndef GPUSPLAT_H
+#define GPUSPLAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "threadPool.h"
+
+// One splat as the splat_buffer SSBO of shader/shader.vs reads it. std430
+// gives every vec3 16 bytes, hence the padding.
+struct GpuSplat {
+  float center[3];
+  float alpha;
+  float covA[3];  // xx, xy, xz
+  float padding0;
+  float covB[3];  // yy, yz, zz
+  float padding1;
+  float sh[16][4];  // rgb + padding, sh[0] is the DC term
+};
+
+static_assert(sizeof(GpuSplat) == 304, "GpuSplat must match the std430 Splat");
+
+// The same splat in 76 bytes, read by shader/shader.vs when PACKED_SPLATS is
+// defined. The GLSL side sees it as uint[19], little endian.
+//
+// Centers are unorm16 offsets inside a cubic cell of the scene grid, the
+// covariance is half float times a per splat power of two, so tiny splats
+// keep their precision, and SH coefficients are unorm16 (DC) or unorm8
+// (rest) over a per scene range for every coefficient.
+struct PackedSplat {
+  uint16_t center[3];  // inside the cell, 65535 is the far corner
+  uint16_t alpha;      // unorm16
+  uint32_t cell;       // index into PackedSplatScene::cells
+  uint16_t covariance[6];  // half: xx, xy, xz, yy, yz, zz, times 2^-e
+  uint16_t dc[3];
+  uint8_t sh[15][3];  // sh[k] is coefficient k + 1
+  uint8_t covarianceExponent;  // e + 128
+};
+
+static_assert(sizeof(PackedSplat) == 76, "PackedSplat must match uint[19]");
+
+// Per scene constants needed to unpack PackedSplat records.
+struct PackedSplatScene {
+  // Occupied grid cells: origin xyz and edge length, the splat_cells SSBO
+  std::vector<float> cells;
+  // Coefficient k of channel c is shOffset[k] + q * shScale[k]
+  float shOffset[16] = {};
+  float shScale[16] = {};
+};
+
+// Packs `count` splats. The scene bounds are split into cellsPerAxis^3
+// cubic cells (at most 128 per axis); only occupied ones end up in
+// scene.cells. At 64 cells a 100 unit scene keeps centers to 2.4e-5 units.
+void packSplats(const GpuSplat* splats, size_t count,
+                std::vector<PackedSplat>& packed, PackedSplatScene& scene,
+                int cellsPerAxis = 64,
+                ThreadPool& pool = ThreadPool::shared());
+
+// Inverse of packSplats(), same math as the shader. Up to float rounding,
+// unpacked centers are within half a step (cell edge / 65535) of the
+// original, alpha within 0.5 / 65535, every covariance entry within 2^-11 of
+// the largest entry of its splat, and SH coefficient k within
+// shScale[k] / 2. bench/packedSplatCheck.cpp checks these.
+void unpackSplats(const PackedSplat* packed, size_t count,
+                  const PackedSplatScene& scene, GpuSplat* splats,
+                  ThreadPool& pool = ThreadPool::shared());
+
+#endif
@@ -0,0 +1,94 @@
+#include "halfFloat.h"
+
+#include "simd.h"
+
+static void halfToFloatScalar(const uint16_t* in, float* out, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    out[i] = halfToFloat(in[i]);
+}
+
+static void floatToHalfScalar(const float* in, uint16_t* out, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    out[i] = floatToHalf(in[i]);
+}
+
+#if defined(SPLAT_X86_DISPATCH)
+
+SPLAT_TARGET_F16C static void floatToHalfF16C(const float* in, uint16_t* out,
+                                              size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm256_cvtps_ph(_mm256_loadu_ps(in + i),
+                                     _MM_FROUND_TO_NEAREST_INT));
+  floatToHalfScalar(in + i, out + i, count - i);
+}
+
+SPLAT_TARGET_F16C static void halfToFloatF16C(const uint16_t* in, float* out,
+                                              size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128(
+                                  reinterpret_cast<const __m128i*>(in + i))));
+  halfToFloatScalar(in + i, out + i, count - i);
+}
+
+#elif defined(SPLAT_NEON) && defined(__aarch64__)
+
+static void halfToFloatNeon(const uint16_t* in, float* out, size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+    vst1q_f32(out + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(in + i))));
+  halfToFloatScalar(in + i, out + i, count - i);
+}
+
+static void floatToHalfNeon(const float* in, uint16_t* out, size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+    vst1_u16(out + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(in + i))));
+  floatToHalfScalar(in + i, out + i, count - i);
+}
+
+#elif defined(SPLAT_WASM_SIMD)
+
+// Same magic number scaling as the scalar version, four at a time
+static void halfToFloatWasm(const uint16_t* in, float* out, size_t count) {
+  const v128_t magic = wasm_i32x4_splat((254 - 15) << 23);
+  const v128_t wasInfNan = wasm_f32x4_splat(65536.0f);
+  const v128_t expMask = wasm_i32x4_splat(255 << 23);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const v128_t h = wasm_u32x4_load16x4(in + i);
+    v128_t f = wasm_f32x4_mul(
+        wasm_i32x4_shl(wasm_v128_and(h, wasm_i32x4_splat(0x7fff)), 13), magic);
+    f = wasm_v128_or(f, wasm_v128_and(wasm_f32x4_ge(f, wasInfNan), expMask));
+    f = wasm_v128_or(
+        f, wasm_i32x4_shl(wasm_v128_and(h, wasm_i32x4_splat(0x8000)), 16));
+    wasm_v128_store(out + i, f);
+  }
+  halfToFloatScalar(in + i, out + i, count - i);
+}
+
+#endif
+
+void halfToFloat(const uint16_t* in, float* out, size_t count) {
+#if defined(SPLAT_X86_DISPATCH)
+  if (simd::hasF16C())
+    return halfToFloatF16C(in, out, count);
+#elif defined(SPLAT_NEON) && defined(__aarch64__)
+  return halfToFloatNeon(in, out, count);
+#elif defined(SPLAT_WASM_SIMD)
+  return halfToFloatWasm(in, out, count);
+#endif
+  halfToFloatScalar(in, out, count);
+}
+
+void floatToHalf(const float* in, uint16_t* out, size_t count) {
+#if defined(SPLAT_X86_DISPATCH)
+  if (simd::hasF16C())
+    return floatToHalfF16C(in, out, count);
+#elif defined(SPLAT_NEON) && defined(__aarch64__)
+  return floatToHalfNeon(in, out, count);
+#endif
+  floatToHalfScalar(in, out, count);
+}
@@ -0,0 +1,64 @@
+#ifndef HALFFLOAT_H
+#define HALFFLOAT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// IEEE 754 half precision to float. Denormals, Inf and NaN are preserved.
+inline float halfToFloat(uint16_t value) {
+  union Fp32 {
+    uint32_t u;
+    float f;
+  };
+  const Fp32 magic = {(254U - 15U) << 23};
+  const Fp32 was_infnan = {(127U + 16U) << 23};
+  Fp32 out;
+
+  out.u = (value & 0x7FFFU) << 13; /* exponent/mantissa bits */
+  out.f *= magic.f;                /* exponent adjust */
+  if (out.f >= was_infnan.f)       /* make sure Inf/NaN survive */
+    out.u |= 255U << 23;
+  out.u |= (value & 0x8000U) << 16; /* sign bit */
+  return out.f;
+}
+
+// Converts `count` halfs, using F16C, NEON or WASM SIMD when available.
+// Same results as the scalar halfToFloat(), except that F16C and NEON quiet
+// signalling NaNs.
+void halfToFloat(const uint16_t* in, float* out, size_t count);
+
+// Float to IEEE 754 half precision, rounding to nearest even. Values too
+// large for a half become Inf, NaN stays NaN.
+inline uint16_t floatToHalf(float value) {
+  union Fp32 {
+    uint32_t u;
+    float f;
+  };
+  const Fp32 f32infty = {255U << 23};
+  const Fp32 f16max = {(127U + 16U) << 23};
+  const Fp32 denorm_magic = {((127U - 15U) + (23U - 10U) + 1U) << 23};
+  Fp32 f;
+  f.f = value;
+  const uint32_t sign = f.u & 0x80000000U;
+  f.u ^= sign;
+
+  uint16_t out;
+  if (f.u >= f16max.u) {  // Inf or NaN, or too large
+    out = f.u > f32infty.u ? 0x7E00 : 0x7C00;
+  } else if (f.u < (113U << 23)) {  // half denormal or zero
+    f.f += denorm_magic.f;          /* the add rounds the mantissa */
+    out = (uint16_t)(f.u - denorm_magic.u);
+  } else {
+    const uint32_t mant_odd = (f.u >> 13) & 1U;
+    f.u += ((uint32_t)(15 - 127) << 23) + 0xFFFU; /* rebias, round */
+    f.u += mant_odd;                              /* ties to even */
+    out = (uint16_t)(f.u >> 13);
+  }
+  return (uint16_t)(out | (sign >> 16));
+}
+
+// Converts `count` floats, using F16C or NEON when available. Same results
+// as the scalar floatToHalf(), except for the payload of NaNs.
+void floatToHalf(const float* in, uint16_t* out, size_t count);
+
+#endif
@@ -0,0 +1,206 @@
+#include "indexUpload.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "timing.h"
+#include "vera/ops/profile.h"
+
+static const size_t kMinBlocksPerTask = 256;
+
+// Low bits in place, and the runs of equal chunks along the order: every
+// task finds the runs of its range, then runs that continue across a task
+// boundary are joined.
+static void packExact(const uint32_t* sorted, uint32_t count,
+                      std::vector<uint16_t>& indexes16,
+                      std::vector<SortIndexRun>& runs, ThreadPool& pool) {
+  const size_t tasks = std::max<size_t>(
+      1, std::min<size_t>(pool.getThreadCount(),
+                          count / ThreadPool::kDefaultGrain));
+  const uint32_t taskSize = (uint32_t)((count + tasks - 1) / tasks);
+  const uint32_t mask = (1u << SortChunkBits) - 1;
+  std::vector<std::vector<SortIndexRun>> taskRuns(tasks);
+  pool.parallelFor(tasks, [&](size_t t) {
+    std::vector<SortIndexRun>& out = taskRuns[t];
+    const uint32_t end = std::min<uint32_t>(count, (t + 1) * taskSize);
+    for (uint32_t i = std::min<uint32_t>(count, t * taskSize); i < end; i++) {
+      const uint32_t index = sorted[i];
+      const uint32_t base = index & ~mask;
+      if (out.empty() || out.back().base != base) {
+        SortIndexRun run;
+        run.base = base;
+        run.first = i;
+        out.push_back(run);
+      }
+      out.back().count++;
+      indexes16[i] = (uint16_t)(index & mask);
+    }
+  });
+
+  for (const std::vector<SortIndexRun>& part : taskRuns)
+    for (const SortIndexRun& run : part) {
+      if (!runs.empty() && runs.back().base == run.base)
+        runs.back().count += run.count;
+      else
+        runs.push_back(run);
+    }
+}
+
+static void packGroupChunks(const uint32_t* sorted, uint32_t count,
+                            std::vector<uint16_t>& indexes16,
+                            std::vector<SortIndexRun>& runs,
+                            ThreadPool& pool) {
+  const size_t tasks = std::max<size_t>(
+      1, std::min<size_t>(pool.getThreadCount(),
+                          count / ThreadPool::kDefaultGrain));
+  const uint32_t taskSize = (uint32_t)((count + tasks - 1) / tasks);
+  auto taskBegin = [&](size_t t) {
+    return std::min<uint32_t>(count, t * taskSize);
+  };
+  auto taskEnd = [&](size_t t) {
+    return std::min<uint32_t>(count, (t + 1) * taskSize);
+  };
+
+  // 1. Entries and summed output positions per chunk, per task
+  std::vector<std::vector<uint32_t>> counts(tasks);
+  std::vector<std::vector<uint64_t>> positionSums(tasks);
+  pool.parallelFor(tasks, [&](size_t t) {
+    std::vector<uint32_t>& taskCounts = counts[t];
+    std::vector<uint64_t>& taskSums = positionSums[t];
+    for (uint32_t i = taskBegin(t); i < taskEnd(t); i++) {
+      const uint32_t chunk = sorted[i] >> SortChunkBits;
+      if (chunk >= taskCounts.size()) {
+        taskCounts.resize(chunk + 1, 0);
+        taskSums.resize(chunk + 1, 0);
+      }
+      taskCounts[chunk]++;
+      taskSums[chunk] += i;
+    }
+  });
+
+  size_t chunkCount = 0;
+  for (size_t t = 0; t < tasks; t++)
+    chunkCount = std::max(chunkCount, counts[t].size());
+  std::vector<uint32_t> totals(chunkCount, 0);
+  std::vector<double> meanPositions(chunkCount, 0.0);
+  for (size_t t = 0; t < tasks; t++)
+    for (size_t c = 0; c < counts[t].size(); c++) {
+      totals[c] += counts[t][c];
+      meanPositions[c] += (double)positionSums[t][c];
+    }
+
+  // 2. Chunk order, then where every task writes each chunk
+  std::vector<uint32_t> order;
+  for (uint32_t c = 0; c < chunkCount; c++)
+    if (totals[c] > 0) {
+      meanPositions[c] /= totals[c];
+      order.push_back(c);
+    }
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return meanPositions[a] < meanPositions[b];
+  });
+
+  std::vector<std::vector<uint32_t>> offsets(tasks,
+                                             std::vector<uint32_t>(chunkCount));
+  uint32_t offset = 0;
+  for (uint32_t c : order) {
+    SortIndexRun run;
+    run.base = c << SortChunkBits;
+    run.first = offset;
+    run.count = totals[c];
+    runs.push_back(run);
+    for (size_t t = 0; t < tasks; t++) {
+      offsets[t][c] = offset;
+      if (c < counts[t].size())
+        offset += counts[t][c];
+    }
+  }
+
+  // 3. Stable scatter of the low bits
+  const uint32_t mask = (1u << SortChunkBits) - 1;
+  pool.parallelFor(tasks, [&](size_t t) {
+    std::vector<uint32_t>& taskOffsets = offsets[t];
+    for (uint32_t i = taskBegin(t); i < taskEnd(t); i++) {
+      const uint32_t index = sorted[i];
+      indexes16[taskOffsets[index >> SortChunkBits]++] =
+          (uint16_t)(index & mask);
+    }
+  });
+}
+
+void packSortedIndexes(const uint32_t* sorted, uint32_t count,
+                       std::vector<uint16_t>& indexes16,
+                       std::vector<SortIndexRun>& runs,
+                       SortIndexPacking packing, ThreadPool& pool) {
+  indexes16.resize(count);
+  runs.clear();
+  if (count == 0)
+    return;
+  if (packing == SortIndexPacking::Exact)
+    packExact(sorted, count, indexes16, runs, pool);
+  else
+    packGroupChunks(sorted, count, indexes16, runs, pool);
+}
+
+IndexUploader::IndexUploader(size_t blockBytes, size_t mergeGap,
+                             ThreadPool& pool)
+    : pool(pool), blockBytes(std::max<size_t>(1, blockBytes)),
+      mergeGap(mergeGap) {}
+
+IndexUploadStats IndexUploader::upload(const void* data, size_t size,
+                                       const UploadFunction& send) {
+  VERA_PROFILE("upload");
+  const Clock::time_point start = Clock::now();
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  IndexUploadStats stats;
+  stats.bytes = size;
+
+  if (!valid || shadow.size() != size) {
+    shadow.assign(bytes, bytes + size);
+    valid = true;
+    if (size > 0) {
+      send(0, bytes, size);
+      stats.uploadedBytes = size;
+      stats.ranges = 1;
+    }
+    stats.ms = msSince(start);
+    return stats;
+  }
+
+  // Compare and take over changed blocks, blocks in parallel
+  const size_t blocks = (size + blockBytes - 1) / blockBytes;
+  dirty.assign(blocks, 0);
+  pool.parallelForRange(0, blocks, kMinBlocksPerTask, [&](size_t first,
+                                                          size_t last) {
+    for (size_t b = first; b < last; b++) {
+      const size_t begin = b * blockBytes;
+      const size_t length = std::min(blockBytes, size - begin);
+      if (std::memcmp(shadow.data() + begin, bytes + begin, length) != 0) {
+        std::memcpy(shadow.data() + begin, bytes + begin, length);
+        dirty[b] = 1;
+      }
+    }
+  });
+
+  size_t b = 0;
+  while (b < blocks) {
+    if (!dirty[b]) {
+      b++;
+      continue;
+    }
+    // Extend over clean gaps of at most mergeGap blocks
+    size_t last = b;
+    for (size_t next = b + 1; next < blocks && next <= last + mergeGap + 1;
+         next++)
+      if (dirty[next])
+        last = next;
+    const size_t begin = b * blockBytes;
+    const size_t end = std::min(size, (last + 1) * blockBytes);
+    send(begin, bytes + begin, end - begin);
+    stats.uploadedBytes += end - begin;
+    stats.ranges++;
+    b = last + 1;
+  }
+  stats.ms = msSince(start);
+  return stats;
+}
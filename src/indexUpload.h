@@ -0,0 +1,92 @@
+#ifndef INDEXUPLOAD_H
+#define INDEXUPLOAD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "threadPool.h"
+
+// Splats per chunk of the 16-bit sort output: chunk c holds splats
+// [c << SortChunkBits, (c + 1) << SortChunkBits).
+static const int SortChunkBits = 16;
+
+// Entries [first, first + count) of the 16-bit output belong to the chunk
+// starting at splat `base`. Drawn as one instanced call each, in order, with
+// `base` as the index_base uniform of shader.vs.
+struct SortIndexRun {
+  uint32_t base = 0;
+  uint32_t first = 0;
+  uint32_t count = 0;
+};
+
+enum class SortIndexPacking {
+  // Entries keep the order of `sorted`; a new run starts wherever the chunk
+  // changes. Runs are maximal, so no two of them can be merged without
+  // moving splats across each other.
+  Exact,
+  // Lossy: entries are regrouped by chunk, one run per chunk, and chunks
+  // are drawn by the mean position of their splats in `sorted`. Splats keep
+  // their depth order inside each chunk, but where chunks overlap in depth
+  // whole chunks are drawn one after the other and blending is wrong, e.g.
+  // for scenes seen from inside. splat_bench --only pack reports its PSNR
+  // against the exact order.
+  GroupChunks
+};
+
+// Turns the 32-bit order of sortIndexes() into chunk relative 16-bit
+// indexes, halving what the depth_index attribute uploads.
+//
+// Exact packing is only worth it when consecutive entries mostly share a
+// chunk: every run is a draw call. Splats in spatial order (sortSplats(),
+// level 1 SplatBuffer bucket order, SplatPager slots) are a requirement, not
+// a guarantee; seen from inside, the synthetic scenes of splat_bench still
+// change chunk almost every entry (~0.8 runs per splat at 1M splats). Check
+// runs.size() and keep the 32-bit indexes when it is large. Grouping bounds
+// the runs by the chunk count, but costs 26 to 30 dB PSNR on those scenes.
+void packSortedIndexes(const uint32_t* sorted, uint32_t count,
+                       std::vector<uint16_t>& indexes16,
+                       std::vector<SortIndexRun>& runs,
+                       SortIndexPacking packing = SortIndexPacking::Exact,
+                       ThreadPool& pool = ThreadPool::shared());
+
+struct IndexUploadStats {
+  size_t bytes = 0;          // of the whole array
+  size_t uploadedBytes = 0;  // sent this time
+  uint32_t ranges = 0;
+  double ms = 0.0;
+};
+
+// Keeps a copy of what the GPU buffer holds and sends only the blocks
+// that changed since the last upload.
+//
+// Blocks are compared in parallel; dirty blocks closer than `mergeGap`
+// blocks are sent as one range, since every glBufferSubData() call has a
+// fixed cost. The first upload, and every upload after a size change or
+// invalidate(), sends the whole array.
+class IndexUploader {
+ public:
+  // (byte offset, data, byte count), e.g. wrapping glBufferSubData()
+  using UploadFunction =
+      std::function<void(size_t offset, const void* data, size_t size)>;
+
+  explicit IndexUploader(size_t blockBytes = 4096, size_t mergeGap = 4,
+                         ThreadPool& pool = ThreadPool::shared());
+
+  IndexUploadStats upload(const void* data, size_t size,
+                          const UploadFunction& send);
+
+  // The GPU buffer lost its content, e.g. it was reallocated.
+  void invalidate() { valid = false; }
+
+ private:
+  ThreadPool& pool;
+  const size_t blockBytes;
+  const size_t mergeGap;
+  std::vector<uint8_t> shadow;
+  std::vector<uint8_t> dirty;
+  bool valid = false;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "mappedFile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif !defined(__EMSCRIPTEN__)
+#define SPLAT_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+  *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    close();
+    bytes = other.bytes;
+    byteCount = other.byteCount;
+    opened = other.opened;
+    mapping = other.mapping;
+    mappingHandle = other.mappingHandle;
+    fallback = std::move(other.fallback);
+    other.bytes = nullptr;
+    other.byteCount = 0;
+    other.opened = false;
+    other.mapping = nullptr;
+    other.mappingHandle = nullptr;
+  }
+  return *this;
+}
+
+bool MappedFile::open(const std::string& path) {
+  close();
+
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                            nullptr);
+  if (file != INVALID_HANDLE_VALUE) {
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size)) {
+      byteCount = (size_t)size.QuadPart;
+      opened = true;
+      if (byteCount > 0) {
+        HANDLE handle =
+            CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (handle) {
+          mapping = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+          if (mapping)
+            mappingHandle = handle;
+          else
+            CloseHandle(handle);
+        }
+      }
+    }
+    CloseHandle(file);
+  }
+#elif defined(SPLAT_HAS_MMAP)
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+      byteCount = (size_t)info.st_size;
+      opened = true;
+      if (byteCount > 0) {
+        void* address =
+            mmap(nullptr, byteCount, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED)
+          mapping = address;
+      }
+    }
+    ::close(fd);
+  }
+#endif
+
+  if (mapping) {
+    bytes = static_cast<const uint8_t*>(mapping);
+    return true;
+  }
+  if (opened && byteCount == 0)
+    return true;
+
+  // No mapping, read the whole file
+  std::ifstream stream(path, std::ios::binary | std::ios::ate);
+  if (!stream) {
+    std::cerr << "Error: can't open " << path << std::endl;
+    opened = false;
+    byteCount = 0;
+    return false;
+  }
+  byteCount = (size_t)stream.tellg();
+  fallback.resize(byteCount);
+  stream.seekg(0);
+  if (!stream.read(reinterpret_cast<char*>(fallback.data()), byteCount)) {
+    std::cerr << "Error: can't read " << path << std::endl;
+    fallback.clear();
+    opened = false;
+    byteCount = 0;
+    return false;
+  }
+  bytes = fallback.data();
+  opened = true;
+  return true;
+}
+
+void MappedFile::close() {
+#if defined(_WIN32)
+  if (mapping)
+    UnmapViewOfFile(mapping);
+  if (mappingHandle)
+    CloseHandle((HANDLE)mappingHandle);
+#elif defined(SPLAT_HAS_MMAP)
+  if (mapping)
+    munmap(mapping, byteCount);
+#endif
+  mapping = nullptr;
+  mappingHandle = nullptr;
+  fallback.clear();
+  fallback.shrink_to_fit();
+  bytes = nullptr;
+  byteCount = 0;
+  opened = false;
+}
+
+void MappedFile::prefetch(size_t offset, size_t length) const {
+#if defined(SPLAT_HAS_MMAP)
+  if (!mapping || offset >= byteCount)
+    return;
+  // madvise wants a page aligned start
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t begin = offset / page * page;
+  const size_t end = std::min(byteCount, offset + length);
+  madvise(static_cast<uint8_t*>(mapping) + begin, end - begin, MADV_WILLNEED);
+#else
+  (void)offset;
+  (void)length;
+#endif
+}
@@ -0,0 +1,44 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file. Uses mmap / MapViewOfFile so pages are
+// only read when touched and can be dropped by the OS under memory
+// pressure. Where mapping is not available (Emscripten) or fails, the file
+// is read into memory instead and data() points there.
+class MappedFile {
+ public:
+  MappedFile() {}
+  explicit MappedFile(const std::string& path) { open(path); }
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+
+  bool open(const std::string& path);
+  void close();
+
+  bool isOpen() const { return opened; }
+  bool isMapped() const { return mapping != nullptr; }
+  const uint8_t* data() const { return bytes; }
+  size_t size() const { return byteCount; }
+
+  // Hint that [offset, offset + length) will be read soon.
+  void prefetch(size_t offset, size_t length) const;
+
+ private:
+  const uint8_t* bytes = nullptr;
+  size_t byteCount = 0;
+  bool opened = false;
+  void* mapping = nullptr;
+  void* mappingHandle = nullptr;
+  std::vector<uint8_t> fallback;
+};
+
+#endif
@@ -0,0 +1,625 @@
+#include "shCodebook.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+#include "simd.h"
+#include "timing.h"
+
+// Coefficients 1 to 15 rgb, padded to whole SIMD registers
+static const int kDimensions = 48;
+static const int kUsedDimensions = 45;
+static const uint32_t kMaxCodebookSize = 65536;
+// Vectors per assignment task
+static const size_t kMinVectorsPerTask = 4096;
+// Coarse clusters searched for the final entry of every splat
+static const int kCoarseProbes = 2;
+// Splats per error statistics task, fixed so sums do not depend on threads
+static const size_t kErrorChunk = 16384;
+static const int kErrorDirections = 64;
+
+// |x - c|^2 = |x|^2 + 2 * (|c|^2 / 2 - x.c), only the bracket is needed to
+// compare centroids. scores[j] = halfNorms[j] - x.centroid[j].
+static void scoreCentroidsScalar(const float* x, const float* centroids,
+                                 const float* halfNorms, uint32_t k,
+                                 float* scores) {
+  for (uint32_t j = 0; j < k; j++) {
+    const float* c = centroids + (size_t)j * kDimensions;
+    float dot = 0.0f;
+    for (int d = 0; d < kUsedDimensions; d++)
+      dot += x[d] * c[d];
+    scores[j] = halfNorms[j] - dot;
+  }
+}
+
+#if defined(SPLAT_X86_DISPATCH)
+
+SPLAT_TARGET_AVX2_FMA static void scoreCentroidsAVX2(const float* x,
+                                                     const float* centroids,
+                                                     const float* halfNorms,
+                                                     uint32_t k,
+                                                     float* scores) {
+  __m256 xv[6];
+  for (int r = 0; r < 6; r++)
+    xv[r] = _mm256_loadu_ps(x + 8 * r);
+  for (uint32_t j = 0; j < k; j++) {
+    const float* c = centroids + (size_t)j * kDimensions;
+    // Two chains so the FMA latency overlaps
+    __m256 a = _mm256_mul_ps(xv[0], _mm256_loadu_ps(c));
+    __m256 b = _mm256_mul_ps(xv[1], _mm256_loadu_ps(c + 8));
+    a = _mm256_fmadd_ps(xv[2], _mm256_loadu_ps(c + 16), a);
+    b = _mm256_fmadd_ps(xv[3], _mm256_loadu_ps(c + 24), b);
+    a = _mm256_fmadd_ps(xv[4], _mm256_loadu_ps(c + 32), a);
+    b = _mm256_fmadd_ps(xv[5], _mm256_loadu_ps(c + 40), b);
+    a = _mm256_add_ps(a, b);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(a),
+                          _mm256_extractf128_ps(a, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    scores[j] = halfNorms[j] - _mm_cvtss_f32(s);
+  }
+}
+
+#elif defined(SPLAT_NEON)
+
+static void scoreCentroidsNeon(const float* x, const float* centroids,
+                               const float* halfNorms, uint32_t k,
+                               float* scores) {
+  float32x4_t xv[12];
+  for (int r = 0; r < 12; r++)
+    xv[r] = vld1q_f32(x + 4 * r);
+  for (uint32_t j = 0; j < k; j++) {
+    const float* c = centroids + (size_t)j * kDimensions;
+    float32x4_t a = vmulq_f32(xv[0], vld1q_f32(c));
+    float32x4_t b = vmulq_f32(xv[1], vld1q_f32(c + 4));
+    for (int r = 2; r < 12; r += 2) {
+      a = vmlaq_f32(a, xv[r], vld1q_f32(c + 4 * r));
+      b = vmlaq_f32(b, xv[r + 1], vld1q_f32(c + 4 * r + 4));
+    }
+    a = vaddq_f32(a, b);
+    const float32x2_t s = vadd_f32(vget_low_f32(a), vget_high_f32(a));
+    scores[j] = halfNorms[j] - vget_lane_f32(vpadd_f32(s, s), 0);
+  }
+}
+
+#endif
+
+// Vectors must be padded with zeros to kDimensions.
+static void scoreCentroids(const float* x, const float* centroids,
+                           const float* halfNorms, uint32_t k, float* scores) {
+#if defined(SPLAT_X86_DISPATCH)
+  if (simd::hasFMA())
+    return scoreCentroidsAVX2(x, centroids, halfNorms, k, scores);
+#elif defined(SPLAT_NEON)
+  return scoreCentroidsNeon(x, centroids, halfNorms, k, scores);
+#endif
+  scoreCentroidsScalar(x, centroids, halfNorms, k, scores);
+}
+
+static float squaredNorm(const float* x) {
+  float norm = 0.0f;
+  for (int d = 0; d < kUsedDimensions; d++)
+    norm += x[d] * x[d];
+  return norm;
+}
+
+static void getHalfNorms(const float* centroids, uint32_t k,
+                         std::vector<float>& halfNorms) {
+  halfNorms.resize(k);
+  for (uint32_t j = 0; j < k; j++)
+    halfNorms[j] = 0.5f * squaredNorm(centroids + (size_t)j * kDimensions);
+}
+
+// Groups 0 .. count - 1 by label, in order inside a group: members of
+// group g are sorted[offsets[g] .. offsets[g + 1]).
+static void groupByLabel(const uint32_t* labels, size_t count,
+                         uint32_t groupCount, std::vector<uint32_t>& offsets,
+                         std::vector<uint32_t>& sorted) {
+  offsets.assign(groupCount + 1, 0);
+  for (size_t i = 0; i < count; i++)
+    offsets[labels[i] + 1]++;
+  for (uint32_t g = 0; g < groupCount; g++)
+    offsets[g + 1] += offsets[g];
+  std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+  sorted.resize(count);
+  for (size_t i = 0; i < count; i++)
+    sorted[cursor[labels[i]]++] = (uint32_t)i;
+}
+
+// Moves every centroid with points to their mean, summed in doubles in
+// point order. Returns the number of empty centroids.
+static uint32_t updateCentroids(const float* points, const uint32_t* labels,
+                                size_t count, uint32_t k, float* centroids,
+                                ThreadPool& pool) {
+  std::vector<uint32_t> offsets, sorted;
+  groupByLabel(labels, count, k, offsets, sorted);
+  std::atomic<uint32_t> empty{0};
+  pool.parallelForRange(0, k, 16, [&](size_t first, size_t last) {
+    double sum[kDimensions];
+    for (size_t j = first; j < last; j++) {
+      const uint32_t begin = offsets[j], end = offsets[j + 1];
+      if (begin == end) {
+        empty++;
+        continue;
+      }
+      std::fill(sum, sum + kDimensions, 0.0);
+      for (uint32_t m = begin; m < end; m++) {
+        const float* x = points + (size_t)sorted[m] * kDimensions;
+        for (int d = 0; d < kUsedDimensions; d++)
+          sum[d] += x[d];
+      }
+      float* c = centroids + j * kDimensions;
+      for (int d = 0; d < kUsedDimensions; d++)
+        c[d] = (float)(sum[d] / (end - begin));
+    }
+  });
+  return empty;
+}
+
+// k-means++ seeding: every next centroid is a point picked with
+// probability proportional to its squared distance to the nearest one so
+// far. Plain evenly spread seeds leave small clusters without a centroid.
+static void seedKMeans(const float* points, size_t count, uint32_t k,
+                       const std::vector<float>& halfNorms, uint32_t seed,
+                       float* centroids) {
+  std::mt19937 random(seed);
+  std::vector<float> nearest(count, INFINITY), scores(count);
+  size_t pick = random() % count;
+  for (uint32_t j = 0; j < k; j++) {
+    float* c = centroids + (size_t)j * kDimensions;
+    std::copy_n(points + pick * kDimensions, kDimensions, c);
+    // Scores of every point against c: |p - c|^2 = 2 * score + |c|^2
+    scoreCentroids(c, points, halfNorms.data(), (uint32_t)count,
+                   scores.data());
+    const float norm = squaredNorm(c);
+    double total = 0.0;
+    for (size_t i = 0; i < count; i++) {
+      const float distance = std::max(0.0f, 2.0f * scores[i] + norm);
+      nearest[i] = std::min(nearest[i], distance);
+      total += nearest[i];
+    }
+    if (total <= 0.0) {
+      // Fewer distinct points than centroids, repeat the last one
+      for (uint32_t rest = j + 1; rest < k; rest++)
+        std::copy_n(c, kDimensions, centroids + (size_t)rest * kDimensions);
+      return;
+    }
+    double target = std::uniform_real_distribution<double>(0.0, total)(random);
+    pick = count - 1;
+    for (size_t i = 0; i < count; i++) {
+      target -= nearest[i];
+      if (target < 0.0 && nearest[i] > 0.0f) {
+        pick = i;
+        break;
+      }
+    }
+  }
+}
+
+// Lloyd's k-means over `count` contiguous points, seeded with k-means++.
+// Empty centroids are moved to the points furthest from theirs. Inside a
+// pool task the loops run serially.
+static void runKMeans(const float* points, size_t count, uint32_t k,
+                      int iterations, uint32_t seed, float* centroids,
+                      ThreadPool& pool) {
+  std::vector<float> pointHalfNorms;
+  getHalfNorms(points, (uint32_t)count, pointHalfNorms);
+  seedKMeans(points, count, k, pointHalfNorms, seed, centroids);
+
+  std::vector<uint32_t> labels(count, UINT32_MAX);
+  std::vector<float> distances(count);
+  std::vector<float> halfNorms;
+  for (int iteration = 0; iteration < iterations; iteration++) {
+    getHalfNorms(centroids, k, halfNorms);
+    std::atomic<size_t> changed{0};
+    pool.parallelForRange(0, count, kMinVectorsPerTask,
+                          [&](size_t first, size_t last) {
+      std::vector<float> scores(k);
+      size_t rangeChanged = 0;
+      for (size_t i = first; i < last; i++) {
+        const float* x = points + i * kDimensions;
+        scoreCentroids(x, centroids, halfNorms.data(), k, scores.data());
+        const uint32_t best = (uint32_t)(
+            std::min_element(scores.begin(), scores.end()) - scores.begin());
+        distances[i] = 2.0f * (pointHalfNorms[i] + scores[best]);
+        rangeChanged += labels[i] != best;
+        labels[i] = best;
+      }
+      changed += rangeChanged;
+    });
+    if (changed == 0)
+      break;
+
+    const uint32_t empty =
+        updateCentroids(points, labels.data(), count, k, centroids, pool);
+    if (empty == 0)
+      continue;
+    std::vector<uint32_t> furthest(count);
+    for (size_t i = 0; i < count; i++)
+      furthest[i] = (uint32_t)i;
+    std::partial_sort(furthest.begin(), furthest.begin() + empty,
+                      furthest.end(), [&](uint32_t a, uint32_t b) {
+                        return distances[a] > distances[b] ||
+                               (distances[a] == distances[b] && a < b);
+                      });
+    std::vector<uint32_t> counts(k, 0);
+    for (uint32_t label : labels)
+      counts[label]++;
+    uint32_t next = 0;
+    for (uint32_t j = 0; j < k; j++)
+      if (counts[j] == 0)
+        std::copy_n(points + (size_t)furthest[next++] * kDimensions,
+                    kDimensions, centroids + (size_t)j * kDimensions);
+  }
+}
+
+// Splits `total` entries between groups in proportion to their sizes:
+// every non empty group gets at least one and at most one per member.
+static std::vector<uint32_t> allocateEntries(
+    const std::vector<uint32_t>& offsets, uint32_t total) {
+  const size_t groupCount = offsets.size() - 1;
+  const uint64_t memberCount = offsets.back();
+  std::vector<uint32_t> entries(groupCount, 0);
+  std::vector<double> remainders(groupCount, 0.0);
+  uint32_t allocated = 0;
+  for (size_t g = 0; g < groupCount; g++) {
+    const uint32_t size = offsets[g + 1] - offsets[g];
+    if (size == 0)
+      continue;
+    const double quota = (double)total * size / memberCount;
+    entries[g] = std::min(size, std::max(1u, (uint32_t)quota));
+    remainders[g] = quota - entries[g];
+    allocated += entries[g];
+  }
+  // Largest remainders first, then trim groups that got the most
+  while (allocated < total) {
+    size_t best = groupCount;
+    for (size_t g = 0; g < groupCount; g++)
+      if (entries[g] < offsets[g + 1] - offsets[g] &&
+          (best == groupCount || remainders[g] > remainders[best]))
+        best = g;
+    if (best == groupCount)
+      break;
+    entries[best]++;
+    remainders[best] -= 1.0;
+    allocated++;
+  }
+  while (allocated > total) {
+    const size_t largest =
+        std::max_element(entries.begin(), entries.end()) - entries.begin();
+    if (entries[largest] <= 1)
+      break;
+    entries[largest]--;
+    allocated--;
+  }
+  return entries;
+}
+
+// Copies of at most `limit` vectors, members spread evenly through the
+// list, contiguous for the k-means kernels.
+static std::vector<float> gatherSample(const float* vectors,
+                                       const uint32_t* members,
+                                       size_t memberCount, size_t limit) {
+  const size_t n = std::min(memberCount, limit);
+  std::vector<float> sample(n * kDimensions);
+  for (size_t i = 0; i < n; i++) {
+    const size_t member = members[(uint64_t)i * memberCount / n];
+    std::copy_n(vectors + member * kDimensions, kDimensions,
+                &sample[i * kDimensions]);
+  }
+  return sample;
+}
+
+bool buildShCodebook(const GpuSplat* splats, size_t count, ShCodebook& codebook,
+                     std::vector<uint16_t>& indexes,
+                     const ShCodebookOptions& options, ShCodebookStats* stats,
+                     ThreadPool& pool) {
+  const Clock::time_point start = Clock::now();
+  if (options.codebookSize == 0 || options.codebookSize > kMaxCodebookSize) {
+    std::cerr << "Error: SH codebook size must be in [1, 65536]" << std::endl;
+    return false;
+  }
+  codebook = ShCodebook();
+  indexes.assign(count, 0);
+  if (count == 0)
+    return true;
+
+  std::vector<float> vectors(count * kDimensions, 0.0f);
+  pool.parallelForRange(0, count, kMinVectorsPerTask, [&](size_t first,
+                                                          size_t last) {
+    for (size_t i = first; i < last; i++)
+      for (int k = 1; k < 16; k++)
+        for (int c = 0; c < 3; c++)
+          vectors[i * kDimensions + (k - 1) * 3 + c] = splats[i].sh[k][c];
+  });
+  std::vector<uint32_t> all(count);
+  for (size_t i = 0; i < count; i++)
+    all[i] = (uint32_t)i;
+
+  const uint32_t size = (uint32_t)std::min<size_t>(options.codebookSize, count);
+  const uint32_t coarseCount = std::max(
+      1u, std::min(size, (uint32_t)std::lround(std::sqrt((double)size))));
+  const size_t samplesPerEntry = std::max(1u, options.samplesPerEntry);
+
+  // Coarse clusters, trained on a sample
+  std::vector<float> coarse((size_t)coarseCount * kDimensions, 0.0f);
+  {
+    const std::vector<float> sample = gatherSample(
+        vectors.data(), all.data(), count, samplesPerEntry * coarseCount);
+    runKMeans(sample.data(), sample.size() / kDimensions, coarseCount,
+              options.iterations, options.seed, coarse.data(), pool);
+  }
+
+  // Every splat's nearest coarse clusters, best first
+  const int probes = (int)std::min<uint32_t>(kCoarseProbes, coarseCount);
+  std::vector<uint32_t> nearest(count * kCoarseProbes);
+  std::vector<float> coarseHalfNorms;
+  getHalfNorms(coarse.data(), coarseCount, coarseHalfNorms);
+  pool.parallelForRange(0, count, kMinVectorsPerTask, [&](size_t first,
+                                                          size_t last) {
+    std::vector<float> scores(coarseCount);
+    std::vector<uint32_t> order(coarseCount);
+    for (size_t i = first; i < last; i++) {
+      scoreCentroids(&vectors[i * kDimensions], coarse.data(),
+                     coarseHalfNorms.data(), coarseCount, scores.data());
+      for (uint32_t j = 0; j < coarseCount; j++)
+        order[j] = j;
+      std::partial_sort(order.begin(), order.begin() + probes, order.end(),
+                        [&](uint32_t a, uint32_t b) {
+                          return scores[a] < scores[b] ||
+                                 (scores[a] == scores[b] && a < b);
+                        });
+      for (int p = 0; p < kCoarseProbes; p++)
+        nearest[i * kCoarseProbes + p] = order[std::min(p, probes - 1)];
+    }
+  });
+
+  // Entries of every coarse cluster, trained on a sample of its members
+  std::vector<uint32_t> coarseOf(count);
+  for (size_t i = 0; i < count; i++)
+    coarseOf[i] = nearest[i * kCoarseProbes];
+  std::vector<uint32_t> offsets, grouped;
+  groupByLabel(coarseOf.data(), count, coarseCount, offsets, grouped);
+  const std::vector<uint32_t> entryCounts = allocateEntries(offsets, size);
+  std::vector<uint32_t> entryOffsets(coarseCount + 1, 0);
+  for (uint32_t g = 0; g < coarseCount; g++)
+    entryOffsets[g + 1] = entryOffsets[g] + entryCounts[g];
+  const uint32_t entryCount = entryOffsets[coarseCount];
+  std::vector<float> entries((size_t)entryCount * kDimensions, 0.0f);
+  pool.parallelFor(coarseCount, [&](size_t g) {
+    if (entryCounts[g] == 0)
+      return;
+    const std::vector<float> sample = gatherSample(
+        vectors.data(), &grouped[offsets[g]], offsets[g + 1] - offsets[g],
+        samplesPerEntry * entryCounts[g]);
+    runKMeans(sample.data(), sample.size() / kDimensions, entryCounts[g],
+              options.iterations, options.seed + 1 + (uint32_t)g,
+              &entries[entryOffsets[g] * kDimensions], pool);
+  });
+  const double trainMs = msSince(start);
+
+  // Nearest entry among those of the nearest coarse clusters
+  const Clock::time_point assignStart = Clock::now();
+  std::vector<float> halfNorms;
+  getHalfNorms(entries.data(), entryCount, halfNorms);
+  std::vector<uint32_t> labels(count);
+  pool.parallelForRange(0, count, kMinVectorsPerTask, [&](size_t first,
+                                                          size_t last) {
+    std::vector<float> scores;
+    for (size_t i = first; i < last; i++) {
+      float bestScore = INFINITY;
+      uint32_t best = 0;
+      for (int p = 0; p < probes; p++) {
+        const uint32_t g = nearest[i * kCoarseProbes + p];
+        const uint32_t begin = entryOffsets[g], n = entryCounts[g];
+        scores.resize(n);
+        scoreCentroids(&vectors[i * kDimensions],
+                       &entries[(size_t)begin * kDimensions],
+                       &halfNorms[begin], n, scores.data());
+        for (uint32_t j = 0; j < n; j++)
+          if (scores[j] < bestScore) {
+            bestScore = scores[j];
+            best = begin + j;
+          }
+      }
+      labels[i] = best;
+      indexes[i] = (uint16_t)best;
+    }
+  });
+  // Entries were trained on samples, settle them on everything they got
+  updateCentroids(vectors.data(), labels.data(), count, entryCount,
+                  entries.data(), pool);
+
+  codebook.size = entryCount;
+  codebook.entries.assign((size_t)entryCount * ShCodebook::EntryFloats, 0.0f);
+  for (uint32_t j = 0; j < entryCount; j++)
+    for (int k = 0; k < 15; k++)
+      for (int c = 0; c < 3; c++)
+        codebook.entries[((size_t)j * 15 + k) * 4 + c] =
+            entries[(size_t)j * kDimensions + k * 3 + c];
+
+  if (stats) {
+    stats->codebookSize = entryCount;
+    stats->trainMs = trainMs;
+    stats->assignMs = msSince(assignStart);
+    stats->ms = msSince(start);
+  }
+  return true;
+}
+
+// Directions evenly spread on the sphere (Fibonacci lattice) and the SH
+// basis of get_rgb() in shader.vs for each, coefficients 1 to 15.
+static void getErrorBasis(float basis[kErrorDirections][15]) {
+  static const float C1 = 0.4886025119029199f;
+  static const float C2[5] = {1.0925484305920792f, -1.0925484305920792f,
+                              0.31539156525252005f, -1.0925484305920792f,
+                              0.5462742152960396f};
+  static const float C3[7] = {-0.5900435899266435f, 2.890611442640554f,
+                              -0.4570457994644658f, 0.3731763325901154f,
+                              -0.4570457994644658f, 1.445305721320277f,
+                              -0.5900435899266435f};
+  const double golden = std::acos(-1.0) * (3.0 - std::sqrt(5.0));
+  for (int i = 0; i < kErrorDirections; i++) {
+    const double z = 1.0 - (2.0 * i + 1.0) / kErrorDirections;
+    const double r = std::sqrt(1.0 - z * z);
+    const float x = (float)(r * std::cos(golden * i));
+    const float y = (float)(r * std::sin(golden * i));
+    const float zf = (float)z;
+    const float xx = x * x, yy = y * y, zz = zf * zf;
+    float* b = basis[i];
+    b[0] = -C1 * y;
+    b[1] = C1 * zf;
+    b[2] = -C1 * x;
+    b[3] = C2[0] * x * y;
+    b[4] = C2[1] * y * zf;
+    b[5] = C2[2] * (2.0f * zz - xx - yy);
+    b[6] = C2[3] * x * zf;
+    b[7] = C2[4] * (xx - yy);
+    b[8] = C3[0] * y * (3.0f * xx - yy);
+    b[9] = C3[1] * zf * x * y;
+    b[10] = C3[2] * y * (4.0f * zz - xx - yy);
+    b[11] = C3[3] * zf * (2.0f * zz - 3.0f * xx - 3.0f * yy);
+    b[12] = C3[4] * x * (4.0f * zz - xx - yy);
+    b[13] = C3[5] * zf * (xx - yy);
+    b[14] = C3[6] * x * (xx - 3.0f * yy);
+  }
+}
+
+// `difference(i, diff)` writes the coefficient errors of splat i,
+// diff[k][c] for coefficient k + 1.
+template <typename Difference>
+static ShErrorStats computeShError(size_t count, ThreadPool& pool,
+                                   const Difference& difference) {
+  ShErrorStats result;
+  if (count == 0)
+    return result;
+  float basis[kErrorDirections][15];
+  getErrorBasis(basis);
+
+  struct Partial {
+    double coefficient = 0.0;
+    double color = 0.0;
+    float max = 0.0f;
+  };
+  const size_t chunkCount = (count + kErrorChunk - 1) / kErrorChunk;
+  std::vector<Partial> partial(chunkCount);
+  pool.parallelFor(chunkCount, [&](size_t chunk) {
+    Partial& sums = partial[chunk];
+    const size_t end = std::min(count, (chunk + 1) * kErrorChunk);
+    float diff[15][3];
+    for (size_t i = chunk * kErrorChunk; i < end; i++) {
+      difference(i, diff);
+      for (int k = 0; k < 15; k++)
+        for (int c = 0; c < 3; c++) {
+          sums.coefficient += (double)diff[k][c] * diff[k][c];
+          sums.max = std::max(sums.max, std::fabs(diff[k][c]));
+        }
+      for (int d = 0; d < kErrorDirections; d++) {
+        float rgb[3] = {0.0f, 0.0f, 0.0f};
+        for (int k = 0; k < 15; k++)
+          for (int c = 0; c < 3; c++)
+            rgb[c] += basis[d][k] * diff[k][c];
+        for (int c = 0; c < 3; c++)
+          sums.color += (double)rgb[c] * rgb[c];
+      }
+    }
+  });
+  double coefficient = 0.0, color = 0.0;
+  for (const Partial& sums : partial) {
+    coefficient += sums.coefficient;
+    color += sums.color;
+    result.coefficientMaxError = std::max(result.coefficientMaxError, sums.max);
+  }
+  result.coefficientRmse = std::sqrt(coefficient / (count * 45.0));
+  result.colorRmse =
+      std::sqrt(color / ((double)count * kErrorDirections * 3.0));
+  result.colorPsnr = result.colorRmse > 0.0
+                         ? -20.0 * std::log10(result.colorRmse)
+                         : INFINITY;
+  return result;
+}
+
+bool compressSplatSh(const GpuSplat* splats, size_t count,
+                     std::vector<CodebookSplat>& compressed,
+                     ShCodebook& codebook, const ShCodebookOptions& options,
+                     ShCodebookStats* stats, ThreadPool& pool) {
+  const Clock::time_point start = Clock::now();
+  std::vector<uint16_t> indexes;
+  if (!buildShCodebook(splats, count, codebook, indexes, options, stats, pool))
+    return false;
+
+  compressed.resize(count);
+  pool.parallelForRange(0, count, kMinVectorsPerTask, [&](size_t first,
+                                                          size_t last) {
+    for (size_t i = first; i < last; i++) {
+      const GpuSplat& splat = splats[i];
+      CodebookSplat& out = compressed[i];
+      for (int c = 0; c < 3; c++) {
+        out.center[c] = splat.center[c];
+        out.covA[c] = splat.covA[c];
+        out.covB[c] = splat.covB[c];
+        out.dc[c] = splat.sh[0][c];
+      }
+      out.alpha = splat.alpha;
+      out.shIndex = indexes[i];
+      out.padding0 = 0.0f;
+      out.padding1 = 0.0f;
+    }
+  });
+
+  if (stats) {
+    stats->error = computeShError(count, pool, [&](size_t i,
+                                                   float diff[15][3]) {
+      const float* entry =
+          &codebook.entries[(size_t)indexes[i] * ShCodebook::EntryFloats];
+      for (int k = 0; k < 15; k++)
+        for (int c = 0; c < 3; c++)
+          diff[k][c] = entry[k * 4 + c] - splats[i].sh[k + 1][c];
+    });
+    stats->compressionRatio =
+        count * (double)sizeof(GpuSplat) /
+        (count * (double)sizeof(CodebookSplat) +
+         codebook.entries.size() * sizeof(float));
+    stats->ms = msSince(start);
+  }
+  return true;
+}
+
+void decompressSplatSh(const CodebookSplat* compressed, size_t count,
+                       const ShCodebook& codebook, GpuSplat* splats,
+                       ThreadPool& pool) {
+  pool.parallelForRange(0, count, kMinVectorsPerTask, [&](size_t first,
+                                                          size_t last) {
+    for (size_t i = first; i < last; i++) {
+      const CodebookSplat& in = compressed[i];
+      GpuSplat& out = splats[i];
+      const float* entry =
+          &codebook.entries[(size_t)in.shIndex * ShCodebook::EntryFloats];
+      for (int c = 0; c < 3; c++) {
+        out.center[c] = in.center[c];
+        out.covA[c] = in.covA[c];
+        out.covB[c] = in.covB[c];
+        out.sh[0][c] = in.dc[c];
+      }
+      out.alpha = in.alpha;
+      out.padding0 = 0.0f;
+      out.padding1 = 0.0f;
+      out.sh[0][3] = 0.0f;
+      for (int k = 1; k < 16; k++)
+        for (int c = 0; c < 4; c++)
+          out.sh[k][c] = entry[(k - 1) * 4 + c];
+    }
+  });
+}
+
+ShErrorStats compareSplatSh(const GpuSplat* reference, const GpuSplat* splats,
+                            size_t count, ThreadPool& pool) {
+  return computeShError(count, pool, [&](size_t i, float diff[15][3]) {
+    for (int k = 0; k < 15; k++)
+      for (int c = 0; c < 3; c++)
+        diff[k][c] = splats[i].sh[k + 1][c] - reference[i].sh[k + 1][c];
+  });
+}
@@ -0,0 +1,99 @@
+#ifndef SHCODEBOOK_H
+#define SHCODEBOOK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "gpuSplat.h"
+#include "threadPool.h"
+
+// A splat whose SH coefficients 1 to 15 are replaced by a codebook entry,
+// read by shader/shader.vs when SH_CODEBOOK is defined. 64 bytes against
+// the 304 of GpuSplat, std430 layout.
+struct CodebookSplat {
+  float center[3];
+  float alpha;
+  float covA[3];     // xx, xy, xz
+  uint32_t shIndex;  // codebook entry, below 65536
+  float covB[3];     // yy, yz, zz
+  float padding0;
+  float dc[3];  // sh[0]
+  float padding1;
+};
+
+static_assert(sizeof(CodebookSplat) == 64,
+              "CodebookSplat must match the std430 CodebookSplat");
+
+// Shared SH coefficients, the sh_codebook SSBO: entry i holds coefficients
+// 1 to 15 as rgb + padding, entries[(i * 15 + k - 1) * 4 + c].
+struct ShCodebook {
+  static const int EntryFloats = 60;
+  uint32_t size = 0;
+  std::vector<float> entries;
+};
+
+struct ShCodebookOptions {
+  // Entries, at most 65536 so indexes fit 16 bits
+  uint32_t codebookSize = 4096;
+  // Lloyd iterations of every k-means, fewer when assignments settle
+  int iterations = 10;
+  // Training points per entry, the rest of the splats are only assigned
+  uint32_t samplesPerEntry = 64;
+  // k-means++ seeding, the same seed gives the same codebook
+  uint32_t seed = 1;
+};
+
+// Reconstruction error of SH coefficients 1 to 15.
+struct ShErrorStats {
+  double coefficientRmse = 0.0;
+  float coefficientMaxError = 0.0f;
+  // RMS of the view dependent color change, 0 to 1 units before clamping,
+  // over 64 directions evenly spread on the sphere, and its PSNR in dB.
+  double colorRmse = 0.0;
+  double colorPsnr = 0.0;
+};
+
+struct ShCodebookStats {
+  uint32_t codebookSize = 0;
+  ShErrorStats error;
+  // GpuSplat bytes over CodebookSplat plus codebook bytes
+  double compressionRatio = 0.0;
+  double trainMs = 0.0;
+  double assignMs = 0.0;
+  double ms = 0.0;
+};
+
+// Clusters the 45 higher order coefficients of every splat and picks an
+// entry for each. A full k-means over millions of 45-dimensional vectors
+// is too slow on the CPU, so the clustering is two level: about
+// sqrt(codebookSize) coarse clusters first, then every coarse cluster is
+// split into entries in proportion to its population, coarse clusters in
+// parallel. Both levels are seeded with k-means++ and trained on samples.
+// Every splat then takes the nearest entry of its two nearest coarse
+// clusters, and entries move to the mean of what they were given.
+// Distances use SIMD kernels; results do not depend on the thread count.
+bool buildShCodebook(const GpuSplat* splats, size_t count, ShCodebook& codebook,
+                     std::vector<uint16_t>& indexes,
+                     const ShCodebookOptions& options = ShCodebookOptions(),
+                     ShCodebookStats* stats = nullptr,
+                     ThreadPool& pool = ThreadPool::shared());
+
+// buildShCodebook() and the CodebookSplat records, with error metrics.
+bool compressSplatSh(const GpuSplat* splats, size_t count,
+                     std::vector<CodebookSplat>& compressed,
+                     ShCodebook& codebook,
+                     const ShCodebookOptions& options = ShCodebookOptions(),
+                     ShCodebookStats* stats = nullptr,
+                     ThreadPool& pool = ThreadPool::shared());
+
+// Back to shader.vs records, same math as the shader.
+void decompressSplatSh(const CodebookSplat* compressed, size_t count,
+                       const ShCodebook& codebook, GpuSplat* splats,
+                       ThreadPool& pool = ThreadPool::shared());
+
+ShErrorStats compareSplatSh(const GpuSplat* reference, const GpuSplat* splats,
+                            size_t count,
+                            ThreadPool& pool = ThreadPool::shared());
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Instruction set selection shared by the hot loops (sort, decode, culling).
+//
+// On GCC/Clang x86 builds the wide kernels are compiled with per-function
+// target attributes and picked at runtime, so a default build still uses AVX2
+// on machines that have it. Other compilers only get what the build flags
+// enable. WASM SIMD is used when building with -msimd128.
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define SPLAT_X86_DISPATCH 1
+#include <immintrin.h>
+#define SPLAT_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define SPLAT_TARGET_AVX2 __attribute__((target("avx2")))
+#define SPLAT_TARGET_AVX2_FMA __attribute__((target("avx2,fma")))
+#define SPLAT_TARGET_F16C __attribute__((target("avx2,f16c")))
+#define SPLAT_TARGET_AVX512 __attribute__((target("avx512f")))
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+#if defined(__wasm_simd128__)
+#define SPLAT_WASM_SIMD 1
+#include <wasm_simd128.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SPLAT_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace simd {
+
+inline bool hasSSE41() {
+#if defined(SPLAT_X86_DISPATCH)
+  static const bool supported = __builtin_cpu_supports("sse4.1");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+inline bool hasAVX2() {
+#if defined(SPLAT_X86_DISPATCH)
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+inline bool hasFMA() {
+#if defined(SPLAT_X86_DISPATCH)
+  static const bool supported =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+// F16C kernels are compiled together with AVX2, see SPLAT_TARGET_F16C.
+inline bool hasF16C() {
+#if defined(SPLAT_X86_DISPATCH)
+  static const bool supported =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+// Only the AVX-512 foundation instructions, 16 floats per register.
+inline bool hasAVX512F() {
+#if defined(SPLAT_X86_DISPATCH)
+  static const bool supported = __builtin_cpu_supports("avx512f");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+}  // namespace simd
+
+#endif
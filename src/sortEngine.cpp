@@ -0,0 +1,507 @@
+#include "sortEngine.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#include "simd.h"
+#include "timing.h"
+
+
+static size_t taskCountFor(ThreadPool& pool, uint32_t count) {
+  return std::max<size_t>(
+      1, std::min<size_t>(pool.getThreadCount(),
+                          count / ThreadPool::kDefaultGrain));
+}
+
+static glm::vec3 viewDirection(const int* viewProj) {
+  const glm::vec3 direction((float)viewProj[2], (float)viewProj[6],
+                            (float)viewProj[10]);
+  const float length = glm::length(direction);
+  return length > 0.0f ? direction / length : direction;
+}
+
+static void computeSplatDepthsScalar(const uint32_t* indexes,
+                                     const int* positions, const int* viewProj,
+                                     int* depths, uint32_t begin, uint32_t end,
+                                     int& minDepth, int& maxDepth) {
+  const int vx = viewProj[2], vy = viewProj[6], vz = viewProj[10];
+  int lo = minDepth, hi = maxDepth;
+  for (uint32_t i = begin; i < end; i++) {
+    const int* p = positions + 3 * indexes[i];
+    const int depth = vx * p[0] + vy * p[1] + vz * p[2];
+    depths[i] = depth;
+    lo = std::min(lo, depth);
+    hi = std::max(hi, depth);
+  }
+  minDepth = lo;
+  maxDepth = hi;
+}
+
+#if defined(SPLAT_X86_DISPATCH)
+
+SPLAT_TARGET_AVX2 static void computeSplatDepthsAVX2(
+    const uint32_t* indexes, const int* positions, const int* viewProj,
+    int* depths, uint32_t begin, uint32_t end, int& minDepth, int& maxDepth) {
+  const __m256i vx = _mm256_set1_epi32(viewProj[2]);
+  const __m256i vy = _mm256_set1_epi32(viewProj[6]);
+  const __m256i vz = _mm256_set1_epi32(viewProj[10]);
+  __m256i lo = _mm256_set1_epi32(minDepth);
+  __m256i hi = _mm256_set1_epi32(maxDepth);
+
+  uint32_t i = begin;
+  for (; i + 8 <= end; i += 8) {
+    const __m256i index =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indexes + i));
+    const __m256i base =
+        _mm256_add_epi32(index, _mm256_add_epi32(index, index));
+    const __m256i px = _mm256_i32gather_epi32(positions, base, 4);
+    const __m256i py = _mm256_i32gather_epi32(positions + 1, base, 4);
+    const __m256i pz = _mm256_i32gather_epi32(positions + 2, base, 4);
+    const __m256i depth = _mm256_add_epi32(
+        _mm256_add_epi32(_mm256_mullo_epi32(px, vx), _mm256_mullo_epi32(py, vy)),
+        _mm256_mullo_epi32(pz, vz));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(depths + i), depth);
+    lo = _mm256_min_epi32(lo, depth);
+    hi = _mm256_max_epi32(hi, depth);
+  }
+
+  alignas(32) int los[8], his[8];
+  _mm256_store_si256(reinterpret_cast<__m256i*>(los), lo);
+  _mm256_store_si256(reinterpret_cast<__m256i*>(his), hi);
+  for (int k = 0; k < 8; k++) {
+    minDepth = std::min(minDepth, los[k]);
+    maxDepth = std::max(maxDepth, his[k]);
+  }
+  computeSplatDepthsScalar(indexes, positions, viewProj, depths, i, end,
+                           minDepth, maxDepth);
+}
+
+SPLAT_TARGET_SSE41 static void computeSplatDepthsSSE41(
+    const uint32_t* indexes, const int* positions, const int* viewProj,
+    int* depths, uint32_t begin, uint32_t end, int& minDepth, int& maxDepth) {
+  const __m128i vx = _mm_set1_epi32(viewProj[2]);
+  const __m128i vy = _mm_set1_epi32(viewProj[6]);
+  const __m128i vz = _mm_set1_epi32(viewProj[10]);
+  __m128i lo = _mm_set1_epi32(minDepth);
+  __m128i hi = _mm_set1_epi32(maxDepth);
+
+  uint32_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    const int* p0 = positions + 3 * indexes[i];
+    const int* p1 = positions + 3 * indexes[i + 1];
+    const int* p2 = positions + 3 * indexes[i + 2];
+    const int* p3 = positions + 3 * indexes[i + 3];
+    const __m128i px = _mm_setr_epi32(p0[0], p1[0], p2[0], p3[0]);
+    const __m128i py = _mm_setr_epi32(p0[1], p1[1], p2[1], p3[1]);
+    const __m128i pz = _mm_setr_epi32(p0[2], p1[2], p2[2], p3[2]);
+    const __m128i depth = _mm_add_epi32(
+        _mm_add_epi32(_mm_mullo_epi32(px, vx), _mm_mullo_epi32(py, vy)),
+        _mm_mullo_epi32(pz, vz));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(depths + i), depth);
+    lo = _mm_min_epi32(lo, depth);
+    hi = _mm_max_epi32(hi, depth);
+  }
+
+  alignas(16) int los[4], his[4];
+  _mm_store_si128(reinterpret_cast<__m128i*>(los), lo);
+  _mm_store_si128(reinterpret_cast<__m128i*>(his), hi);
+  for (int k = 0; k < 4; k++) {
+    minDepth = std::min(minDepth, los[k]);
+    maxDepth = std::max(maxDepth, his[k]);
+  }
+  computeSplatDepthsScalar(indexes, positions, viewProj, depths, i, end,
+                           minDepth, maxDepth);
+}
+
+#elif defined(SPLAT_WASM_SIMD)
+
+static void computeSplatDepthsWasm(const uint32_t* indexes,
+                                   const int* positions, const int* viewProj,
+                                   int* depths, uint32_t begin, uint32_t end,
+                                   int& minDepth, int& maxDepth) {
+  const v128_t vx = wasm_i32x4_splat(viewProj[2]);
+  const v128_t vy = wasm_i32x4_splat(viewProj[6]);
+  const v128_t vz = wasm_i32x4_splat(viewProj[10]);
+  v128_t lo = wasm_i32x4_splat(minDepth);
+  v128_t hi = wasm_i32x4_splat(maxDepth);
+
+  uint32_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    const int* p0 = positions + 3 * indexes[i];
+    const int* p1 = positions + 3 * indexes[i + 1];
+    const int* p2 = positions + 3 * indexes[i + 2];
+    const int* p3 = positions + 3 * indexes[i + 3];
+    const v128_t px = wasm_i32x4_make(p0[0], p1[0], p2[0], p3[0]);
+    const v128_t py = wasm_i32x4_make(p0[1], p1[1], p2[1], p3[1]);
+    const v128_t pz = wasm_i32x4_make(p0[2], p1[2], p2[2], p3[2]);
+    const v128_t depth =
+        wasm_i32x4_add(wasm_i32x4_add(wasm_i32x4_mul(px, vx),
+                                      wasm_i32x4_mul(py, vy)),
+                       wasm_i32x4_mul(pz, vz));
+    wasm_v128_store(depths + i, depth);
+    lo = wasm_i32x4_min(lo, depth);
+    hi = wasm_i32x4_max(hi, depth);
+  }
+
+  int los[4], his[4];
+  wasm_v128_store(los, lo);
+  wasm_v128_store(his, hi);
+  for (int k = 0; k < 4; k++) {
+    minDepth = std::min(minDepth, los[k]);
+    maxDepth = std::max(maxDepth, his[k]);
+  }
+  computeSplatDepthsScalar(indexes, positions, viewProj, depths, i, end,
+                           minDepth, maxDepth);
+}
+
+#endif
+
+void computeSplatDepths(const uint32_t* indexes, const int* positions,
+                        const int* viewProj, int* depths, uint32_t begin,
+                        uint32_t end, int& minDepth, int& maxDepth) {
+#if defined(SPLAT_X86_DISPATCH)
+  if (simd::hasAVX2())
+    return computeSplatDepthsAVX2(indexes, positions, viewProj, depths, begin,
+                                  end, minDepth, maxDepth);
+  if (simd::hasSSE41())
+    return computeSplatDepthsSSE41(indexes, positions, viewProj, depths,
+                                   begin, end, minDepth, maxDepth);
+#elif defined(SPLAT_WASM_SIMD)
+  return computeSplatDepthsWasm(indexes, positions, viewProj, depths, begin,
+                                end, minDepth, maxDepth);
+#endif
+  computeSplatDepthsScalar(indexes, positions, viewProj, depths, begin, end,
+                           minDepth, maxDepth);
+}
+
+SortEngine::SortEngine(ThreadPool& pool) : pool(pool) {}
+
+SortEngine& SortEngine::shared() {
+  static SortEngine engine;
+  return engine;
+}
+
+void SortEngine::sort(const uint32_t* indexes, const int* positions,
+                      const int* viewProj, uint32_t* indexesOut,
+                      uint32_t distanceMapRange, uint32_t sortCount,
+                      uint32_t renderCount) {
+  const Clock::time_point sortStart = Clock::now();
+  timings = SortTimings();
+
+  for (uint32_t i = sortCount; i < renderCount; i++)
+    indexesOut[i] = indexes[i];
+
+  if (sortCount == 0 || distanceMapRange == 0) {
+    timings.total = msSince(sortStart);
+    return;
+  }
+
+  const size_t chunks = taskCountFor(pool, sortCount);
+  const uint32_t chunkSize = (sortCount + chunks - 1) / chunks;
+  auto chunkBegin = [&](size_t c) {
+    return std::min<uint32_t>(sortCount, c * chunkSize);
+  };
+  auto chunkEnd = [&](size_t c) {
+    return std::min<uint32_t>(sortCount, (c + 1) * chunkSize);
+  };
+
+  if (distances.size() < sortCount)
+    distances.resize(sortCount);
+  chunkMin.assign(chunks, INT_MAX);
+  chunkMax.assign(chunks, INT_MIN);
+
+  // 1. Depths
+  Clock::time_point phase = Clock::now();
+  pool.parallelFor(chunks, [&](size_t c) {
+    computeSplatDepths(indexes, positions, viewProj, distances.data(),
+                       chunkBegin(c), chunkEnd(c), chunkMin[c], chunkMax[c]);
+  });
+  const int minDistance = *std::min_element(chunkMin.begin(), chunkMin.end());
+  const int maxDistance = *std::max_element(chunkMax.begin(), chunkMax.end());
+  timings.depth = msSince(phase);
+
+  countingSort(indexes, indexesOut, distanceMapRange, sortCount, minDistance,
+               maxDistance);
+  timings.total = msSince(sortStart);
+}
+
+// Phases 2 to 4 of the sort, for depths already in `distances` (in the order
+// of `input`).
+void SortEngine::countingSort(const uint32_t* input, uint32_t* indexesOut,
+                              uint32_t distanceMapRange, uint32_t sortCount,
+                              int minDistance, int maxDistance) {
+  const size_t chunks = taskCountFor(pool, sortCount);
+  const uint32_t chunkSize = (sortCount + chunks - 1) / chunks;
+  auto chunkBegin = [&](size_t c) {
+    return std::min<uint32_t>(sortCount, c * chunkSize);
+  };
+  auto chunkEnd = [&](size_t c) {
+    return std::min<uint32_t>(sortCount, (c + 1) * chunkSize);
+  };
+
+  if (bucketOf.size() < sortCount)
+    bucketOf.resize(sortCount);
+  histograms.resize(chunks * distanceMapRange);
+  lastMinDistance = minDistance;
+  lastMaxDistance = maxDistance;
+
+  // 2. Per chunk histograms. The bucket of each splat is kept so the scatter
+  // does not have to map it again.
+  Clock::time_point phase = Clock::now();
+  const float distancesRange = (float)maxDistance - (float)minDistance;
+  const float rangeMap =
+      distancesRange > 0.0f ? (float)(distanceMapRange - 1) / distancesRange
+                            : 0.0f;
+  pool.parallelFor(chunks, [&](size_t c) {
+    uint32_t* frequencies = histograms.data() + c * distanceMapRange;
+    std::memset(frequencies, 0, distanceMapRange * sizeof(uint32_t));
+    for (uint32_t i = chunkBegin(c); i < chunkEnd(c); i++) {
+      const uint32_t bucket =
+          (uint32_t)(((float)distances[i] - (float)minDistance) * rangeMap);
+      bucketOf[i] = bucket;
+      frequencies[bucket]++;
+    }
+  });
+  timings.histogram = msSince(phase);
+
+  // 3. Exclusive prefix sum in (bucket, chunk) order: column totals per block
+  // of buckets, a serial scan over the block totals, then each block writes
+  // its starting offsets.
+  phase = Clock::now();
+  const size_t blocks = std::max<size_t>(
+      1, std::min<size_t>(pool.getThreadCount(), distanceMapRange / 4096));
+  const uint32_t blockSize = (distanceMapRange + blocks - 1) / blocks;
+  blockSums.assign(blocks + 1, 0);
+  pool.parallelFor(blocks, [&](size_t b) {
+    const uint32_t end = std::min<uint32_t>(distanceMapRange, (b + 1) * blockSize);
+    uint32_t sum = 0;
+    for (uint32_t bucket = b * blockSize; bucket < end; bucket++)
+      for (size_t c = 0; c < chunks; c++)
+        sum += histograms[c * distanceMapRange + bucket];
+    blockSums[b + 1] = sum;
+  });
+  for (size_t b = 1; b <= blocks; b++)
+    blockSums[b] += blockSums[b - 1];
+  pool.parallelFor(blocks, [&](size_t b) {
+    const uint32_t end = std::min<uint32_t>(distanceMapRange, (b + 1) * blockSize);
+    uint32_t running = blockSums[b];
+    for (uint32_t bucket = b * blockSize; bucket < end; bucket++)
+      for (size_t c = 0; c < chunks; c++) {
+        uint32_t& frequency = histograms[c * distanceMapRange + bucket];
+        const uint32_t count = frequency;
+        frequency = running;
+        running += count;
+      }
+  });
+  timings.prefixSum = msSince(phase);
+
+  // 4. Scatter
+  phase = Clock::now();
+  pool.parallelFor(chunks, [&](size_t c) {
+    uint32_t* offsets = histograms.data() + c * distanceMapRange;
+    for (uint32_t i = chunkBegin(c); i < chunkEnd(c); i++)
+      indexesOut[offsets[bucketOf[i]]++] = input[i];
+  });
+  timings.scatter = msSince(phase);
+}
+
+SortPath SortEngine::sortCoherent(const uint32_t* indexes, const int* positions,
+                                  const int* viewProj, uint32_t* indexesOut,
+                                  uint32_t distanceMapRange, uint32_t sortCount,
+                                  uint32_t renderCount,
+                                  const glm::vec3& cameraPosition) {
+  const Clock::time_point sortStart = Clock::now();
+  const glm::vec3 direction = viewDirection(viewProj);
+  const CoherentSortSettings& settings = coherentSettings;
+
+  SortPath path = SortPath::Full;
+  if (previousValid && indexes == previousIndexes &&
+      positions == previousPositions && sortCount == previousSortCount &&
+      renderCount == previousRenderCount &&
+      distanceMapRange == previousRange) {
+    // atan2 keeps its precision for tiny angles, unlike acos(dot).
+    const float angle =
+        std::atan2(glm::length(glm::cross(direction, previousDirection)),
+                   glm::dot(direction, previousDirection));
+    const float distance = glm::distance(cameraPosition, previousCamera);
+    if (angle <= settings.skipAngle && distance <= settings.skipDistance)
+      path = SortPath::Skipped;
+    else if (angle <= settings.fixUpAngle &&
+             distance <= settings.fixUpDistance)
+      path = SortPath::FixUp;
+  }
+
+  if (path != SortPath::Full) {
+    timings = SortTimings();
+    for (uint32_t i = sortCount; i < renderCount; i++)
+      indexesOut[i] = indexes[i];
+  }
+
+  if (path == SortPath::Skipped) {
+    std::memcpy(indexesOut, previousOrder.data(),
+                sortCount * sizeof(uint32_t));
+  } else if (path == SortPath::FixUp &&
+             !fixUpLikely(positions, viewProj, sortCount)) {
+    sort(indexes, positions, viewProj, indexesOut, distanceMapRange,
+         sortCount, renderCount);
+    path = SortPath::Full;
+  } else if (path == SortPath::FixUp) {
+    const Clock::time_point phase = Clock::now();
+    int minDistance, maxDistance;
+    const bool repaired = fixUp(positions, viewProj, indexesOut,
+                                distanceMapRange, sortCount, minDistance,
+                                maxDistance);
+    timings.fixUp = msSince(phase);
+    if (!repaired) {
+      // The depths of the previous order are still valid, sorting that
+      // order instead of `indexes` gives the same result without computing
+      // them again.
+      countingSort(previousOrder.data(), indexesOut, distanceMapRange,
+                   sortCount, minDistance, maxDistance);
+      path = SortPath::Full;
+    }
+  } else {
+    sort(indexes, positions, viewProj, indexesOut, distanceMapRange,
+         sortCount, renderCount);
+  }
+
+  if (path != SortPath::Skipped) {
+    previousOrder.assign(indexesOut, indexesOut + sortCount);
+    previousDirection = direction;
+    previousCamera = cameraPosition;
+  }
+  previousValid = true;
+  previousIndexes = indexes;
+  previousPositions = positions;
+  previousSortCount = sortCount;
+  previousRenderCount = renderCount;
+  previousRange = distanceMapRange;
+
+  lastPath = path;
+  pathCounts[(int)path]++;
+  timings.total = msSince(sortStart);
+  return path;
+}
+
+// Cheap estimate of the insertion sort cost: counts inversions inside a few
+// short windows of the previous order under the new camera, bucketed with the
+// depth range of the last sort. Depths are gathered in sorted order, which is
+// all cache misses, so a hopeless fix-up is better rejected here than after
+// touching every splat.
+bool SortEngine::fixUpLikely(const int* positions, const int* viewProj,
+                             uint32_t sortCount) {
+  const uint32_t kWindows = 128, kWindowSize = 64;
+  if (sortCount < kWindows * kWindowSize)
+    return true;
+
+  const float distancesRange =
+      (float)lastMaxDistance - (float)lastMinDistance;
+  const float rangeMap =
+      distancesRange > 0.0f ? (float)(previousRange - 1) / distancesRange
+                            : 0.0f;
+  int depths[kWindowSize];
+  float buckets[kWindowSize];
+  uint64_t inversions = 0;
+  const uint32_t stride = sortCount / kWindows;
+  for (uint32_t w = 0; w < kWindows; w++) {
+    int lo = INT_MAX, hi = INT_MIN;
+    computeSplatDepths(previousOrder.data() + w * stride, positions, viewProj,
+                       depths, 0, kWindowSize, lo, hi);
+    for (uint32_t i = 0; i < kWindowSize; i++) {
+      buckets[i] = std::floor(((float)depths[i] - (float)lastMinDistance) *
+                              rangeMap);
+      for (uint32_t j = 0; j < i; j++)
+        inversions += buckets[j] > buckets[i];
+    }
+  }
+  return inversions <= (uint64_t)kWindows * kWindowSize *
+                           coherentSettings.maxMovesPerSplat;
+}
+
+// Re-buckets the splats in their previous order and restores the order with
+// an insertion sort per task followed by pairwise merges. Keys are
+// (bucket, previous position), so splats sharing a bucket keep their relative
+// order just like in the counting sort, and an unchanged camera costs no
+// moves at all.
+bool SortEngine::fixUp(const int* positions, const int* viewProj,
+                       uint32_t* indexesOut, uint32_t distanceMapRange,
+                       uint32_t sortCount, int& minDistance,
+                       int& maxDistance) {
+  if (sortCount == 0 || distanceMapRange == 0)
+    return true;
+
+  const size_t chunks = taskCountFor(pool, sortCount);
+  const uint32_t chunkSize = (sortCount + chunks - 1) / chunks;
+  auto chunkBegin = [&](size_t c) {
+    return std::min<uint32_t>(sortCount, c * chunkSize);
+  };
+  auto chunkEnd = [&](size_t c) {
+    return std::min<uint32_t>(sortCount, (c + 1) * chunkSize);
+  };
+
+  if (distances.size() < sortCount)
+    distances.resize(sortCount);
+  fixUpKeys.resize(sortCount);
+  chunkMin.assign(chunks, INT_MAX);
+  chunkMax.assign(chunks, INT_MIN);
+  chunkFailed.assign(chunks, 0);
+
+  pool.parallelFor(chunks, [&](size_t c) {
+    computeSplatDepths(previousOrder.data(), positions, viewProj,
+                       distances.data(), chunkBegin(c), chunkEnd(c),
+                       chunkMin[c], chunkMax[c]);
+  });
+  minDistance = *std::min_element(chunkMin.begin(), chunkMin.end());
+  maxDistance = *std::max_element(chunkMax.begin(), chunkMax.end());
+  const float distancesRange = (float)maxDistance - (float)minDistance;
+  const float rangeMap =
+      distancesRange > 0.0f ? (float)(distanceMapRange - 1) / distancesRange
+                            : 0.0f;
+
+  pool.parallelFor(chunks, [&](size_t c) {
+    uint64_t* keys = fixUpKeys.data();
+    const uint32_t begin = chunkBegin(c), end = chunkEnd(c);
+    const uint64_t budget =
+        (uint64_t)(end - begin) * coherentSettings.maxMovesPerSplat;
+    uint64_t moves = 0;
+    for (uint32_t i = begin; i < end; i++) {
+      const uint64_t bucket =
+          (uint32_t)(((float)distances[i] - (float)minDistance) * rangeMap);
+      const uint64_t key = (bucket << 32) | i;
+      uint32_t j = i;
+      while (j > begin && keys[j - 1] > key) {
+        keys[j] = keys[j - 1];
+        j--;
+      }
+      keys[j] = key;
+      moves += i - j;
+      if (moves > budget) {
+        chunkFailed[c] = 1;
+        return;
+      }
+    }
+  });
+  if (std::find(chunkFailed.begin(), chunkFailed.end(), 1) !=
+      chunkFailed.end())
+    return false;
+
+  for (uint32_t width = chunkSize; width < sortCount; width *= 2) {
+    const size_t pairs = (sortCount + 2 * (size_t)width - 1) / (2 * (size_t)width);
+    pool.parallelFor(pairs, [&](size_t p) {
+      uint64_t* keys = fixUpKeys.data();
+      const size_t first = p * 2 * (size_t)width;
+      const size_t middle = std::min<size_t>(sortCount, first + width);
+      const size_t last = std::min<size_t>(sortCount, first + 2 * (size_t)width);
+      if (middle < last)
+        std::inplace_merge(keys + first, keys + middle, keys + last);
+    });
+  }
+
+  pool.parallelFor(chunks, [&](size_t c) {
+    for (uint32_t i = chunkBegin(c); i < chunkEnd(c); i++)
+      indexesOut[i] = previousOrder[(uint32_t)fixUpKeys[i]];
+  });
+  return true;
+}
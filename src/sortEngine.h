@@ -0,0 +1,131 @@
+#ifndef SORTENGINE_H
+#define SORTENGINE_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "threadPool.h"
+
+// Wall clock spent in each phase of the last sort, in milliseconds.
+struct SortTimings {
+  double depth = 0.0;
+  double histogram = 0.0;
+  double prefixSum = 0.0;
+  double scatter = 0.0;
+  double fixUp = 0.0;
+  double total = 0.0;
+};
+
+// What sortCoherent() did with the previous order.
+enum class SortPath { Full, FixUp, Skipped };
+
+// Camera deltas are measured against the camera of the last full sort or
+// fix-up, so slow drifts still end up triggering a new sort.
+struct CoherentSortSettings {
+  // Below both thresholds the previous order is reused as is.
+  float skipAngle = 0.0005f;  // radians
+  float skipDistance = 0.001f;
+  // Below both thresholds the previous order is repaired, above either one
+  // a full sort runs.
+  float fixUpAngle = 0.005f;  // radians
+  float fixUpDistance = 0.05f;
+  // The repair gives up and falls back to a full sort after this many
+  // element moves per splat on average.
+  uint32_t maxMovesPerSplat = 4;
+};
+
+// Computes the view depth of each splat center and orders the indexes back
+// to front with a counting sort over `distanceMapRange` buckets.
+//
+// Every phase is split across the thread pool: depths (SIMD), per-task
+// histograms, a parallel prefix sum over the bucket columns and a parallel
+// scatter. The result is identical to the serial counting sort: splats that
+// fall in the same bucket keep their input order.
+class SortEngine {
+ public:
+  explicit SortEngine(ThreadPool& pool = ThreadPool::shared());
+
+  // `positions` are fixed point xyz triplets and `viewProj` the fixed point
+  // view-projection matrix (column major), as fed to sortIndexes(). The first
+  // `sortCount` entries of `indexes` are sorted into `indexesOut`, entries
+  // in [sortCount, renderCount) are copied unchanged.
+  void sort(const uint32_t* indexes, const int* positions, const int* viewProj,
+            uint32_t* indexesOut, uint32_t distanceMapRange,
+            uint32_t sortCount, uint32_t renderCount);
+
+  // Temporally coherent variant of sort(). The order from the previous call
+  // is kept: if the view barely moved it is reused, if it moved a little it
+  // is repaired with a bounded per-task insertion sort and a parallel merge,
+  // otherwise a full sort runs. A different `indexes` or `positions` array,
+  // or different counts or range, invalidates the previous order; call
+  // invalidate() when the content of those arrays changes in place.
+  SortPath sortCoherent(const uint32_t* indexes, const int* positions,
+                        const int* viewProj, uint32_t* indexesOut,
+                        uint32_t distanceMapRange, uint32_t sortCount,
+                        uint32_t renderCount, const glm::vec3& cameraPosition);
+  void invalidate() { previousValid = false; }
+
+  // Makes sortIndexes() go through sortCoherent().
+  void setCoherent(bool _coherent) { coherent = _coherent; }
+  bool isCoherent() const { return coherent; }
+  CoherentSortSettings& getCoherentSettings() { return coherentSettings; }
+
+  SortPath getLastPath() const { return lastPath; }
+  uint64_t getPathCount(SortPath path) const {
+    return pathCounts[(int)path];
+  }
+
+  const SortTimings& getTimings() const { return timings; }
+
+  // Depth of every splat written by the last sort(), in input order.
+  const int* getDistances() const { return distances.data(); }
+
+  static SortEngine& shared();
+
+ private:
+  ThreadPool& pool;
+  SortTimings timings;
+
+  std::vector<int> distances;
+  std::vector<uint32_t> bucketOf;
+  std::vector<uint32_t> histograms;
+  std::vector<int> chunkMin, chunkMax;
+  std::vector<uint32_t> blockSums;
+
+  void countingSort(const uint32_t* input, uint32_t* indexesOut,
+                    uint32_t distanceMapRange, uint32_t sortCount,
+                    int minDistance, int maxDistance);
+  bool fixUpLikely(const int* positions, const int* viewProj,
+                   uint32_t sortCount);
+  bool fixUp(const int* positions, const int* viewProj, uint32_t* indexesOut,
+             uint32_t distanceMapRange, uint32_t sortCount, int& minDistance,
+             int& maxDistance);
+
+  bool coherent = false;
+  CoherentSortSettings coherentSettings;
+  SortPath lastPath = SortPath::Full;
+  uint64_t pathCounts[3] = {0, 0, 0};
+
+  // State of the last sortCoherent() call
+  bool previousValid = false;
+  const uint32_t* previousIndexes = nullptr;
+  const int* previousPositions = nullptr;
+  uint32_t previousSortCount = 0, previousRenderCount = 0;
+  uint32_t previousRange = 0;
+  int lastMinDistance = 0, lastMaxDistance = 0;
+  glm::vec3 previousDirection;
+  glm::vec3 previousCamera;
+  std::vector<uint32_t> previousOrder;
+  std::vector<uint64_t> fixUpKeys;
+  std::vector<uint8_t> chunkFailed;
+};
+
+// depths[i] = dot(viewProj row 2, positions[indexes[i]]) for i in
+// [begin, end), also widening `minDepth`/`maxDepth`.
+void computeSplatDepths(const uint32_t* indexes, const int* positions,
+                        const int* viewProj, int* depths, uint32_t begin,
+                        uint32_t end, int& minDepth, int& maxDepth);
+
+#endif
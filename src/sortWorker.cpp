@@ -0,0 +1,229 @@
+#include "sortWorker.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include "timing.h"
+#include "vera/ops/profile.h"
+
+// Splats handled per sliced step, small enough to check the budget often.
+static const uint32_t kSliceSize = 65536;
+
+SortWorker::SortWorker(bool threaded) : threaded(threaded) {
+#if defined(SPLAT_HAS_THREADS)
+  if (threaded)
+    worker = std::thread(&SortWorker::workerLoop, this);
+#endif
+}
+
+SortWorker::~SortWorker() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  if (worker.joinable())
+    worker.join();
+}
+
+void SortWorker::setScene(const uint32_t* _indexes, const int* _positions,
+                          uint32_t _distanceMapRange, uint32_t _sortCount,
+                          uint32_t _renderCount) {
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this] { return !busy; });
+
+  indexes = _indexes;
+  positions = _positions;
+  distanceMapRange = std::max(1u, _distanceMapRange);
+  sortCount = _sortCount;
+  renderCount = _renderCount;
+
+  // acquire() returns nullptr until a sort of the new scene has finished
+  hasPending = false;
+  readyFresh = false;
+  completed = 0;
+  latency = 0;
+  averageLatency = 0.0;
+  phase = Phase::Idle;
+  for (std::vector<uint32_t>& buffer : buffers)
+    buffer.resize(renderCount);
+  engine.invalidate();
+}
+
+void SortWorker::setCoherent(bool _coherent) {
+  std::lock_guard<std::mutex> lock(mutex);
+  coherent = _coherent;
+}
+
+void SortWorker::request(const int* viewProj, const glm::vec3& cameraPosition,
+                         uint64_t frame) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (hasPending)
+      dropped++;
+    std::memcpy(pending.viewProj, viewProj, sizeof(pending.viewProj));
+    pending.cameraPosition = cameraPosition;
+    pending.frame = frame;
+    hasPending = true;
+  }
+  if (threaded)
+    wake.notify_one();
+}
+
+const uint32_t* SortWorker::acquire(uint64_t frame) {
+  if (!threaded)
+    pump(frameBudget);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (readyFresh) {
+    std::swap(front, ready);
+    readyFresh = false;
+    latency = frame >= readyFrame ? frame - readyFrame : 0;
+    averageLatency = completed <= 1
+                         ? (double)latency
+                         : averageLatency * 0.9 + (double)latency * 0.1;
+  }
+  return completed > 0 ? buffers[front].data() : nullptr;
+}
+
+SortTimings SortWorker::getTimings() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return readyTimings;
+}
+
+void SortWorker::publish(const Request& finished,
+                         const SortTimings& sortTimings) {
+  std::swap(back, ready);
+  readyFresh = true;
+  readyFrame = finished.frame;
+  readyTimings = sortTimings;
+  completed++;
+}
+
+void SortWorker::workerLoop() {
+  vera::setProfileThreadName("sort worker");
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.wait(lock, [this] { return stopping || hasPending; });
+    if (stopping)
+      return;
+
+    const Request job = pending;
+    hasPending = false;
+    busy = true;
+    engine.setCoherent(coherent);
+    uint32_t* out = buffers[back].data();
+    lock.unlock();
+
+    if (sortCount > 0 || renderCount > 0) {
+      VERA_PROFILE("sort");
+      if (engine.isCoherent())
+        engine.sortCoherent(indexes, positions, job.viewProj, out,
+                            distanceMapRange, sortCount, renderCount,
+                            job.cameraPosition);
+      else
+        engine.sort(indexes, positions, job.viewProj, out, distanceMapRange,
+                    sortCount, renderCount);
+    }
+
+    lock.lock();
+    publish(job, engine.getTimings());
+    busy = false;
+    idle.notify_all();
+  }
+}
+
+bool SortWorker::pump(double budgetMs) {
+  const Clock::time_point start = Clock::now();
+  std::lock_guard<std::mutex> lock(mutex);
+  do {
+    if (!step())
+      return false;
+  } while (msSince(start) < budgetMs);
+  return true;
+}
+
+// Same counting sort as SortEngine, serial and resumable. Returns false when
+// there is nothing left to do.
+bool SortWorker::step() {
+  VERA_PROFILE("sort");
+  const Clock::time_point start = Clock::now();
+  uint32_t* out = buffers[back].data();
+
+  switch (phase) {
+    case Phase::Idle:
+      if (!hasPending)
+        return false;
+      current = pending;
+      hasPending = false;
+      cursor = 0;
+      slicedTime = 0.0;
+      minDistance = INT_MAX;
+      maxDistance = INT_MIN;
+      if (distances.size() < sortCount)
+        distances.resize(sortCount);
+      phase = Phase::Depth;
+      break;
+
+    case Phase::Depth: {
+      const uint32_t end = std::min(sortCount, cursor + kSliceSize);
+      computeSplatDepths(indexes, positions, current.viewProj,
+                         distances.data(), cursor, end, minDistance,
+                         maxDistance);
+      cursor = end;
+      if (cursor == sortCount) {
+        const float distancesRange = (float)maxDistance - (float)minDistance;
+        rangeMap = distancesRange > 0.0f
+                       ? (float)(distanceMapRange - 1) / distancesRange
+                       : 0.0f;
+        frequencies.assign(distanceMapRange, 0);
+        cursor = 0;
+        phase = Phase::Histogram;
+      }
+      break;
+    }
+
+    case Phase::Histogram: {
+      const uint32_t end = std::min(sortCount, cursor + kSliceSize);
+      for (uint32_t i = cursor; i < end; i++)
+        frequencies[(uint32_t)(((float)distances[i] - (float)minDistance) *
+                               rangeMap)]++;
+      cursor = end;
+      if (cursor == sortCount) {
+        uint32_t running = 0;
+        for (uint32_t& frequency : frequencies) {
+          const uint32_t count = frequency;
+          frequency = running;
+          running += count;
+        }
+        cursor = 0;
+        phase = Phase::Scatter;
+      }
+      break;
+    }
+
+    case Phase::Scatter: {
+      const uint32_t end = std::min(sortCount, cursor + kSliceSize);
+      for (uint32_t i = cursor; i < end; i++) {
+        const uint32_t bucket =
+            (uint32_t)(((float)distances[i] - (float)minDistance) * rangeMap);
+        out[frequencies[bucket]++] = indexes[i];
+      }
+      cursor = end;
+      if (cursor == sortCount) {
+        for (uint32_t i = sortCount; i < renderCount; i++)
+          out[i] = indexes[i];
+        SortTimings sliced;
+        sliced.total = slicedTime + msSince(start);
+        publish(current, sliced);
+        phase = Phase::Idle;
+        return true;
+      }
+      break;
+    }
+  }
+
+  slicedTime += msSince(start);
+  return true;
+}
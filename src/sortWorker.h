@@ -0,0 +1,117 @@
+#ifndef SORTWORKER_H
+#define SORTWORKER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "sortEngine.h"
+
+// Moves splat sorting off the render thread.
+//
+// The render thread posts view-projection snapshots with request() and picks
+// up the newest finished order with acquire(); it never waits for a sort.
+// Results are triple buffered: one buffer is being drawn, one holds the
+// latest finished sort and one is being written by the worker. A request
+// that is still queued when a newer one arrives is dropped.
+//
+// Without threads (Emscripten built with USE_PTHREADS=0) the same sort is
+// split into slices and advanced from acquire() for at most the frame
+// budget, so a large scene is sorted over several frames instead of stalling
+// one.
+class SortWorker {
+ public:
+#if defined(SPLAT_HAS_THREADS)
+  explicit SortWorker(bool threaded = true);
+#else
+  explicit SortWorker(bool threaded = false);
+#endif
+  ~SortWorker();
+
+  // Arrays must stay alive and unchanged until the next setScene(). Waits for
+  // the sort in flight and discards queued and finished results.
+  void setScene(const uint32_t* indexes, const int* positions,
+                uint32_t distanceMapRange, uint32_t sortCount,
+                uint32_t renderCount);
+
+  void request(const int* viewProj, const glm::vec3& cameraPosition,
+               uint64_t frame);
+
+  // Newest finished order (renderCount indexes) or nullptr if nothing has
+  // finished yet. The pointer stays valid until the next acquire().
+  const uint32_t* acquire(uint64_t frame);
+
+  // Sliced mode only: advances the current sort for about `budgetMs`.
+  // Returns true while work is left.
+  bool pump(double budgetMs);
+
+  void setFrameBudget(double budgetMs) { frameBudget = budgetMs; }
+  void setCoherent(bool coherent);
+
+  // Frames between a request and the acquire() that first returned it.
+  uint64_t getLatency() const { return latency; }
+  double getAverageLatency() const { return averageLatency; }
+  uint64_t getDroppedCount() const { return dropped; }
+  // Sorts finished since the last setScene()
+  uint64_t getCompletedCount() const { return completed; }
+  SortTimings getTimings() const;
+
+ private:
+  struct Request {
+    int viewProj[16];
+    glm::vec3 cameraPosition;
+    uint64_t frame = 0;
+  };
+
+  void workerLoop();
+  void publish(const Request& finished, const SortTimings& sortTimings);
+
+  // Sliced sort, one phase step per call
+  bool step();
+
+  const bool threaded;
+  std::thread worker;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  bool stopping = false;
+  bool busy = false;
+
+  const uint32_t* indexes = nullptr;
+  const int* positions = nullptr;
+  uint32_t distanceMapRange = 0, sortCount = 0, renderCount = 0;
+
+  Request pending;
+  bool hasPending = false;
+
+  std::vector<uint32_t> buffers[3];
+  int front = 0, ready = 1, back = 2;
+  bool readyFresh = false;
+  uint64_t readyFrame = 0;
+  SortTimings readyTimings;
+
+  SortEngine engine;
+  bool coherent = false;
+
+  uint64_t latency = 0;
+  double averageLatency = 0.0;
+  uint64_t dropped = 0;
+  uint64_t completed = 0;
+  double frameBudget = 4.0;
+
+  enum class Phase { Idle, Depth, Histogram, Scatter };
+  Phase phase = Phase::Idle;
+  Request current;
+  uint32_t cursor = 0;
+  int minDistance = 0, maxDistance = 0;
+  float rangeMap = 0.0f;
+  std::vector<int> distances;
+  std::vector<uint32_t> frequencies;
+  double slicedTime = 0.0;
+};
+
+#endif
@@ -1 +1,492 @@
-#include "splatBuffer.h"
\ No newline at end of file
+#include "splatBuffer.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "simd.h"
+#include "splatMath.h"
+#include "timing.h"
+
+// Level 0 files have no buckets, they are decoded in blocks of this size.
+static const uint32_t kLevel0BlockSize = 4096;
+
+// Splats converted per step inside a block, sized to keep the temporary in L1.
+static const uint32_t kChunkSize = 256;
+
+// Blocks smaller than this many splats are grouped into one task.
+static const uint32_t kMinSplatsPerTask = 16384;
+
+// out[i] = (in[i] - range) * factor + offset[i % 3] for 3 * count values,
+// i.e. count quantized xyz centers around the same bucket center.
+static void dequantizeCentersScalar(const uint16_t* in, float* out,
+                                    size_t count, float range, float factor,
+                                    const float* offset) {
+  for (size_t i = 0; i < count; i++)
+    for (int c = 0; c < 3; c++)
+      out[3 * i + c] = ((float)in[3 * i + c] - range) * factor + offset[c];
+}
+
+#if defined(SPLAT_X86_DISPATCH)
+
+// 8 splats, 24 values, per step. The offsets repeat every 3 values, so three
+// registers hold the pattern for a whole step.
+SPLAT_TARGET_AVX2 static void dequantizeCentersAVX2(const uint16_t* in,
+                                                    float* out, size_t count,
+                                                    float range, float factor,
+                                                    const float* offset) {
+  float pattern[24];
+  for (int k = 0; k < 24; k++)
+    pattern[k] = offset[k % 3];
+  const __m256 offsets[3] = {_mm256_loadu_ps(pattern),
+                             _mm256_loadu_ps(pattern + 8),
+                             _mm256_loadu_ps(pattern + 16)};
+  const __m256 rangeV = _mm256_set1_ps(range);
+  const __m256 factorV = _mm256_set1_ps(factor);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    for (int k = 0; k < 3; k++) {
+      const __m128i q = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(in + 3 * i + 8 * k));
+      const __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(q));
+      _mm256_storeu_ps(out + 3 * i + 8 * k,
+                       _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(v, rangeV),
+                                                   factorV),
+                                     offsets[k]));
+    }
+  }
+  dequantizeCentersScalar(in + 3 * i, out + 3 * i, count - i, range, factor,
+                          offset);
+}
+
+SPLAT_TARGET_SSE41 static void dequantizeCentersSSE41(const uint16_t* in,
+                                                      float* out, size_t count,
+                                                      float range, float factor,
+                                                      const float* offset) {
+  const __m128 offsets[3] = {_mm_setr_ps(offset[0], offset[1], offset[2], offset[0]),
+                             _mm_setr_ps(offset[1], offset[2], offset[0], offset[1]),
+                             _mm_setr_ps(offset[2], offset[0], offset[1], offset[2])};
+  const __m128 rangeV = _mm_set1_ps(range);
+  const __m128 factorV = _mm_set1_ps(factor);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    for (int k = 0; k < 3; k++) {
+      const __m128i q = _mm_loadl_epi64(
+          reinterpret_cast<const __m128i*>(in + 3 * i + 4 * k));
+      const __m128 v = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(q));
+      _mm_storeu_ps(out + 3 * i + 4 * k,
+                    _mm_add_ps(_mm_mul_ps(_mm_sub_ps(v, rangeV), factorV),
+                               offsets[k]));
+    }
+  }
+  dequantizeCentersScalar(in + 3 * i, out + 3 * i, count - i, range, factor,
+                          offset);
+}
+
+#elif defined(SPLAT_NEON)
+
+static void dequantizeCentersNeon(const uint16_t* in, float* out, size_t count,
+                                  float range, float factor,
+                                  const float* offset) {
+  const float pattern[12] = {offset[0], offset[1], offset[2], offset[0],
+                             offset[1], offset[2], offset[0], offset[1],
+                             offset[2], offset[0], offset[1], offset[2]};
+  const float32x4_t offsets[3] = {vld1q_f32(pattern), vld1q_f32(pattern + 4),
+                                  vld1q_f32(pattern + 8)};
+  const float32x4_t rangeV = vdupq_n_f32(range);
+  const float32x4_t factorV = vdupq_n_f32(factor);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    for (int k = 0; k < 3; k++) {
+      const float32x4_t v =
+          vcvtq_f32_u32(vmovl_u16(vld1_u16(in + 3 * i + 4 * k)));
+      vst1q_f32(out + 3 * i + 4 * k,
+                vaddq_f32(vmulq_f32(vsubq_f32(v, rangeV), factorV),
+                          offsets[k]));
+    }
+  }
+  dequantizeCentersScalar(in + 3 * i, out + 3 * i, count - i, range, factor,
+                          offset);
+}
+
+#elif defined(SPLAT_WASM_SIMD)
+
+static void dequantizeCentersWasm(const uint16_t* in, float* out, size_t count,
+                                  float range, float factor,
+                                  const float* offset) {
+  const v128_t offsets[3] = {
+      wasm_f32x4_make(offset[0], offset[1], offset[2], offset[0]),
+      wasm_f32x4_make(offset[1], offset[2], offset[0], offset[1]),
+      wasm_f32x4_make(offset[2], offset[0], offset[1], offset[2])};
+  const v128_t rangeV = wasm_f32x4_splat(range);
+  const v128_t factorV = wasm_f32x4_splat(factor);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    for (int k = 0; k < 3; k++) {
+      const v128_t v =
+          wasm_f32x4_convert_u32x4(wasm_u32x4_load16x4(in + 3 * i + 4 * k));
+      wasm_v128_store(out + 3 * i + 4 * k,
+                      wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_sub(v, rangeV),
+                                                    factorV),
+                                     offsets[k]));
+    }
+  }
+  dequantizeCentersScalar(in + 3 * i, out + 3 * i, count - i, range, factor,
+                          offset);
+}
+
+#endif
+
+static void dequantizeCenters(const uint16_t* in, float* out, size_t count,
+                              float range, float factor, const float* offset) {
+#if defined(SPLAT_X86_DISPATCH)
+  if (simd::hasAVX2())
+    return dequantizeCentersAVX2(in, out, count, range, factor, offset);
+  if (simd::hasSSE41())
+    return dequantizeCentersSSE41(in, out, count, range, factor, offset);
+#elif defined(SPLAT_NEON)
+  return dequantizeCentersNeon(in, out, count, range, factor, offset);
+#elif defined(SPLAT_WASM_SIMD)
+  return dequantizeCentersWasm(in, out, count, range, factor, offset);
+#endif
+  dequantizeCentersScalar(in, out, count, range, factor, offset);
+}
+
+// Splits `count` interleaved records of `components` values into the
+// per-component arrays of `out`, starting at out[c][dest].
+template <typename T>
+static void deinterleave(const T* in, int components, T* const* out,
+                         size_t dest, size_t count) {
+  for (int c = 0; c < components; c++) {
+    T* component = out[c];
+    if (!component)
+      continue;
+    component += dest;
+    for (size_t i = 0; i < count; i++)
+      component[i] = in[i * components + c];
+  }
+}
+
+template <typename T, size_t N>
+static bool anyOf(T* const (&arrays)[N]) {
+  for (T* array : arrays)
+    if (array)
+      return true;
+  return false;
+}
+
+SplatBuffer::SplatBuffer(std::vector<uint8_t>&& bufferData)
+    : storage(std::move(bufferData)) {
+  bytes = storage.data();
+  byteCount = storage.size();
+  linkBufferArrays();
+}
+
+SplatBuffer::SplatBuffer(const uint8_t* _bytes, size_t _byteCount) {
+  bytes = _bytes;
+  byteCount = _byteCount;
+  linkBufferArrays();
+}
+
+SplatBuffer::SplatBuffer(const std::string& path) {
+  if (!file.open(path))
+    return;
+  bytes = file.data();
+  byteCount = file.size();
+  if (!linkBufferArrays())
+    std::cerr << "Error: " << path << " is not a valid splat buffer"
+              << std::endl;
+}
+
+size_t SplatBuffer::getByteCount(const uint8_t* header) {
+  uint32_t fields[7];
+  std::memcpy(fields, header, sizeof(fields));
+  const uint8_t level = header[3];
+  if (level >= levels.size())
+    return 0;
+  const uint32_t count = fields[1], bucketSize = fields[2],
+                 bucketCount = fields[3], bytesPerBucket = fields[5];
+  const CompressionLevels& sizes = levels[level];
+  size_t byteCount = HeaderSizeBytes + (size_t)count * (sizes.BytesPerCenter +
+                                                        sizes.BytesPerScale +
+                                                        sizes.BytesPerColor +
+                                                        sizes.BytesPerRotation);
+  if (level > 0) {
+    if (bucketSize == 0 || bytesPerBucket < 3 * sizeof(float) ||
+        (size_t)bucketCount * bucketSize < count)
+      return 0;
+    byteCount += (size_t)bucketCount * bytesPerBucket;
+  }
+  return byteCount;
+}
+
+bool SplatBuffer::linkBufferArrays() {
+  valid = false;
+  if (!bytes || byteCount < (size_t)HeaderSizeBytes)
+    return false;
+  const size_t expectedByteCount = getByteCount(bytes);
+  if (expectedByteCount == 0 || byteCount < expectedByteCount)
+    return false;
+
+  headerBufferData = bytes;
+  headerArrayUint8 = headerBufferData;
+  headerArrayUint32 = reinterpret_cast<const uint32_t*>(headerBufferData);
+  headerArrayFloat32 = reinterpret_cast<const float*>(headerBufferData);
+
+  this->versionMajor = headerArrayUint8[0];
+  this->versionMinor = headerArrayUint8[1];
+  this->headerExtraK = headerArrayUint8[2];
+  this->compressionLevel = headerArrayUint8[3];
+
+  this->splatCount = headerArrayUint32[1];
+  this->bucketSize = headerArrayUint32[2];
+  this->bucketCount = headerArrayUint32[3];
+  this->bucketBlockSize = headerArrayFloat32[4];
+  this->halfBucketBlockSize = bucketBlockSize / 2.0f;
+  this->bytesPerBucket = headerArrayUint32[5];
+  this->compressionScaleRange =
+      headerArrayUint32[6] != 0 ? headerArrayUint32[6]
+                                : levels[this->compressionLevel].ScaleRange;
+  this->compressionScaleFactor =
+      halfBucketBlockSize / (float)compressionScaleRange;
+
+  bytesPerCenter = levels[this->compressionLevel].BytesPerCenter;
+  bytesPerScale = levels[this->compressionLevel].BytesPerScale;
+  bytesPerColor = levels[this->compressionLevel].BytesPerColor;
+  bytesPerRotation = levels[this->compressionLevel].BytesPerRotation;
+  bytesPerSplat =
+      bytesPerCenter + bytesPerScale + bytesPerColor + bytesPerRotation;
+
+  // Attribute arrays one after the other, then the bucket centers
+  const size_t count = splatCount;
+  const size_t centersBytes = count * bytesPerCenter;
+  const size_t scalesBytes = count * bytesPerScale;
+  const size_t colorsBytes = count * bytesPerColor;
+  bucketsBase = count * bytesPerSplat;
+
+  splatBufferData = reinterpret_cast<const char*>(bytes + HeaderSizeBytes);
+  const char* scales = splatBufferData + centersBytes;
+  const char* colors = scales + scalesBytes;
+  const char* rotations = colors + colorsBytes;
+
+  // No copies: every view points into the file bytes. The header is 1024
+  // bytes and each array size is a multiple of its element size, so the
+  // views stay naturally aligned.
+  centerArrayFloat = {};
+  scaleArrayFloat = {};
+  rotationArrayFloat = {};
+  centerArray = {};
+  scaleArray = {};
+  rotationArray = {};
+  bucketArray = {};
+  if (compressionLevel == 0) {
+    centerArrayFloat = SplatArrayView<float>(
+        reinterpret_cast<const float*>(splatBufferData), count * CenterComponentCount);
+    scaleArrayFloat = SplatArrayView<float>(
+        reinterpret_cast<const float*>(scales), count * ScaleComponentCount);
+    rotationArrayFloat = SplatArrayView<float>(
+        reinterpret_cast<const float*>(rotations), count * RotationComponentCount);
+  } else {
+    centerArray = SplatArrayView<uint16_t>(
+        reinterpret_cast<const uint16_t*>(splatBufferData), count * CenterComponentCount);
+    scaleArray = SplatArrayView<uint16_t>(
+        reinterpret_cast<const uint16_t*>(scales), count * ScaleComponentCount);
+    rotationArray = SplatArrayView<uint16_t>(
+        reinterpret_cast<const uint16_t*>(rotations), count * RotationComponentCount);
+    bucketArray = SplatArrayView<float>(
+        reinterpret_cast<const float*>(splatBufferData + bucketsBase),
+        (size_t)bucketCount * bytesPerBucket / sizeof(float));
+  }
+  colorArray = SplatArrayView<uint8_t>(reinterpret_cast<const uint8_t*>(colors),
+                                       count * ColorComponentCount);
+
+  valid = true;
+  return true;
+}
+
+uint32_t SplatBuffer::getDecodeBlockSize() const {
+  return compressionLevel > 0 ? bucketSize : kLevel0BlockSize;
+}
+
+uint32_t SplatBuffer::getDecodeBlockCount() const {
+  const uint32_t blockSize = getDecodeBlockSize();
+  return blockSize > 0 ? (splatCount + blockSize - 1) / blockSize : 0;
+}
+
+void SplatBuffer::decodeBlock(uint32_t block, const SplatSoA& out,
+                              uint32_t destOffset) const {
+  decodeBlockAt(block, out, (size_t)destOffset + block * getDecodeBlockSize());
+}
+
+void SplatBuffer::decodeBlockCompact(uint32_t block,
+                                     const SplatSoA& out) const {
+  decodeBlockAt(block, out, 0);
+}
+
+void SplatBuffer::decodeBlockAt(uint32_t block, const SplatSoA& out,
+                                size_t destBegin) const {
+  const uint32_t blockSize = getDecodeBlockSize();
+  const uint32_t begin = block * blockSize;
+  const uint32_t end = std::min(splatCount, begin + blockSize);
+
+  if (compressionLevel == 0) {
+    const size_t count = end - begin;
+    const size_t dest = destBegin;
+    deinterleave(centerArrayFloat.data() + 3 * (size_t)begin, 3, out.center,
+                 dest, count);
+    deinterleave(scaleArrayFloat.data() + 3 * (size_t)begin, 3, out.scale,
+                 dest, count);
+    deinterleave(rotationArrayFloat.data() + 4 * (size_t)begin, 4,
+                 out.rotation, dest, count);
+    deinterleave(colorArray.data() + 4 * (size_t)begin, 4, out.color, dest,
+                 count);
+    return;
+  }
+
+  // One bucket: every center is quantized around the same bucket center
+  const float* bucket = reinterpret_cast<const float*>(
+      splatBufferData + bucketsBase + (size_t)block * bytesPerBucket);
+  const bool centers = anyOf(out.center);
+  const bool scales = anyOf(out.scale);
+  const bool rotations = anyOf(out.rotation);
+  float decoded[kChunkSize * 4];
+  for (uint32_t first = begin; first < end; first += kChunkSize) {
+    const size_t count = std::min(end - first, kChunkSize);
+    const size_t dest = destBegin + (first - begin);
+    if (centers) {
+      dequantizeCenters(centerArray.data() + 3 * (size_t)first, decoded, count,
+                        (float)compressionScaleRange, compressionScaleFactor,
+                        bucket);
+      deinterleave(decoded, 3, out.center, dest, count);
+    }
+    if (scales) {
+      halfToFloat(scaleArray.data() + 3 * (size_t)first, decoded, 3 * count);
+      deinterleave(decoded, 3, out.scale, dest, count);
+    }
+    if (rotations) {
+      halfToFloat(rotationArray.data() + 4 * (size_t)first, decoded,
+                  4 * count);
+      deinterleave(decoded, 4, out.rotation, dest, count);
+    }
+    deinterleave(colorArray.data() + 4 * (size_t)first, 4, out.color, dest,
+                 count);
+  }
+}
+
+SplatDecodeStats SplatBuffer::decodeSplats(const SplatSoA& out,
+                                           uint32_t destOffset,
+                                           ThreadPool& pool) const {
+  const Clock::time_point start = Clock::now();
+  const uint32_t blockSize = getDecodeBlockSize();
+  const size_t grain = std::max<uint32_t>(1, kMinSplatsPerTask / std::max(1u, blockSize));
+  pool.parallelForRange(0, getDecodeBlockCount(), grain,
+                        [&](size_t first, size_t last) {
+                          for (size_t b = first; b < last; b++)
+                            decodeBlock((uint32_t)b, out, destOffset);
+                        });
+
+  SplatDecodeStats stats;
+  stats.splatCount = splatCount;
+  stats.ms = msSince(start);
+  stats.splatsPerSecond =
+      stats.ms > 0.0 ? (double)splatCount * 1000.0 / stats.ms : 0.0;
+  return stats;
+}
+
+void SplatBuffer::fillSplatCenterArray(std::vector<float>& outCenterArray,
+                                       int destOffset) const {
+  float* out = outCenterArray.data() + 3 * (size_t)destOffset;
+  if (compressionLevel == 0) {
+    std::memcpy(out, centerArrayFloat.data(),
+                centerArrayFloat.size() * sizeof(float));
+    return;
+  }
+
+  // Interleaved output is what the kernel produces, so no temporary here
+  const size_t grain = std::max<uint32_t>(1, kMinSplatsPerTask / bucketSize);
+  ThreadPool::shared().parallelForRange(
+      0, getDecodeBlockCount(), grain, [&](size_t first, size_t last) {
+        for (size_t b = first; b < last; b++) {
+          const size_t begin = b * bucketSize;
+          const size_t end = std::min<size_t>(splatCount, begin + bucketSize);
+          const float* bucket = reinterpret_cast<const float*>(
+              splatBufferData + bucketsBase + b * bytesPerBucket);
+          dequantizeCenters(centerArray.data() + 3 * begin, out + 3 * begin,
+                            end - begin, (float)compressionScaleRange,
+                            compressionScaleFactor, bucket);
+        }
+      });
+}
+
+void SplatBuffer::fillSplatScaleAndRotationArray(
+    std::vector<float>& outScaleArray, std::vector<float>& outRotationArray,
+    int destOffset) const {
+  float* scales = outScaleArray.data() + 3 * (size_t)destOffset;
+  float* rotations = outRotationArray.data() + 4 * (size_t)destOffset;
+  if (compressionLevel == 0) {
+    std::memcpy(scales, scaleArrayFloat.data(),
+                scaleArrayFloat.size() * sizeof(float));
+    std::memcpy(rotations, rotationArrayFloat.data(),
+                rotationArrayFloat.size() * sizeof(float));
+    return;
+  }
+
+  const size_t grain = std::max<uint32_t>(1, kMinSplatsPerTask / bucketSize);
+  ThreadPool::shared().parallelForRange(
+      0, getDecodeBlockCount(), grain, [&](size_t first, size_t last) {
+        const size_t begin = first * bucketSize;
+        const size_t end = std::min<size_t>(splatCount, last * bucketSize);
+        halfToFloat(scaleArray.data() + 3 * begin, scales + 3 * begin,
+                    3 * (end - begin));
+        halfToFloat(rotationArray.data() + 4 * begin, rotations + 4 * begin,
+                    4 * (end - begin));
+      });
+}
+
+void SplatBuffer::fillSplatCovarianceArray(std::vector<float>& covarianceArray,
+                                           int destOffset,
+                                           const glm::mat4* transform) const {
+  float matrix[9];
+  if (transform) {
+    const glm::mat3 upper(*transform);
+    std::memcpy(matrix, &upper[0][0], sizeof(matrix));
+  }
+  float* out = covarianceArray.data() +
+               (size_t)CovarianceSizeFloats * (size_t)destOffset;
+
+  const size_t chunkCount = (splatCount + kChunkSize - 1) / kChunkSize;
+  ThreadPool::shared().parallelForRange(
+      0, chunkCount, kMinSplatsPerTask / kChunkSize,
+      [&](size_t firstChunk, size_t lastChunk) {
+        // Interleaved halfs converted, then SoA in and out of the kernel
+        float decoded[kChunkSize * 4];
+        float soa[13][kChunkSize];
+        float* scales[3] = {soa[0], soa[1], soa[2]};
+        float* rotations[4] = {soa[3], soa[4], soa[5], soa[6]};
+        float* covariances[6] = {soa[7],  soa[8],  soa[9],
+                                 soa[10], soa[11], soa[12]};
+
+        for (size_t chunk = firstChunk; chunk < lastChunk; chunk++) {
+          const size_t first = chunk * kChunkSize;
+          const size_t count = std::min<size_t>(splatCount - first, kChunkSize);
+          if (compressionLevel == 0) {
+            deinterleave(scaleArrayFloat.data() + 3 * first, 3, scales, 0,
+                         count);
+            deinterleave(rotationArrayFloat.data() + 4 * first, 4, rotations,
+                         0, count);
+          } else {
+            halfToFloat(scaleArray.data() + 3 * first, decoded, 3 * count);
+            deinterleave(decoded, 3, scales, 0, count);
+            halfToFloat(rotationArray.data() + 4 * first, decoded, 4 * count);
+            deinterleave(decoded, 4, rotations, 0, count);
+          }
+
+          computeCovariances(scales, rotations, covariances, count,
+                             transform ? matrix : nullptr);
+
+          float* dest = out + first * CovarianceSizeFloats;
+          for (size_t i = 0; i < count; i++)
+            for (int c = 0; c < CovarianceSizeFloats; c++)
+              dest[i * CovarianceSizeFloats + c] = covariances[c][i];
+        }
+      });
+}
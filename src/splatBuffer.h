@@ -4,18 +4,61 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtx/quaternion.hpp>
-#include <vector>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "halfFloat.h"
+#include "mappedFile.h"
+#include "threadPool.h"
+
+// Read-only typed window into the SplatBuffer bytes. Never owns memory.
+template <typename T>
+class SplatArrayView {
+ public:
+  SplatArrayView() {}
+  SplatArrayView(const T* data, size_t count) : ptr(data), count(count) {}
+
+  const T* data() const { return ptr; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  const T& operator[](size_t i) const { return ptr[i]; }
+  const T* begin() const { return ptr; }
+  const T* end() const { return ptr + count; }
+
+ private:
+  const T* ptr = nullptr;
+  size_t count = 0;
+};
+
+// Destination of SplatBuffer::decodeSplats(), one array per component so
+// each can be uploaded or processed on its own. Null arrays are skipped.
+// Rotation components are in file order.
+struct SplatSoA {
+  float* center[3] = {nullptr, nullptr, nullptr};
+  float* scale[3] = {nullptr, nullptr, nullptr};
+  float* rotation[4] = {nullptr, nullptr, nullptr, nullptr};
+  uint8_t* color[4] = {nullptr, nullptr, nullptr, nullptr};
+};
+
+struct SplatDecodeStats {
+  uint32_t splatCount = 0;
+  double ms = 0.0;
+  double splatsPerSecond = 0.0;
+};
 
  class SplatBuffer {
  public:
   using vec3 = glm::vec3;
-  int CenterComponentCount = 3;
-  int ScaleComponentCount = 3;
-  int RotationComponentCount = 4;
-  int ColorComponentCount = 4;
+  static const int CenterComponentCount = 3;
+  static const int ScaleComponentCount = 3;
+  static const int RotationComponentCount = 4;
+  static const int ColorComponentCount = 4;
 
-  static const struct CompressionLevels {
+  struct CompressionLevels {
     int BytesPerCenter;
     int BytesPerScale;
     int BytesPerColor;
@@ -30,256 +73,106 @@
   static const int CovarianceSizeBytes = 24;
   static const int HeaderSizeBytes = 1024;
 
-  int bytesPerCenter, bytesPerScale, bytesPerColor, bytesPerRotation,
-      bytesPerSplat;
-  uint8_t compressionLevel, versionMajor, versionMinor, headerExtraK;
-  uint32_t splatCount, bucketSize, bucketCount, bucketBlockSize, bytesPerBucket,
-      compressionScaleRange;
-  float halfBucketBlockSize, compressionScaleFactor;
-  uint8_t* headerBufferData;
-  uint8_t* headerArrayUint8;
-  uint32_t* headerArrayUint32;
-  float* headerArrayFloat32;
-  std::vector<uint8_t> splatbuffer;
-  char* splatBufferData;
-  std::vector<uint16_t> centerArray;
-  std::vector<uint16_t> rotationArray;
-  std::vector<uint16_t> scaleArray;
-  std::vector<uint8_t> colorArray;
-  int bucketsBase;
-
+  int bytesPerCenter = 0, bytesPerScale = 0, bytesPerColor = 0,
+      bytesPerRotation = 0, bytesPerSplat = 0;
+  uint8_t compressionLevel = 0, versionMajor = 0, versionMinor = 0,
+          headerExtraK = 0;
+  uint32_t splatCount = 0, bucketSize = 0, bucketCount = 0, bytesPerBucket = 0,
+           compressionScaleRange = 0;
+  float bucketBlockSize = 0.0f, halfBucketBlockSize = 0.0f,
+        compressionScaleFactor = 0.0f;
+  const uint8_t* headerBufferData = nullptr;
+  const uint8_t* headerArrayUint8 = nullptr;
+  const uint32_t* headerArrayUint32 = nullptr;
+  const float* headerArrayFloat32 = nullptr;
+  const char* splatBufferData = nullptr;
+
+  // Views into the splat data, valid while this SplatBuffer lives. Level 0
+  // files hold float centers, scales and rotations; level 1 files hold
+  // 16-bit quantized centers and half float scales and rotations. The views
+  // of the other level are empty.
+  SplatArrayView<float> centerArrayFloat;
+  SplatArrayView<float> scaleArrayFloat;
+  SplatArrayView<float> rotationArrayFloat;
+  SplatArrayView<uint16_t> centerArray;
+  SplatArrayView<uint16_t> scaleArray;
+  SplatArrayView<uint16_t> rotationArray;
+  SplatArrayView<uint8_t> colorArray;
+  // Level 1 only: bucket centers, xyz first in every bytesPerBucket record
+  SplatArrayView<float> bucketArray;
+  size_t bucketsBase = 0;
+
+  // Takes over the file bytes, header included. Byte vectors passed as
+  // rvalues are moved in, anything else is copied once.
+  explicit SplatBuffer(std::vector<uint8_t>&& bufferData);
   template <typename T>
-  SplatBuffer(std::vector<T> bufferData) {
-    std::vector<uint8_t> headerBuffer(HeaderSizeBytes);
-    headerBufferData = headerBuffer.data();
-    headerArrayUint8 = reinterpret_cast<uint8_t*>(headerBufferData);
-    headerArrayUint32 = reinterpret_cast<uint32_t*>(headerBufferData);
-    headerArrayFloat32 = reinterpret_cast<float*>(headerBufferData);
-    memcpy(headerArrayUint8, bufferData.data(),
-           sizeof(uint8_t) * HeaderSizeBytes);
-    this->versionMajor = headerArrayUint8[0];
-    this->versionMinor = headerArrayUint8[1];
-    this->headerExtraK = headerArrayUint8[2];
-    this->compressionLevel = headerArrayUint8[3];
-    this->splatCount = headerArrayUint32[1];
-    this->bucketSize = headerArrayUint32[2];
-    this->bucketCount = headerArrayUint32[3];
-    this->bucketBlockSize = headerArrayFloat32[4];
-    this->halfBucketBlockSize = (float)bucketBlockSize / 2.0;
-    this->bytesPerBucket = headerArrayUint32[5];
-    this->compressionScaleRange =
-        headerArrayUint32[6] == 0 ? headerArrayUint32[6]
-                                  : levels[this->compressionLevel].ScaleRange;
-    this->compressionScaleFactor =
-        (float)halfBucketBlockSize / (float)compressionScaleRange;
-
-    const long dataBufferSizeBytes = bufferData.size() - HeaderSizeBytes;
-    this->splatBufferData = new char[dataBufferSizeBytes];
-    std::memcpy(this->splatBufferData,
-                bufferData.data() + SplatBuffer::HeaderSizeBytes,
-                dataBufferSizeBytes);
-
-    bytesPerCenter = levels[this->compressionLevel].BytesPerCenter;
-    bytesPerScale = levels[this->compressionLevel].BytesPerScale;
-    bytesPerColor = levels[this->compressionLevel].BytesPerColor;
-    bytesPerRotation = levels[this->compressionLevel].BytesPerRotation;
-
-    bytesPerSplat =
-        bytesPerCenter + bytesPerScale + bytesPerColor + bytesPerRotation;
-
-    linkBufferArrays();
-  }
+  explicit SplatBuffer(const std::vector<T>& bufferData)
+      : SplatBuffer(toBytes(bufferData)) {}
 
-  void linkBufferArrays() {
-    if (compressionLevel == 0) {
-      std::vector<float> centerBuffer(splatCount * CenterComponentCount);
-      memcpy(centerBuffer.data(), splatBufferData,
-             splatCount * CenterComponentCount);
-      // centerArray = centerBuffer.data();
-
-      std::vector<float> scaleBuffer(splatCount * CenterComponentCount);
-      memcpy(scaleBuffer.data(), splatBufferData + bytesPerCenter * splatCount,
-             splatCount * CenterComponentCount);
-      // scaleArray = scaleBuffer.data();
-
-      std::vector<uint8_t> colorBuffer(splatCount * CenterComponentCount);
-      memcpy(colorBuffer.data(),
-             splatBufferData + (bytesPerCenter + bytesPerScale) * splatCount,
-             splatCount * CenterComponentCount);
-      // colorArray = colorBuffer.data();
-
-      std::vector<float> rotationBuffer(splatCount * CenterComponentCount);
-      memcpy(rotationBuffer.data(),
-             splatBufferData +
-                 (bytesPerCenter + bytesPerScale + bytesPerColor) * splatCount,
-             splatCount * CenterComponentCount);
-      // rotationArray = rotationBuffer.data();
-
-      bucketsBase = splatCount * bytesPerSplat;
-    } else {
-      centerArray = std::vector<uint16_t>(this->splatCount *
-                                          SplatBuffer::CenterComponentCount);
-      memcpy(centerArray.data(), splatBufferData,
-             this->splatCount * SplatBuffer::CenterComponentCount);
-
-      scaleArray = std::vector<uint16_t>(this->splatCount *
-                                         SplatBuffer::ScaleComponentCount);
-      memcpy(scaleArray.data(),
-             splatBufferData + this->bytesPerCenter * this->splatCount,
-             this->splatCount * SplatBuffer::ScaleComponentCount);
-
-      colorArray = std::vector<uint8_t>(this->splatCount *
-                                        SplatBuffer::ColorComponentCount);
-      memcpy(colorArray.data(),
-             splatBufferData + (this->bytesPerCenter + this->bytesPerScale) *
-                                   this->splatCount,
-             this->splatCount * SplatBuffer::ColorComponentCount);
-
-      rotationArray = std::vector<uint16_t>(
-          this->splatCount * SplatBuffer::RotationComponentCount);
-      memcpy(rotationArray.data(),
-             splatBufferData + (this->bytesPerCenter + this->bytesPerScale +
-                                this->bytesPerColor) *
-                                   this->splatCount,
-             this->splatCount * SplatBuffer::RotationComponentCount);
-
-      bucketsBase = splatCount * bytesPerSplat;
-    }
-  }
-  void float32(float* __restrict out, const uint16_t in) {
-    uint32_t t1;
-    uint32_t t2;
-    uint32_t t3;
+  // Wraps bytes owned by the caller, which must outlive this SplatBuffer.
+  SplatBuffer(const uint8_t* bytes, size_t byteCount);
 
-    t1 = in & 0x7fffu;  // Non-sign bits
-    t2 = in & 0x8000u;  // Sign bit
-    t3 = in & 0x7c00u;  // Exponent
+  // Maps the file instead of reading it, so the attribute views point
+  // straight into the page cache and nothing is copied.
+  explicit SplatBuffer(const std::string& path);
 
-    t1 <<= 13u;  // Align mantissa on MSB
-    t2 <<= 16u;  // Shift sign bit into position
+  SplatBuffer(const SplatBuffer&) = delete;
+  SplatBuffer& operator=(const SplatBuffer&) = delete;
+  SplatBuffer(SplatBuffer&&) = default;
+  SplatBuffer& operator=(SplatBuffer&&) = default;
 
-    t1 += 0x38000000;  // Adjust bias
+  // False when the file could not be read or its header and size disagree.
+  bool isValid() const { return valid; }
+  bool isMapped() const { return file.isMapped(); }
 
-    t1 = (t3 == 0 ? 0 : t1);  // Denormals-as-zero
+  // Size of the whole file described by a HeaderSizeBytes header, or 0 if
+  // the header is not usable.
+  static size_t getByteCount(const uint8_t* header);
 
-    t1 |= t2;  // Re-insert sign bit
+  // Parses the header and links the attribute views. Returns false when the
+  // bytes are not a usable SplatBuffer.
+  bool linkBufferArrays();
 
-    *((uint32_t*)out) = t1;
-  };
   // 16bit to 32bit
-  union Fp32 {
-    uint32_t u;
-    float f;
-  };
-  inline float fbf(uint16_t value) {
-    if (this->compressionLevel == 0) {
-      return value;
-    } else {
-      const Fp32 magic = {(254U - 15U) << 23};
-      const Fp32 was_infnan = {(127U + 16U) << 23};
-      Fp32 out;
-
-      out.u = (value & 0x7FFFU) << 13; /* exponent/mantissa bits */
-      out.f *= magic.f;                /* exponent adjust */
-      if (out.f >= was_infnan.f)       /* make sure Inf/NaN survive */
-      {
-        out.u |= 255U << 23;
-      }
-      out.u |= (value & 0x8000U) << 16; /* sign bit */
-      return out.f;
-    }
-  };
+  inline float fbf(uint16_t value) const { return halfToFloat(value); }
+
+  const uint8_t* getHeaderBufferData() const { return this->headerBufferData; }
 
-  uint8_t* getHeaderBufferData() { return this->headerBufferData; }
+  const char* getSplatBufferData() const { return this->splatBufferData; }
 
-  char* getSplatBufferData() { return this->splatBufferData; }
+  uint32_t getSplatCount() const { return this->splatCount; }
 
-  uint32_t getSplatCount() { return this->splatCount; }
+  // Decodes every splat into `out`, splat i landing at destOffset + i.
+  // Level 1 files are decoded a bucket at a time, buckets in parallel, with
+  // SIMD half float conversion and dequantization.
+  SplatDecodeStats decodeSplats(const SplatSoA& out, uint32_t destOffset = 0,
+                                ThreadPool& pool = ThreadPool::shared()) const;
 
+  // Decode unit: a bucket for level 1 files, a fixed block of splats for
+  // level 0. decodeBlock() is safe to call concurrently for different blocks.
+  uint32_t getDecodeBlockSize() const;
+  uint32_t getDecodeBlockCount() const;
+  void decodeBlock(uint32_t block, const SplatSoA& out,
+                   uint32_t destOffset) const;
+  // Same, with splat i of the block landing at index i of `out`, so the
+  // arrays only need to hold getDecodeBlockSize() splats.
+  void decodeBlockCompact(uint32_t block, const SplatSoA& out) const;
+
+  // Interleaved xyz, same bucket-wise kernels as decodeSplats().
   void fillSplatCenterArray(std::vector<float>& outCenterArray,
-                            int destOffset) {
-    int splatCount = this->splatCount;
-    float bucket[3] = {0, 0, 0};
-    float center[3] = {0, 0, 0};
-    for (int i = 0; i < splatCount; i++) {
-      int centerSrcBase = i * SplatBuffer::CenterComponentCount;
-      int centerDestBase = (i + destOffset) * SplatBuffer::CenterComponentCount;
-      if (this->compressionLevel > 0) {
-        int bucketIndex = floor(i / this->bucketSize);
-        float* bucket = new float[3];
-        memcpy(bucket,
-               this->splatBufferData + this->bucketsBase +
-                   bucketIndex * this->bytesPerBucket,
-               3 * sizeof(float));
-
-        float sf = this->compressionScaleFactor;
-        float sr = this->compressionScaleRange;
-        center[0] = (this->centerArray[centerSrcBase] - sr) * sf + bucket[0];
-        center[1] =
-            (this->centerArray[centerSrcBase + 1] - sr) * sf + bucket[1];
-        center[2] =
-            (this->centerArray[centerSrcBase + 2] - sr) * sf + bucket[2];
-      } else {
-        center[0] = this->centerArray[centerSrcBase];
-        center[1] = this->centerArray[centerSrcBase + 1];
-        center[2] = this->centerArray[centerSrcBase + 2];
-      }
-      // if (transform) {
-      //     center.applyMatrix4(transform);
-      // }
-      outCenterArray[centerDestBase] = center[0];
-      outCenterArray[centerDestBase + 1] = center[1];
-      outCenterArray[centerDestBase + 2] = center[2];
-    }
-  }
+                            int destOffset) const;
 
   void fillSplatScaleAndRotationArray(std::vector<float>& scaleArray,
                                       std::vector<float>& rotationArray,
-                                      int destOffse) {
-    const int splatCount = this->splatCount;
-
-    float scale[3] = {0, 0, 0};
-    glm::mat3 rotationMatrix;
-    glm::mat3 covarianceMatrix;
-    glm::mat3 transformedCovariance;
-    glm::mat3 transform3x3;
-    glm::mat3 transform3x3Transpose;
-    glm::mat4 tempMatrix4(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0,
-                                      0, 1);
-
-    for (int i = 0; i < splatCount; i++) {
-      const int scaleBase = i * SplatBuffer::ScaleComponentCount;
-      scaleArray[i * 3] = fbf(this->scaleArray[scaleBase]);
-      scaleArray[i * 3 + 1] = fbf(this->scaleArray[scaleBase + 1]);
-      scaleArray[i * 3 + 2] = fbf(this->scaleArray[scaleBase + 2]);
-   
-      const int rotationBase = i * SplatBuffer::RotationComponentCount;
-      rotationArray[i * 4] = fbf(this->rotationArray[rotationBase]);
-      rotationArray[i * 4 + 1] = fbf(this->rotationArray[rotationBase + 1]);
-      rotationArray[i * 4 + 2] = fbf(this->rotationArray[rotationBase + 2]);
-      rotationArray[i * 4 + 3] = fbf(this->rotationArray[rotationBase + 3]);
-    }
-  }
+                                      int destOffset) const;
 
+  // CovarianceSizeFloats entries per splat (xx, xy, xz, yy, yz, zz), splat i
+  // at destOffset + i. With a transform the covariances are those of the
+  // transformed splats; only its upper 3x3 matters. Decoded and computed in
+  // SoA chunks, 8 or 16 splats per SIMD iteration, chunks in parallel.
   void fillSplatCovarianceArray(std::vector<float>& covarianceArray,
-                                int destOffset) {
-    const int splatCount = this->splatCount;
-    float scale[3] = {0, 0, 0};
-    glm::mat3 rotationMatrix;
-    glm::mat3 covarianceMatrix;
-    glm::mat3 transformedCovariance;
-    glm::mat3 transform3x3;
-    glm::mat3 transform3x3Transpose;
-    glm::mat4 tempMatrix4(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1);
-
-    for (int i = 0; i < splatCount; i++) {
-      const int scaleBase = i * SplatBuffer::ScaleComponentCount;
-      scale[0] = fbf(this->scaleArray[scaleBase]);
-      scale[1] = fbf(this->scaleArray[scaleBase + 1]);
-      scale[2] = fbf(this->scaleArray[scaleBase + 2]);
-      // TODO
-    }
-  }
+                                int destOffset,
+                                const glm::mat4* transform = nullptr) const;
 
   inline void makeRotationFromQuaternion(glm::quat& quaternion,
                                          glm::mat4& matrix) {
@@ -330,5 +223,32 @@
       // TODO: implement application of transform for spherical harmonics
     }
   }
+
+ private:
+  template <typename T>
+  static std::vector<uint8_t> toBytes(const std::vector<T>& bufferData) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SplatBuffer needs raw bytes");
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(bufferData.data());
+    return std::vector<uint8_t>(bytes, bytes + bufferData.size() * sizeof(T));
+  }
+
+  void decodeBlockAt(uint32_t block, const SplatSoA& out,
+                     size_t destBegin) const;
+
+  float getScale(int i) const {
+    return compressionLevel == 0 ? scaleArrayFloat[i] : fbf(scaleArray[i]);
+  }
+  float getRotation(int i) const {
+    return compressionLevel == 0 ? rotationArrayFloat[i]
+                                 : fbf(rotationArray[i]);
+  }
+
+  // At most one of these holds the bytes, none when wrapping caller memory
+  MappedFile file;
+  std::vector<uint8_t> storage;
+  const uint8_t* bytes = nullptr;
+  size_t byteCount = 0;
+  bool valid = false;
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,259 @@
+#include "splatBufferWriter.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+#include "halfFloat.h"
+#include "splatBuffer.h"
+#include "timing.h"
+
+// Ranges below this are split by a single task
+static const uint32_t kMinSplatsPerTask = 16384;
+
+// Header fields, as read by SplatBuffer::linkBufferArrays()
+static void writeHeader(uint8_t* header, uint8_t compressionLevel,
+                        uint32_t splatCount, uint32_t bucketSize,
+                        uint32_t bucketCount, float bucketBlockSize,
+                        uint32_t bytesPerBucket,
+                        uint32_t compressionScaleRange) {
+  std::memset(header, 0, SplatBuffer::HeaderSizeBytes);
+  header[0] = 0;  // version 0.1
+  header[1] = 1;
+  header[3] = compressionLevel;
+  const uint32_t fields[6] = {splatCount, bucketSize, bucketCount, 0,
+                              bytesPerBucket, compressionScaleRange};
+  std::memcpy(header + 4, fields, sizeof(fields));
+  std::memcpy(header + 16, &bucketBlockSize, sizeof(float));
+}
+
+// Reorders `order` so every run of bucketSize entries is a tight group:
+// ranges are split at a multiple of bucketSize along the longest axis of
+// their bounds, a level at a time, until they hold one bucket.
+static void partitionBuckets(const float* centers, uint32_t bucketSize,
+                             std::vector<uint32_t>& order, ThreadPool& pool) {
+  typedef std::pair<uint32_t, uint32_t> Range;
+  std::vector<Range> level = {Range(0, (uint32_t)order.size())};
+  std::vector<std::array<Range, 2>> children;
+  while (!level.empty()) {
+    children.assign(level.size(), std::array<Range, 2>());
+    auto split = [&](size_t r) {
+      const uint32_t begin = level[r].first, end = level[r].second;
+      float lo[3] = {INFINITY, INFINITY, INFINITY};
+      float hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+      for (uint32_t i = begin; i < end; i++)
+        for (int a = 0; a < 3; a++) {
+          lo[a] = std::min(lo[a], centers[3 * order[i] + a]);
+          hi[a] = std::max(hi[a], centers[3 * order[i] + a]);
+        }
+      int axis = 0;
+      for (int a = 1; a < 3; a++)
+        if (hi[a] - lo[a] > hi[axis] - lo[axis])
+          axis = a;
+
+      const uint32_t buckets = (end - begin + bucketSize - 1) / bucketSize;
+      const uint32_t middle = begin + buckets / 2 * bucketSize;
+      std::nth_element(order.begin() + begin, order.begin() + middle,
+                       order.begin() + end, [&](uint32_t a, uint32_t b) {
+                         return centers[3 * a + axis] < centers[3 * b + axis];
+                       });
+      children[r][0] = Range(begin, middle);
+      children[r][1] = Range(middle, end);
+    };
+    // Wide levels split their ranges in parallel; the first few levels
+    // have fewer ranges than threads and run serially
+    pool.parallelFor(level.size(), split);
+
+    std::vector<Range> next;
+    for (const std::array<Range, 2>& pair : children)
+      for (const Range& child : pair)
+        if (child.second - child.first > bucketSize)
+          next.push_back(child);
+    level.swap(next);
+  }
+}
+
+static void writeLevel0(const SplatArrays& splats,
+                        std::vector<uint8_t>& bytes) {
+  const size_t count = splats.size();
+  bytes.resize(SplatBuffer::HeaderSizeBytes + count * 44);
+  writeHeader(bytes.data(), 0, (uint32_t)count, 0, 0, 0.0f, 0,
+              SplatBuffer::levels[0].ScaleRange);
+  uint8_t* out = bytes.data() + SplatBuffer::HeaderSizeBytes;
+  auto append = [&](const void* data, size_t size) {
+    std::memcpy(out, data, size);
+    out += size;
+  };
+  append(splats.centers.data(), count * 12);
+  append(splats.scales.data(), count * 12);
+  append(splats.colors.data(), count * 4);
+  append(splats.rotations.data(), count * 16);
+}
+
+bool writeSplatBuffer(const SplatArrays& splats, std::vector<uint8_t>& bytes,
+                      const SplatBufferWriteOptions& options,
+                      SplatBufferWriteStats* stats, ThreadPool& pool) {
+  const Clock::time_point start = Clock::now();
+  const uint32_t count = splats.size();
+  if (splats.scales.size() != 3 * (size_t)count ||
+      splats.rotations.size() != 4 * (size_t)count ||
+      splats.colors.size() != 4 * (size_t)count) {
+    std::cerr << "Error: splat arrays have different sizes" << std::endl;
+    return false;
+  }
+  if (options.compressionLevel > 1 ||
+      (options.compressionLevel == 1 && options.bucketSize == 0)) {
+    std::cerr << "Error: unsupported splat buffer compression settings"
+              << std::endl;
+    return false;
+  }
+  if (options.compressionLevel == 0) {
+    writeLevel0(splats, bytes);
+    if (stats) {
+      *stats = SplatBufferWriteStats();
+      stats->ms = msSince(start);
+    }
+    return true;
+  }
+
+  const uint32_t bucketSize = options.bucketSize;
+  const uint32_t bucketCount = (count + bucketSize - 1) / bucketSize;
+  const SplatBuffer::CompressionLevels& sizes = SplatBuffer::levels[1];
+  const uint32_t scaleRange = (uint32_t)sizes.ScaleRange;
+  const uint32_t bytesPerBucket = 3 * sizeof(float);
+
+  std::vector<uint32_t> order(count);
+  for (uint32_t i = 0; i < count; i++)
+    order[i] = i;
+  if (!options.keepOrder)
+    partitionBuckets(splats.centers.data(), bucketSize, order, pool);
+
+  // Bucket centers and the largest distance from one, per axis
+  std::vector<float> bucketCenters(3 * (size_t)bucketCount);
+  std::vector<float> bucketExtents(bucketCount);
+  const size_t grain = std::max<size_t>(1, kMinSplatsPerTask / bucketSize);
+  pool.parallelForRange(0, bucketCount, grain, [&](size_t first, size_t last) {
+    for (size_t b = first; b < last; b++) {
+      const uint32_t begin = (uint32_t)b * bucketSize;
+      const uint32_t end = std::min(count, begin + bucketSize);
+      float lo[3] = {INFINITY, INFINITY, INFINITY};
+      float hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+      for (uint32_t i = begin; i < end; i++)
+        for (int a = 0; a < 3; a++) {
+          lo[a] = std::min(lo[a], splats.centers[3 * (size_t)order[i] + a]);
+          hi[a] = std::max(hi[a], splats.centers[3 * (size_t)order[i] + a]);
+        }
+      float extent = 0.0f;
+      for (int a = 0; a < 3; a++) {
+        const float center = 0.5f * (lo[a] + hi[a]);
+        bucketCenters[3 * b + a] = center;
+        extent = std::max(extent, std::max(hi[a] - center, center - lo[a]));
+      }
+      bucketExtents[b] = extent;
+    }
+  });
+
+  float bucketBlockSize = options.bucketBlockSize;
+  if (bucketBlockSize <= 0.0f) {
+    float extent = 0.0f;
+    for (float bucketExtent : bucketExtents)
+      extent = std::max(extent, bucketExtent);
+    // A hair larger, rounding must not push offsets past the range
+    bucketBlockSize = std::max(2.0f * extent * 1.0001f, 1e-6f);
+  }
+  // Same float math as SplatBuffer::linkBufferArrays()
+  const float factor = bucketBlockSize / 2.0f / (float)scaleRange;
+  const float inverseFactor = 1.0f / factor;
+
+  const size_t headerBytes = SplatBuffer::HeaderSizeBytes;
+  bytes.resize(headerBytes + (size_t)count * (sizes.BytesPerCenter +
+                                              sizes.BytesPerScale +
+                                              sizes.BytesPerColor +
+                                              sizes.BytesPerRotation) +
+               (size_t)bucketCount * bytesPerBucket);
+  writeHeader(bytes.data(), 1, count, bucketSize, bucketCount,
+              bucketBlockSize, bytesPerBucket, scaleRange);
+  uint16_t* centersOut =
+      reinterpret_cast<uint16_t*>(bytes.data() + headerBytes);
+  uint16_t* scalesOut = centersOut + 3 * (size_t)count;
+  uint8_t* colorsOut =
+      reinterpret_cast<uint8_t*>(scalesOut + 3 * (size_t)count);
+  uint16_t* rotationsOut =
+      reinterpret_cast<uint16_t*>(colorsOut + 4 * (size_t)count);
+  float* bucketsOut =
+      reinterpret_cast<float*>(rotationsOut + 4 * (size_t)count);
+  std::memcpy(bucketsOut, bucketCenters.data(),
+              bucketCenters.size() * sizeof(float));
+
+  std::vector<uint32_t> clamped(bucketCount, 0);
+  pool.parallelForRange(0, bucketCount, grain, [&](size_t first, size_t last) {
+    float gathered[4 * 256];
+    for (size_t b = first; b < last; b++) {
+      const uint32_t begin = (uint32_t)b * bucketSize;
+      const uint32_t end = std::min(count, begin + bucketSize);
+      const float* bucketCenter = &bucketCenters[3 * b];
+      for (uint32_t i = begin; i < end; i++) {
+        const size_t source = order[i];
+        bool clampedSplat = false;
+        for (int a = 0; a < 3; a++) {
+          const float offset =
+              (splats.centers[3 * source + a] - bucketCenter[a]) *
+              inverseFactor;
+          float q = std::floor(offset + 0.5f) + (float)scaleRange;
+          if (q < 0.0f || q > 2.0f * scaleRange) {
+            q = std::min(std::max(q, 0.0f), 2.0f * scaleRange);
+            clampedSplat = true;
+          }
+          centersOut[3 * (size_t)i + a] = (uint16_t)q;
+        }
+        if (clampedSplat)
+          clamped[b]++;
+        std::memcpy(colorsOut + 4 * (size_t)i, &splats.colors[4 * source], 4);
+      }
+
+      // Halfs through the bulk converter, a slice of the bucket at a time
+      for (uint32_t slice = begin; slice < end; slice += 256) {
+        const uint32_t sliceEnd = std::min(end, slice + 256);
+        const size_t n = sliceEnd - slice;
+        for (uint32_t i = slice; i < sliceEnd; i++)
+          std::memcpy(&gathered[3 * (i - slice)],
+                      &splats.scales[3 * (size_t)order[i]], 3 * sizeof(float));
+        floatToHalf(gathered, scalesOut + 3 * (size_t)slice, 3 * n);
+        for (uint32_t i = slice; i < sliceEnd; i++)
+          std::memcpy(&gathered[4 * (i - slice)],
+                      &splats.rotations[4 * (size_t)order[i]],
+                      4 * sizeof(float));
+        floatToHalf(gathered, rotationsOut + 4 * (size_t)slice, 4 * n);
+      }
+    }
+  });
+
+  if (stats) {
+    stats->bucketCount = bucketCount;
+    stats->bucketBlockSize = bucketBlockSize;
+    stats->clampedSplats = 0;
+    for (uint32_t n : clamped)
+      stats->clampedSplats += n;
+    stats->ms = msSince(start);
+  }
+  return true;
+}
+
+bool writeSplatBuffer(const SplatArrays& splats, const std::string& path,
+                      const SplatBufferWriteOptions& options,
+                      SplatBufferWriteStats* stats, ThreadPool& pool) {
+  std::vector<uint8_t> bytes;
+  if (!writeSplatBuffer(splats, bytes, options, stats, pool))
+    return false;
+  std::ofstream file(path, std::ios::binary);
+  if (!file.write(reinterpret_cast<const char*>(bytes.data()),
+                  (std::streamsize)bytes.size())) {
+    std::cerr << "Error: can't write " << path << std::endl;
+    return false;
+  }
+  return true;
+}
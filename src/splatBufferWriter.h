@@ -0,0 +1,70 @@
+#ifndef SPLATBUFFERWRITER_H
+#define SPLATBUFFERWRITER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "threadPool.h"
+
+// Uncompressed splats as interleaved arrays, the layout of a level 0
+// SplatBuffer file.
+struct SplatArrays {
+  std::vector<float> centers;    // xyz
+  std::vector<float> scales;     // xyz, activated
+  std::vector<float> rotations;  // w, x, y, z, normalized
+  std::vector<uint8_t> colors;   // rgba
+
+  uint32_t size() const { return (uint32_t)(centers.size() / 3); }
+  void resize(uint32_t count) {
+    centers.resize(3 * (size_t)count);
+    scales.resize(3 * (size_t)count);
+    rotations.resize(4 * (size_t)count);
+    colors.resize(4 * (size_t)count);
+  }
+};
+
+struct SplatBufferWriteOptions {
+  uint8_t compressionLevel = 1;
+  uint32_t bucketSize = 256;
+  // Edge of the cube every bucket is quantized over. 0 picks the smallest
+  // one holding every bucket; with a fixed size, splats further than half
+  // of it from their bucket center are clamped.
+  float bucketBlockSize = 0.0f;
+  // Buckets are runs of the given order instead of a kd partition, so the
+  // file keeps the splat indexes. Only tight for input sorted along
+  // SplatCurve::Hilbert (see sortSplats()): Morton order jumps between
+  // octants, and the widest bucket sets bucketBlockSize for all of them.
+  bool keepOrder = false;
+};
+
+struct SplatBufferWriteStats {
+  uint32_t bucketCount = 0;
+  float bucketBlockSize = 0.0f;
+  uint32_t clampedSplats = 0;
+  double ms = 0.0;
+};
+
+// Encodes `splats` as a SplatBuffer file image.
+//
+// Level 1 partitions the splats into buckets of bucketSize that are tight
+// in space: ranges are split in parallel, at a multiple of bucketSize,
+// along the longest axis of their bounds until each holds one bucket. Every
+// bucket is then written on its own task: centers as 16-bit offsets from
+// the bucket center over compressionScaleRange, scales and rotations as
+// half floats. Level 1 files hold the splats in bucket order, not in the
+// order given, unless keepOrder is set. Level 0 writes the arrays as they
+// are.
+bool writeSplatBuffer(const SplatArrays& splats, std::vector<uint8_t>& bytes,
+                      const SplatBufferWriteOptions& options =
+                          SplatBufferWriteOptions(),
+                      SplatBufferWriteStats* stats = nullptr,
+                      ThreadPool& pool = ThreadPool::shared());
+
+bool writeSplatBuffer(const SplatArrays& splats, const std::string& path,
+                      const SplatBufferWriteOptions& options =
+                          SplatBufferWriteOptions(),
+                      SplatBufferWriteStats* stats = nullptr,
+                      ThreadPool& pool = ThreadPool::shared());
+
+#endif
@@ -0,0 +1,183 @@
+#include "splatComposer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+
+#include "splatBuffer.h"
+#include "splatMath.h"
+#include "splatPly.h"
+#include "splatTransform.h"
+#include "timing.h"
+
+// DC term of the shader.vs SH basis, colors become sh[0]
+static const float SH_C0 = 0.28209479177387814f;
+// Splats per decode range, across file boundaries
+static const size_t kMinSplatsPerTask = 16384;
+
+static bool isPly(const std::string& path) {
+  if (path.size() < 4)
+    return false;
+  std::string extension = path.substr(path.size() - 4);
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](char c) { return (char)std::tolower((unsigned char)c); });
+  return extension == ".ply";
+}
+
+struct SceneSource {
+  std::unique_ptr<SplatPlyReader> ply;
+  std::unique_ptr<SplatBuffer> buffer;
+  std::unique_ptr<SplatTransform> transform;
+  uint32_t splatCount = 0;
+  uint32_t blockSize = 0;
+  uint32_t blockCount = 0;
+  uint32_t firstSplat = 0;
+  size_t firstBlock = 0;  // in the loop over the blocks of every file
+  bool ok = false;
+};
+
+void decodeSplatBufferBlock(const SplatBuffer& buffer, uint32_t block,
+                            GpuSplat* splats,
+                            const SplatTransform* transform) {
+  // SplatBuffer files hold activated scales and rotations and rgba colors
+  static thread_local std::vector<float> scratch;
+  static thread_local std::vector<uint8_t> colorScratch;
+  const uint32_t blockSize = buffer.getDecodeBlockSize();
+  const uint32_t n =
+      std::min(buffer.getSplatCount() - block * blockSize, blockSize);
+  scratch.resize(16 * (size_t)blockSize);
+  colorScratch.resize(4 * (size_t)blockSize);
+
+  SplatSoA soa;
+  float* columns[16];
+  for (int c = 0; c < 16; c++)
+    columns[c] = scratch.data() + (size_t)c * blockSize;
+  for (int c = 0; c < 3; c++) {
+    soa.center[c] = columns[c];
+    soa.scale[c] = columns[3 + c];
+  }
+  for (int c = 0; c < 4; c++) {
+    soa.rotation[c] = columns[6 + c];
+    soa.color[c] = colorScratch.data() + (size_t)c * blockSize;
+  }
+  buffer.decodeBlockCompact(block, soa);
+
+  if (transform && transform->isIdentity())
+    transform = nullptr;
+  computeCovariances(soa.scale, soa.rotation, columns + 10, n,
+                     transform ? transform->getLinear() : nullptr);
+
+  for (uint32_t i = 0; i < n; i++) {
+    GpuSplat splat = GpuSplat();
+    for (int c = 0; c < 3; c++) {
+      splat.center[c] = soa.center[c][i];
+      splat.covA[c] = columns[10 + c][i];
+      splat.covB[c] = columns[13 + c][i];
+      splat.sh[0][c] = (soa.color[c][i] / 255.0f - 0.5f) / SH_C0;
+    }
+    splat.alpha = soa.color[3][i] / 255.0f;
+    if (transform)
+      transform->transformCenter(splat.center);
+    splats[i] = splat;
+  }
+}
+
+bool composeSplatScene(const std::vector<SplatSceneFile>& files,
+                       std::vector<GpuSplat>& splats, SplatComposeStats* stats,
+                       ThreadPool& pool) {
+  const Clock::time_point start = Clock::now();
+
+  std::vector<SceneSource> sources(files.size());
+  pool.parallelFor(files.size(), [&](size_t f) {
+    SceneSource& source = sources[f];
+    source.transform.reset(new SplatTransform(files[f].transform));
+    if (isPly(files[f].path)) {
+      source.ply.reset(new SplatPlyReader());
+      if (!source.ply->open(files[f].path))
+        return;
+      source.splatCount = source.ply->getSplatCount();
+      source.blockSize = SplatPlyReader::BlockSize;
+      source.blockCount = source.ply->getBlockCount();
+    } else {
+      source.buffer.reset(new SplatBuffer(files[f].path));
+      if (!source.buffer->isValid()) {
+        std::cerr << "Error: can't read splat file " << files[f].path
+                  << std::endl;
+        return;
+      }
+      source.splatCount = source.buffer->getSplatCount();
+      source.blockSize = source.buffer->getDecodeBlockSize();
+      source.blockCount = source.buffer->getDecodeBlockCount();
+    }
+    source.ok = true;
+  });
+
+  // Ranges of the merged buffer and of the block loop
+  uint64_t splatCount = 0;
+  size_t blockCount = 0;
+  uint32_t maxBlockSize = 0;
+  for (SceneSource& source : sources) {
+    if (!source.ok)
+      return false;
+    source.firstSplat = (uint32_t)splatCount;
+    source.firstBlock = blockCount;
+    splatCount += source.splatCount;
+    blockCount += source.blockCount;
+    maxBlockSize = std::max(maxBlockSize, source.blockSize);
+  }
+  if (splatCount > UINT32_MAX) {
+    std::cerr << "Error: composed scene has more than 2^32 splats"
+              << std::endl;
+    return false;
+  }
+  const double openMs = msSince(start);
+
+  const Clock::time_point decodeStart = Clock::now();
+  splats.clear();
+  splats.resize((size_t)splatCount);
+  const size_t grain =
+      std::max<size_t>(1, kMinSplatsPerTask / std::max(1u, maxBlockSize));
+  pool.parallelForRange(0, blockCount, grain, [&](size_t first, size_t last) {
+    // Source of the first block, then walk forward
+    size_t s = std::upper_bound(sources.begin(), sources.end(), first,
+                                [](size_t block, const SceneSource& source) {
+                                  return block < source.firstBlock;
+                                }) -
+               sources.begin() - 1;
+    for (size_t b = first; b < last; b++) {
+      while (b >= sources[s].firstBlock + sources[s].blockCount)
+        s++;
+      const SceneSource& source = sources[s];
+      const uint32_t block = (uint32_t)(b - source.firstBlock);
+      const SplatTransform* transform =
+          source.transform->isIdentity() ? nullptr : source.transform.get();
+      if (source.ply)
+        source.ply->decodeBlock(block, splats.data() + source.firstSplat,
+                                nullptr, transform);
+      else
+        decodeSplatBufferBlock(
+            *source.buffer, block,
+            splats.data() + source.firstSplat +
+                (size_t)block * source.blockSize,
+            transform);
+    }
+  });
+
+  if (stats) {
+    stats->splatCount = (uint32_t)splatCount;
+    stats->files.clear();
+    for (const SceneSource& source : sources) {
+      SplatSceneFileInfo info;
+      info.firstSplat = source.firstSplat;
+      info.splatCount = source.splatCount;
+      info.shDegree = source.ply ? source.ply->getShDegree() : 0;
+      stats->files.push_back(info);
+    }
+    stats->openMs = openMs;
+    stats->decodeMs = msSince(decodeStart);
+    stats->ms = msSince(start);
+  }
+  return true;
+}
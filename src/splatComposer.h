@@ -0,0 +1,59 @@
+#ifndef SPLATCOMPOSER_H
+#define SPLATCOMPOSER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "gpuSplat.h"
+#include "threadPool.h"
+
+class SplatBuffer;
+class SplatTransform;
+
+// One capture placed in the composed scene. Files ending in .ply are read
+// as trained splat PLYs (see loadSplatPly()), anything else as SplatBuffer.
+struct SplatSceneFile {
+  std::string path;
+  glm::mat4 transform = glm::mat4(1.0f);
+};
+
+struct SplatSceneFileInfo {
+  // Splats [firstSplat, firstSplat + splatCount) of the composed buffer
+  uint32_t firstSplat = 0;
+  uint32_t splatCount = 0;
+  int shDegree = 0;
+};
+
+struct SplatComposeStats {
+  uint32_t splatCount = 0;
+  std::vector<SplatSceneFileInfo> files;
+  double openMs = 0.0;  // mapping files and reading headers
+  double decodeMs = 0.0;
+  double ms = 0.0;
+};
+
+// Merges `files` into one shader.vs buffer, in the order given.
+//
+// Every file is mapped and its header read first, files in parallel, so the
+// merged buffer is sized once and each file gets its own range of it. The
+// decode blocks of all files (SplatBuffer buckets, PLY blocks) then form a
+// single parallel loop: rooms decode concurrently and a small file does not
+// leave threads idle. Each splat is moved by its file's transform as it is
+// written: center, covariance and SH rotation (see SplatTransform).
+// Returns false, with nothing composed, if any file cannot be read.
+bool composeSplatScene(const std::vector<SplatSceneFile>& files,
+                       std::vector<GpuSplat>& splats,
+                       SplatComposeStats* stats = nullptr,
+                       ThreadPool& pool = ThreadPool::shared());
+
+// Decodes block `block` of `buffer` (see SplatBuffer::getDecodeBlockSize())
+// into shader.vs records, splat i of the block landing at splats[i]. Colors
+// become the DC term and alpha. Safe to call concurrently.
+void decodeSplatBufferBlock(const SplatBuffer& buffer, uint32_t block,
+                            GpuSplat* splats,
+                            const SplatTransform* transform = nullptr);
+
+#endif
@@ -0,0 +1,389 @@
+#include "splatCull.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "simd.h"
+#include "timing.h"
+
+
+// Everything one cull kernel call needs, rows of projection * view
+struct CullParams {
+  const float* x;
+  const float* y;
+  const float* z;
+  const float* alpha;
+  const float* radius;
+  const uint32_t* indexes;  // null: splat i is index i
+  float rows[4][4];
+  float minAlpha;
+  float minRadius;  // pixels over focal length, compared at depth w
+  bool testSize;
+};
+
+// What one range dropped, by reason; the first failing test counts.
+struct CullCounts {
+  uint32_t outside = 0;
+  uint32_t transparent = 0;
+  uint32_t small = 0;
+};
+
+static uint32_t cullScalar(const CullParams& p, uint32_t begin, uint32_t end,
+                           uint32_t* out, CullCounts& counts) {
+  uint32_t kept = 0;
+  for (uint32_t i = begin; i < end; i++) {
+    const uint32_t s = p.indexes ? p.indexes[i] : i;
+    const float x = p.x[s], y = p.y[s], z = p.z[s];
+    float clip[4];
+    for (int r = 0; r < 4; r++)
+      clip[r] = p.rows[r][0] * x + p.rows[r][1] * y + p.rows[r][2] * z +
+                p.rows[r][3];
+    const float bounds = 1.2f * clip[3];
+    if (!(clip[2] >= -clip[3] && clip[0] >= -bounds && clip[0] <= bounds &&
+          clip[1] >= -bounds && clip[1] <= bounds)) {
+      counts.outside++;
+      continue;
+    }
+    if (!(p.alpha[s] >= p.minAlpha)) {
+      counts.transparent++;
+      continue;
+    }
+    if (p.testSize && !(p.radius[s] >= p.minRadius * clip[3])) {
+      counts.small++;
+      continue;
+    }
+    out[kept++] = s;
+  }
+  return kept;
+}
+
+#if defined(SPLAT_X86_DISPATCH) || defined(SPLAT_WASM_SIMD)
+
+// Appends the lanes set in all three masks and counts why the others were
+// dropped, lane k being entry first + k.
+static inline uint32_t emitLanes(const CullParams& p, uint32_t first,
+                                 int lanes, unsigned inside, unsigned opaque,
+                                 unsigned large, uint32_t* out,
+                                 CullCounts& counts) {
+  const unsigned all = (1u << lanes) - 1;
+  counts.outside += __builtin_popcount(~inside & all);
+  counts.transparent += __builtin_popcount(inside & ~opaque & all);
+  unsigned keep = inside & opaque;
+  counts.small += __builtin_popcount(keep & ~large & all);
+  keep &= large;
+  uint32_t kept = 0;
+  while (keep) {
+    const int lane = __builtin_ctz(keep);
+    out[kept++] = p.indexes ? p.indexes[first + lane] : first + lane;
+    keep &= keep - 1;
+  }
+  return kept;
+}
+
+#endif
+
+#if defined(SPLAT_X86_DISPATCH)
+
+// Same operation order as cullScalar(), no FMA, so every path keeps the
+// same splats
+SPLAT_TARGET_AVX2 static uint32_t cullAVX2(const CullParams& p,
+                                           uint32_t begin, uint32_t end,
+                                           uint32_t* out, CullCounts& counts) {
+  __m256 rows[4][4];
+  for (int r = 0; r < 4; r++)
+    for (int c = 0; c < 4; c++)
+      rows[r][c] = _mm256_set1_ps(p.rows[r][c]);
+  const __m256 guard = _mm256_set1_ps(1.2f);
+  const __m256 minAlpha = _mm256_set1_ps(p.minAlpha);
+  const __m256 minRadius = _mm256_set1_ps(p.minRadius);
+
+  uint32_t kept = 0;
+  uint32_t i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m256 x, y, z, alpha, radius;
+    if (p.indexes) {
+      const __m256i index =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p.indexes + i));
+      x = _mm256_i32gather_ps(p.x, index, 4);
+      y = _mm256_i32gather_ps(p.y, index, 4);
+      z = _mm256_i32gather_ps(p.z, index, 4);
+      alpha = _mm256_i32gather_ps(p.alpha, index, 4);
+      radius = _mm256_i32gather_ps(p.radius, index, 4);
+    } else {
+      x = _mm256_loadu_ps(p.x + i);
+      y = _mm256_loadu_ps(p.y + i);
+      z = _mm256_loadu_ps(p.z + i);
+      alpha = _mm256_loadu_ps(p.alpha + i);
+      radius = _mm256_loadu_ps(p.radius + i);
+    }
+    __m256 clip[4];
+    for (int r = 0; r < 4; r++)
+      clip[r] = _mm256_add_ps(
+          _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rows[r][0], x),
+                                      _mm256_mul_ps(rows[r][1], y)),
+                        _mm256_mul_ps(rows[r][2], z)),
+          rows[r][3]);
+    const __m256 bounds = _mm256_mul_ps(guard, clip[3]);
+    const __m256 negativeBounds =
+        _mm256_sub_ps(_mm256_setzero_ps(), bounds);
+    __m256 inside = _mm256_cmp_ps(
+        clip[2], _mm256_sub_ps(_mm256_setzero_ps(), clip[3]), _CMP_GE_OQ);
+    inside = _mm256_and_ps(inside,
+                           _mm256_cmp_ps(clip[0], negativeBounds, _CMP_GE_OQ));
+    inside = _mm256_and_ps(inside, _mm256_cmp_ps(clip[0], bounds, _CMP_LE_OQ));
+    inside = _mm256_and_ps(inside,
+                           _mm256_cmp_ps(clip[1], negativeBounds, _CMP_GE_OQ));
+    inside = _mm256_and_ps(inside, _mm256_cmp_ps(clip[1], bounds, _CMP_LE_OQ));
+    const __m256 opaque = _mm256_cmp_ps(alpha, minAlpha, _CMP_GE_OQ);
+    const unsigned large =
+        p.testSize ? (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(
+                         radius, _mm256_mul_ps(minRadius, clip[3]),
+                         _CMP_GE_OQ))
+                   : 0xffu;
+    kept += emitLanes(p, i, 8, (unsigned)_mm256_movemask_ps(inside),
+                      (unsigned)_mm256_movemask_ps(opaque), large, out + kept,
+                      counts);
+  }
+  return kept + cullScalar(p, i, end, out + kept, counts);
+}
+
+SPLAT_TARGET_SSE41 static uint32_t cullSSE41(const CullParams& p,
+                                             uint32_t begin, uint32_t end,
+                                             uint32_t* out,
+                                             CullCounts& counts) {
+  __m128 rows[4][4];
+  for (int r = 0; r < 4; r++)
+    for (int c = 0; c < 4; c++)
+      rows[r][c] = _mm_set1_ps(p.rows[r][c]);
+  const __m128 guard = _mm_set1_ps(1.2f);
+  const __m128 minAlpha = _mm_set1_ps(p.minAlpha);
+  const __m128 minRadius = _mm_set1_ps(p.minRadius);
+
+  uint32_t kept = 0;
+  uint32_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m128 x, y, z, alpha, radius;
+    if (p.indexes) {
+      const uint32_t* s = p.indexes + i;
+      x = _mm_setr_ps(p.x[s[0]], p.x[s[1]], p.x[s[2]], p.x[s[3]]);
+      y = _mm_setr_ps(p.y[s[0]], p.y[s[1]], p.y[s[2]], p.y[s[3]]);
+      z = _mm_setr_ps(p.z[s[0]], p.z[s[1]], p.z[s[2]], p.z[s[3]]);
+      alpha = _mm_setr_ps(p.alpha[s[0]], p.alpha[s[1]], p.alpha[s[2]],
+                          p.alpha[s[3]]);
+      radius = _mm_setr_ps(p.radius[s[0]], p.radius[s[1]], p.radius[s[2]],
+                           p.radius[s[3]]);
+    } else {
+      x = _mm_loadu_ps(p.x + i);
+      y = _mm_loadu_ps(p.y + i);
+      z = _mm_loadu_ps(p.z + i);
+      alpha = _mm_loadu_ps(p.alpha + i);
+      radius = _mm_loadu_ps(p.radius + i);
+    }
+    __m128 clip[4];
+    for (int r = 0; r < 4; r++)
+      clip[r] = _mm_add_ps(
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(rows[r][0], x),
+                                _mm_mul_ps(rows[r][1], y)),
+                     _mm_mul_ps(rows[r][2], z)),
+          rows[r][3]);
+    const __m128 bounds = _mm_mul_ps(guard, clip[3]);
+    const __m128 negativeBounds = _mm_sub_ps(_mm_setzero_ps(), bounds);
+    __m128 inside =
+        _mm_cmpge_ps(clip[2], _mm_sub_ps(_mm_setzero_ps(), clip[3]));
+    inside = _mm_and_ps(inside, _mm_cmpge_ps(clip[0], negativeBounds));
+    inside = _mm_and_ps(inside, _mm_cmple_ps(clip[0], bounds));
+    inside = _mm_and_ps(inside, _mm_cmpge_ps(clip[1], negativeBounds));
+    inside = _mm_and_ps(inside, _mm_cmple_ps(clip[1], bounds));
+    const __m128 opaque = _mm_cmpge_ps(alpha, minAlpha);
+    const unsigned large =
+        p.testSize ? (unsigned)_mm_movemask_ps(_mm_cmpge_ps(
+                         radius, _mm_mul_ps(minRadius, clip[3])))
+                   : 0xfu;
+    kept += emitLanes(p, i, 4, (unsigned)_mm_movemask_ps(inside),
+                      (unsigned)_mm_movemask_ps(opaque), large, out + kept,
+                      counts);
+  }
+  return kept + cullScalar(p, i, end, out + kept, counts);
+}
+
+#elif defined(SPLAT_WASM_SIMD)
+
+static uint32_t cullWasm(const CullParams& p, uint32_t begin, uint32_t end,
+                         uint32_t* out, CullCounts& counts) {
+  v128_t rows[4][4];
+  for (int r = 0; r < 4; r++)
+    for (int c = 0; c < 4; c++)
+      rows[r][c] = wasm_f32x4_splat(p.rows[r][c]);
+  const v128_t guard = wasm_f32x4_splat(1.2f);
+  const v128_t minAlpha = wasm_f32x4_splat(p.minAlpha);
+  const v128_t minRadius = wasm_f32x4_splat(p.minRadius);
+
+  uint32_t kept = 0;
+  uint32_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    v128_t x, y, z, alpha, radius;
+    if (p.indexes) {
+      const uint32_t* s = p.indexes + i;
+      x = wasm_f32x4_make(p.x[s[0]], p.x[s[1]], p.x[s[2]], p.x[s[3]]);
+      y = wasm_f32x4_make(p.y[s[0]], p.y[s[1]], p.y[s[2]], p.y[s[3]]);
+      z = wasm_f32x4_make(p.z[s[0]], p.z[s[1]], p.z[s[2]], p.z[s[3]]);
+      alpha = wasm_f32x4_make(p.alpha[s[0]], p.alpha[s[1]], p.alpha[s[2]],
+                              p.alpha[s[3]]);
+      radius = wasm_f32x4_make(p.radius[s[0]], p.radius[s[1]],
+                               p.radius[s[2]], p.radius[s[3]]);
+    } else {
+      x = wasm_v128_load(p.x + i);
+      y = wasm_v128_load(p.y + i);
+      z = wasm_v128_load(p.z + i);
+      alpha = wasm_v128_load(p.alpha + i);
+      radius = wasm_v128_load(p.radius + i);
+    }
+    v128_t clip[4];
+    for (int r = 0; r < 4; r++)
+      clip[r] = wasm_f32x4_add(
+          wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(rows[r][0], x),
+                                        wasm_f32x4_mul(rows[r][1], y)),
+                         wasm_f32x4_mul(rows[r][2], z)),
+          rows[r][3]);
+    const v128_t bounds = wasm_f32x4_mul(guard, clip[3]);
+    const v128_t negativeBounds = wasm_f32x4_neg(bounds);
+    v128_t inside = wasm_f32x4_ge(clip[2], wasm_f32x4_neg(clip[3]));
+    inside = wasm_v128_and(inside, wasm_f32x4_ge(clip[0], negativeBounds));
+    inside = wasm_v128_and(inside, wasm_f32x4_le(clip[0], bounds));
+    inside = wasm_v128_and(inside, wasm_f32x4_ge(clip[1], negativeBounds));
+    inside = wasm_v128_and(inside, wasm_f32x4_le(clip[1], bounds));
+    const v128_t opaque = wasm_f32x4_ge(alpha, minAlpha);
+    const unsigned large =
+        p.testSize ? (unsigned)wasm_i32x4_bitmask(wasm_f32x4_ge(
+                         radius, wasm_f32x4_mul(minRadius, clip[3])))
+                   : 0xfu;
+    kept += emitLanes(p, i, 4, (unsigned)wasm_i32x4_bitmask(inside),
+                      (unsigned)wasm_i32x4_bitmask(opaque), large, out + kept,
+                      counts);
+  }
+  return kept + cullScalar(p, i, end, out + kept, counts);
+}
+
+#endif
+
+static uint32_t cullRange(const CullParams& p, uint32_t begin, uint32_t end,
+                          uint32_t* out, CullCounts& counts) {
+#if defined(SPLAT_X86_DISPATCH)
+  if (simd::hasAVX2())
+    return cullAVX2(p, begin, end, out, counts);
+  if (simd::hasSSE41())
+    return cullSSE41(p, begin, end, out, counts);
+#elif defined(SPLAT_WASM_SIMD)
+  return cullWasm(p, begin, end, out, counts);
+#endif
+  return cullScalar(p, begin, end, out, counts);
+}
+
+SplatCuller::SplatCuller(ThreadPool& pool) : pool(pool) {}
+
+void SplatCuller::setSplats(const GpuSplat* splats, uint32_t count) {
+  for (int c = 0; c < 3; c++)
+    centers[c].resize(count);
+  alphas.resize(count);
+  radii.resize(count);
+  pool.parallelForRange(0, count, ThreadPool::kDefaultGrain,
+                        [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; i++) {
+      const GpuSplat& splat = splats[i];
+      for (int c = 0; c < 3; c++)
+        centers[c][i] = splat.center[c];
+      alphas[i] = splat.alpha;
+      const float trace = splat.covA[0] + splat.covB[0] + splat.covB[2];
+      radii[i] = 3.0f * std::sqrt(std::max(trace, 0.0f));
+    }
+  });
+}
+
+uint32_t SplatCuller::cull(const SplatCamera& camera,
+                           const SplatCullSettings& settings,
+                           std::vector<uint32_t>& indexesOut,
+                           const uint32_t* indexes, uint32_t count,
+                           SplatCullStats* stats) {
+  const Clock::time_point start = Clock::now();
+  if (!indexes)
+    count = getSplatCount();
+
+  CullParams params;
+  params.x = centers[0].data();
+  params.y = centers[1].data();
+  params.z = centers[2].data();
+  params.alpha = alphas.data();
+  params.radius = radii.data();
+  params.indexes = indexes;
+  const glm::mat4 viewProj = camera.projection * camera.view;
+  for (int r = 0; r < 4; r++)
+    for (int c = 0; c < 4; c++)
+      params.rows[r][c] = viewProj[c][r];
+  params.minAlpha = settings.minAlpha;
+  const float focal = std::max(camera.focal.x, camera.focal.y);
+  params.testSize = settings.minRadiusPixels > 0.0f;
+  params.minRadius = settings.minRadiusPixels / focal;
+
+  // Every task compacts into the start of its own range of the output
+  indexesOut.resize(count);
+  const size_t tasks = std::max<size_t>(
+      1, std::min<size_t>(pool.getThreadCount(),
+                          count / ThreadPool::kDefaultGrain));
+  const uint32_t taskSize = (uint32_t)((count + tasks - 1) / tasks);
+  taskKept.assign(tasks, 0);
+  std::vector<CullCounts> taskCounts(tasks);
+  pool.parallelFor(tasks, [&](size_t t) {
+    const uint32_t begin = std::min<uint32_t>(count, t * taskSize);
+    const uint32_t end = std::min<uint32_t>(count, begin + taskSize);
+    taskKept[t] = cullRange(params, begin, end, indexesOut.data() + begin,
+                            taskCounts[t]);
+  });
+
+  // Parts only ever move down, in task order nothing is overwritten unread
+  uint32_t kept = taskKept[0];
+  for (size_t t = 1; t < tasks; t++) {
+    const uint32_t begin = std::min<uint32_t>(count, t * taskSize);
+    std::memmove(indexesOut.data() + kept, indexesOut.data() + begin,
+                 taskKept[t] * sizeof(uint32_t));
+    kept += taskKept[t];
+  }
+  indexesOut.resize(kept);
+
+  // Compared with the last output in parallel, copied only when it differs
+  changed = kept != previousKept.size();
+  if (!changed && kept > 0) {
+    const size_t compareTasks = std::max<size_t>(
+        1, std::min<size_t>(pool.getThreadCount(),
+                            kept / ThreadPool::kDefaultGrain));
+    const uint32_t compareSize =
+        (uint32_t)((kept + compareTasks - 1) / compareTasks);
+    taskChanged.assign(compareTasks, 0);
+    pool.parallelFor(compareTasks, [&](size_t t) {
+      const uint32_t begin = std::min<uint32_t>(kept, t * compareSize);
+      const uint32_t end = std::min<uint32_t>(kept, begin + compareSize);
+      taskChanged[t] = std::memcmp(indexesOut.data() + begin,
+                                   previousKept.data() + begin,
+                                   (end - begin) * sizeof(uint32_t)) != 0;
+    });
+    changed = std::find(taskChanged.begin(), taskChanged.end(), 1) !=
+              taskChanged.end();
+  }
+  if (changed)
+    previousKept.assign(indexesOut.begin(), indexesOut.end());
+
+  if (stats) {
+    *stats = SplatCullStats();
+    stats->inputSplats = count;
+    for (const CullCounts& counts : taskCounts) {
+      stats->outsideSplats += counts.outside;
+      stats->transparentSplats += counts.transparent;
+      stats->smallSplats += counts.small;
+    }
+    stats->sortCount = kept;
+    stats->renderCount = kept;
+    stats->changed = changed;
+    stats->ms = msSince(start);
+  }
+  return kept;
+}
@@ -0,0 +1,78 @@
+#ifndef SPLATCULL_H
+#define SPLATCULL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "gpuSplat.h"
+#include "splatRasterizer.h"
+#include "threadPool.h"
+
+struct SplatCullSettings {
+  // Splats whose 3 sigma radius covers fewer pixels on screen are dropped,
+  // before the 0.3 pixel dilation of shader.vs. 0 keeps every size.
+  float minRadiusPixels = 0.0f;
+  // Splats below this opacity are dropped
+  float minAlpha = 1.0f / 255.0f;
+};
+
+struct SplatCullStats {
+  uint32_t inputSplats = 0;
+  uint32_t outsideSplats = 0;  // off screen or behind the near plane
+  uint32_t transparentSplats = 0;
+  uint32_t smallSplats = 0;
+  // For sortIndexes(): every kept splat needs sorting
+  uint32_t sortCount = 0;
+  uint32_t renderCount = 0;
+  bool changed = false;  // see SplatCuller::hasChanged()
+  double ms = 0.0;
+};
+
+// Drops the splats shader.vs would throw away, and those too faint or too
+// small to matter, before they reach the sort.
+//
+// setSplats() keeps what the test needs in a compact SoA copy, 20 bytes
+// per splat: center, alpha and 3 sqrt(trace) of the covariance, a world
+// space radius at least as long as the largest 3 sigma axis. cull()
+// then streams through it with 8 (AVX2) or 4 (SSE4.1, WASM SIMD) splats per
+// step: the center goes through projection * view and is tested against
+// the clip volume with the 1.2x guard band on x/y and the near plane of
+// shader.vs, the radius against `minRadiusPixels` at its depth, clip w.
+// Ranges are culled in parallel, each compacted into its own part of the
+// output, and the parts are then moved together.
+class SplatCuller {
+ public:
+  explicit SplatCuller(ThreadPool& pool = ThreadPool::shared());
+
+  // Call again whenever the splats change.
+  void setSplats(const GpuSplat* splats, uint32_t count);
+  uint32_t getSplatCount() const { return (uint32_t)alphas.size(); }
+
+  // Writes to `indexesOut` the kept splats among `indexes` (count of them,
+  // e.g. from SplatTree::getVisibleIndexes()), or among all splats when
+  // `indexes` is null, in input order. Returns how many were kept, both the
+  // sortCount and renderCount for sortIndexes().
+  uint32_t cull(const SplatCamera& camera, const SplatCullSettings& settings,
+                std::vector<uint32_t>& indexesOut,
+                const uint32_t* indexes = nullptr, uint32_t count = 0,
+                SplatCullStats* stats = nullptr);
+
+  // Whether the last cull() kept other splats than the one before it. The
+  // coherent sort only notices new arrays or counts, so call
+  // SortEngine::invalidate() when this is set.
+  bool hasChanged() const { return changed; }
+
+ private:
+  ThreadPool& pool;
+  std::vector<float> centers[3];
+  std::vector<float> alphas;
+  std::vector<float> radii;
+  std::vector<uint32_t> taskKept;
+  std::vector<uint8_t> taskChanged;
+  // Output of the last cull()
+  std::vector<uint32_t> previousKept;
+  bool changed = true;
+};
+
+#endif
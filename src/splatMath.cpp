@@ -0,0 +1,298 @@
+#include "splatMath.h"
+
+#include <cmath>
+
+#include "simd.h"
+
+static void activateScalesScalar(float* values, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    values[i] = std::exp(values[i]);
+}
+
+static void activateOpacitiesScalar(float* values, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    values[i] = 1.0f / (1.0f + std::exp(-values[i]));
+}
+
+static void computeCovariancesScalar(const float* const scale[3],
+                                     const float* const rotation[4],
+                                     float* const covariance[6],
+                                     const float* transform, size_t begin,
+                                     size_t end) {
+  for (size_t i = begin; i < end; i++) {
+    float w = rotation[0][i], x = rotation[1][i], y = rotation[2][i],
+          z = rotation[3][i];
+    const float length = std::sqrt(w * w + x * x + y * y + z * z);
+    const float inverse = length > 0.0f ? 1.0f / length : 0.0f;
+    w *= inverse, x *= inverse, y *= inverse, z *= inverse;
+    if (length == 0.0f)
+      w = 1.0f;
+
+    // M = R S, then covariance = M M^T
+    const float sx = scale[0][i], sy = scale[1][i], sz = scale[2][i];
+    float m[3][3] = {
+        {(1.0f - 2.0f * (y * y + z * z)) * sx, 2.0f * (x * y - w * z) * sy,
+         2.0f * (x * z + w * y) * sz},
+        {2.0f * (x * y + w * z) * sx, (1.0f - 2.0f * (x * x + z * z)) * sy,
+         2.0f * (y * z - w * x) * sz},
+        {2.0f * (x * z - w * y) * sx, 2.0f * (y * z + w * x) * sy,
+         (1.0f - 2.0f * (x * x + y * y)) * sz}};
+    if (transform) {
+      // M = T R S, T[r][k] is transform[k * 3 + r]
+      const float r[3][3] = {{m[0][0], m[0][1], m[0][2]},
+                             {m[1][0], m[1][1], m[1][2]},
+                             {m[2][0], m[2][1], m[2][2]}};
+      for (int row = 0; row < 3; row++)
+        for (int col = 0; col < 3; col++)
+          m[row][col] = transform[row] * r[0][col] +
+                        transform[3 + row] * r[1][col] +
+                        transform[6 + row] * r[2][col];
+    }
+    const int rows[6][2] = {{0, 0}, {0, 1}, {0, 2}, {1, 1}, {1, 2}, {2, 2}};
+    for (int k = 0; k < 6; k++) {
+      const float* a = m[rows[k][0]];
+      const float* b = m[rows[k][1]];
+      covariance[k][i] = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+  }
+}
+
+#if defined(SPLAT_X86_DISPATCH)
+
+// Cephes style exp: 2^n * p(r) with n = round(x / ln 2), about 1 ulp.
+SPLAT_TARGET_AVX2_FMA static inline __m256 exp8(__m256 x) {
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.3f)),
+                    _mm256_set1_ps(88.3f));
+  const __m256 n = _mm256_round_ps(
+      _mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+  r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+
+  __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+  p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r),
+                      _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+  const __m256i pow2n = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(pow2n));
+}
+
+SPLAT_TARGET_AVX2_FMA static void activateScalesAVX2(float* values,
+                                                     size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+    _mm256_storeu_ps(values + i, exp8(_mm256_loadu_ps(values + i)));
+  activateScalesScalar(values + i, count - i);
+}
+
+SPLAT_TARGET_AVX2_FMA static void activateOpacitiesAVX2(float* values,
+                                                        size_t count) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 x = _mm256_loadu_ps(values + i);
+    const __m256 e = exp8(_mm256_sub_ps(_mm256_setzero_ps(), x));
+    _mm256_storeu_ps(values + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+  }
+  activateOpacitiesScalar(values + i, count - i);
+}
+
+SPLAT_TARGET_AVX2_FMA static inline __m256 dot3(__m256 a0, __m256 a1,
+                                                __m256 a2, __m256 b0,
+                                                __m256 b1, __m256 b2) {
+  return _mm256_fmadd_ps(a0, b0,
+                         _mm256_fmadd_ps(a1, b1, _mm256_mul_ps(a2, b2)));
+}
+
+SPLAT_TARGET_AVX2_FMA static void computeCovariancesAVX2(
+    const float* const scale[3], const float* const rotation[4],
+    float* const covariance[6], const float* transform, size_t count) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  const __m256 zero = _mm256_setzero_ps();
+  __m256 t[9];
+  if (transform)
+    for (int k = 0; k < 9; k++)
+      t[k] = _mm256_set1_ps(transform[k]);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 w = _mm256_loadu_ps(rotation[0] + i);
+    __m256 x = _mm256_loadu_ps(rotation[1] + i);
+    __m256 y = _mm256_loadu_ps(rotation[2] + i);
+    __m256 z = _mm256_loadu_ps(rotation[3] + i);
+    const __m256 length2 = _mm256_fmadd_ps(
+        w, w, _mm256_fmadd_ps(x, x, _mm256_fmadd_ps(y, y, _mm256_mul_ps(z, z))));
+    // Exact division, rsqrt alone is only good to 12 bits
+    const __m256 degenerate = _mm256_cmp_ps(length2, zero, _CMP_EQ_OQ);
+    const __m256 inverse = _mm256_andnot_ps(
+        degenerate, _mm256_div_ps(one, _mm256_sqrt_ps(length2)));
+    w = _mm256_or_ps(_mm256_mul_ps(w, inverse), _mm256_and_ps(degenerate, one));
+    x = _mm256_mul_ps(x, inverse);
+    y = _mm256_mul_ps(y, inverse);
+    z = _mm256_mul_ps(z, inverse);
+
+    const __m256 sx = _mm256_loadu_ps(scale[0] + i);
+    const __m256 sy = _mm256_loadu_ps(scale[1] + i);
+    const __m256 sz = _mm256_loadu_ps(scale[2] + i);
+    const __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y),
+                 zz = _mm256_mul_ps(z, z);
+    const __m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z),
+                 yz = _mm256_mul_ps(y, z);
+    const __m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y),
+                 wz = _mm256_mul_ps(w, z);
+
+    __m256 m[3][3];
+    m[0][0] = _mm256_mul_ps(
+        _mm256_fnmadd_ps(two, _mm256_add_ps(yy, zz), one), sx);
+    m[0][1] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), sy);
+    m[0][2] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), sz);
+    m[1][0] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), sx);
+    m[1][1] = _mm256_mul_ps(
+        _mm256_fnmadd_ps(two, _mm256_add_ps(xx, zz), one), sy);
+    m[1][2] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), sz);
+    m[2][0] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), sx);
+    m[2][1] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), sy);
+    m[2][2] = _mm256_mul_ps(
+        _mm256_fnmadd_ps(two, _mm256_add_ps(xx, yy), one), sz);
+    if (transform) {
+      // M = T R S, T[row][k] is transform[k * 3 + row]
+      __m256 r[3][3];
+      for (int row = 0; row < 3; row++)
+        for (int col = 0; col < 3; col++)
+          r[row][col] = m[row][col];
+      for (int row = 0; row < 3; row++)
+        for (int col = 0; col < 3; col++)
+          m[row][col] = dot3(t[row], t[3 + row], t[6 + row], r[0][col],
+                             r[1][col], r[2][col]);
+    }
+
+    const int rows[6][2] = {{0, 0}, {0, 1}, {0, 2}, {1, 1}, {1, 2}, {2, 2}};
+    for (int k = 0; k < 6; k++) {
+      const __m256* a = m[rows[k][0]];
+      const __m256* b = m[rows[k][1]];
+      _mm256_storeu_ps(covariance[k] + i,
+                       dot3(a[0], a[1], a[2], b[0], b[1], b[2]));
+    }
+  }
+  computeCovariancesScalar(scale, rotation, covariance, transform, i, count);
+}
+
+SPLAT_TARGET_AVX512 static inline __m512 dot3x16(__m512 a0, __m512 a1,
+                                                 __m512 a2, __m512 b0,
+                                                 __m512 b1, __m512 b2) {
+  return _mm512_fmadd_ps(a0, b0,
+                         _mm512_fmadd_ps(a1, b1, _mm512_mul_ps(a2, b2)));
+}
+
+// Same math as the AVX2 kernel, 16 splats per iteration
+SPLAT_TARGET_AVX512 static void computeCovariancesAVX512(
+    const float* const scale[3], const float* const rotation[4],
+    float* const covariance[6], const float* transform, size_t count) {
+  const __m512 one = _mm512_set1_ps(1.0f);
+  const __m512 two = _mm512_set1_ps(2.0f);
+  __m512 t[9];
+  if (transform)
+    for (int k = 0; k < 9; k++)
+      t[k] = _mm512_set1_ps(transform[k]);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m512 w = _mm512_loadu_ps(rotation[0] + i);
+    __m512 x = _mm512_loadu_ps(rotation[1] + i);
+    __m512 y = _mm512_loadu_ps(rotation[2] + i);
+    __m512 z = _mm512_loadu_ps(rotation[3] + i);
+    const __m512 length2 = _mm512_fmadd_ps(
+        w, w,
+        _mm512_fmadd_ps(x, x, _mm512_fmadd_ps(y, y, _mm512_mul_ps(z, z))));
+    const __mmask16 degenerate =
+        _mm512_cmp_ps_mask(length2, _mm512_setzero_ps(), _CMP_EQ_OQ);
+    const __mmask16 valid = (__mmask16)~degenerate;
+    const __m512 inverse = _mm512_maskz_div_ps(
+        valid, one, _mm512_maskz_sqrt_ps(valid, length2));
+    w = _mm512_mask_mov_ps(_mm512_mul_ps(w, inverse), degenerate, one);
+    x = _mm512_mul_ps(x, inverse);
+    y = _mm512_mul_ps(y, inverse);
+    z = _mm512_mul_ps(z, inverse);
+
+    const __m512 sx = _mm512_loadu_ps(scale[0] + i);
+    const __m512 sy = _mm512_loadu_ps(scale[1] + i);
+    const __m512 sz = _mm512_loadu_ps(scale[2] + i);
+    const __m512 xx = _mm512_mul_ps(x, x), yy = _mm512_mul_ps(y, y),
+                 zz = _mm512_mul_ps(z, z);
+    const __m512 xy = _mm512_mul_ps(x, y), xz = _mm512_mul_ps(x, z),
+                 yz = _mm512_mul_ps(y, z);
+    const __m512 wx = _mm512_mul_ps(w, x), wy = _mm512_mul_ps(w, y),
+                 wz = _mm512_mul_ps(w, z);
+
+    __m512 m[3][3];
+    m[0][0] = _mm512_mul_ps(
+        _mm512_fnmadd_ps(two, _mm512_add_ps(yy, zz), one), sx);
+    m[0][1] = _mm512_mul_ps(_mm512_mul_ps(two, _mm512_sub_ps(xy, wz)), sy);
+    m[0][2] = _mm512_mul_ps(_mm512_mul_ps(two, _mm512_add_ps(xz, wy)), sz);
+    m[1][0] = _mm512_mul_ps(_mm512_mul_ps(two, _mm512_add_ps(xy, wz)), sx);
+    m[1][1] = _mm512_mul_ps(
+        _mm512_fnmadd_ps(two, _mm512_add_ps(xx, zz), one), sy);
+    m[1][2] = _mm512_mul_ps(_mm512_mul_ps(two, _mm512_sub_ps(yz, wx)), sz);
+    m[2][0] = _mm512_mul_ps(_mm512_mul_ps(two, _mm512_sub_ps(xz, wy)), sx);
+    m[2][1] = _mm512_mul_ps(_mm512_mul_ps(two, _mm512_add_ps(yz, wx)), sy);
+    m[2][2] = _mm512_mul_ps(
+        _mm512_fnmadd_ps(two, _mm512_add_ps(xx, yy), one), sz);
+    if (transform) {
+      __m512 r[3][3];
+      for (int row = 0; row < 3; row++)
+        for (int col = 0; col < 3; col++)
+          r[row][col] = m[row][col];
+      for (int row = 0; row < 3; row++)
+        for (int col = 0; col < 3; col++)
+          m[row][col] = dot3x16(t[row], t[3 + row], t[6 + row], r[0][col],
+                                r[1][col], r[2][col]);
+    }
+
+    const int rows[6][2] = {{0, 0}, {0, 1}, {0, 2}, {1, 1}, {1, 2}, {2, 2}};
+    for (int k = 0; k < 6; k++) {
+      const __m512* a = m[rows[k][0]];
+      const __m512* b = m[rows[k][1]];
+      _mm512_storeu_ps(covariance[k] + i,
+                       dot3x16(a[0], a[1], a[2], b[0], b[1], b[2]));
+    }
+  }
+  computeCovariancesScalar(scale, rotation, covariance, transform, i, count);
+}
+
+#endif
+
+void activateScales(float* values, size_t count) {
+#if defined(SPLAT_X86_DISPATCH)
+  if (simd::hasFMA())
+    return activateScalesAVX2(values, count);
+#endif
+  activateScalesScalar(values, count);
+}
+
+void activateOpacities(float* values, size_t count) {
+#if defined(SPLAT_X86_DISPATCH)
+  if (simd::hasFMA())
+    return activateOpacitiesAVX2(values, count);
+#endif
+  activateOpacitiesScalar(values, count);
+}
+
+void computeCovariances(const float* const scale[3],
+                        const float* const rotation[4],
+                        float* const covariance[6], size_t count,
+                        const float* transform) {
+#if defined(SPLAT_X86_DISPATCH)
+  if (simd::hasAVX512F())
+    return computeCovariancesAVX512(scale, rotation, covariance, transform,
+                                    count);
+  if (simd::hasFMA())
+    return computeCovariancesAVX2(scale, rotation, covariance, transform,
+                                  count);
+#endif
+  computeCovariancesScalar(scale, rotation, covariance, transform, 0, count);
+}
@@ -0,0 +1,25 @@
+#ifndef SPLATMATH_H
+#define SPLATMATH_H
+
+#include <cstddef>
+
+// Bulk Gaussian splat activations shared by the loaders, over SoA arrays.
+// AVX2 or AVX-512 on x86 (picked at runtime), scalar elsewhere.
+
+// values = exp(values), trained log scales to scales.
+void activateScales(float* values, size_t count);
+
+// values = 1 / (1 + exp(-values)), trained logits to opacities.
+void activateOpacities(float* values, size_t count);
+
+// 3D covariance R S S^T R^T of each splat as its six unique entries
+// (xx, xy, xz, yy, yz, zz). `rotation` holds unnormalized quaternions as
+// w, x, y, z; they are normalized here. With a `transform` (column major
+// 3x3, as in glm::mat3) the result is T R S S^T R^T T^T, the covariance of
+// the transformed splat.
+void computeCovariances(const float* const scale[3],
+                        const float* const rotation[4],
+                        float* const covariance[6], size_t count,
+                        const float* transform = nullptr);
+
+#endif
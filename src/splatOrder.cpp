@@ -0,0 +1,241 @@
+#include "splatOrder.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "timing.h"
+
+// Keys per histogram and scatter task
+static const size_t kMinKeysPerTask = 65536;
+static const int kRadixBits = 12;
+static const uint32_t kRadixSize = 1u << kRadixBits;
+
+// Moves the low SplatCurveBits bits of `x` to every third bit.
+static uint64_t spreadBits(uint32_t x) {
+  uint64_t v = x & 0xffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8) & 0x100f00f00f00f00full;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2) & 0x1249249249249249ull;
+  return v;
+}
+
+// Points per key step. The Hilbert transform is a long dependency chain per
+// point so blocks of them are interleaved.
+static const size_t kKeyBlock = 64;
+
+// Skilling's transform on `n` points as three axis arrays: the Hilbert
+// index of every point, as three bit planes to be interleaved most
+// significant axis first. Branch free, with the point loop innermost so it
+// vectorizes.
+static void axesToTranspose(uint32_t* x[3], size_t n) {
+  const uint32_t top = 1u << (SplatCurveBits - 1);
+  for (uint32_t q = top; q > 1; q >>= 1) {
+    const uint32_t p = q - 1;
+    for (int i = 0; i < 3; i++) {
+      // Set bit: invert the low bits of x[0], clear bit: swap them with x[i]
+      for (size_t j = 0; j < n; j++) {
+        const uint32_t set = 0u - ((x[i][j] & q) != 0);
+        const uint32_t t = (x[0][j] ^ x[i][j]) & p & ~set;
+        x[0][j] ^= (p & set) | t;
+        x[i][j] ^= t;
+      }
+    }
+  }
+  for (size_t j = 0; j < n; j++) {
+    x[1][j] ^= x[0][j];
+    x[2][j] ^= x[1][j];
+    uint32_t t = 0;
+    for (uint32_t q = top; q > 1; q >>= 1)
+      t ^= (q - 1) & (0u - ((x[2][j] & q) != 0));
+    for (int i = 0; i < 3; i++)
+      x[i][j] ^= t;
+  }
+}
+
+void computeSplatCurveKeys(const float* centers, size_t stride, size_t count,
+                           SplatCurve curve, std::vector<uint64_t>& keys,
+                           ThreadPool& pool) {
+  keys.resize(count);
+  if (count == 0)
+    return;
+
+  // Bounds, per task then merged
+  const size_t taskCount = std::min(pool.getThreadCount(),
+                                    (count + kMinKeysPerTask - 1) /
+                                        kMinKeysPerTask);
+  std::vector<float> bounds(taskCount * 6);
+  pool.parallelFor(taskCount, [&](size_t task) {
+    float* lo = &bounds[task * 6];
+    float* hi = lo + 3;
+    std::fill(lo, lo + 3, std::numeric_limits<float>::max());
+    std::fill(hi, hi + 3, -std::numeric_limits<float>::max());
+    const size_t end = count * (task + 1) / taskCount;
+    for (size_t i = count * task / taskCount; i < end; i++)
+      for (int c = 0; c < 3; c++) {
+        lo[c] = std::min(lo[c], centers[i * stride + c]);
+        hi[c] = std::max(hi[c], centers[i * stride + c]);
+      }
+  });
+  float origin[3], extent = 0.0f;
+  for (int c = 0; c < 3; c++) {
+    float lo = bounds[c], hi = bounds[3 + c];
+    for (size_t task = 1; task < taskCount; task++) {
+      lo = std::min(lo, bounds[task * 6 + c]);
+      hi = std::max(hi, bounds[task * 6 + 3 + c]);
+    }
+    origin[c] = lo;
+    extent = std::max(extent, hi - lo);
+  }
+  const float maxCell = (float)((1u << SplatCurveBits) - 1);
+  const float scale = extent > 0.0f ? maxCell / extent : 0.0f;
+
+  pool.parallelForRange(0, count, kMinKeysPerTask, [&](size_t first,
+                                                       size_t last) {
+    uint32_t cells[3][kKeyBlock];
+    uint32_t* axes[3] = {cells[0], cells[1], cells[2]};
+    for (size_t block = first; block < last; block += kKeyBlock) {
+      const size_t n = std::min(last - block, kKeyBlock);
+      for (size_t j = 0; j < n; j++)
+        for (int c = 0; c < 3; c++) {
+          // Clamped, NaN centers land in cell 0
+          const float q =
+              (centers[(block + j) * stride + c] - origin[c]) * scale;
+          cells[c][j] = q > 0.0f ? (uint32_t)std::min(q, maxCell) : 0;
+        }
+      if (curve == SplatCurve::Hilbert) {
+        axesToTranspose(axes, n);
+        for (size_t j = 0; j < n; j++)
+          keys[block + j] = spreadBits(cells[0][j]) << 2 |
+                            spreadBits(cells[1][j]) << 1 |
+                            spreadBits(cells[2][j]);
+      } else {
+        for (size_t j = 0; j < n; j++)
+          keys[block + j] = spreadBits(cells[0][j]) |
+                            spreadBits(cells[1][j]) << 1 |
+                            spreadBits(cells[2][j]) << 2;
+      }
+    }
+  });
+}
+
+void radixSortKeys(std::vector<uint64_t>& keys, std::vector<uint32_t>& values,
+                   SplatOrderStats* stats, ThreadPool& pool) {
+  const Clock::time_point start = Clock::now();
+  const size_t count = keys.size();
+  int passes = 0;
+  const size_t taskCount = std::max<size_t>(
+      1, std::min(pool.getThreadCount(),
+                  (count + kMinKeysPerTask - 1) / kMinKeysPerTask));
+
+  // Bits that differ between keys, digits without any are skipped
+  std::vector<uint64_t> taskBits(taskCount, 0);
+  if (count > 0) {
+    pool.parallelFor(taskCount, [&](size_t task) {
+      uint64_t bits = 0;
+      const size_t end = count * (task + 1) / taskCount;
+      for (size_t i = count * task / taskCount; i < end; i++)
+        bits |= keys[i] ^ keys[0];
+      taskBits[task] = bits;
+    });
+  }
+  uint64_t varying = 0;
+  for (uint64_t bits : taskBits)
+    varying |= bits;
+
+  std::vector<uint64_t> keysOut(count);
+  std::vector<uint32_t> valuesOut(count);
+  std::vector<uint32_t> histograms(taskCount * kRadixSize);
+  for (int shift = 0; shift < 64; shift += kRadixBits) {
+    if (((varying >> shift) & (kRadixSize - 1)) == 0)
+      continue;
+    passes++;
+
+    pool.parallelFor(taskCount, [&](size_t task) {
+      uint32_t* histogram = &histograms[task * kRadixSize];
+      std::fill(histogram, histogram + kRadixSize, 0);
+      const size_t end = count * (task + 1) / taskCount;
+      for (size_t i = count * task / taskCount; i < end; i++)
+        histogram[(keys[i] >> shift) & (kRadixSize - 1)]++;
+    });
+
+    // Digit major, then task: equal digits keep the input order
+    uint32_t offset = 0;
+    for (uint32_t digit = 0; digit < kRadixSize; digit++)
+      for (size_t task = 0; task < taskCount; task++) {
+        uint32_t& entry = histograms[task * kRadixSize + digit];
+        const uint32_t n = entry;
+        entry = offset;
+        offset += n;
+      }
+
+    pool.parallelFor(taskCount, [&](size_t task) {
+      uint32_t* next = &histograms[task * kRadixSize];
+      const size_t end = count * (task + 1) / taskCount;
+      for (size_t i = count * task / taskCount; i < end; i++) {
+        const uint32_t to = next[(keys[i] >> shift) & (kRadixSize - 1)]++;
+        keysOut[to] = keys[i];
+        valuesOut[to] = values[i];
+      }
+    });
+    keys.swap(keysOut);
+    values.swap(valuesOut);
+  }
+
+  if (stats) {
+    stats->sortMs = msSince(start);
+    stats->radixPasses = passes;
+  }
+}
+
+void getSplatCurveOrder(const float* centers, size_t stride, size_t count,
+                        SplatCurve curve, std::vector<uint32_t>& order,
+                        SplatOrderStats* stats, ThreadPool& pool) {
+  const Clock::time_point start = Clock::now();
+  order.resize(count);
+  for (size_t i = 0; i < count; i++)
+    order[i] = (uint32_t)i;
+  SplatOrderStats local;
+  if (curve != SplatCurve::None) {
+    std::vector<uint64_t> keys;
+    computeSplatCurveKeys(centers, stride, count, curve, keys, pool);
+    local.keyMs = msSince(start);
+    radixSortKeys(keys, order, &local, pool);
+  }
+  local.ms = msSince(start);
+  if (stats)
+    *stats = local;
+}
+
+std::vector<uint32_t> sortSplats(std::vector<GpuSplat>& splats,
+                                 SplatCurve curve, SplatOrderStats* stats,
+                                 ThreadPool& pool) {
+  const Clock::time_point start = Clock::now();
+  std::vector<uint32_t> order;
+  getSplatCurveOrder(splats.empty() ? nullptr : splats[0].center,
+                     sizeof(GpuSplat) / sizeof(float), splats.size(), curve,
+                     order, stats, pool);
+  if (curve != SplatCurve::None)
+    reorderSplats(splats, order, 1, pool);
+  if (stats)
+    stats->ms = msSince(start);
+  return order;
+}
+
+std::vector<uint32_t> sortSplats(SplatArrays& splats, SplatCurve curve,
+                                 SplatOrderStats* stats, ThreadPool& pool) {
+  const Clock::time_point start = Clock::now();
+  std::vector<uint32_t> order;
+  getSplatCurveOrder(splats.centers.data(), 3, splats.size(), curve, order,
+                     stats, pool);
+  if (curve != SplatCurve::None) {
+    reorderSplats(splats.centers, order, 3, pool);
+    reorderSplats(splats.scales, order, 3, pool);
+    reorderSplats(splats.rotations, order, 4, pool);
+    reorderSplats(splats.colors, order, 4, pool);
+  }
+  if (stats)
+    stats->ms = msSince(start);
+  return order;
+}
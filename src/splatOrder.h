@@ -0,0 +1,85 @@
+#ifndef SPLATORDER_H
+#define SPLATORDER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "gpuSplat.h"
+#include "splatBufferWriter.h"
+#include "threadPool.h"
+
+// Space filling curves splats can be laid out along. Splats close in space
+// end up close in memory, so depth passes and GPU fetches in sorted order
+// touch fewer cache lines and SplatBuffer buckets made of consecutive
+// splats stay small.
+enum class SplatCurve { None, Morton, Hilbert };
+
+struct SplatOrderStats {
+  double keyMs = 0.0;
+  double sortMs = 0.0;
+  double ms = 0.0;
+  int radixPasses = 0;  // passes with more than one digit value
+};
+
+// Bits per axis of the curve keys. 65536 cells per axis are far finer than
+// a cache line worth of splats, and 48 bit keys sort in four passes.
+static const int SplatCurveBits = 16;
+
+// keys[i] is the position along `curve` of center i, centers quantized to
+// SplatCurveBits over their bounding cube. Centers are xyz triplets
+// `stride` floats apart.
+void computeSplatCurveKeys(const float* centers, size_t stride, size_t count,
+                           SplatCurve curve, std::vector<uint64_t>& keys,
+                           ThreadPool& pool = ThreadPool::shared());
+
+// Stable LSD radix sort of `keys`, carrying `values` along. Every pass is
+// a parallel histogram, prefix sum and scatter over fixed ranges; digits
+// that are the same for all keys are skipped.
+void radixSortKeys(std::vector<uint64_t>& keys, std::vector<uint32_t>& values,
+                   SplatOrderStats* stats = nullptr,
+                   ThreadPool& pool = ThreadPool::shared());
+
+// order[j] is the splat stored at j once sorted along `curve`. With
+// SplatCurve::None it is the identity.
+void getSplatCurveOrder(const float* centers, size_t stride, size_t count,
+                        SplatCurve curve, std::vector<uint32_t>& order,
+                        SplatOrderStats* stats = nullptr,
+                        ThreadPool& pool = ThreadPool::shared());
+
+// out[j] = in[order[j]] for records of `size` elements, in parallel.
+template <typename T>
+void gatherSplats(const T* in, const std::vector<uint32_t>& order,
+                  size_t size, T* out,
+                  ThreadPool& pool = ThreadPool::shared()) {
+  pool.parallelForRange(0, order.size(), 16384, [&](size_t first,
+                                                    size_t last) {
+    for (size_t j = first; j < last; j++)
+      std::memcpy(out + j * size, in + (size_t)order[j] * size,
+                  size * sizeof(T));
+  });
+}
+
+// Reorders one attribute array holding `size` elements per splat. Apply
+// the same order to every array of a splat set. `order` may also be a
+// subset, the array then keeps only those splats.
+template <typename T>
+void reorderSplats(std::vector<T>& values, const std::vector<uint32_t>& order,
+                   size_t size = 1, ThreadPool& pool = ThreadPool::shared()) {
+  std::vector<T> sorted(order.size() * size);
+  gatherSplats(values.data(), order, size, sorted.data(), pool);
+  values.swap(sorted);
+}
+
+// Sorts every attribute of `splats` along `curve`. Returns the order
+// applied, order[j] being the old index of splat j.
+std::vector<uint32_t> sortSplats(std::vector<GpuSplat>& splats,
+                                 SplatCurve curve,
+                                 SplatOrderStats* stats = nullptr,
+                                 ThreadPool& pool = ThreadPool::shared());
+std::vector<uint32_t> sortSplats(SplatArrays& splats, SplatCurve curve,
+                                 SplatOrderStats* stats = nullptr,
+                                 ThreadPool& pool = ThreadPool::shared());
+
+#endif
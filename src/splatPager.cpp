@@ -0,0 +1,494 @@
+#include "splatPager.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "splatComposer.h"
+#include "timing.h"
+
+// Chunks outside the view volume count as this many times farther
+static const float kHiddenWeight = 4.0f;
+// Share of a new velocity sample in the smoothed camera velocity
+static const float kVelocitySmoothing = 0.25f;
+// Chunks ranked per parallel task
+static const size_t kChunksPerTask = 4096;
+
+static float distanceToBox(const glm::vec3& p, const glm::vec3& boxMin,
+                           const glm::vec3& boxMax) {
+  const glm::vec3 outside =
+      glm::max(glm::max(boxMin - p, p - boxMax), glm::vec3(0.0f));
+  return glm::length(outside);
+}
+
+SplatPager::SplatPager(const SplatPagerSettings& settings, bool threaded)
+    : settings(settings), threaded(threaded) {}
+
+SplatPager::~SplatPager() {
+  close();
+}
+
+bool SplatPager::open(const std::string& path, ThreadPool& threadPool) {
+  close();
+
+  buffer.reset(new SplatBuffer(path));
+  if (!buffer->isValid()) {
+    buffer.reset();
+    return false;
+  }
+  pool = &threadPool;
+
+  const uint32_t blockSize = buffer->getDecodeBlockSize();
+  const uint32_t blocksPerChunk =
+      std::max(1u, settings.splatsPerChunk / std::max(1u, blockSize));
+  slotSize = blocksPerChunk * blockSize;
+  const uint32_t splatCount = buffer->getSplatCount();
+  chunks.resize((splatCount + slotSize - 1) / slotSize);
+  for (size_t c = 0; c < chunks.size(); c++)
+    chunks[c].count = std::min(splatCount - (uint32_t)c * slotSize, slotSize);
+
+  if (buffer->compressionLevel > 0) {
+    // Quantized centers can't leave the bucket's cell
+    const float extent =
+        buffer->compressionScaleFactor *
+        (float)std::max(buffer->compressionScaleRange,
+                        65535u - buffer->compressionScaleRange);
+    const size_t stride = buffer->bytesPerBucket / sizeof(float);
+    const uint32_t blockCount = buffer->getDecodeBlockCount();
+    for (size_t c = 0; c < chunks.size(); c++) {
+      Chunk& chunk = chunks[c];
+      chunk.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+      chunk.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+      const uint32_t first = (uint32_t)c * blocksPerChunk;
+      const uint32_t last = std::min(blockCount, first + blocksPerChunk);
+      for (uint32_t b = first; b < last; b++) {
+        const float* center = buffer->bucketArray.data() + b * stride;
+        const glm::vec3 p(center[0], center[1], center[2]);
+        chunk.boundsMin = glm::min(chunk.boundsMin, p - extent);
+        chunk.boundsMax = glm::max(chunk.boundsMax, p + extent);
+      }
+    }
+  } else {
+    computeLevel0Bounds(threadPool);
+  }
+
+  const size_t slotBytes = (size_t)slotSize * sizeof(GpuSplat);
+  cpuSlotCount = (uint32_t)std::max<size_t>(
+      1, std::min(chunks.size(), settings.cpuBudgetBytes / slotBytes));
+  gpuSlotCount = (uint32_t)std::max<size_t>(
+      1, std::min(chunks.size(), settings.gpuBudgetBytes / slotBytes));
+  cpuSlots.resize(cpuSlotCount);
+  for (uint32_t s = cpuSlotCount; s-- > 0;)
+    freeCpuSlots.push_back((int32_t)s);
+  for (uint32_t s = gpuSlotCount; s-- > 0;)
+    freeGpuSlots.push_back((int32_t)s);
+  gpuSlotChunks.assign(gpuSlotCount, -1);
+  stats.chunkCount = (uint32_t)chunks.size();
+
+  stopping = false;
+#if defined(SPLAT_HAS_THREADS)
+  if (threaded)
+    for (int t = 0; t < std::max(1, settings.ioThreadCount); t++)
+      ioThreads.emplace_back(&SplatPager::ioLoop, this);
+#endif
+  return true;
+}
+
+void SplatPager::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread& thread : ioThreads)
+    thread.join();
+  ioThreads.clear();
+
+  buffer.reset();
+  chunks.clear();
+  slotSize = 0;
+  cpuSlotCount = 0;
+  gpuSlotCount = 0;
+  cpuSlots.clear();
+  freeCpuSlots.clear();
+  freeGpuSlots.clear();
+  gpuSlotChunks.clear();
+  queue.clear();
+  queueHead = 0;
+  loaded.clear();
+  ranked.clear();
+  drawSlots.clear();
+  frame = 0;
+  hasLastPosition = false;
+  velocity = glm::vec3(0.0f);
+  stats = SplatPagerStats();
+  totalLoadMs = 0.0;
+}
+
+// Centers only, the level 0 file has them as plain floats
+void SplatPager::computeLevel0Bounds(ThreadPool& threadPool) {
+  const float* centers = buffer->centerArrayFloat.data();
+  threadPool.parallelFor(chunks.size(), [&](size_t c) {
+    Chunk& chunk = chunks[c];
+    glm::vec3 boundsMin(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+    const float* center = centers + 3 * c * (size_t)slotSize;
+    for (uint32_t i = 0; i < chunk.count; i++, center += 3) {
+      const glm::vec3 p(center[0], center[1], center[2]);
+      boundsMin = glm::min(boundsMin, p);
+      boundsMax = glm::max(boundsMax, p);
+    }
+    chunk.boundsMin = boundsMin;
+    chunk.boundsMax = boundsMax;
+  });
+}
+
+void SplatPager::getChunkBounds(uint32_t chunk, glm::vec3& boundsMin,
+                                glm::vec3& boundsMax) const {
+  boundsMin = chunks[chunk].boundsMin;
+  boundsMax = chunks[chunk].boundsMax;
+}
+
+void SplatPager::ioLoop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [this] { return stopping || queueHead < queue.size(); });
+    if (stopping)
+      return;
+    const uint32_t chunk = queue[queueHead++];
+    chunks[chunk].state = ChunkState::Loading;
+    const int32_t cpuSlot = chunks[chunk].cpuSlot;
+    lock.unlock();
+    const Loaded result = load(chunk, cpuSlot);
+    lock.lock();
+    chunks[chunk].state = ChunkState::Resident;
+    loaded.push_back(result);
+  }
+}
+
+// Decodes `chunk` into its slot; the slot belongs to the chunk until
+// update() evicts it, so this runs unlocked.
+SplatPager::Loaded SplatPager::load(uint32_t chunk, int32_t cpuSlot) {
+  const Clock::time_point start = Clock::now();
+  std::unique_ptr<GpuSplat[]>& slot = cpuSlots[cpuSlot];
+  if (!slot)
+    slot.reset(new GpuSplat[slotSize]);
+
+  const uint32_t blockSize = buffer->getDecodeBlockSize();
+  const uint32_t firstBlock = chunk * (slotSize / blockSize);
+  const uint32_t count = chunks[chunk].count;
+  for (uint32_t i = 0; i < count; i += blockSize)
+    decodeSplatBufferBlock(*buffer, firstBlock + i / blockSize,
+                           slot.get() + i);
+
+  Loaded result;
+  result.chunk = chunk;
+  result.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+  result.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+  for (uint32_t i = 0; i < count; i++) {
+    const GpuSplat& splat = slot[i];
+    const glm::vec3 center(splat.center[0], splat.center[1], splat.center[2]);
+    const glm::vec3 extent =
+        3.0f * glm::sqrt(glm::max(
+                   glm::vec3(splat.covA[0], splat.covB[0], splat.covB[2]),
+                   glm::vec3(0.0f)));
+    result.boundsMin = glm::min(result.boundsMin, center - extent);
+    result.boundsMax = glm::max(result.boundsMax, center + extent);
+  }
+  result.ms = msSince(start);
+  return result;
+}
+
+std::vector<SplatPageUpload> SplatPager::update(const glm::mat4& viewProj,
+                                                const glm::vec3& cameraPosition,
+                                                double budgetMs) {
+  std::vector<SplatPageUpload> uploads;
+  if (!buffer)
+    return uploads;
+  const Clock::time_point start = Clock::now();
+  frame++;
+
+  if (hasLastPosition) {
+    const float seconds =
+        std::chrono::duration<float>(start - lastUpdate).count();
+    if (seconds > 0.0f)
+      velocity = glm::mix(velocity, (cameraPosition - lastPosition) / seconds,
+                          kVelocitySmoothing);
+  }
+  hasLastPosition = true;
+  lastPosition = cameraPosition;
+  lastUpdate = start;
+  const glm::vec3 predictedPosition =
+      cameraPosition + velocity * settings.prefetchSeconds;
+
+  collectLoaded();
+  rankChunks(viewProj, cameraPosition, predictedPosition);
+
+  const size_t wantedCount = std::min<size_t>(cpuSlotCount, chunks.size());
+  const size_t rankedCount =
+      std::max<size_t>(wantedCount, std::min<size_t>(gpuSlotCount,
+                                                     chunks.size()));
+  ranked.resize(chunks.size());
+  for (size_t c = 0; c < chunks.size(); c++)
+    ranked[c] = (uint32_t)c;
+  auto better = [this](uint32_t a, uint32_t b) {
+    return chunks[a].rank < chunks[b].rank;
+  };
+  if (rankedCount < ranked.size())
+    std::nth_element(ranked.begin(), ranked.begin() + rankedCount,
+                     ranked.end(), better);
+  ranked.resize(rankedCount);
+  std::sort(ranked.begin(), ranked.end(), better);
+
+  pageCpu(wantedCount);
+  if (threaded) {
+    wake.notify_all();
+  } else {
+    // No I/O threads: load from the queue for the rest of the budget
+    std::unique_lock<std::mutex> lock(mutex);
+    while (queueHead < queue.size() && msSince(start) < budgetMs) {
+      const uint32_t chunk = queue[queueHead++];
+      chunks[chunk].state = ChunkState::Resident;
+      loaded.push_back(load(chunk, chunks[chunk].cpuSlot));
+    }
+    lock.unlock();
+    collectLoaded();
+  }
+  uploads = pageGpu(rankedCount);
+
+  drawSlots.clear();
+  for (uint32_t s = 0; s < gpuSlotCount; s++) {
+    const int32_t chunk = gpuSlotChunks[s];
+    if (chunk >= 0 && chunks[chunk].visible) {
+      SplatPageSlot draw;
+      draw.chunk = (uint32_t)chunk;
+      draw.slot = s;
+      draw.count = chunks[chunk].count;
+      drawSlots.push_back(draw);
+    }
+  }
+  std::sort(drawSlots.begin(), drawSlots.end(),
+            [this](const SplatPageSlot& a, const SplatPageSlot& b) {
+              return chunks[a.chunk].rank < chunks[b.chunk].rank;
+            });
+
+  stats.drawnChunks = (uint32_t)drawSlots.size();
+  stats.gpuChunks = gpuSlotCount - (uint32_t)freeGpuSlots.size();
+  stats.gpuBytes = (size_t)stats.gpuChunks * slotSize * sizeof(GpuSplat);
+  stats.uploadedBytes = 0;
+  for (const SplatPageUpload& upload : uploads)
+    stats.uploadedBytes += (size_t)upload.count * sizeof(GpuSplat);
+  stats.averageLoadMs = stats.loads > 0 ? totalLoadMs / stats.loads : 0.0;
+  stats.updateMs = msSince(start);
+  return uploads;
+}
+
+// Bounds of finished chunks, render thread only.
+void SplatPager::collectLoaded() {
+  std::vector<Loaded> finished;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    finished.swap(loaded);
+  }
+  for (const Loaded& result : finished) {
+    Chunk& chunk = chunks[result.chunk];
+    chunk.boundsMin = result.boundsMin;
+    chunk.boundsMax = result.boundsMax;
+    totalLoadMs += result.ms;
+    stats.loads++;
+  }
+}
+
+// Visibility with the same 1.2x guard band on x/y as the vertex shader and
+// no far plane, see SplatTree::getVisibleIndexes().
+void SplatPager::rankChunks(const glm::mat4& viewProj,
+                            const glm::vec3& cameraPosition,
+                            const glm::vec3& predictedPosition) {
+  const glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0],
+                       viewProj[3][0]);
+  const glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1],
+                       viewProj[3][1]);
+  const glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2],
+                       viewProj[3][2]);
+  const glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3],
+                       viewProj[3][3]);
+  const glm::vec4 planes[5] = {1.2f * row3 + row0, 1.2f * row3 - row0,
+                               1.2f * row3 + row1, 1.2f * row3 - row1,
+                               row3 + row2};
+
+  std::vector<uint32_t> visibleCounts(
+      (chunks.size() + kChunksPerTask - 1) / kChunksPerTask, 0);
+  pool->parallelFor(visibleCounts.size(), [&](size_t task) {
+    const size_t first = task * kChunksPerTask;
+    const size_t last = std::min(chunks.size(), first + kChunksPerTask);
+    for (size_t c = first; c < last; c++) {
+      Chunk& chunk = chunks[c];
+      bool visible = true;
+      for (int p = 0; p < 5 && visible; p++) {
+        const glm::vec3 n(planes[p]);
+        const glm::vec3 positive(
+            n.x >= 0.0f ? chunk.boundsMax.x : chunk.boundsMin.x,
+            n.y >= 0.0f ? chunk.boundsMax.y : chunk.boundsMin.y,
+            n.z >= 0.0f ? chunk.boundsMax.z : chunk.boundsMin.z);
+        visible = glm::dot(n, positive) + planes[p].w >= 0.0f;
+      }
+      const float distance =
+          distanceToBox(cameraPosition, chunk.boundsMin, chunk.boundsMax);
+      chunk.visible = visible;
+      if (visible) {
+        chunk.rank = distance;
+        chunk.lastVisible = frame;
+        visibleCounts[task]++;
+      } else {
+        chunk.rank = kHiddenWeight *
+                     std::min(distance,
+                              distanceToBox(predictedPosition, chunk.boundsMin,
+                                            chunk.boundsMax));
+      }
+    }
+  });
+
+  stats.visibleChunks = 0;
+  for (uint32_t count : visibleCounts)
+    stats.visibleChunks += count;
+}
+
+// Least recently visible first once sorted from the back
+static void sortForEviction(std::vector<uint32_t>& candidates,
+                            const std::vector<uint64_t>& lastVisible) {
+  std::sort(candidates.begin(), candidates.end(),
+            [&](uint32_t a, uint32_t b) {
+              return lastVisible[a] > lastVisible[b];
+            });
+}
+
+void SplatPager::pageCpu(size_t wantedCount) {
+  for (Chunk& chunk : chunks)
+    chunk.wanted = false;
+  for (size_t i = 0; i < wantedCount; i++)
+    chunks[ranked[i]].wanted = true;
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // Queued chunks that dropped out give their slot back
+  for (size_t q = queueHead; q < queue.size(); q++) {
+    Chunk& chunk = chunks[queue[q]];
+    if (!chunk.wanted) {
+      chunk.state = ChunkState::Unloaded;
+      freeCpuSlots.push_back(chunk.cpuSlot);
+      chunk.cpuSlot = -1;
+    }
+  }
+  queue.clear();
+  queueHead = 0;
+
+  std::vector<uint32_t> candidates;
+  std::vector<uint64_t> lastVisible(chunks.size());
+  uint32_t resident = 0;
+  for (size_t c = 0; c < chunks.size(); c++) {
+    const Chunk& chunk = chunks[c];
+    lastVisible[c] = chunk.lastVisible;
+    if (chunk.state == ChunkState::Resident) {
+      resident++;
+      if (!chunk.wanted)
+        candidates.push_back((uint32_t)c);
+    }
+  }
+  sortForEviction(candidates, lastVisible);
+
+  // The queue is rebuilt in this frame's rank order
+  for (size_t i = 0; i < wantedCount; i++) {
+    Chunk& chunk = chunks[ranked[i]];
+    if (chunk.state == ChunkState::Queued) {
+      queue.push_back(ranked[i]);
+      continue;
+    }
+    if (chunk.state != ChunkState::Unloaded)
+      continue;
+    if (freeCpuSlots.empty()) {
+      if (candidates.empty())
+        break;
+      Chunk& evicted = chunks[candidates.back()];
+      candidates.pop_back();
+      evicted.state = ChunkState::Unloaded;
+      freeCpuSlots.push_back(evicted.cpuSlot);
+      evicted.cpuSlot = -1;
+      resident--;
+      stats.cpuEvictions++;
+    }
+    chunk.state = ChunkState::Queued;
+    chunk.cpuSlot = freeCpuSlots.back();
+    freeCpuSlots.pop_back();
+    queue.push_back(ranked[i]);
+  }
+
+  stats.residentChunks = resident;
+  stats.queuedChunks = (uint32_t)queue.size();
+  stats.cpuBytes =
+      (size_t)(cpuSlotCount - freeCpuSlots.size()) * slotSize *
+      sizeof(GpuSplat);
+}
+
+std::vector<SplatPageUpload> SplatPager::pageGpu(size_t rankedCount) {
+  std::vector<SplatPageUpload> uploads;
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // The best ranked chunks that are decoded or already in the SSBO
+  std::vector<uint32_t> wanted;
+  std::vector<bool> isWanted(chunks.size(), false);
+  for (size_t i = 0; i < rankedCount && wanted.size() < gpuSlotCount; i++) {
+    const Chunk& chunk = chunks[ranked[i]];
+    if (chunk.gpuSlot >= 0 || chunk.state == ChunkState::Resident) {
+      wanted.push_back(ranked[i]);
+      isWanted[ranked[i]] = true;
+    }
+  }
+
+  std::vector<uint32_t> candidates;
+  std::vector<uint64_t> lastVisible(chunks.size());
+  for (uint32_t s = 0; s < gpuSlotCount; s++) {
+    const int32_t chunk = gpuSlotChunks[s];
+    if (chunk >= 0 && !isWanted[chunk]) {
+      candidates.push_back((uint32_t)chunk);
+      lastVisible[chunk] = chunks[chunk].lastVisible;
+    }
+  }
+  sortForEviction(candidates, lastVisible);
+
+  size_t uploadBytes = 0;
+  const size_t chunkBytes = (size_t)slotSize * sizeof(GpuSplat);
+  for (uint32_t c : wanted) {
+    Chunk& chunk = chunks[c];
+    if (chunk.gpuSlot >= 0)
+      continue;
+    if (!uploads.empty() &&
+        uploadBytes + chunkBytes > settings.uploadBytesPerFrame)
+      break;
+    if (freeGpuSlots.empty()) {
+      if (candidates.empty())
+        break;
+      Chunk& evicted = chunks[candidates.back()];
+      candidates.pop_back();
+      freeGpuSlots.push_back(evicted.gpuSlot);
+      gpuSlotChunks[evicted.gpuSlot] = -1;
+      evicted.gpuSlot = -1;
+      stats.gpuEvictions++;
+    }
+    chunk.gpuSlot = freeGpuSlots.back();
+    freeGpuSlots.pop_back();
+    gpuSlotChunks[chunk.gpuSlot] = (int32_t)c;
+
+    SplatPageUpload upload;
+    upload.chunk = c;
+    upload.slot = (uint32_t)chunk.gpuSlot;
+    upload.count = chunk.count;
+    upload.splats = cpuSlots[chunk.cpuSlot].get();
+    uploads.push_back(upload);
+    uploadBytes += chunkBytes;
+  }
+  return uploads;
+}
+
+SplatPagerStats SplatPager::getStats() const {
+  return stats;
+}
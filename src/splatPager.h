@@ -0,0 +1,202 @@
+#ifndef SPLATPAGER_H
+#define SPLATPAGER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "gpuSplat.h"
+#include "splatBuffer.h"
+#include "threadPool.h"
+
+struct SplatPagerSettings {
+  // Decoded splats kept in memory, and in the splat_buffer SSBO
+  size_t cpuBudgetBytes = (size_t)2 << 30;
+  size_t gpuBudgetBytes = (size_t)1 << 30;
+  // Most bytes handed out by one update() for uploading
+  size_t uploadBytesPerFrame = (size_t)64 << 20;
+  // Chunks are runs of whole decode blocks of about this many splats
+  uint32_t splatsPerChunk = 16384;
+  int ioThreadCount = 2;
+  // Chunks near where the camera will be this far ahead are loaded first
+  float prefetchSeconds = 0.5f;
+};
+
+// Chunk `chunk` goes to splats [slot * getSlotSize(), + count) of the SSBO.
+// `splats` stays valid until the next update().
+struct SplatPageUpload {
+  uint32_t chunk = 0;
+  uint32_t slot = 0;
+  uint32_t count = 0;
+  const GpuSplat* splats = nullptr;
+};
+
+// A chunk to draw: splats [slot * getSlotSize(), + count) of the SSBO.
+struct SplatPageSlot {
+  uint32_t chunk = 0;
+  uint32_t slot = 0;
+  uint32_t count = 0;
+};
+
+struct SplatPagerStats {
+  uint32_t chunkCount = 0;
+  uint32_t visibleChunks = 0;
+  uint32_t drawnChunks = 0;  // visible and on the GPU
+  uint32_t residentChunks = 0;
+  uint32_t gpuChunks = 0;
+  uint32_t queuedChunks = 0;
+  size_t cpuBytes = 0;
+  size_t gpuBytes = 0;
+  size_t uploadedBytes = 0;  // by the last update()
+  uint64_t loads = 0;
+  uint64_t cpuEvictions = 0;
+  uint64_t gpuEvictions = 0;
+  double averageLoadMs = 0.0;
+  double updateMs = 0.0;
+};
+
+// Draws SplatBuffer files larger than memory, keeping only the chunks the
+// camera needs decoded.
+//
+// Chunks are runs of consecutive decode blocks of the file: buckets for
+// compressed files, which the writer partitions spatially, and fixed blocks
+// of splats for level 0 files, which should be written in curve order (see
+// sortSplats()). The file is mapped, not read; chunk bounds come from the
+// bucket grid, or from one parallel pass over the centers of a level 0
+// file, and are tightened to the splats' 3 sigma extent once a chunk has
+// been decoded.
+//
+// Every update() ranks the chunks by distance: chunks inside the view
+// volume by their distance to the camera, the rest by their distance to the
+// camera or to where it is heading, whichever is less, counted four times.
+// The heading extrapolates the camera velocity `prefetchSeconds`. The best
+// ranked chunks that fit the CPU budget are wanted; missing ones are queued
+// for the I/O threads in rank order, taking the slot of the least recently
+// visible resident chunk no longer wanted once the budget is full. The GPU
+// side works the same way with slots of its own: the best ranked decoded
+// chunks are kept in the SSBO, the least recently visible leave first, and
+// update() returns what the render thread has to upload. A chunk can stay
+// in the SSBO after leaving memory.
+//
+// Without threads (Emscripten built with USE_PTHREADS=0) update() decodes
+// queued chunks itself, for at most its budget.
+class SplatPager {
+ public:
+#if defined(SPLAT_HAS_THREADS)
+  explicit SplatPager(const SplatPagerSettings& settings = SplatPagerSettings(),
+                      bool threaded = true);
+#else
+  explicit SplatPager(const SplatPagerSettings& settings = SplatPagerSettings(),
+                      bool threaded = false);
+#endif
+  ~SplatPager();
+
+  SplatPager(const SplatPager&) = delete;
+  SplatPager& operator=(const SplatPager&) = delete;
+
+  // Maps `path` and computes the chunk bounds. Returns false if it is not a
+  // usable SplatBuffer.
+  bool open(const std::string& path, ThreadPool& pool = ThreadPool::shared());
+  void close();
+
+  // Ranks the chunks for this view and moves them between disk, memory and
+  // GPU. Call once per frame from the render thread, then upload what it
+  // returns before drawing getDrawSlots().
+  std::vector<SplatPageUpload> update(const glm::mat4& viewProj,
+                                      const glm::vec3& cameraPosition,
+                                      double budgetMs = 4.0);
+
+  // Visible chunks whose splats are in the SSBO, nearest first.
+  const std::vector<SplatPageSlot>& getDrawSlots() const { return drawSlots; }
+
+  // Splats per chunk, and per SSBO slot
+  uint32_t getSlotSize() const { return slotSize; }
+  // The SSBO holds getGpuSlotCount() * getSlotSize() splats
+  uint32_t getGpuSlotCount() const { return gpuSlotCount; }
+  uint32_t getCpuSlotCount() const { return cpuSlotCount; }
+  uint32_t getChunkCount() const { return (uint32_t)chunks.size(); }
+  uint32_t getSplatCount() const { return buffer ? buffer->getSplatCount() : 0; }
+  void getChunkBounds(uint32_t chunk, glm::vec3& boundsMin,
+                      glm::vec3& boundsMax) const;
+
+  SplatPagerStats getStats() const;
+
+ private:
+  enum class ChunkState { Unloaded, Queued, Loading, Resident };
+
+  struct Chunk {
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    uint32_t count = 0;
+    ChunkState state = ChunkState::Unloaded;  // guarded by mutex
+    int32_t cpuSlot = -1;
+    int32_t gpuSlot = -1;
+    uint64_t lastVisible = 0;  // frame, for LRU eviction
+    float rank = 0.0f;
+    bool visible = false;
+    bool wanted = false;
+  };
+
+  // Written by the loader, picked up by update()
+  struct Loaded {
+    uint32_t chunk;
+    glm::vec3 boundsMin, boundsMax;
+    double ms;
+  };
+
+  void ioLoop();
+  Loaded load(uint32_t chunk, int32_t cpuSlot);
+  void computeLevel0Bounds(ThreadPool& pool);
+  void rankChunks(const glm::mat4& viewProj, const glm::vec3& cameraPosition,
+                  const glm::vec3& predictedPosition);
+  void collectLoaded();
+  void pageCpu(size_t wantedCount);
+  std::vector<SplatPageUpload> pageGpu(size_t rankedCount);
+
+  const SplatPagerSettings settings;
+  const bool threaded;
+  std::vector<std::thread> ioThreads;
+  ThreadPool* pool = nullptr;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  std::unique_ptr<SplatBuffer> buffer;
+  std::vector<Chunk> chunks;
+  uint32_t slotSize = 0;
+  uint32_t cpuSlotCount = 0;
+  uint32_t gpuSlotCount = 0;
+
+  // Chunk storage, allocated on first use and recycled
+  std::vector<std::unique_ptr<GpuSplat[]>> cpuSlots;
+  std::vector<int32_t> freeCpuSlots;
+  std::vector<int32_t> freeGpuSlots;
+  std::vector<int32_t> gpuSlotChunks;
+
+  // Chunks to load, best ranked first, consumed from queueHead on
+  std::vector<uint32_t> queue;
+  size_t queueHead = 0;
+  std::vector<Loaded> loaded;
+
+  // Chunk indexes, best ranked first up to the CPU or GPU slot count
+  std::vector<uint32_t> ranked;
+  std::vector<SplatPageSlot> drawSlots;
+  uint64_t frame = 0;
+  bool hasLastPosition = false;
+  glm::vec3 lastPosition = glm::vec3(0.0f);
+  glm::vec3 velocity = glm::vec3(0.0f);
+  std::chrono::steady_clock::time_point lastUpdate;
+
+  SplatPagerStats stats;
+  double totalLoadMs = 0.0;
+};
+
+#endif
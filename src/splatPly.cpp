@@ -0,0 +1,285 @@
+#include "splatPly.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "mappedFile.h"
+#include "splatMath.h"
+#include "timing.h"
+
+// vera only compiles the tinyply implementation with SUPPORT_PLY_BINARY
+#if !defined(SUPPORT_PLY_BINARY)
+#define TINYPLY_IMPLEMENTATION
+#endif
+#include "tinyply.h"
+
+static bool findHeaderEnd(const uint8_t* bytes, size_t size, size_t& end) {
+  static const char marker[] = "end_header";
+  const size_t limit = std::min<size_t>(size, 1 << 20);
+  for (size_t i = 0; i + sizeof(marker) - 1 < limit; i++) {
+    if (std::memcmp(bytes + i, marker, sizeof(marker) - 1) != 0)
+      continue;
+    end = i + sizeof(marker) - 1;
+    if (end < size && bytes[end] == '\r')
+      end++;
+    if (end < size && bytes[end] == '\n') {
+      end++;
+      return true;
+    }
+    return false;
+  }
+  return false;
+}
+
+static bool parseLayout(const tinyply::PlyFile& ply, uint32_t& count,
+                        size_t& dataOffset, SplatPlyLayout& layout) {
+  const std::vector<tinyply::PlyElement> elements = ply.get_elements();
+  const tinyply::PlyElement* vertex = nullptr;
+  for (const tinyply::PlyElement& element : elements) {
+    if (element.name == "vertex") {
+      vertex = &element;
+      break;
+    }
+    // Elements before the vertices have to be skipped, only possible when
+    // their records have a fixed size
+    for (const tinyply::PlyProperty& property : element.properties) {
+      if (property.isList) {
+        std::cerr << "Error: splat PLY has list properties before vertices"
+                  << std::endl;
+        return false;
+      }
+      dataOffset += element.size *
+                    tinyply::PropertyTable[property.propertyType].stride;
+    }
+  }
+  if (!vertex) {
+    std::cerr << "Error: splat PLY has no vertex element" << std::endl;
+    return false;
+  }
+  count = (uint32_t)vertex->size;
+
+  auto find = [&](const std::string& name, size_t& offset) {
+    size_t position = 0;
+    for (const tinyply::PlyProperty& property : vertex->properties) {
+      if (property.name == name) {
+        if (property.propertyType != tinyply::Type::FLOAT32 || property.isList)
+          break;
+        offset = position;
+        return true;
+      }
+      position += tinyply::PropertyTable[property.propertyType].stride;
+    }
+    std::cerr << "Error: splat PLY has no float property " << name
+              << std::endl;
+    return false;
+  };
+
+  for (const tinyply::PlyProperty& property : vertex->properties) {
+    if (property.isList) {
+      std::cerr << "Error: splat PLY vertices have list properties"
+                << std::endl;
+      return false;
+    }
+    layout.stride += tinyply::PropertyTable[property.propertyType].stride;
+  }
+
+  const char* axes[3] = {"x", "y", "z"};
+  for (int c = 0; c < 3; c++) {
+    if (!find(axes[c], layout.center[c]) ||
+        !find("scale_" + std::to_string(c), layout.scale[c]) ||
+        !find("f_dc_" + std::to_string(c), layout.dc[c]))
+      return false;
+  }
+  for (int c = 0; c < 4; c++)
+    if (!find("rot_" + std::to_string(c), layout.rotation[c]))
+      return false;
+  if (!find("opacity", layout.opacity))
+    return false;
+
+  // f_rest_* are optional, but must be numbered without gaps
+  size_t restCount = 0;
+  for (const tinyply::PlyProperty& property : vertex->properties)
+    if (property.name.compare(0, 7, "f_rest_") == 0)
+      restCount++;
+  layout.rest.resize(restCount);
+  for (size_t k = 0; k < restCount; k++)
+    if (!find("f_rest_" + std::to_string(k), layout.rest[k]))
+      return false;
+  return true;
+}
+
+static float readFloat(const uint8_t* record, size_t offset) {
+  float value;
+  std::memcpy(&value, record + offset, sizeof(value));
+  return value;
+}
+
+bool SplatPlyReader::open(const std::string& path) {
+  splatCount = 0;
+  records = nullptr;
+  if (!file.open(path))
+    return false;
+
+  size_t headerEnd = 0;
+  if (!findHeaderEnd(file.data(), file.size(), headerEnd)) {
+    std::cerr << "Error: " << path << " has no PLY header" << std::endl;
+    return false;
+  }
+  const std::string headerText(reinterpret_cast<const char*>(file.data()),
+                               headerEnd);
+  if (headerText.find("format binary_little_endian") == std::string::npos) {
+    std::cerr << "Error: " << path << " is not a binary little endian PLY"
+              << std::endl;
+    return false;
+  }
+
+  tinyply::PlyFile ply;
+  try {
+    std::istringstream header(headerText);
+    if (!ply.parse_header(header))
+      return false;
+  } catch (const std::exception& e) {
+    std::cerr << "tinyply exception: " << e.what() << std::endl;
+    return false;
+  }
+
+  uint32_t count = 0;
+  size_t dataOffset = headerEnd;
+  layout = SplatPlyLayout();
+  if (!parseLayout(ply, count, dataOffset, layout))
+    return false;
+  if (file.size() < dataOffset + (size_t)count * layout.stride) {
+    std::cerr << "Error: " << path << " is truncated" << std::endl;
+    return false;
+  }
+
+  // Coefficients per channel are stored channel after channel:
+  // f_rest_[channel * perChannel + coefficient]
+  const size_t perChannel = layout.rest.size() / 3;
+  shDegree = perChannel >= 15 ? 3 : perChannel >= 8 ? 2
+                                  : perChannel >= 3 ? 1 : 0;
+  records = file.data() + dataOffset;
+  splatCount = count;
+  return true;
+}
+
+void SplatPlyReader::readCenter(uint32_t index, float center[3]) const {
+  const uint8_t* record = records + (size_t)index * layout.stride;
+  for (int c = 0; c < 3; c++)
+    center[c] = readFloat(record, layout.center[c]);
+}
+
+void SplatPlyReader::decodeBlock(uint32_t block, GpuSplat* splats,
+                                 const uint32_t* slots,
+                                 const SplatTransform* transform) const {
+  const size_t perChannel = layout.rest.size() / 3;
+  const size_t restUsed = std::min<size_t>(perChannel, 15);
+  const size_t begin = (size_t)block * BlockSize;
+  const size_t n = std::min<size_t>(splatCount - begin, BlockSize);
+  const uint8_t* first = records + begin * layout.stride;
+
+  // SoA scratch: opacity, scale xyz, rotation wxyz, covariance
+  float scratch[14][BlockSize];
+  float* opacity = scratch[0];
+  float* scale[3], * rotation[4], * covariance[6];
+  for (int c = 0; c < 3; c++)
+    scale[c] = scratch[1 + c];
+  for (int c = 0; c < 4; c++)
+    rotation[c] = scratch[4 + c];
+  for (int c = 0; c < 6; c++)
+    covariance[c] = scratch[8 + c];
+
+  for (size_t i = 0; i < n; i++) {
+    const uint8_t* record = first + i * layout.stride;
+    opacity[i] = readFloat(record, layout.opacity);
+    for (int c = 0; c < 3; c++)
+      scale[c][i] = readFloat(record, layout.scale[c]);
+    for (int c = 0; c < 4; c++)
+      rotation[c][i] = readFloat(record, layout.rotation[c]);
+  }
+
+  activateOpacities(opacity, n);
+  for (int c = 0; c < 3; c++)
+    activateScales(scale[c], n);
+  computeCovariances(scale, rotation, covariance, n,
+                     transform ? transform->getLinear() : nullptr);
+
+  for (size_t i = 0; i < n; i++) {
+    const uint8_t* record = first + i * layout.stride;
+    // Every byte written, padding and missing SH coefficients as zeros
+    GpuSplat& splat = splats[slots ? slots[begin + i] : begin + i];
+    splat.padding0 = 0.0f;
+    splat.padding1 = 0.0f;
+    for (size_t k = 0; k < 16; k++)
+      splat.sh[k][3] = 0.0f;
+    for (size_t k = restUsed; k < 15; k++)
+      for (int c = 0; c < 3; c++)
+        splat.sh[1 + k][c] = 0.0f;
+    for (int c = 0; c < 3; c++) {
+      splat.center[c] = readFloat(record, layout.center[c]);
+      splat.covA[c] = covariance[c][i];
+      splat.covB[c] = covariance[3 + c][i];
+      splat.sh[0][c] = readFloat(record, layout.dc[c]);
+      for (size_t k = 0; k < restUsed; k++)
+        splat.sh[1 + k][c] =
+            readFloat(record, layout.rest[c * perChannel + k]);
+    }
+    splat.alpha = opacity[i];
+    if (transform) {
+      transform->transformCenter(splat.center);
+      transform->rotateSh(splat.sh, shDegree);
+    }
+  }
+}
+
+bool loadSplatPly(const std::string& path, std::vector<GpuSplat>& splats,
+                  SplatPlyInfo* info, ThreadPool& pool) {
+  return loadSplatPly(path, splats, SplatCurve::None, info, pool);
+}
+
+bool loadSplatPly(const std::string& path, std::vector<GpuSplat>& splats,
+                  SplatCurve curve, SplatPlyInfo* info, ThreadPool& pool) {
+  const Clock::time_point start = Clock::now();
+
+  SplatPlyReader reader;
+  if (!reader.open(path))
+    return false;
+  const uint32_t count = reader.getSplatCount();
+
+  // Slot of every record once sorted along the curve
+  const Clock::time_point orderStart = Clock::now();
+  std::vector<uint32_t> slots;
+  if (curve != SplatCurve::None) {
+    std::vector<float> centers(3 * (size_t)count);
+    pool.parallelForRange(0, count, SplatPlyReader::BlockSize,
+                          [&](size_t first, size_t last) {
+      for (size_t i = first; i < last; i++)
+        reader.readCenter((uint32_t)i, &centers[3 * i]);
+    });
+    std::vector<uint32_t> order;
+    getSplatCurveOrder(centers.data(), 3, count, curve, order, nullptr, pool);
+    slots.resize(count);
+    for (uint32_t j = 0; j < count; j++)
+      slots[order[j]] = j;
+  }
+  const double orderMs = msSince(orderStart);
+
+  splats.clear();
+  splats.resize(count);
+  pool.parallelForRange(0, reader.getBlockCount(), 1, [&](size_t firstBlock,
+                                                          size_t lastBlock) {
+    for (size_t block = firstBlock; block < lastBlock; block++)
+      reader.decodeBlock((uint32_t)block, splats.data(),
+                         slots.empty() ? nullptr : slots.data());
+  });
+
+  if (info) {
+    info->splatCount = count;
+    info->shDegree = reader.getShDegree();
+    info->orderMs = orderMs;
+    info->ms = msSince(start);
+  }
+  return true;
+}
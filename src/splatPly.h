@@ -0,0 +1,84 @@
+#ifndef SPLATPLY_H
+#define SPLATPLY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gpuSplat.h"
+#include "mappedFile.h"
+#include "splatOrder.h"
+#include "splatTransform.h"
+#include "threadPool.h"
+
+struct SplatPlyInfo {
+  uint32_t splatCount = 0;
+  int shDegree = 0;  // highest degree present in the file, 0 to 3
+  double ms = 0.0;
+  double orderMs = 0.0;  // part of ms spent on the curve order
+};
+
+// Offsets in bytes, inside one vertex record, of the properties we read.
+struct SplatPlyLayout {
+  size_t stride = 0;
+  size_t center[3];
+  size_t opacity;
+  size_t scale[3];
+  size_t rotation[4];
+  size_t dc[3];
+  std::vector<size_t> rest;  // f_rest_0 ... in order
+};
+
+// A mapped splat PLY decoded a block of splats at a time, the unit
+// loadSplatPly() runs in parallel. decodeBlock() is safe to call
+// concurrently for different blocks.
+class SplatPlyReader {
+ public:
+  // Splats activated together, small enough for the scratch to stay in L2
+  static const uint32_t BlockSize = 1024;
+
+  // Maps the file and parses its header. Errors are printed.
+  bool open(const std::string& path);
+
+  uint32_t getSplatCount() const { return splatCount; }
+  int getShDegree() const { return shDegree; }
+  uint32_t getBlockCount() const {
+    return (splatCount + BlockSize - 1) / BlockSize;
+  }
+
+  void readCenter(uint32_t index, float center[3]) const;
+
+  // Activates the splats of `block` into shader.vs records: splat i goes to
+  // splats[slots ? slots[i] : i], through `transform` when given.
+  void decodeBlock(uint32_t block, GpuSplat* splats,
+                   const uint32_t* slots = nullptr,
+                   const SplatTransform* transform = nullptr) const;
+
+ private:
+  MappedFile file;
+  SplatPlyLayout layout;
+  const uint8_t* records = nullptr;
+  uint32_t splatCount = 0;
+  int shDegree = 0;
+};
+
+// Loads a trained 3D Gaussian Splatting PLY (x, y, z, f_dc_*, f_rest_*,
+// opacity, scale_*, rot_*) straight into shader.vs records.
+//
+// tinyply parses the header; the binary vertex payload is then read from a
+// mapping of the file as fixed-stride records, in one parallel pass over
+// blocks of splats. Each block is gathered into SoA scratch, activated in
+// bulk (sigmoid opacity, exp scale, normalized rotation to covariance) and
+// written out. Only binary little endian files are supported.
+bool loadSplatPly(const std::string& path, std::vector<GpuSplat>& splats,
+                  SplatPlyInfo* info = nullptr,
+                  ThreadPool& pool = ThreadPool::shared());
+
+// Same, with the splats stored along `curve` instead of in file order. The
+// centers are read and sorted first, then every record is activated
+// straight into its sorted slot, so no extra copy of the splats is made.
+bool loadSplatPly(const std::string& path, std::vector<GpuSplat>& splats,
+                  SplatCurve curve, SplatPlyInfo* info = nullptr,
+                  ThreadPool& pool = ThreadPool::shared());
+
+#endif
@@ -0,0 +1,167 @@
+#include "splatPrune.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "splatMath.h"
+#include "splatOrder.h"
+#include "timing.h"
+
+// Splats per scoring range
+static const size_t kMinSplatsPerTask = 4096;
+// SplatArrays are converted to covariances this many splats at a time
+static const size_t kChunkSize = 256;
+
+std::vector<SplatCamera> getOrbitCameras(const glm::vec3& target,
+                                         float distance, int count,
+                                         const glm::vec2& viewport,
+                                         float fovY) {
+  // Fibonacci lattice, evenly spread without a pole cluster
+  const float golden = std::acos(-1.0f) * (3.0f - std::sqrt(5.0f));
+  std::vector<SplatCamera> cameras;
+  for (int i = 0; i < count; i++) {
+    const float y = 1.0f - (2.0f * i + 1.0f) / count;
+    const float r = std::sqrt(std::max(0.0f, 1.0f - y * y));
+    const glm::vec3 direction(r * std::cos(golden * i), y,
+                              r * std::sin(golden * i));
+    cameras.push_back(SplatCamera::lookAt(target + distance * direction,
+                                          target, viewport, fovY));
+  }
+  return cameras;
+}
+
+static float scoreSplat(const GpuSplat& splat,
+                        const std::vector<SplatCamera>& cameras) {
+  float score = 0.0f;
+  for (const SplatCamera& camera : cameras) {
+    SplatQuad quad;
+    if (!projectSplat(splat, camera, quad))
+      continue;
+    // Integral of exp(-|p|^2) over the quad plane is pi
+    const float area = std::acos(-1.0f) * glm::length(quad.v1) *
+                       glm::length(quad.v2);
+    const float screen = camera.viewport.x * camera.viewport.y;
+    score += splat.alpha * std::min(area, screen);
+  }
+  return score;
+}
+
+void scoreSplats(const GpuSplat* splats, size_t count,
+                 const std::vector<SplatCamera>& cameras,
+                 std::vector<float>& scores, ThreadPool& pool) {
+  scores.resize(count);
+  pool.parallelForRange(0, count, kMinSplatsPerTask, [&](size_t first,
+                                                         size_t last) {
+    for (size_t i = first; i < last; i++)
+      scores[i] = scoreSplat(splats[i], cameras);
+  });
+}
+
+void scoreSplats(const SplatArrays& splats,
+                 const std::vector<SplatCamera>& cameras,
+                 std::vector<float>& scores, ThreadPool& pool) {
+  const size_t count = splats.size();
+  scores.resize(count);
+  const size_t chunkCount = (count + kChunkSize - 1) / kChunkSize;
+  pool.parallelForRange(0, chunkCount, kMinSplatsPerTask / kChunkSize,
+                        [&](size_t firstChunk, size_t lastChunk) {
+    float scratch[13][kChunkSize];
+    const float* scale[3] = {scratch[0], scratch[1], scratch[2]};
+    const float* rotation[4] = {scratch[3], scratch[4], scratch[5],
+                                scratch[6]};
+    float* covariance[6];
+    for (int c = 0; c < 6; c++)
+      covariance[c] = scratch[7 + c];
+    GpuSplat splat = GpuSplat();
+    for (size_t chunk = firstChunk; chunk < lastChunk; chunk++) {
+      const size_t begin = chunk * kChunkSize;
+      const size_t n = std::min(kChunkSize, count - begin);
+      for (size_t i = 0; i < n; i++) {
+        for (int c = 0; c < 3; c++)
+          scratch[c][i] = splats.scales[3 * (begin + i) + c];
+        for (int c = 0; c < 4; c++)
+          scratch[3 + c][i] = splats.rotations[4 * (begin + i) + c];
+      }
+      computeCovariances(scale, rotation, covariance, n);
+      for (size_t i = 0; i < n; i++) {
+        for (int c = 0; c < 3; c++) {
+          splat.center[c] = splats.centers[3 * (begin + i) + c];
+          splat.covA[c] = covariance[c][i];
+          splat.covB[c] = covariance[3 + c][i];
+        }
+        splat.alpha = splats.colors[4 * (begin + i) + 3] / 255.0f;
+        scores[begin + i] = scoreSplat(splat, cameras);
+      }
+    }
+  });
+}
+
+std::vector<uint32_t> selectSplats(const std::vector<float>& scores,
+                                   const SplatPruneOptions& options,
+                                   SplatPruneStats* stats) {
+  std::vector<uint32_t> kept;
+  double total = 0.0;
+  for (size_t i = 0; i < scores.size(); i++) {
+    total += scores[i];
+    if (scores[i] >= options.minScore)
+      kept.push_back((uint32_t)i);
+  }
+  if (options.maxSplats > 0 && kept.size() > options.maxSplats) {
+    // Highest scores, earlier splats first on ties, back in input order
+    auto higher = [&](uint32_t a, uint32_t b) {
+      return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+    };
+    std::nth_element(kept.begin(), kept.begin() + options.maxSplats,
+                     kept.end(), higher);
+    kept.resize(options.maxSplats);
+    std::sort(kept.begin(), kept.end());
+  }
+
+  if (stats) {
+    double keptTotal = 0.0;
+    float lowest = kept.empty() ? 0.0f : scores[kept[0]];
+    for (uint32_t i : kept) {
+      keptTotal += scores[i];
+      lowest = std::min(lowest, scores[i]);
+    }
+    stats->inputSplats = (uint32_t)scores.size();
+    stats->keptSplats = (uint32_t)kept.size();
+    stats->lowestKeptScore = lowest;
+    stats->keptContribution = total > 0.0 ? keptTotal / total : 1.0;
+  }
+  return kept;
+}
+
+void pruneSplats(std::vector<GpuSplat>& splats,
+                 const std::vector<SplatCamera>& cameras,
+                 const SplatPruneOptions& options, SplatPruneStats* stats,
+                 ThreadPool& pool) {
+  const Clock::time_point start = Clock::now();
+  std::vector<float> scores;
+  scoreSplats(splats.data(), splats.size(), cameras, scores, pool);
+  const double scoreMs = msSince(start);
+  const std::vector<uint32_t> kept = selectSplats(scores, options, stats);
+  reorderSplats(splats, kept, 1, pool);
+  if (stats) {
+    stats->scoreMs = scoreMs;
+    stats->ms = msSince(start);
+  }
+}
+
+void pruneSplats(SplatArrays& splats, const std::vector<SplatCamera>& cameras,
+                 const SplatPruneOptions& options, SplatPruneStats* stats,
+                 ThreadPool& pool) {
+  const Clock::time_point start = Clock::now();
+  std::vector<float> scores;
+  scoreSplats(splats, cameras, scores, pool);
+  const double scoreMs = msSince(start);
+  const std::vector<uint32_t> kept = selectSplats(scores, options, stats);
+  reorderSplats(splats.centers, kept, 3, pool);
+  reorderSplats(splats.scales, kept, 3, pool);
+  reorderSplats(splats.rotations, kept, 4, pool);
+  reorderSplats(splats.colors, kept, 4, pool);
+  if (stats) {
+    stats->scoreMs = scoreMs;
+    stats->ms = msSince(start);
+  }
+}
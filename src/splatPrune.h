@@ -0,0 +1,73 @@
+#ifndef SPLATPRUNE_H
+#define SPLATPRUNE_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "gpuSplat.h"
+#include "splatBufferWriter.h"
+#include "splatRasterizer.h"
+#include "threadPool.h"
+
+struct SplatPruneOptions {
+  // Splats scoring below this are dropped. Scores are in pixels of full
+  // opacity summed over the cameras, see scoreSplats().
+  float minScore = 0.0f;
+  // Keep at most this many splats, highest scores first; 0 keeps every
+  // splat reaching minScore.
+  uint32_t maxSplats = 0;
+};
+
+struct SplatPruneStats {
+  uint32_t inputSplats = 0;
+  uint32_t keptSplats = 0;
+  float lowestKeptScore = 0.0f;
+  // Share of the summed score of all splats that the kept ones hold
+  double keptContribution = 0.0;
+  double scoreMs = 0.0;
+  double ms = 0.0;
+};
+
+// Cameras spread evenly on a sphere around `target`, all looking at it.
+std::vector<SplatCamera> getOrbitCameras(const glm::vec3& target,
+                                         float distance, int count,
+                                         const glm::vec2& viewport,
+                                         float fovY);
+
+// scores[i] is the contribution of splat i summed over `cameras`: alpha
+// times the area of its Gaussian on screen, pi |v1| |v2| in pixels with
+// the quad axes of projectSplat(), capped at the viewport. Splats culled
+// by shader.vs add nothing. Ranges of splats are scored in parallel, each
+// against every camera.
+void scoreSplats(const GpuSplat* splats, size_t count,
+                 const std::vector<SplatCamera>& cameras,
+                 std::vector<float>& scores,
+                 ThreadPool& pool = ThreadPool::shared());
+
+// Same for SplatArrays, covariances computed from scales and rotations and
+// alpha taken from the color.
+void scoreSplats(const SplatArrays& splats,
+                 const std::vector<SplatCamera>& cameras,
+                 std::vector<float>& scores,
+                 ThreadPool& pool = ThreadPool::shared());
+
+// The splats to keep, in input order so any spatial order survives.
+std::vector<uint32_t> selectSplats(const std::vector<float>& scores,
+                                   const SplatPruneOptions& options,
+                                   SplatPruneStats* stats = nullptr);
+
+// Scores, selects and compacts in place. The kept set can be written back
+// out with writeSplatBuffer().
+void pruneSplats(std::vector<GpuSplat>& splats,
+                 const std::vector<SplatCamera>& cameras,
+                 const SplatPruneOptions& options,
+                 SplatPruneStats* stats = nullptr,
+                 ThreadPool& pool = ThreadPool::shared());
+void pruneSplats(SplatArrays& splats, const std::vector<SplatCamera>& cameras,
+                 const SplatPruneOptions& options,
+                 SplatPruneStats* stats = nullptr,
+                 ThreadPool& pool = ThreadPool::shared());
+
+#endif
@@ -0,0 +1,362 @@
+#include "splatRasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "timing.h"
+
+// Splats per projection range
+static const size_t kMinSplatsPerTask = 16384;
+// A pixel is done once less than this of the background can show through
+static const float kMinTransmittance = 1.0f / 255.0f;
+
+static const float SH_C0 = 0.28209479177387814f;
+static const float SH_C1 = 0.4886025119029199f;
+static const float SH_C2[5] = {1.0925484305920792f, -1.0925484305920792f,
+                               0.31539156525252005f, -1.0925484305920792f,
+                               0.5462742152960396f};
+static const float SH_C3[7] = {-0.5900435899266435f, 2.890611442640554f,
+                               -0.4570457994644658f, 0.3731763325901154f,
+                               -0.4570457994644658f, 1.445305721320277f,
+                               -0.5900435899266435f};
+
+// get_rgb() of shader.vs
+static glm::vec3 getRgb(const GpuSplat& s, const glm::vec3& d, int shDegree) {
+  auto sh = [&](int k) {
+    return glm::vec3(s.sh[k][0], s.sh[k][1], s.sh[k][2]);
+  };
+  glm::vec3 rgb(0.5f);
+  rgb += SH_C0 * sh(0);
+
+  if (shDegree >= 1) {
+    rgb += -SH_C1 * d.y * sh(1) + SH_C1 * d.z * sh(2) - SH_C1 * d.x * sh(3);
+  }
+
+  if (shDegree >= 2) {
+    const float xx = d.x * d.x, yy = d.y * d.y, zz = d.z * d.z;
+    const float xy = d.x * d.y, yz = d.y * d.z, xz = d.x * d.z;
+    rgb += SH_C2[0] * xy * sh(4) + SH_C2[1] * yz * sh(5) +
+           SH_C2[2] * (2.0f * zz - xx - yy) * sh(6) + SH_C2[3] * xz * sh(7) +
+           SH_C2[4] * (xx - yy) * sh(8);
+
+    if (shDegree >= 3) {
+      rgb += SH_C3[0] * d.y * (3.0f * xx - yy) * sh(9) +
+             SH_C3[1] * d.z * xy * sh(10) +
+             SH_C3[2] * d.y * (4.0f * zz - xx - yy) * sh(11) +
+             SH_C3[3] * d.z * (2.0f * zz - 3.0f * xx - 3.0f * yy) * sh(12) +
+             SH_C3[4] * d.x * (4.0f * zz - xx - yy) * sh(13) +
+             SH_C3[5] * d.z * (xx - yy) * sh(14) +
+             SH_C3[6] * d.x * (xx - 3.0f * yy) * sh(15);
+    }
+  }
+
+  return glm::clamp(rgb, 0.0f, 1.0f);
+}
+
+SplatCamera SplatCamera::lookAt(const glm::vec3& eye,
+                               const glm::vec3& target,
+                               const glm::vec2& viewport, float fovY,
+                               float nearPlane, float farPlane) {
+  const glm::vec3 forward = glm::normalize(target - eye);
+  const glm::vec3 helper = std::fabs(forward.y) < 0.999f
+                               ? glm::vec3(0.0f, 1.0f, 0.0f)
+                               : glm::vec3(0.0f, 0.0f, 1.0f);
+  const glm::vec3 right = glm::normalize(glm::cross(forward, helper));
+  const glm::vec3 down = glm::cross(forward, right);
+
+  SplatCamera camera;
+  camera.view = glm::mat4(1.0f);
+  for (int c = 0; c < 3; c++) {
+    camera.view[c][0] = right[c];
+    camera.view[c][1] = down[c];
+    camera.view[c][2] = forward[c];
+  }
+  camera.view[3] = glm::vec4(-glm::dot(right, eye), -glm::dot(down, eye),
+                             -glm::dot(forward, eye), 1.0f);
+
+  const float focal = 0.5f * viewport.y / std::tan(0.5f * fovY);
+  camera.focal = glm::vec2(focal);
+  camera.viewport = viewport;
+  camera.position = eye;
+  camera.projection = glm::mat4(0.0f);
+  camera.projection[0][0] = 2.0f * focal / viewport.x;
+  camera.projection[1][1] = -2.0f * focal / viewport.y;
+  camera.projection[2][2] = (farPlane + nearPlane) / (farPlane - nearPlane);
+  camera.projection[2][3] = 1.0f;
+  camera.projection[3][2] =
+      -2.0f * farPlane * nearPlane / (farPlane - nearPlane);
+  return camera;
+}
+
+// main() of shader.vs, up to the quad corners
+bool projectSplat(const GpuSplat& s, const SplatCamera& camera,
+                  SplatQuad& quad) {
+  const glm::vec3 center(s.center[0], s.center[1], s.center[2]);
+  const glm::vec4 camspace = camera.view * glm::vec4(center, 1.0f);
+  const glm::vec4 pos2d = camera.projection * camspace;
+
+  const float bounds = 1.2f * pos2d.w;
+  if (pos2d.z < -pos2d.w || pos2d.x < -bounds || pos2d.x > bounds ||
+      pos2d.y < -bounds || pos2d.y > bounds)
+    return false;
+
+  const glm::mat3 Vrk(s.covA[0], s.covA[1], s.covA[2],
+                      s.covA[1], s.covB[0], s.covB[1],
+                      s.covA[2], s.covB[1], s.covB[2]);
+  const float z2 = camspace.z * camspace.z;
+  const glm::mat3 J(camera.focal.x / camspace.z, 0.0f,
+                    -(camera.focal.x * camspace.x) / z2,
+                    0.0f, -camera.focal.y / camspace.z,
+                    (camera.focal.y * camspace.y) / z2,
+                    0.0f, 0.0f, 0.0f);
+  const glm::mat3 W = glm::transpose(glm::mat3(camera.view));
+  const glm::mat3 T = W * J;
+  const glm::mat3 cov = glm::transpose(T) * Vrk * T;
+
+  const glm::vec2 vCenter = glm::vec2(pos2d) / pos2d.w;
+
+  const float diagonal1 = cov[0][0] + 0.3f;
+  const float offDiagonal = cov[0][1];
+  const float diagonal2 = cov[1][1] + 0.3f;
+
+  const float mid = 0.5f * (diagonal1 + diagonal2);
+  const float radius =
+      glm::length(glm::vec2((diagonal1 - diagonal2) / 2.0f, offDiagonal));
+  const float lambda1 = mid + radius;
+  const float lambda2 = std::max(mid - radius, 0.1f);
+  // The shader normalizes a zero vector for axis aligned splats with
+  // diagonal1 >= diagonal2; their major axis is x
+  glm::vec2 diagonalVector(offDiagonal, lambda1 - diagonal1);
+  const float vectorLength = glm::length(diagonalVector);
+  diagonalVector = vectorLength > 0.0f ? diagonalVector / vectorLength
+                                       : glm::vec2(1.0f, 0.0f);
+  const glm::vec2 v1 =
+      std::min(std::sqrt(2.0f * lambda1), 1024.0f) * diagonalVector;
+  const glm::vec2 v2 = std::min(std::sqrt(2.0f * lambda2), 1024.0f) *
+                       glm::vec2(diagonalVector.y, -diagonalVector.x);
+  if (!std::isfinite(v1.x + v1.y + v2.x + v2.y + vCenter.x + vCenter.y))
+    return false;
+
+  quad.center = vCenter;
+  quad.v1 = v1;
+  quad.v2 = v2;
+  quad.depth = pos2d.w;
+  return true;
+}
+
+SplatRasterizer::SplatRasterizer(ThreadPool& pool) : pool(pool) {}
+
+SplatRasterStats SplatRasterizer::render(const GpuSplat* splats, size_t count,
+                                         const SplatCamera& camera,
+                                         std::vector<uint8_t>& rgba,
+                                         const glm::vec4& background) {
+  const Clock::time_point start = Clock::now();
+  const int width = std::max(0, (int)camera.viewport.x);
+  const int height = std::max(0, (int)camera.viewport.y);
+  const int tilesX = (width + TileSize - 1) / TileSize;
+  const int tilesY = (height + TileSize - 1) / TileSize;
+  rgba.resize((size_t)width * height * 4);
+
+  SplatRasterStats stats;
+  project(splats, count, camera, width, height);
+  stats.projectMs = msSince(start);
+
+  Clock::time_point phase = Clock::now();
+  stats.visibleSplats = bin(count, tilesX, tilesY);
+  stats.tileEntries = tileEntries.size();
+  stats.binMs = msSince(phase);
+
+  phase = Clock::now();
+  pool.parallelFor((size_t)tilesX * tilesY, [&](size_t tile) {
+    blendTile((int)(tile % tilesX), (int)(tile / tilesX), width, height,
+              background, rgba.data());
+  });
+  stats.blendMs = msSince(phase);
+  stats.ms = msSince(start);
+  return stats;
+}
+
+// projectSplat() of every splat, then the tiles its quad touches
+void SplatRasterizer::project(const GpuSplat* splats, size_t count,
+                              const SplatCamera& camera, int width,
+                              int height) {
+  projected.resize(count);
+  const int shDegree = std::min(std::max(camera.shDegree, 0), 3);
+
+  pool.parallelForRange(0, count, kMinSplatsPerTask, [&](size_t first,
+                                                         size_t last) {
+    for (size_t i = first; i < last; i++) {
+      const GpuSplat& s = splats[i];
+      ProjectedSplat& out = projected[i];
+      out.tileMin[0] = out.tileMax[0] = 0;
+
+      SplatQuad quad;
+      if (!projectSplat(s, camera, quad))
+        continue;
+      const glm::vec2& v1 = quad.v1;
+      const glm::vec2& v2 = quad.v2;
+      const glm::vec3 center(s.center[0], s.center[1], s.center[2]);
+
+      out.center = (quad.center * 0.5f + 0.5f) * camera.viewport;
+      out.axis1 = v1 / glm::dot(v1, v1);
+      out.axis2 = v2 / glm::dot(v2, v2);
+      out.color = getRgb(s, glm::normalize(center - camera.position), shDegree);
+      out.alpha = s.alpha;
+      out.depth = quad.depth;
+
+      // Pixels whose centers fall in the quad, corners at +-2 v1 +-2 v2
+      const glm::vec2 extent = 2.0f * (glm::abs(v1) + glm::abs(v2));
+      for (int a = 0; a < 2; a++) {
+        const int size = a == 0 ? width : height;
+        const float lo = std::ceil(out.center[a] - extent[a] - 0.5f);
+        const float hi = std::floor(out.center[a] + extent[a] - 0.5f) + 1.0f;
+        out.pixelMin[a] = (int)std::max(lo, 0.0f);
+        out.pixelMax[a] = (int)std::min(hi, (float)size);
+      }
+      if (out.pixelMin[0] >= out.pixelMax[0] ||
+          out.pixelMin[1] >= out.pixelMax[1])
+        continue;
+      for (int a = 0; a < 2; a++) {
+        out.tileMin[a] = out.pixelMin[a] / TileSize;
+        out.tileMax[a] = (out.pixelMax[a] - 1) / TileSize + 1;
+      }
+    }
+  });
+}
+
+// Tile lists in splat order: per range histograms over the tiles, offsets
+// in (tile, range) order, then every range scatters its own splats.
+// Returns the number of splats that touch a tile.
+uint32_t SplatRasterizer::bin(size_t count, int tilesX, int tilesY) {
+  const size_t tileCount = (size_t)tilesX * tilesY;
+  const size_t ranges = std::max<size_t>(
+      1, std::min(pool.getThreadCount(), count / kMinSplatsPerTask));
+  const size_t rangeSize = (count + ranges - 1) / ranges;
+  std::vector<uint32_t> counts(ranges * tileCount, 0);
+  std::vector<uint32_t> rangeVisible(ranges, 0);
+
+  auto forEachTile = [&](const ProjectedSplat& p, uint32_t* range,
+                         uint32_t value, bool scatter) {
+    for (int y = p.tileMin[1]; y < p.tileMax[1]; y++)
+      for (int x = p.tileMin[0]; x < p.tileMax[0]; x++) {
+        uint32_t& slot = range[(size_t)y * tilesX + x];
+        if (scatter)
+          tileEntries[slot] = value;
+        slot++;
+      }
+  };
+
+  pool.parallelFor(ranges, [&](size_t r) {
+    uint32_t* range = &counts[r * tileCount];
+    const size_t end = std::min(count, (r + 1) * rangeSize);
+    for (size_t i = r * rangeSize; i < end; i++) {
+      const ProjectedSplat& p = projected[i];
+      if (p.tileMax[0] > p.tileMin[0]) {
+        forEachTile(p, range, 0, false);
+        rangeVisible[r]++;
+      }
+    }
+  });
+
+  tileOffsets.resize(tileCount + 1);
+  uint32_t offset = 0;
+  for (size_t t = 0; t < tileCount; t++) {
+    tileOffsets[t] = offset;
+    for (size_t r = 0; r < ranges; r++) {
+      const uint32_t n = counts[r * tileCount + t];
+      counts[r * tileCount + t] = offset;
+      offset += n;
+    }
+  }
+  tileOffsets[tileCount] = offset;
+  tileEntries.resize(offset);
+
+  pool.parallelFor(ranges, [&](size_t r) {
+    uint32_t* range = &counts[r * tileCount];
+    const size_t end = std::min(count, (r + 1) * rangeSize);
+    for (size_t i = r * rangeSize; i < end; i++) {
+      const ProjectedSplat& p = projected[i];
+      if (p.tileMax[0] > p.tileMin[0])
+        forEachTile(p, range, (uint32_t)i, true);
+    }
+  });
+
+  uint32_t visibleSplats = 0;
+  for (uint32_t n : rangeVisible)
+    visibleSplats += n;
+  return visibleSplats;
+}
+
+void SplatRasterizer::blendTile(int tileX, int tileY, int width, int height,
+                                const glm::vec4& background, uint8_t* rgba) {
+  const size_t tile = (size_t)tileY * ((width + TileSize - 1) / TileSize) +
+                      tileX;
+  uint32_t* first = tileEntries.data() + tileOffsets[tile];
+  uint32_t* last = tileEntries.data() + tileOffsets[tile + 1];
+  // Front to back, splat index breaking ties so the image is deterministic
+  if (blendInInputOrder)
+    std::sort(first, last);
+  else
+    std::sort(first, last, [&](uint32_t a, uint32_t b) {
+      const float da = projected[a].depth, db = projected[b].depth;
+      return da < db || (da == db && a < b);
+    });
+
+  const int x0 = tileX * TileSize, y0 = tileY * TileSize;
+  const int x1 = std::min(x0 + TileSize, width);
+  const int y1 = std::min(y0 + TileSize, height);
+  const int tileWidth = x1 - x0;
+  const int pixelCount = tileWidth * (y1 - y0);
+  float transmittance[TileSize * TileSize];
+  glm::vec3 color[TileSize * TileSize];
+  std::fill(transmittance, transmittance + pixelCount, 1.0f);
+  std::fill(color, color + pixelCount, glm::vec3(0.0f));
+  int done = 0;
+
+  for (const uint32_t* entry = first; entry != last && done < pixelCount;
+       entry++) {
+    const ProjectedSplat& p = projected[*entry];
+    const int xBegin = std::max(p.pixelMin[0], x0);
+    const int xEnd = std::min(p.pixelMax[0], x1);
+    const int yBegin = std::max(p.pixelMin[1], y0);
+    const int yEnd = std::min(p.pixelMax[1], y1);
+    for (int y = yBegin; y < yEnd; y++) {
+      const float dy = (float)y + 0.5f - p.center.y;
+      for (int x = xBegin; x < xEnd; x++) {
+        const int pixel = (y - y0) * tileWidth + (x - x0);
+        float& t = transmittance[pixel];
+        if (t < kMinTransmittance)
+          continue;
+        const float dx = (float)x + 0.5f - p.center.x;
+        const float px = dx * p.axis1.x + dy * p.axis1.y;
+        const float py = dx * p.axis2.x + dy * p.axis2.y;
+        const float A = -(px * px + py * py);
+        if (A < -4.0f)
+          continue;
+        const float B = std::exp(A) * p.alpha;
+        color[pixel] += t * B * p.color;
+        t *= 1.0f - B;
+        if (t < kMinTransmittance)
+          done++;
+      }
+    }
+  }
+
+  // Over the background, back to straight alpha; window rows are bottom up
+  const glm::vec3 backgroundColor = glm::vec3(background) * background.a;
+  for (int y = y0; y < y1; y++) {
+    uint8_t* row = rgba + ((size_t)(height - 1 - y) * width + x0) * 4;
+    for (int x = 0; x < tileWidth; x++) {
+      const int pixel = (y - y0) * tileWidth + x;
+      const float t = transmittance[pixel];
+      const float alpha = (1.0f - t) + t * background.a;
+      glm::vec3 rgb = color[pixel] + t * backgroundColor;
+      if (alpha > 0.0f)
+        rgb /= alpha;
+      const glm::vec4 out =
+          glm::clamp(glm::vec4(rgb, alpha), 0.0f, 1.0f) * 255.0f + 0.5f;
+      for (int c = 0; c < 4; c++)
+        row[4 * x + c] = (uint8_t)out[c];
+    }
+  }
+}
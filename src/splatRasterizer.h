@@ -0,0 +1,108 @@
+#ifndef SPLATRASTERIZER_H
+#define SPLATRASTERIZER_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "gpuSplat.h"
+#include "threadPool.h"
+
+// The uniforms of shader/shader.vs, in the same conventions.
+struct SplatCamera {
+  glm::mat4 projection = glm::mat4(1.0f);
+  glm::mat4 view = glm::mat4(1.0f);
+  glm::vec2 focal = glm::vec2(1.0f);     // pixels
+  glm::vec2 viewport = glm::vec2(1.0f);  // pixels, the image size
+  glm::vec3 position = glm::vec3(0.0f);
+  int shDegree = 3;
+
+  // A camera at `eye` looking at `target`, in the conventions above: view
+  // space looks down +z with y down, clip w is the view depth.
+  static SplatCamera lookAt(const glm::vec3& eye, const glm::vec3& target,
+                            const glm::vec2& viewport, float fovY,
+                            float nearPlane = 0.1f, float farPlane = 1000.0f);
+};
+
+// A splat as main() of shader.vs places it: the quad center in NDC and its
+// two half axes in pixels (the quad spans +-2 of each).
+struct SplatQuad {
+  glm::vec2 center;
+  glm::vec2 v1;
+  glm::vec2 v2;
+  float depth;  // clip w
+};
+
+// False when shader.vs culls the splat or its quad is not finite.
+bool projectSplat(const GpuSplat& splat, const SplatCamera& camera,
+                  SplatQuad& quad);
+
+struct SplatRasterStats {
+  uint32_t visibleSplats = 0;
+  uint64_t tileEntries = 0;
+  double projectMs = 0.0;
+  double binMs = 0.0;
+  double blendMs = 0.0;
+  double ms = 0.0;
+};
+
+// Renders GpuSplat records without a GL context, for thumbnails, golden
+// images and as a baseline for the GPU path.
+//
+// Projection follows shader.vs line by line: the same culling, 2D
+// covariance, eigen decomposition, quad axes and SH up to degree 3. Pixels
+// follow shader.fs: exp(-|p|^2) * alpha inside |p|^2 <= 4, where p is the
+// pixel in quad coordinates, blended front to back in the order of w as
+// with ONE_MINUS_DST_ALPHA, ONE blending.
+//
+// Splats are binned into TileSize x TileSize tiles; every tile sorts its
+// splats by depth and blends them as a task of its own, and stops once all
+// its pixels are opaque to 8 bits.
+class SplatRasterizer {
+ public:
+  static const int TileSize = 16;
+
+  explicit SplatRasterizer(ThreadPool& pool = ThreadPool::shared());
+
+  // Writes camera.viewport sized RGBA8 to `rgba`, top row first, composited
+  // over `background` (straight alpha).
+  SplatRasterStats render(const GpuSplat* splats, size_t count,
+                          const SplatCamera& camera,
+                          std::vector<uint8_t>& rgba,
+                          const glm::vec4& background = glm::vec4(0.0f));
+
+  // Blends the splats in the order given, first in front, as the GPU does
+  // with its draw order, instead of sorting every tile by depth. Measures
+  // what an approximate draw order costs.
+  void setBlendInInputOrder(bool inputOrder) { blendInInputOrder = inputOrder; }
+
+ private:
+  // A splat after the vertex shader, in window coordinates (y up)
+  struct ProjectedSplat {
+    glm::vec2 center;
+    glm::vec2 axis1;  // v1 / |v1|^2, so p.x = dot(pixel - center, axis1)
+    glm::vec2 axis2;
+    glm::vec3 color;
+    float alpha;
+    float depth;
+    int tileMin[2];
+    int tileMax[2];  // exclusive
+    int pixelMin[2];
+    int pixelMax[2];  // exclusive
+  };
+
+  void project(const GpuSplat* splats, size_t count, const SplatCamera& camera,
+               int width, int height);
+  uint32_t bin(size_t count, int tilesX, int tilesY);
+  void blendTile(int tileX, int tileY, int width, int height,
+                 const glm::vec4& background, uint8_t* rgba);
+
+  ThreadPool& pool;
+  std::vector<ProjectedSplat> projected;
+  std::vector<uint32_t> tileOffsets;  // tileCount + 1
+  std::vector<uint32_t> tileEntries;  // splat indexes, grouped by tile
+  bool blendInInputOrder = false;
+};
+
+#endif
@@ -0,0 +1,550 @@
+#include "splatSequence.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include "mappedFile.h"
+#include "splatBuffer.h"
+#include "splatComposer.h"
+#include "timing.h"
+
+static const size_t kMinBlocksPerTask = 4;
+
+// Relative cost per splat of the ways to build a frame, to pick the
+// cheapest: copying a decoded frame, applying a delta (decode and scatter)
+// and decoding a key frame.
+static const size_t kCopySplatCost = 1;
+static const size_t kDeltaSplatCost = 2;
+static const size_t kDecodeSplatCost = 4;
+
+static size_t getDeltaDataOffset(uint32_t changedCount) {
+  return (SplatDeltaHeaderBytes + 4 * (size_t)changedCount + 15) & ~(size_t)15;
+}
+
+template <typename T>
+static bool differs(const std::vector<T>& a, const std::vector<T>& b,
+                    size_t begin, size_t count, float tolerance) {
+  for (size_t i = begin; i < begin + count; i++)
+    if (std::fabs((float)a[i] - (float)b[i]) > tolerance)
+      return true;
+  return false;
+}
+
+bool writeSplatDelta(const SplatArrays& previous, const SplatArrays& next,
+                     const std::string& path,
+                     const SplatDeltaWriteOptions& options,
+                     SplatDeltaWriteStats* stats, ThreadPool& pool) {
+  const Clock::time_point start = Clock::now();
+  const uint32_t count = next.size();
+  if (previous.size() != count) {
+    std::cerr << "Error: delta frame " << path << " has " << count
+              << " splats, the frame before it " << previous.size()
+              << std::endl;
+    return false;
+  }
+
+  std::vector<uint8_t> changedFlags(count, 0);
+  pool.parallelForRange(0, count, ThreadPool::kDefaultGrain,
+                        [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; i++)
+      changedFlags[i] =
+          differs(previous.centers, next.centers, 3 * i, 3,
+                  options.tolerance) ||
+          differs(previous.scales, next.scales, 3 * i, 3,
+                  options.tolerance) ||
+          differs(previous.rotations, next.rotations, 4 * i, 4,
+                  options.tolerance) ||
+          std::memcmp(&previous.colors[4 * i], &next.colors[4 * i], 4) != 0;
+  });
+
+  std::vector<uint32_t> indexes;
+  for (uint32_t i = 0; i < count; i++)
+    if (changedFlags[i])
+      indexes.push_back(i);
+  const uint32_t changedCount = (uint32_t)indexes.size();
+
+  std::vector<uint8_t> image;
+  if (changedCount > 0) {
+    SplatArrays changed;
+    changed.resize(changedCount);
+    for (uint32_t c = 0; c < changedCount; c++) {
+      const size_t i = indexes[c];
+      std::copy_n(&next.centers[3 * i], 3, &changed.centers[3 * c]);
+      std::copy_n(&next.scales[3 * i], 3, &changed.scales[3 * c]);
+      std::copy_n(&next.rotations[4 * i], 4, &changed.rotations[4 * c]);
+      std::copy_n(&next.colors[4 * i], 4, &changed.colors[4 * c]);
+    }
+    SplatBufferWriteOptions bufferOptions = options.buffer;
+    bufferOptions.keepOrder = true;
+    if (!writeSplatBuffer(changed, image, bufferOptions, nullptr, pool))
+      return false;
+  }
+
+  const uint32_t header[4] = {SplatDeltaVersion, count, changedCount, 0};
+  std::vector<uint8_t> bytes(getDeltaDataOffset(changedCount) + image.size(),
+                             0);
+  std::memcpy(bytes.data(), SplatDeltaMagic, sizeof(SplatDeltaMagic));
+  std::memcpy(bytes.data() + sizeof(SplatDeltaMagic), header, sizeof(header));
+  if (changedCount > 0) {
+    std::memcpy(bytes.data() + SplatDeltaHeaderBytes, indexes.data(),
+                4 * (size_t)changedCount);
+    std::memcpy(bytes.data() + getDeltaDataOffset(changedCount), image.data(),
+                image.size());
+  }
+
+  std::ofstream file(path, std::ios::binary);
+  if (!file.write(reinterpret_cast<const char*>(bytes.data()),
+                  (std::streamsize)bytes.size())) {
+    std::cerr << "Error: can't write " << path << std::endl;
+    return false;
+  }
+
+  if (stats) {
+    stats->splatCount = count;
+    stats->changedCount = changedCount;
+    stats->bytes = bytes.size();
+    stats->ms = msSince(start);
+  }
+  return true;
+}
+
+SplatSequence::SplatSequence(const SplatSequenceSettings& settings,
+                             bool threaded)
+    : settings(settings), threaded(threaded) {}
+
+SplatSequence::~SplatSequence() {
+  clear();
+}
+
+bool SplatSequence::load(const std::vector<std::string>& paths,
+                         ThreadPool& threadPool) {
+  clear();
+  if (paths.empty()) {
+    std::cerr << "Error: empty splat sequence" << std::endl;
+    return false;
+  }
+  // Frame times and the loop wrap divide by it
+  if (!(settings.fps > 0.0f) || !std::isfinite(settings.fps)) {
+    std::cerr << "Error: splat sequence fps must be positive and finite, got "
+              << settings.fps << std::endl;
+    return false;
+  }
+  pool = &threadPool;
+
+  // Only the delta headers are read here; key frames are decoded on demand
+  frames.resize(paths.size());
+  for (size_t f = 0; f < paths.size(); f++) {
+    Frame& frame = frames[f];
+    frame.path = paths[f];
+    std::ifstream file(frame.path, std::ios::binary);
+    if (!file) {
+      std::cerr << "Error: can't read splat frame " << frame.path
+                << std::endl;
+      clear();
+      return false;
+    }
+    char header[SplatDeltaHeaderBytes];
+    if (!file.read(header, sizeof(header)) ||
+        std::memcmp(header, SplatDeltaMagic, sizeof(SplatDeltaMagic)) != 0)
+      continue;
+    uint32_t fields[4];
+    std::memcpy(fields, header + sizeof(SplatDeltaMagic), sizeof(fields));
+    if (fields[0] != SplatDeltaVersion || f == 0) {
+      std::cerr << "Error: "
+                << (f == 0 ? "the first frame must be a key frame, "
+                           : "unsupported delta frame version, ")
+                << frame.path << std::endl;
+      clear();
+      return false;
+    }
+    frame.delta = true;
+    frame.changedCount = fields[2];
+  }
+  for (const Frame& frame : frames)
+    (frame.delta ? stats.deltaFrames : stats.keyFrames)++;
+  stats.frameCount = (uint32_t)frames.size();
+
+  // The current frame, a window of prefetchFrames + 1 from the target on,
+  // and the one the target replaces
+  slots.resize(std::max(0, settings.prefetchFrames) + 2);
+  build(0, 0);
+  if (!slots[0].ready) {
+    clear();
+    return false;
+  }
+  activeSlot = 0;
+  currentFrame = 0;
+  fullUpload = true;
+  time = 0.0;
+  updateWindow();
+
+  stopping = false;
+#if defined(SPLAT_HAS_THREADS)
+  if (threaded)
+    decodeThread = std::thread(&SplatSequence::decodeLoop, this);
+#endif
+  return true;
+}
+
+void SplatSequence::clear() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  if (decodeThread.joinable())
+    decodeThread.join();
+
+  frames.clear();
+  slots.clear();
+  window.clear();
+  activeSlot = -1;
+  currentFrame = -1;
+  time = 0.0;
+  fullUpload = true;
+  stats = SplatSequenceStats();
+  totalBuildMs = 0.0;
+  buildCount = 0;
+}
+
+bool SplatSequence::update(double deltaSeconds, double budgetMs) {
+  if (frames.empty())
+    return false;
+
+  if (playing) {
+    time += deltaSeconds * speed;
+    const double duration = getDuration();
+    if (settings.loop) {
+      time = std::fmod(time, duration);
+      if (time < 0.0)
+        time += duration;
+    } else if (time < 0.0 || time >= duration) {
+      time = std::max(0.0, std::min(time, duration));
+      playing = false;
+    }
+  }
+  updateWindow();
+
+  if (!threaded) {
+    // No decode thread: build frames for the rest of the budget
+    const Clock::time_point start = Clock::now();
+    int frame, slot;
+    while (msSince(start) < budgetMs) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!findWork(frame, slot))
+          break;
+        slots[slot].ready = false;
+      }
+      build(frame, slot);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  return swapToTarget();
+}
+
+const GpuSplat* SplatSequence::getSplats() const {
+  return activeSlot < 0 ? nullptr : slots[activeSlot].splats.data();
+}
+
+uint32_t SplatSequence::getSplatCount() const {
+  return activeSlot < 0 ? 0 : (uint32_t)slots[activeSlot].splats.size();
+}
+
+const std::vector<uint32_t>& SplatSequence::getChangedSplats() const {
+  static const std::vector<uint32_t> none;
+  return activeSlot < 0 || fullUpload ? none : slots[activeSlot].changed;
+}
+
+void SplatSequence::setSpeed(float newSpeed) {
+  speed = newSpeed;
+  updateWindow();
+}
+
+void SplatSequence::setTime(float newTime) {
+  time = std::max(0.0, std::min((double)newTime, (double)getDuration()));
+  updateWindow();
+}
+
+// The frames to keep decoded: the target and prefetchFrames after it, in
+// the playing direction.
+void SplatSequence::updateWindow() {
+  if (frames.empty())
+    return;
+  const int count = (int)frames.size();
+  const int step = speed < 0.0f ? -1 : 1;
+  int frame = getTargetFrame();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    window.clear();
+    for (int i = 0; i <= std::max(0, settings.prefetchFrames); i++) {
+      window.push_back(frame);
+      frame += step;
+      if (frame < 0 || frame >= count) {
+        if (!settings.loop)
+          break;
+        frame = (frame + count) % count;
+      }
+      if (frame == window[0])
+        break;
+    }
+  }
+  wake.notify_one();
+}
+
+float SplatSequence::getDuration() const {
+  return settings.fps > 0.0f ? (float)frames.size() / settings.fps : 0.0f;
+}
+
+float SplatSequence::getPct() const {
+  const float duration = getDuration();
+  return duration > 0.0f ? (float)time / duration : 0.0f;
+}
+
+SplatSequenceStats SplatSequence::getStats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  SplatSequenceStats result = stats;
+  result.readyFrames = 0;
+  for (size_t s = 0; s < slots.size(); s++)
+    if (slots[s].ready && (int)s != activeSlot &&
+        std::find(window.begin(), window.end(), slots[s].frame) !=
+            window.end())
+      result.readyFrames++;
+  return result;
+}
+
+void SplatSequence::decodeLoop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  int frame, slot;
+  while (true) {
+    wake.wait(lock, [&] { return stopping || findWork(frame, slot); });
+    if (stopping)
+      return;
+    slots[slot].ready = false;
+    lock.unlock();
+    build(frame, slot);
+    lock.lock();
+  }
+}
+
+// With the mutex held: the first frame of the window without a decoded
+// slot, and the free slot it is cheapest to build in. Free slots are the
+// ones that are not shown and hold nothing in the window.
+bool SplatSequence::findWork(int& frame, int& slot) {
+  auto inWindow = [this](int f) {
+    return std::find(window.begin(), window.end(), f) != window.end();
+  };
+  for (int f : window) {
+    if (frames[f].failed)
+      continue;
+    bool decoded = false;
+    for (const Slot& s : slots)
+      decoded |= s.ready && s.frame == f;
+    if (decoded)
+      continue;
+
+    const int key = getKeyFrame(f);
+    size_t bestCost = std::numeric_limits<size_t>::max();
+    slot = -1;
+    for (int s = 0; s < (int)slots.size(); s++) {
+      if (s == activeSlot || (slots[s].ready && inWindow(slots[s].frame)))
+        continue;
+      const int held = slots[s].ready ? slots[s].frame : -1;
+      const size_t cost = held >= key && held <= f
+                              ? getDeltaCost(held, f)
+                              : std::numeric_limits<size_t>::max() - 1;
+      if (slot < 0 || cost < bestCost) {
+        slot = s;
+        bestCost = cost;
+      }
+    }
+    if (slot < 0)
+      return false;
+    frame = f;
+    return true;
+  }
+  return false;
+}
+
+// Builds `frame` into slot `s`, which findWork() handed out. Only the
+// builder writes slot contents, ready flags and failed flags, so it reads
+// them unlocked.
+void SplatSequence::build(int frame, int s) {
+  const Clock::time_point start = Clock::now();
+  Slot& slot = slots[s];
+  const int key = getKeyFrame(frame);
+  const int held = slot.frame;
+
+  // Nearest decoded frame between the key frame and this one
+  int source = -1;
+  for (int t = 0; t < (int)slots.size(); t++)
+    if (t != s && slots[t].ready && slots[t].frame >= key &&
+        slots[t].frame < frame &&
+        (source < 0 || slots[t].frame > slots[source].frame))
+      source = t;
+
+  const size_t splatCount =
+      held >= 0 ? slot.splats.size()
+                : (source >= 0 ? slots[source].splats.size() : 0);
+  const size_t heldCost = held >= key && held <= frame
+                              ? kDeltaSplatCost * getDeltaCost(held, frame)
+                              : std::numeric_limits<size_t>::max();
+  const size_t copyCost =
+      source >= 0 ? kCopySplatCost * slots[source].splats.size() +
+                        kDeltaSplatCost *
+                            getDeltaCost(slots[source].frame, frame)
+                  : std::numeric_limits<size_t>::max();
+  const size_t decodeCost = kDecodeSplatCost * splatCount +
+                            kDeltaSplatCost * getDeltaCost(key, frame);
+
+  int base;
+  bool ok = true;
+  uint64_t decoded = 0, copied = 0, applied = 0;
+  if (heldCost <= copyCost && heldCost <= decodeCost) {
+    base = held;
+  } else if (copyCost <= decodeCost) {
+    const Slot& from = slots[source];
+    slot.splats.resize(from.splats.size());
+    pool->parallelForRange(0, from.splats.size(), ThreadPool::kDefaultGrain,
+                           [&](size_t first, size_t last) {
+                             std::memcpy(slot.splats.data() + first,
+                                         from.splats.data() + first,
+                                         (last - first) * sizeof(GpuSplat));
+                           });
+    base = from.frame;
+    copied++;
+  } else {
+    ok = decodeKeyFrame(key, slot);
+    slot.changed.clear();
+    base = key;
+    decoded++;
+  }
+  for (int f = base + 1; ok && f <= frame; f++) {
+    ok = applyDelta(f, slot);
+    applied++;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  slot.frame = ok ? frame : -1;
+  slot.ready = ok;
+  if (!ok) {
+    frames[frame].failed = true;
+    stats.errors++;
+    return;
+  }
+  stats.decodedFrames += decoded;
+  stats.copiedFrames += copied;
+  stats.appliedDeltas += applied;
+  totalBuildMs += msSince(start);
+  stats.averageBuildMs = totalBuildMs / (double)++buildCount;
+}
+
+bool SplatSequence::decodeKeyFrame(int frame, Slot& slot) {
+  SplatSceneFile file;
+  file.path = frames[frame].path;
+  // Keeps the slot's allocation when the splat count does not change
+  if (!composeSplatScene({file}, slot.splats, nullptr, *pool)) {
+    std::cerr << "Error: can't decode splat frame " << file.path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool SplatSequence::applyDelta(int frame, Slot& slot) {
+  const std::string& path = frames[frame].path;
+  MappedFile file(path);
+  const uint8_t* bytes = file.data();
+  uint32_t header[4] = {0, 0, 0, 0};
+  if (file.isOpen() && file.size() >= SplatDeltaHeaderBytes)
+    std::memcpy(header, bytes + sizeof(SplatDeltaMagic), sizeof(header));
+  const uint32_t changedCount = header[2];
+  const size_t dataOffset = getDeltaDataOffset(changedCount);
+  if (!file.isOpen() || header[0] != SplatDeltaVersion ||
+      file.size() < dataOffset) {
+    std::cerr << "Error: can't read delta frame " << path << std::endl;
+    return false;
+  }
+  if (header[1] != slot.splats.size()) {
+    std::cerr << "Error: delta frame " << path << " has " << header[1]
+              << " splats, the frame before it " << slot.splats.size()
+              << std::endl;
+    return false;
+  }
+
+  const uint32_t* indexes =
+      reinterpret_cast<const uint32_t*>(bytes + SplatDeltaHeaderBytes);
+  for (uint32_t c = 0; c < changedCount; c++)
+    if (indexes[c] >= header[1]) {
+      std::cerr << "Error: delta frame " << path << " changes splat "
+                << indexes[c] << " of " << header[1] << std::endl;
+      return false;
+    }
+  slot.changed.assign(indexes, indexes + changedCount);
+  if (changedCount == 0)
+    return true;
+
+  const SplatBuffer buffer(bytes + dataOffset, file.size() - dataOffset);
+  if (!buffer.isValid() || buffer.getSplatCount() != changedCount) {
+    std::cerr << "Error: can't read the splats of delta frame " << path
+              << std::endl;
+    return false;
+  }
+
+  // Decode blocks in parallel, each scattered to the splats it replaces
+  const uint32_t blockSize = buffer.getDecodeBlockSize();
+  GpuSplat* splats = slot.splats.data();
+  pool->parallelForRange(
+      0, buffer.getDecodeBlockCount(), kMinBlocksPerTask,
+      [&](size_t firstBlock, size_t lastBlock) {
+        std::vector<GpuSplat> scratch(blockSize);
+        for (size_t b = firstBlock; b < lastBlock; b++) {
+          decodeSplatBufferBlock(buffer, (uint32_t)b, scratch.data());
+          const uint32_t first = (uint32_t)b * blockSize;
+          const uint32_t count = std::min(blockSize, changedCount - first);
+          for (uint32_t i = 0; i < count; i++)
+            splats[indexes[first + i]] = scratch[i];
+        }
+      });
+  return true;
+}
+
+int SplatSequence::getKeyFrame(int frame) const {
+  while (frame > 0 && frames[frame].delta)
+    frame--;
+  return frame;
+}
+
+// Splats changed by the deltas after `from` up to `to`.
+size_t SplatSequence::getDeltaCost(int from, int to) const {
+  size_t cost = 0;
+  for (int f = from + 1; f <= to; f++)
+    cost += frames[f].changedCount;
+  return cost;
+}
+
+int SplatSequence::getTargetFrame() const {
+  const int frame = (int)std::floor(time * settings.fps);
+  return std::max(0, std::min(frame, (int)frames.size() - 1));
+}
+
+// With the mutex held: shows the target frame if it is decoded.
+bool SplatSequence::swapToTarget() {
+  const int target = getTargetFrame();
+  if (target == currentFrame)
+    return false;
+  for (int s = 0; s < (int)slots.size(); s++) {
+    if (!slots[s].ready || slots[s].frame != target)
+      continue;
+    fullUpload = !(frames[target].delta && target == currentFrame + 1);
+    activeSlot = s;
+    currentFrame = target;
+    return true;
+  }
+  stats.lateFrames++;
+  return false;
+}
@@ -0,0 +1,209 @@
+#ifndef SPLATSEQUENCE_H
+#define SPLATSEQUENCE_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gpuSplat.h"
+#include "splatBufferWriter.h"
+#include "threadPool.h"
+
+// Delta frame file: the splats of a frame that differ from the frame before
+// it, all others being kept.
+//
+//   char     magic[8]             "SPLATDLT"
+//   uint32_t version              1
+//   uint32_t splatCount           of the whole frame
+//   uint32_t changedCount
+//   uint32_t reserved
+//   uint32_t indexes[changedCount], ascending
+//   zero padding up to a multiple of 16 bytes
+//   SplatBuffer file image of the changed splats, in index order
+static const char SplatDeltaMagic[8] = {'S', 'P', 'L', 'A', 'T', 'D', 'L', 'T'};
+static const uint32_t SplatDeltaVersion = 1;
+static const size_t SplatDeltaHeaderBytes = 24;
+
+struct SplatDeltaWriteOptions {
+  // Splats whose centers, scales and rotations all moved by at most this
+  // much, and whose colors are unchanged, are left out.
+  float tolerance = 0.0f;
+  // For the changed splats. keepOrder is always set, the indexes need it.
+  SplatBufferWriteOptions buffer;
+};
+
+struct SplatDeltaWriteStats {
+  uint32_t splatCount = 0;
+  uint32_t changedCount = 0;
+  size_t bytes = 0;
+  double ms = 0.0;
+};
+
+// Writes `next` as a delta frame of `previous`. Both must hold as many
+// splats; a frame that adds or removes splats has to be a key frame.
+bool writeSplatDelta(const SplatArrays& previous, const SplatArrays& next,
+                     const std::string& path,
+                     const SplatDeltaWriteOptions& options =
+                         SplatDeltaWriteOptions(),
+                     SplatDeltaWriteStats* stats = nullptr,
+                     ThreadPool& pool = ThreadPool::shared());
+
+struct SplatSequenceSettings {
+  float fps = 30.0f;
+  // Frames decoded ahead of the current one, in the playing direction.
+  // Every frame in flight holds a whole shader.vs buffer.
+  int prefetchFrames = 3;
+  bool loop = true;
+};
+
+struct SplatSequenceStats {
+  uint32_t frameCount = 0;
+  uint32_t keyFrames = 0;
+  uint32_t deltaFrames = 0;
+  uint32_t readyFrames = 0;  // decoded ahead and waiting
+  uint64_t decodedFrames = 0;
+  uint64_t appliedDeltas = 0;
+  uint64_t copiedFrames = 0;  // built from a copy of another slot
+  // update() calls whose frame was not decoded yet, so the previous one
+  // stayed on screen
+  uint64_t lateFrames = 0;
+  uint64_t errors = 0;
+  double averageBuildMs = 0.0;
+};
+
+// Plays a sequence of per-frame splat files, one file per frame.
+//
+// Key frames are anything composeSplatScene() reads (.ply or SplatBuffer),
+// delta frames are files written by writeSplatDelta() and apply to the frame
+// before them, so the first frame must be a key frame.
+//
+// A decode thread keeps the frames from the current one up to
+// `prefetchFrames` ahead in a fixed set of slots, recycling the slots of
+// frames that left that window. A frame is built in the cheapest of three
+// ways: applying the deltas that separate it from what a recycled slot
+// already holds, copying the nearest decoded frame before it and applying
+// the deltas after that one, or decoding its key frame and applying the
+// deltas after it. Decoding and applying deltas run blocks in parallel on
+// the pool.
+//
+// update() moves the playback time and swaps to the slot of the new frame
+// when that one is ready. It never waits: a frame that is not decoded in
+// time leaves the previous one on screen and counts as late.
+//
+// Without threads (Emscripten built with USE_PTHREADS=0) update() builds
+// the frames itself, for at most its budget.
+class SplatSequence {
+ public:
+#if defined(SPLAT_HAS_THREADS)
+  explicit SplatSequence(
+      const SplatSequenceSettings& settings = SplatSequenceSettings(),
+      bool threaded = true);
+#else
+  explicit SplatSequence(
+      const SplatSequenceSettings& settings = SplatSequenceSettings(),
+      bool threaded = false);
+#endif
+  ~SplatSequence();
+
+  SplatSequence(const SplatSequence&) = delete;
+  SplatSequence& operator=(const SplatSequence&) = delete;
+
+  // Frames in playing order. Reads the delta headers and decodes the first
+  // frame before returning. Returns false if any file is not usable, or
+  // settings.fps is not positive and finite.
+  bool load(const std::vector<std::string>& paths,
+            ThreadPool& pool = ThreadPool::shared());
+  void clear();
+
+  // Advances the playback time by deltaSeconds * getSpeed() while playing.
+  // Returns true when the current frame changed; upload it before drawing,
+  // only the splats in getChangedSplats() unless isFullUpload().
+  bool update(double deltaSeconds, double budgetMs = 8.0);
+
+  // The current frame, valid until the next update() that returns true.
+  const GpuSplat* getSplats() const;
+  uint32_t getSplatCount() const;
+  // Splats that differ from the frame shown before the last swap. Only
+  // filled when that swap moved to the next frame and it is a delta frame.
+  const std::vector<uint32_t>& getChangedSplats() const;
+  bool isFullUpload() const { return fullUpload; }
+
+  // Same controls as vera::TextureStream
+  void setSpeed(float speed);
+  void setTime(float time);
+  void setPct(float pct) { setTime(pct * getDuration()); }
+
+  float getFps() const { return settings.fps; }
+  float getDuration() const;
+  float getTime() const { return (float)time; }
+  float getPct() const;
+  float getTotalFrames() const { return (float)frames.size(); }
+  float getCurrentFrame() const { return (float)std::max(0, currentFrame); }
+  float getSpeed() const { return speed; }
+
+  void play() { playing = true; }
+  void stop() { playing = false; }
+  bool isPlaying() const { return playing; }
+  void restart() { setTime(0.0f); }
+
+  SplatSequenceStats getStats() const;
+
+ private:
+  struct Frame {
+    std::string path;
+    bool delta = false;
+    uint32_t changedCount = 0;  // delta frames
+    bool failed = false;
+  };
+
+  struct Slot {
+    std::vector<GpuSplat> splats;
+    // Indexes of the delta of `frame`, empty for key frames
+    std::vector<uint32_t> changed;
+    int frame = -1;  // what the splats hold, once ready
+    bool ready = false;
+  };
+
+  void decodeLoop();
+  bool findWork(int& frame, int& slot);
+  void build(int frame, int slot);
+  bool decodeKeyFrame(int frame, Slot& slot);
+  bool applyDelta(int frame, Slot& slot);
+  int getKeyFrame(int frame) const;
+  size_t getDeltaCost(int from, int to) const;
+  int getTargetFrame() const;
+  void updateWindow();
+  bool swapToTarget();
+
+  const SplatSequenceSettings settings;
+  const bool threaded;
+  std::thread decodeThread;
+  ThreadPool* pool = nullptr;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  std::vector<Frame> frames;
+  // frame and ready are written under the mutex, everything by the builder
+  std::vector<Slot> slots;
+  // Frames wanted in slots, the target first
+  std::vector<int> window;
+  int activeSlot = -1;
+  int currentFrame = -1;
+
+  double time = 0.0;
+  float speed = 1.0f;
+  bool playing = true;
+  bool fullUpload = true;
+
+  SplatSequenceStats stats;
+  double totalBuildMs = 0.0;
+  uint64_t buildCount = 0;
+};
+
+#endif
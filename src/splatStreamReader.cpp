@@ -0,0 +1,250 @@
+#include "splatStreamReader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "timing.h"
+
+// Bytes per read from a pipe
+static const size_t kPipeReadSize = 1 << 20;
+
+// Splats of [start, start + count * itemBytes) covered by the first
+// `received` bytes of the file.
+static size_t coveredItems(size_t received, size_t start, size_t itemBytes,
+                           size_t count) {
+  if (received <= start || itemBytes == 0)
+    return itemBytes == 0 ? count : 0;
+  return std::min(count, (received - start) / itemBytes);
+}
+
+SplatStreamReader::SplatStreamReader(bool threaded) : threaded(threaded) {}
+
+SplatStreamReader::~SplatStreamReader() {
+  close();
+}
+
+bool SplatStreamReader::open(const std::string& path) {
+  close();
+
+  if (path == "-") {
+    stream.reset(new std::istream(std::cin.rdbuf()));
+    seekable = false;
+  } else {
+    std::ifstream* file = new std::ifstream(path, std::ios::binary);
+    stream.reset(file);
+    if (!*file) {
+      std::cerr << "Error: can't open " << path << std::endl;
+      stream.reset();
+      return false;
+    }
+    // Pipes and FIFOs fail to seek
+    seekable = (bool)file->seekg(0, std::ios::end);
+    file->clear();
+    file->seekg(0);
+  }
+
+  openTime = Clock::now();
+  stopping = false;
+#if defined(SPLAT_HAS_THREADS)
+  if (threaded)
+    reader = std::thread(&SplatStreamReader::readerLoop, this);
+#endif
+  return true;
+}
+
+void SplatStreamReader::close() {
+  stopping = true;
+  if (reader.joinable())
+    reader.join();
+
+  stream.reset();
+  buffer.reset();
+  image.reset();
+  imageSize = 0;
+  received = 0;
+  splatCount = 0;
+  blockCount = 0;
+  readBlocks = 0;
+  decodedBlocks = 0;
+  decodedFloats.reset();
+  decodedColors.reset();
+  splats = SplatSoA();
+  finished.clear();
+  renderableCount = 0;
+  firstChunkMs = 0.0;
+  totalMs = 0.0;
+  headerReady = false;
+  done = false;
+  failed = false;
+}
+
+std::vector<SplatChunk> SplatStreamReader::update(double budgetMs) {
+  if (!threaded && stream && !done) {
+    const Clock::time_point start = Clock::now();
+    do {
+      if (!step()) {
+        done = true;
+        break;
+      }
+    } while (msSince(start) < budgetMs);
+  }
+
+  std::vector<SplatChunk> chunks;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    chunks.swap(finished);
+  }
+  for (const SplatChunk& chunk : chunks)
+    renderableCount = std::max(renderableCount, chunk.first + chunk.count);
+  if (!chunks.empty() && firstChunkMs == 0.0)
+    firstChunkMs = msSince(openTime);
+  if (done && totalMs == 0.0 && renderableCount == splatCount)
+    totalMs = msSince(openTime);
+  return chunks;
+}
+
+void SplatStreamReader::readerLoop() {
+  while (!stopping && step()) {
+  }
+  done = true;
+}
+
+bool SplatStreamReader::step() {
+  if (failed)
+    return false;
+  if (!headerReady)
+    return readHeader();
+  if (decodedBlocks == blockCount)
+    return false;
+
+  const uint32_t readyBlocks = seekable ? readBatch() : readSequential();
+  if (failed)
+    return false;
+  decodeReady(readyBlocks);
+  return decodedBlocks < blockCount;
+}
+
+bool SplatStreamReader::readHeader() {
+  uint8_t header[SplatBuffer::HeaderSizeBytes];
+  if (!stream->read(reinterpret_cast<char*>(header), sizeof(header))) {
+    std::cerr << "Error: splat stream ended inside the header" << std::endl;
+    failed = true;
+    return false;
+  }
+  imageSize = SplatBuffer::getByteCount(header);
+  if (imageSize == 0) {
+    std::cerr << "Error: unsupported splat buffer header" << std::endl;
+    failed = true;
+    return false;
+  }
+
+  // Left uninitialized: every byte is written by the reads before the
+  // blocks that use it are decoded.
+  image.reset(new uint8_t[imageSize]);
+  std::memcpy(image.get(), header, sizeof(header));
+  received = sizeof(header);
+  buffer.reset(new SplatBuffer(image.get(), imageSize));
+  splatCount = buffer->getSplatCount();
+  blockCount = buffer->getDecodeBlockCount();
+
+  // Uninitialized too, zeroing them would delay the first chunk
+  const size_t count = splatCount;
+  decodedFloats.reset(new float[count * 10]);
+  decodedColors.reset(new uint8_t[count * 4]);
+  float* floats = decodedFloats.get();
+  for (int c = 0; c < 3; c++)
+    splats.center[c] = floats + count * c;
+  for (int c = 0; c < 3; c++)
+    splats.scale[c] = floats + count * (3 + c);
+  for (int c = 0; c < 4; c++)
+    splats.rotation[c] = floats + count * (6 + c);
+  for (int c = 0; c < 4; c++)
+    splats.color[c] = decodedColors.get() + count * c;
+
+  headerReady = true;
+  return blockCount > 0;
+}
+
+// Next piece of the file, front to back. Returns the blocks now complete.
+uint32_t SplatStreamReader::readSequential() {
+  const size_t size = std::min(kPipeReadSize, imageSize - received);
+  stream->read(reinterpret_cast<char*>(image.get() + received), size);
+  received += (size_t)stream->gcount();
+  if ((size_t)stream->gcount() < size) {
+    std::cerr << "Error: splat stream ended after " << received << " of "
+              << imageSize << " bytes" << std::endl;
+    failed = true;
+  }
+
+  const SplatBuffer& b = *buffer;
+  const size_t count = splatCount;
+  size_t start = SplatBuffer::HeaderSizeBytes;
+  size_t ready = count;
+  for (int bytesPerItem :
+       {b.bytesPerCenter, b.bytesPerScale, b.bytesPerColor, b.bytesPerRotation}) {
+    ready = std::min(ready, coveredItems(received, start, bytesPerItem, count));
+    start += count * bytesPerItem;
+  }
+
+  const uint32_t blockSize = b.getDecodeBlockSize();
+  if (b.compressionLevel > 0)
+    ready = std::min<size_t>(
+        ready, coveredItems(received, start, b.bytesPerBucket, b.bucketCount) *
+                   blockSize);
+  return ready >= count ? blockCount : (uint32_t)(ready / blockSize);
+}
+
+// Next batch of blocks of a regular file, taking the slice of every section
+// that belongs to them. Returns the blocks now complete.
+uint32_t SplatStreamReader::readBatch() {
+  const SplatBuffer& b = *buffer;
+  const uint32_t blockSize = b.getDecodeBlockSize();
+  const uint32_t batchBlocks = std::max(1u, batchSize / blockSize);
+  const uint32_t lastBlock = std::min(blockCount, readBlocks + batchBlocks);
+  const size_t first = (size_t)readBlocks * blockSize;
+  const size_t last = std::min<size_t>(splatCount, (size_t)lastBlock * blockSize);
+
+  auto readRange = [&](size_t offset, size_t size) {
+    stream->seekg((std::streamoff)offset);
+    if (!stream->read(reinterpret_cast<char*>(image.get() + offset), size)) {
+      std::cerr << "Error: splat file is shorter than its header says"
+                << std::endl;
+      failed = true;
+    }
+  };
+
+  size_t start = SplatBuffer::HeaderSizeBytes;
+  for (int bytesPerItem :
+       {b.bytesPerCenter, b.bytesPerScale, b.bytesPerColor, b.bytesPerRotation}) {
+    readRange(start + first * bytesPerItem, (last - first) * bytesPerItem);
+    start += (size_t)splatCount * bytesPerItem;
+  }
+  if (b.compressionLevel > 0)
+    readRange(start + (size_t)readBlocks * b.bytesPerBucket,
+              (size_t)(lastBlock - readBlocks) * b.bytesPerBucket);
+
+  readBlocks = lastBlock;
+  return readBlocks;
+}
+
+void SplatStreamReader::decodeReady(uint32_t readyBlocks) {
+  if (readyBlocks <= decodedBlocks)
+    return;
+
+  const uint32_t firstBlock = decodedBlocks;
+  ThreadPool::shared().parallelForRange(
+      firstBlock, readyBlocks, 16, [&](size_t begin, size_t end) {
+        for (size_t b = begin; b < end; b++)
+          buffer->decodeBlock((uint32_t)b, splats, 0);
+      });
+  decodedBlocks = readyBlocks;
+
+  const uint32_t blockSize = buffer->getDecodeBlockSize();
+  SplatChunk chunk;
+  chunk.first = firstBlock * blockSize;
+  chunk.count = std::min(splatCount, readyBlocks * blockSize) - chunk.first;
+  std::lock_guard<std::mutex> lock(mutex);
+  finished.push_back(chunk);
+}
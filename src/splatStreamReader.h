@@ -0,0 +1,127 @@
+#ifndef SPLATSTREAMREADER_H
+#define SPLATSTREAMREADER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "splatBuffer.h"
+
+// Splats [first, first + count) finished decoding.
+struct SplatChunk {
+  uint32_t first = 0;
+  uint32_t count = 0;
+};
+
+// Loads a SplatBuffer file progressively so the first splats can be drawn
+// long before the whole file has arrived.
+//
+// The 1024 byte header is read first; it sizes the file image and the
+// decoded arrays. After that the file is read in decode blocks (buckets for
+// compressed files) and every block whose bytes are all in is decoded and
+// queued as a chunk. update() hands the queued chunks over to the render
+// thread, which extends the renderable set [0, getRenderableCount()).
+//
+// Regular files are read a batch of blocks at a time, taking each block's
+// slice of every attribute section, so chunks arrive from the start. Pipes
+// can only be read front to back; since the format stores each attribute
+// for all splats before the next one, and compressed files store bucket
+// centers last, chunks from a pipe only appear once the last section
+// starts arriving.
+//
+// Reading and decoding happen on a thread of their own. Without threads
+// (Emscripten built with USE_PTHREADS=0) update() does them instead, for at
+// most its budget.
+class SplatStreamReader {
+ public:
+#if defined(SPLAT_HAS_THREADS)
+  explicit SplatStreamReader(bool threaded = true);
+#else
+  explicit SplatStreamReader(bool threaded = false);
+#endif
+  ~SplatStreamReader();
+
+  SplatStreamReader(const SplatStreamReader&) = delete;
+  SplatStreamReader& operator=(const SplatStreamReader&) = delete;
+
+  // Starts loading `path`, "-" reads standard input. Returns false if it
+  // can't be opened; later problems are reported by hasFailed().
+  bool open(const std::string& path);
+
+  // Stops reading. A reader blocked on a pipe returns once the pipe
+  // delivers data or closes.
+  void close();
+
+  // Finished chunks since the last call, in splat order.
+  std::vector<SplatChunk> update(double budgetMs = 4.0);
+
+  // The getters below are only meaningful once the header is in.
+  bool isHeaderReady() const { return headerReady; }
+  bool isDone() const { return done; }
+  bool hasFailed() const { return failed; }
+
+  uint32_t getSplatCount() const { return splatCount; }
+  uint32_t getRenderableCount() const { return renderableCount; }
+
+  // Decoded attributes, sized for every splat of the file. Only the first
+  // getRenderableCount() entries are valid.
+  const SplatSoA& getSplats() const { return splats; }
+  const SplatBuffer* getBuffer() const { return buffer.get(); }
+
+  // Milliseconds from open() to the first chunk and to the last one.
+  double getFirstChunkMs() const { return firstChunkMs; }
+  double getTotalMs() const { return totalMs; }
+
+  // Splats per read batch of a regular file, rounded to whole blocks.
+  void setBatchSize(uint32_t splatsPerBatch) { batchSize = splatsPerBatch; }
+
+ private:
+  void readerLoop();
+
+  // Reads the header or one batch and decodes what became complete.
+  // Returns false when there is nothing left to do.
+  bool step();
+  bool readHeader();
+  uint32_t readSequential();
+  uint32_t readBatch();
+  void decodeReady(uint32_t readyBlocks);
+
+  const bool threaded;
+  std::thread reader;
+  std::mutex mutex;
+  std::atomic<bool> stopping{false};
+  std::atomic<bool> headerReady{false};
+  std::atomic<bool> done{false};
+  std::atomic<bool> failed{false};
+
+  std::unique_ptr<std::istream> stream;
+  bool seekable = false;
+  std::chrono::steady_clock::time_point openTime;
+
+  std::unique_ptr<uint8_t[]> image;
+  size_t imageSize = 0;
+  size_t received = 0;
+  std::unique_ptr<SplatBuffer> buffer;
+  uint32_t splatCount = 0;
+  uint32_t blockCount = 0;
+  uint32_t readBlocks = 0;
+  uint32_t decodedBlocks = 0;
+  uint32_t batchSize = 65536;
+
+  std::unique_ptr<float[]> decodedFloats;
+  std::unique_ptr<uint8_t[]> decodedColors;
+  SplatSoA splats;
+
+  std::vector<SplatChunk> finished;
+  uint32_t renderableCount = 0;
+  double firstChunkMs = 0.0;
+  double totalMs = 0.0;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include "splatTransform.h"
+
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+// Fit directions per band, well above the 7 unknowns of band 3
+static const int kFitDirections = 64;
+// Below this every entry of the rotation is taken as exact
+static const float kIdentityEpsilon = 1e-6f;
+
+// SH basis of get_rgb() in shader.vs, coefficients 1 to 15.
+static void evaluateShBasis(const glm::dvec3& d, double basis[15]) {
+  static const double C1 = 0.4886025119029199;
+  static const double C2[5] = {1.0925484305920792, -1.0925484305920792,
+                               0.31539156525252005, -1.0925484305920792,
+                               0.5462742152960396};
+  static const double C3[7] = {-0.5900435899266435, 2.890611442640554,
+                               -0.4570457994644658, 0.3731763325901154,
+                               -0.4570457994644658, 1.445305721320277,
+                               -0.5900435899266435};
+  const double x = d.x, y = d.y, z = d.z;
+  const double xx = x * x, yy = y * y, zz = z * z;
+  basis[0] = -C1 * y;
+  basis[1] = C1 * z;
+  basis[2] = -C1 * x;
+  basis[3] = C2[0] * x * y;
+  basis[4] = C2[1] * y * z;
+  basis[5] = C2[2] * (2.0 * zz - xx - yy);
+  basis[6] = C2[3] * x * z;
+  basis[7] = C2[4] * (xx - yy);
+  basis[8] = C3[0] * y * (3.0 * xx - yy);
+  basis[9] = C3[1] * z * x * y;
+  basis[10] = C3[2] * y * (4.0 * zz - xx - yy);
+  basis[11] = C3[3] * z * (2.0 * zz - 3.0 * xx - 3.0 * yy);
+  basis[12] = C3[4] * x * (4.0 * zz - xx - yy);
+  basis[13] = C3[5] * z * (xx - yy);
+  basis[14] = C3[6] * x * (xx - 3.0 * yy);
+}
+
+// Rotated coefficients c' must give at every direction n the color the
+// original ones gave at R^T n: A c' = B c, with A and B the basis at n and
+// R^T n. Solves (A^T A) M = A^T B for the band's M by Gauss-Jordan.
+static void solveBand(const glm::dmat3& rotation, int first, int size,
+                      float* band) {
+  double ata[7][7] = {}, atb[7][7] = {};
+  const double golden = std::acos(-1.0) * (3.0 - std::sqrt(5.0));
+  const glm::dmat3 inverse = glm::transpose(rotation);
+  for (int i = 0; i < kFitDirections; i++) {
+    const double z = 1.0 - (2.0 * i + 1.0) / kFitDirections;
+    const double r = std::sqrt(1.0 - z * z);
+    const glm::dvec3 n(r * std::cos(golden * i), r * std::sin(golden * i), z);
+    double a[15], b[15];
+    evaluateShBasis(n, a);
+    evaluateShBasis(inverse * n, b);
+    for (int j = 0; j < size; j++)
+      for (int k = 0; k < size; k++) {
+        ata[j][k] += a[first + j] * a[first + k];
+        atb[j][k] += a[first + j] * b[first + k];
+      }
+  }
+
+  for (int col = 0; col < size; col++) {
+    int pivot = col;
+    for (int row = col + 1; row < size; row++)
+      if (std::abs(ata[row][col]) > std::abs(ata[pivot][col]))
+        pivot = row;
+    for (int k = 0; k < size; k++) {
+      std::swap(ata[col][k], ata[pivot][k]);
+      std::swap(atb[col][k], atb[pivot][k]);
+    }
+    const double inverseDiagonal = 1.0 / ata[col][col];
+    for (int row = 0; row < size; row++) {
+      if (row == col)
+        continue;
+      const double factor = ata[row][col] * inverseDiagonal;
+      for (int k = 0; k < size; k++) {
+        ata[row][k] -= factor * ata[col][k];
+        atb[row][k] -= factor * atb[col][k];
+      }
+    }
+  }
+  for (int j = 0; j < size; j++)
+    for (int k = 0; k < size; k++)
+      band[j * size + k] = (float)(atb[j][k] / ata[j][j]);
+}
+
+SplatTransform::SplatTransform(const glm::mat4& matrix) : matrix(matrix) {
+  const glm::mat3 upper(matrix);
+  std::memcpy(linear, &upper[0][0], sizeof(linear));
+  identity = matrix == glm::mat4(1.0f);
+
+  // Gram-Schmidt keeps a mirror a mirror, which SH handle as well
+  glm::dvec3 x(upper[0]), y(upper[1]), z(upper[2]);
+  if (glm::length(x) > 0.0 && glm::length(y) > 0.0 && glm::length(z) > 0.0) {
+    x = glm::normalize(x);
+    y = y - glm::dot(x, y) * x;
+    z = z - glm::dot(x, z) * x;
+    if (glm::length(y) > 0.0) {
+      y = glm::normalize(y);
+      z = z - glm::dot(y, z) * y;
+      if (glm::length(z) > 0.0) {
+        z = glm::normalize(z);
+        const glm::dmat3 rotation(x, y, z);
+        const glm::dmat3 offset = rotation - glm::dmat3(1.0);
+        for (int c = 0; c < 3; c++)
+          for (int r = 0; r < 3; r++)
+            rotatesSh |= std::abs(offset[c][r]) > kIdentityEpsilon;
+        if (rotatesSh) {
+          solveBand(rotation, 0, 3, band1);
+          solveBand(rotation, 3, 5, band2);
+          solveBand(rotation, 8, 7, band3);
+        }
+      }
+    }
+  }
+}
+
+void SplatTransform::transformCenter(float center[3]) const {
+  const glm::vec4 p = matrix * glm::vec4(center[0], center[1], center[2], 1.0f);
+  center[0] = p.x;
+  center[1] = p.y;
+  center[2] = p.z;
+}
+
+static void rotateBand(const float* band, int size, float (*sh)[4]) {
+  float rotated[7][3];
+  for (int j = 0; j < size; j++)
+    for (int c = 0; c < 3; c++) {
+      float sum = 0.0f;
+      for (int k = 0; k < size; k++)
+        sum += band[j * size + k] * sh[k][c];
+      rotated[j][c] = sum;
+    }
+  for (int j = 0; j < size; j++)
+    for (int c = 0; c < 3; c++)
+      sh[j][c] = rotated[j][c];
+}
+
+void SplatTransform::rotateSh(float sh[16][4], int shDegree) const {
+  if (!rotatesSh)
+    return;
+  if (shDegree >= 1)
+    rotateBand(band1, 3, sh + 1);
+  if (shDegree >= 2)
+    rotateBand(band2, 5, sh + 4);
+  if (shDegree >= 3)
+    rotateBand(band3, 7, sh + 9);
+}
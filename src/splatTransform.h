@@ -0,0 +1,42 @@
+#ifndef SPLATTRANSFORM_H
+#define SPLATTRANSFORM_H
+
+#include <glm/glm.hpp>
+
+// An affine transform applied to splats as they are decoded: centers go
+// through the whole matrix, covariances through its upper 3x3 (see
+// computeCovariances()) and SH coefficients through the rotation part.
+//
+// SH coefficients rotate band by band; each band's matrix is solved once
+// here, by least squares over directions spread on the sphere, so it
+// follows the basis of get_rgb() in shader.vs exactly. Scale and shear
+// have no SH equivalent: the rotation is the orthonormalized upper 3x3,
+// exact for rotations, uniform scales and mirrors.
+class SplatTransform {
+ public:
+  explicit SplatTransform(const glm::mat4& matrix = glm::mat4(1.0f));
+
+  const glm::mat4& getMatrix() const { return matrix; }
+  bool isIdentity() const { return identity; }
+
+  // Column major upper 3x3, the `transform` of computeCovariances()
+  const float* getLinear() const { return linear; }
+
+  void transformCenter(float center[3]) const;
+
+  // Rotates coefficients 1 to 15 of `sh` (rgb + padding, as in GpuSplat),
+  // only the bands up to `shDegree`.
+  void rotateSh(float sh[16][4], int shDegree = 3) const;
+
+ private:
+  glm::mat4 matrix;
+  float linear[9];
+  bool identity = true;
+  bool rotatesSh = false;
+  // Band l maps coefficients l^2 to l^2 + 2l, row major
+  float band1[3 * 3];
+  float band2[5 * 5];
+  float band3[7 * 7];
+};
+
+#endif
@@ -1 +1,536 @@
-#include "splatTreeNode.h"
\ No newline at end of file
+#include "splatTree.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <queue>
+
+// Ranges with fewer splats than this are not worth a task of their own.
+static const uint32_t kMinSplatsPerTask = 65536;
+
+// Node::parent of the root
+static const uint32_t kNoParent = 0xffffffffu;
+
+// Weighted moments of a set of Gaussians, the state merged up the LOD tree.
+// Doubles, since nodes near the root sum millions of splats.
+struct LodMoments {
+  double weight = 0.0;
+  double mean[3] = {0.0, 0.0, 0.0};
+  double covariance[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+  double color[3] = {0.0, 0.0, 0.0};
+  double transmittance = 1.0;  // product of (1 - opacity)
+};
+
+// xx, xy, xz, yy, yz, zz
+static const int kCovarianceRows[6][2] = {{0, 0}, {0, 1}, {0, 2},
+                                          {1, 1}, {1, 2}, {2, 2}};
+
+// Area like size of a Gaussian: square root of the sum of the principal 2x2
+// minors, which is sx * sy for a flat splat.
+static double getArea(const double c[6]) {
+  const double minors = c[0] * c[3] - c[1] * c[1] + c[3] * c[5] -
+                        c[4] * c[4] + c[0] * c[5] - c[2] * c[2];
+  return minors > 0.0 ? std::sqrt(minors) : 0.0;
+}
+
+// Moment matched merge of `count` parts, `get(i, part)` fills part i.
+// Parts without weight still shape the result when all of them lack it.
+template <typename Get>
+static LodMoments mergeMoments(size_t count, const Get& get) {
+  LodMoments merged;
+  double weightSum = 0.0;
+  for (size_t i = 0; i < count; i++) {
+    LodMoments part;
+    get(i, part);
+    weightSum += part.weight;
+    merged.transmittance *= part.transmittance;
+  }
+  const bool uniform = weightSum <= 0.0;
+  auto weightOf = [&](const LodMoments& part) {
+    return uniform ? 1.0 / (double)count : part.weight / weightSum;
+  };
+
+  for (size_t i = 0; i < count; i++) {
+    LodMoments part;
+    get(i, part);
+    const double w = weightOf(part);
+    for (int a = 0; a < 3; a++) {
+      merged.mean[a] += w * part.mean[a];
+      merged.color[a] += w * part.color[a];
+    }
+  }
+  for (size_t i = 0; i < count; i++) {
+    LodMoments part;
+    get(i, part);
+    const double w = weightOf(part);
+    const double d[3] = {part.mean[0] - merged.mean[0],
+                         part.mean[1] - merged.mean[1],
+                         part.mean[2] - merged.mean[2]};
+    for (int k = 0; k < 6; k++)
+      merged.covariance[k] +=
+          w * (part.covariance[k] +
+               d[kCovarianceRows[k][0]] * d[kCovarianceRows[k][1]]);
+  }
+  merged.weight = weightSum;
+  return merged;
+}
+
+static void getSplatMoments(const GpuSplat& splat, LodMoments& moments) {
+  for (int a = 0; a < 3; a++) {
+    moments.mean[a] = splat.center[a];
+    moments.covariance[a] = splat.covA[a];
+    moments.covariance[3 + a] = splat.covB[a];
+    moments.color[a] = splat.sh[0][a];
+  }
+  const double alpha = std::min(std::max((double)splat.alpha, 0.0), 1.0);
+  moments.weight = alpha * getArea(moments.covariance);
+  moments.transmittance = 1.0 - alpha;
+}
+
+static int octantOf(const float* center, const glm::vec3& split) {
+  return (center[0] >= split.x ? 1 : 0) | (center[1] >= split.y ? 2 : 0) |
+         (center[2] >= split.z ? 4 : 0);
+}
+
+SplatTree::SplatTree(int maxDepth, uint32_t maxLeafSize, ThreadPool& pool)
+    : maxDepth(std::min(std::max(0, maxDepth), 16)),
+      maxLeafSize(std::max(1u, maxLeafSize)),
+      pool(pool) {}
+
+void SplatTree::build(const float* _centers, uint32_t splatCount) {
+  centers = _centers;
+  indexes.resize(splatCount);
+  scratch.resize(splatCount);
+  nodes.clear();
+  lodProxies.clear();
+  lodRadii.clear();
+
+  // Root bounds
+  const size_t tasks = std::max<size_t>(
+      1, std::min<size_t>(pool.getThreadCount(), splatCount / kMinSplatsPerTask));
+  const size_t taskSize = (splatCount + tasks - 1) / tasks;
+  std::vector<BoundingBox> taskBounds(tasks,
+                                      BoundingBox(glm::vec3(FLT_MAX),
+                                                  glm::vec3(-FLT_MAX)));
+  pool.parallelFor(tasks, [&](size_t t) {
+    BoundingBox& bounds = taskBounds[t];
+    const size_t end = std::min<size_t>(splatCount, (t + 1) * taskSize);
+    for (size_t i = t * taskSize; i < end; i++) {
+      indexes[i] = (uint32_t)i;
+      bounds.expand(glm::vec3(centers[3 * i], centers[3 * i + 1],
+                              centers[3 * i + 2]));
+    }
+  });
+  BoundingBox bounds(glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX));
+  for (const BoundingBox& taskBound : taskBounds)
+    bounds.expand(taskBound);
+  if (splatCount == 0)
+    bounds = BoundingBox(glm::vec3(0.0f), glm::vec3(0.0f));
+
+  // Cubic root cell so octants stay cubes. Cell corners only live during the
+  // build; nodes keep quantized tight bounds instead.
+  const glm::vec3 center = bounds.getCenter();
+  const glm::vec3 extent = bounds.max - bounds.min;
+  const float halfSize = std::max(
+      std::max(extent.x, std::max(extent.y, extent.z)) * 0.5f, 1e-6f);
+  const float rootSize = 2.0f * halfSize;
+  std::vector<glm::vec3> cellMin = {center - halfSize};
+
+  SplatTreeNode root = {};
+  root.indexEnd = splatCount;
+  root.parent = kNoParent;
+  nodes.push_back(root);
+
+  // Breadth first, one level at a time
+  std::vector<uint32_t> counts;
+  for (size_t levelBegin = 0, levelEnd = 1; levelBegin < levelEnd;
+       levelBegin = levelEnd, levelEnd = nodes.size()) {
+    const size_t levelCount = levelEnd - levelBegin;
+    const float cellSize = std::ldexp(rootSize, -(int)nodes[levelBegin].depth);
+    auto splits = [&](const SplatTreeNode& node) {
+      return node.getIndexCount() > maxLeafSize && node.depth < maxDepth;
+    };
+
+    counts.assign(levelCount * 8, 0);
+    auto partitionNode = [&](size_t i, bool parallel) {
+      const SplatTreeNode& node = nodes[levelBegin + i];
+      if (splits(node))
+        partition(node.indexBegin, node.indexEnd,
+                  cellMin[levelBegin + i] + 0.5f * cellSize, &counts[8 * i],
+                  parallel);
+    };
+    if (levelCount >= pool.getThreadCount())
+      pool.parallelFor(levelCount, [&](size_t i) { partitionNode(i, false); });
+    else
+      for (size_t i = 0; i < levelCount; i++)
+        partitionNode(i, true);
+
+    // Children of a node are appended together, so they stay contiguous
+    for (size_t i = 0; i < levelCount; i++) {
+      const uint32_t id = (uint32_t)(levelBegin + i);
+      nodes[id].firstChild = (uint32_t)nodes.size();
+      if (!splits(nodes[id]))
+        continue;
+      uint32_t begin = nodes[id].indexBegin;
+      for (int o = 0; o < 8; o++) {
+        const uint32_t count = counts[8 * i + o];
+        if (count == 0)
+          continue;
+        SplatTreeNode child = {};
+        child.indexBegin = begin;
+        child.indexEnd = begin + count;
+        child.parent = id;
+        child.depth = (uint8_t)(nodes[id].depth + 1);
+        nodes.push_back(child);
+        nodes[id].childCount++;
+        glm::vec3 childMin = cellMin[id];
+        if (o & 1) childMin.x += 0.5f * cellSize;
+        if (o & 2) childMin.y += 0.5f * cellSize;
+        if (o & 4) childMin.z += 0.5f * cellSize;
+        cellMin.push_back(childMin);
+        begin += count;
+      }
+    }
+  }
+
+  // Tight bounds: leaves in parallel, then parents before grandparents
+  std::vector<BoundingBox> tight(nodes.size(),
+                                 BoundingBox(glm::vec3(FLT_MAX),
+                                             glm::vec3(-FLT_MAX)));
+  pool.parallelForRange(0, nodes.size(), 64, [&](size_t first, size_t last) {
+    for (size_t n = first; n < last; n++) {
+      const SplatTreeNode& node = nodes[n];
+      if (!node.isLeaf())
+        continue;
+      for (uint32_t i = node.indexBegin; i < node.indexEnd; i++) {
+        const float* c = centers + 3 * indexes[i];
+        tight[n].expand(glm::vec3(c[0], c[1], c[2]));
+      }
+    }
+  });
+  for (size_t n = nodes.size(); n-- > 1;)
+    tight[nodes[n].parent].expand(tight[n]);
+
+  // Quantize over the root cell, rounding outwards so the boxes stay
+  // conservative
+  boundsOrigin = cellMin[0];
+  boundsStep = rootSize / 65535.0f;
+  const float toGrid = 1.0f / boundsStep;
+  pool.parallelForRange(0, nodes.size(), 1024, [&](size_t first, size_t last) {
+    for (size_t n = first; n < last; n++) {
+      const BoundingBox& box = tight[n];
+      const bool empty = box.min.x > box.max.x;
+      for (int a = 0; a < 3; a++) {
+        const float lo = empty ? 0.0f : std::floor((box.min[a] - boundsOrigin[a]) * toGrid);
+        const float hi = empty ? 0.0f : std::ceil((box.max[a] - boundsOrigin[a]) * toGrid);
+        nodes[n].boundsMin[a] = (uint16_t)std::min(std::max(lo, 0.0f), 65535.0f);
+        nodes[n].boundsMax[a] = (uint16_t)std::min(std::max(hi, 0.0f), 65535.0f);
+      }
+    }
+  });
+
+  scratch.clear();
+  scratch.shrink_to_fit();
+}
+
+// Stable partition of indexes[begin, end) into the octants around `split`
+// through the scratch buffer. `counts` receives the size of every octant.
+void SplatTree::partition(uint32_t begin, uint32_t end, const glm::vec3& split,
+                          uint32_t counts[8], bool parallel) {
+  const size_t count = end - begin;
+  const size_t tasks =
+      parallel ? std::max<size_t>(1, std::min<size_t>(pool.getThreadCount(),
+                                                      count / kMinSplatsPerTask))
+               : 1;
+  const size_t taskSize = (count + tasks - 1) / tasks;
+
+  // Per task histograms, then offsets in (octant, task) order so the result
+  // matches a serial pass
+  std::vector<uint32_t> taskCounts(tasks * 8, 0);
+  auto forTasks = [&](const std::function<void(size_t)>& fn) {
+    if (tasks > 1)
+      pool.parallelFor(tasks, fn);
+    else
+      fn(0);
+  };
+  forTasks([&](size_t t) {
+    const uint32_t first = begin + (uint32_t)(t * taskSize);
+    const uint32_t last = (uint32_t)std::min<size_t>(end, first + taskSize);
+    uint32_t* taskCount = &taskCounts[8 * t];
+    for (uint32_t i = first; i < last; i++)
+      taskCount[octantOf(centers + 3 * indexes[i], split)]++;
+  });
+
+  uint32_t offset = begin;
+  for (int o = 0; o < 8; o++) {
+    counts[o] = 0;
+    for (size_t t = 0; t < tasks; t++) {
+      const uint32_t taskCount = taskCounts[8 * t + o];
+      taskCounts[8 * t + o] = offset;
+      offset += taskCount;
+      counts[o] += taskCount;
+    }
+  }
+
+  forTasks([&](size_t t) {
+    const uint32_t first = begin + (uint32_t)(t * taskSize);
+    const uint32_t last = (uint32_t)std::min<size_t>(end, first + taskSize);
+    uint32_t* cursor = &taskCounts[8 * t];
+    for (uint32_t i = first; i < last; i++)
+      scratch[cursor[octantOf(centers + 3 * indexes[i], split)]++] = indexes[i];
+    std::memcpy(indexes.data() + first, scratch.data() + first,
+                (last - first) * sizeof(uint32_t));
+  });
+}
+
+// Clip space planes (Gribb & Hartmann): -1.2w <= x, y <= 1.2w and z >= -w,
+// moved onto the quantized grid, p = origin + q * step, so nodes are tested
+// on their integer bounds directly.
+void SplatTree::getGridPlanes(const glm::mat4& viewProj,
+                              glm::vec4 planes[5]) const {
+  const glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+  const glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+  const glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+  const glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+  planes[0] = 1.2f * row3 + row0;
+  planes[1] = 1.2f * row3 - row0;
+  planes[2] = 1.2f * row3 + row1;
+  planes[3] = 1.2f * row3 - row1;
+  planes[4] = row3 + row2;
+  for (int p = 0; p < 5; p++) {
+    const glm::vec3 n(planes[p]);
+    planes[p] = glm::vec4(n * boundsStep, glm::dot(n, boundsOrigin) + planes[p].w);
+  }
+}
+
+// True when the node bounds are completely outside one of the grid planes.
+// `inside` is cleared when they cross any of them.
+bool SplatTree::isOutside(const SplatTreeNode& node, const glm::vec4 planes[5],
+                          bool& inside) {
+  const glm::vec3 boxMin(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2]);
+  const glm::vec3 boxMax(node.boundsMax[0], node.boundsMax[1], node.boundsMax[2]);
+  for (int p = 0; p < 5; p++) {
+    const glm::vec3 n(planes[p]);
+    const glm::vec3 positive(n.x >= 0.0f ? boxMax.x : boxMin.x,
+                             n.y >= 0.0f ? boxMax.y : boxMin.y,
+                             n.z >= 0.0f ? boxMax.z : boxMin.z);
+    const glm::vec3 negative(n.x >= 0.0f ? boxMin.x : boxMax.x,
+                             n.y >= 0.0f ? boxMin.y : boxMax.y,
+                             n.z >= 0.0f ? boxMin.z : boxMax.z);
+    if (glm::dot(n, positive) + planes[p].w < 0.0f)
+      return true;
+    if (glm::dot(n, negative) + planes[p].w < 0.0f)
+      inside = false;
+  }
+  return false;
+}
+
+BoundingBox SplatTree::getNodeBounds(uint32_t node) const {
+  const SplatTreeNode& n = nodes[node];
+  return BoundingBox(
+      boundsOrigin + glm::vec3(n.boundsMin[0], n.boundsMin[1], n.boundsMin[2]) * boundsStep,
+      boundsOrigin + glm::vec3(n.boundsMax[0], n.boundsMax[1], n.boundsMax[2]) * boundsStep);
+}
+
+uint32_t SplatTree::getVisibleIndexes(
+    const glm::mat4& viewProj, std::vector<uint32_t>& visibleIndexes) const {
+  if (nodes.empty())
+    return 0;
+
+  glm::vec4 planes[5];
+  getGridPlanes(viewProj, planes);
+
+  // Collect visible ranges, then copy them in parallel
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;
+  std::vector<uint32_t> stack = {0};
+  while (!stack.empty()) {
+    const SplatTreeNode& node = nodes[stack.back()];
+    stack.pop_back();
+    if (node.indexBegin == node.indexEnd)
+      continue;
+
+    bool inside = true;
+    if (isOutside(node, planes, inside))
+      continue;
+
+    if (inside || node.isLeaf()) {
+      if (!ranges.empty() && ranges.back().second == node.indexBegin)
+        ranges.back().second = node.indexEnd;
+      else
+        ranges.emplace_back(node.indexBegin, node.indexEnd);
+      continue;
+    }
+
+    // Reverse push keeps ranges in index order, so neighbours merge above
+    for (uint32_t c = node.childCount; c-- > 0;)
+      stack.push_back(node.firstChild + c);
+  }
+
+  return copyRanges(ranges, visibleIndexes);
+}
+
+// Appends indexes[first, second) of every range, ranges in parallel.
+uint32_t SplatTree::copyRanges(
+    const std::vector<std::pair<uint32_t, uint32_t>>& ranges,
+    std::vector<uint32_t>& out) const {
+  const size_t base = out.size();
+  std::vector<size_t> offsets(ranges.size() + 1, base);
+  for (size_t r = 0; r < ranges.size(); r++)
+    offsets[r + 1] = offsets[r] + (ranges[r].second - ranges[r].first);
+  out.resize(offsets.back());
+
+  pool.parallelForRange(0, ranges.size(), 16, [&](size_t first, size_t last) {
+    for (size_t r = first; r < last; r++)
+      std::memcpy(out.data() + offsets[r], indexes.data() + ranges[r].first,
+                  (ranges[r].second - ranges[r].first) * sizeof(uint32_t));
+  });
+
+  return (uint32_t)(offsets.back() - base);
+}
+
+void SplatTree::buildLod(const GpuSplat* splats) {
+  std::vector<LodMoments> moments(nodes.size());
+  lodProxies.assign(nodes.size(), GpuSplat());
+  lodRadii.assign(nodes.size(), 0.0f);
+  if (nodes.empty())
+    return;
+
+  // Leaves from their splats, then one depth at a time from the bottom;
+  // breadth first order keeps every depth contiguous
+  pool.parallelForRange(0, nodes.size(), 64, [&](size_t first, size_t last) {
+    for (size_t n = first; n < last; n++) {
+      const SplatTreeNode& node = nodes[n];
+      if (node.isLeaf() && node.indexBegin < node.indexEnd)
+        moments[n] = mergeMoments(node.getIndexCount(),
+                                  [&](size_t i, LodMoments& part) {
+                                    getSplatMoments(
+                                        splats[indexes[node.indexBegin + i]],
+                                        part);
+                                  });
+    }
+  });
+  size_t levelEnd = nodes.size();
+  while (levelEnd > 0) {
+    size_t levelBegin = levelEnd - 1;
+    while (levelBegin > 0 &&
+           nodes[levelBegin - 1].depth == nodes[levelEnd - 1].depth)
+      levelBegin--;
+    pool.parallelForRange(levelBegin, levelEnd, 64, [&](size_t first,
+                                                        size_t last) {
+      for (size_t n = first; n < last; n++) {
+        const SplatTreeNode& node = nodes[n];
+        if (!node.isLeaf())
+          moments[n] = mergeMoments(node.childCount,
+                                    [&](size_t c, LodMoments& part) {
+                                      part = moments[node.firstChild + c];
+                                    });
+      }
+    });
+    levelEnd = levelBegin;
+  }
+
+  pool.parallelForRange(0, nodes.size(), 256, [&](size_t first, size_t last) {
+    for (size_t n = first; n < last; n++) {
+      const LodMoments& m = moments[n];
+      GpuSplat& proxy = lodProxies[n];
+      for (int a = 0; a < 3; a++) {
+        proxy.center[a] = (float)m.mean[a];
+        proxy.covA[a] = (float)m.covariance[a];
+        proxy.covB[a] = (float)m.covariance[3 + a];
+        proxy.sh[0][a] = (float)m.color[a];
+      }
+      // Same summed weight spread over the proxy's area
+      const double area = getArea(m.covariance);
+      const double stacked = 1.0 - m.transmittance;
+      proxy.alpha =
+          (float)(area > 0.0 ? std::min(m.weight / area, stacked) : stacked);
+
+      const BoundingBox bounds = getNodeBounds((uint32_t)n);
+      const double trace = m.covariance[0] + m.covariance[3] + m.covariance[5];
+      lodRadii[n] = std::max(0.5f * glm::length(bounds.max - bounds.min),
+                             (float)(3.0 * std::sqrt(std::max(trace, 0.0))));
+    }
+  });
+}
+
+uint32_t SplatTree::getLodIndexes(const glm::mat4& viewProj,
+                                  const glm::vec3& cameraPosition,
+                                  float focalPixels, float pixelThreshold,
+                                  uint32_t splatBudget,
+                                  std::vector<uint32_t>& lodIndexes) const {
+  if (nodes.empty() || lodProxies.size() != nodes.size())
+    return 0;
+
+  glm::vec4 planes[5];
+  getGridPlanes(viewProj, planes);
+
+  // Projected diameter in pixels, infinite with the camera inside
+  auto screenSize = [&](uint32_t n) {
+    const BoundingBox bounds = getNodeBounds(n);
+    const float distance =
+        glm::length(bounds.getCenter() - cameraPosition) - lodRadii[n];
+    return distance > 0.0f ? 2.0f * focalPixels * lodRadii[n] / distance
+                           : FLT_MAX;
+  };
+
+  // Max heap of the nodes currently drawn as proxies
+  typedef std::pair<float, uint32_t> Candidate;
+  std::priority_queue<Candidate> cut;
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;
+  bool rootInside = true;
+  if (nodes[0].getIndexCount() == 0 || isOutside(nodes[0], planes, rootInside))
+    return 0;
+  cut.push(Candidate(screenSize(0), 0));
+  uint64_t drawn = 1;
+
+  while (!cut.empty() && cut.top().first >= pixelThreshold) {
+    const uint32_t n = cut.top().second;
+    const SplatTreeNode& node = nodes[n];
+    if (node.isLeaf()) {
+      if (drawn - 1 + node.getIndexCount() > splatBudget)
+        break;
+      cut.pop();
+      drawn += node.getIndexCount() - 1;
+      ranges.emplace_back(node.indexBegin, node.indexEnd);
+      continue;
+    }
+
+    uint32_t visible[8];
+    uint32_t visibleCount = 0;
+    for (uint32_t c = 0; c < node.childCount; c++) {
+      const uint32_t child = node.firstChild + c;
+      bool inside = true;
+      if (nodes[child].getIndexCount() > 0 &&
+          !isOutside(nodes[child], planes, inside))
+        visible[visibleCount++] = child;
+    }
+    if (visibleCount == 0) {
+      // Every child is culled: the node leaves the cut without replacement
+      cut.pop();
+      drawn--;
+      continue;
+    }
+    if (drawn - 1 + visibleCount > splatBudget)
+      break;
+    cut.pop();
+    drawn = drawn - 1 + visibleCount;
+    for (uint32_t c = 0; c < visibleCount; c++)
+      cut.push(Candidate(screenSize(visible[c]), visible[c]));
+  }
+
+  // Leaf ranges first, in index order so neighbours merge, then proxies
+  std::sort(ranges.begin(), ranges.end());
+  std::vector<std::pair<uint32_t, uint32_t>> merged;
+  for (const std::pair<uint32_t, uint32_t>& range : ranges) {
+    if (!merged.empty() && merged.back().second == range.first)
+      merged.back().second = range.second;
+    else
+      merged.push_back(range);
+  }
+  uint32_t written = copyRanges(merged, lodIndexes);
+  const uint32_t proxyBase = getSplatCount();
+  for (; !cut.empty(); cut.pop(), written++)
+    lodIndexes.push_back(proxyBase + cut.top().second);
+  return written;
+}
@@ -1,5 +1,98 @@
+#ifndef SPLATTREE_H
+#define SPLATTREE_H
+
 #include <glm/glm.hpp>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "gpuSplat.h"
+#include "splatTreeNode.h"
+#include "threadPool.h"
+
+// Octree over splat centers used to cull whole groups of splats before they
+// reach the sort.
+//
+// The build reorders a private copy of the splat indexes so every node
+// covers a contiguous range of it; leaves hold ranges, never copies. Nodes
+// are split at the center of their cell until they reach `maxDepth` or hold
+// at most `maxLeafSize` splats. The tree is one flat array of 32 byte nodes
+// in breadth first order, built a level at a time: wide levels partition
+// their nodes in parallel, narrow ones partition each node in parallel.
+//
+// buildLod() adds a level of detail hierarchy on top: every node gets a
+// proxy Gaussian standing in for all the splats underneath, and
+// getLodIndexes() picks a cut of the tree per view.
+class SplatTree {
+ public:
+  explicit SplatTree(int maxDepth = 12, uint32_t maxLeafSize = 1024,
+                     ThreadPool& pool = ThreadPool::shared());
+
+  // `centers` holds xyz triplets, `splatCount` of them.
+  void build(const float* centers, uint32_t splatCount);
+
+  // Appends to `visibleIndexes` the splats whose node bounds intersect the
+  // view volume of `viewProj`, with the same 1.2x guard band on x/y as the
+  // vertex shader and no far plane. Returns the number of splats written,
+  // ready to be passed as sortCount.
+  uint32_t getVisibleIndexes(const glm::mat4& viewProj,
+                             std::vector<uint32_t>& visibleIndexes) const;
+
+  // Computes the proxy of every node from `splats`, which must be in the
+  // order of the centers given to build(). Proxies are moment matched: the
+  // weighted mean and covariance (spread of the centers included) of the
+  // splats below, weights being opacity times the splat's area. Opacity keeps
+  // the summed weight over the proxy's area, at most the opacity of all the
+  // splats stacked; color is the weighted DC term.
+  void buildLod(const GpuSplat* splats);
 
-class SplatTree{
+  // Node proxies as splat records, sh[0] only. Meant to be uploaded right
+  // after the splats of the scene.
+  const std::vector<GpuSplat>& getLodProxies() const { return lodProxies; }
 
+  // Appends the splats to draw for this view: nodes inside the frustum are
+  // refined, largest on screen first, until every node left projects to
+  // less than `pixelThreshold` or refining the next one would exceed
+  // `splatBudget`. Refined leaves contribute their splats, the remaining
+  // nodes their proxy, written as getSplatCount() + node. `cameraPosition`
+  // and `focalPixels` (focal length in pixels) give the screen size.
+  // Returns the number of indexes written.
+  uint32_t getLodIndexes(const glm::mat4& viewProj,
+                         const glm::vec3& cameraPosition, float focalPixels,
+                         float pixelThreshold, uint32_t splatBudget,
+                         std::vector<uint32_t>& lodIndexes) const;
+
+  // Node 0 is the root
+  const std::vector<SplatTreeNode>& getNodes() const { return nodes; }
+  BoundingBox getNodeBounds(uint32_t node) const;
+  const std::vector<uint32_t>& getIndexes() const { return indexes; }
+  uint32_t getNodeCount() const { return (uint32_t)nodes.size(); }
+  uint32_t getSplatCount() const { return (uint32_t)indexes.size(); }
+
+ private:
+  void partition(uint32_t begin, uint32_t end, const glm::vec3& split,
+                 uint32_t counts[8], bool parallel);
+  void getGridPlanes(const glm::mat4& viewProj, glm::vec4 planes[5]) const;
+  static bool isOutside(const SplatTreeNode& node, const glm::vec4 planes[5],
+                        bool& inside);
+  uint32_t copyRanges(const std::vector<std::pair<uint32_t, uint32_t>>& ranges,
+                      std::vector<uint32_t>& out) const;
+
+  int maxDepth;
+  uint32_t maxLeafSize;
+  ThreadPool& pool;
+
+  const float* centers = nullptr;
+  std::vector<SplatTreeNode> nodes;
+  std::vector<uint32_t> indexes;
+  std::vector<uint32_t> scratch;
+  glm::vec3 boundsOrigin = glm::vec3(0.0f);
+  float boundsStep = 0.0f;
+
+  std::vector<GpuSplat> lodProxies;
+  // Radius of each node's proxy: bounds half diagonal, or three standard
+  // deviations if larger
+  std::vector<float> lodRadii;
 };
+
+#endif
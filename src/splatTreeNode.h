@@ -1,4 +1,8 @@
+#ifndef SPLATTREENODE_H
+#define SPLATTREENODE_H
+
 #include <glm/glm.hpp>
+#include <cstdint>
 #include <vector>
 class   BoundingBox {
 public:
@@ -6,28 +10,41 @@ public:
 
     BoundingBox(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
 
-};
+    glm::vec3 getCenter() const { return (min + max) * 0.5f; }
 
-class SplatTreeNode
-{
-private:
-    /* data */
-public:
-    SplatTreeNode(const glm::vec3& min, const glm::vec3& max, int depth, int id) 
-        : min(min), max(max), boundingBox(min, max), depth(depth), data(nullptr), id(id) 
-    {
+    void expand(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
     }
-    virtual ~SplatTreeNode(){};
-    
-    void setIndexes(const std::vector<int>& newIndexes) {
-        
+
+    void expand(const BoundingBox& box) {
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
     }
-  private:      
-    glm::vec3 min, max, center;
-    BoundingBox boundingBox;
-    int depth;
-    std::vector<SplatTreeNode> children;
-    void* data = nullptr;
-    int id = 0;
 };
 
+// One node of the flat SplatTree array, 32 bytes so two share a cache line.
+//
+// Nodes are stored breadth first, so the children of a node are the
+// `childCount` consecutive nodes starting at `firstChild`. The node covers
+// the splats in [indexBegin, indexEnd) of the tree's index array. Bounds are
+// the tight bounds of the centers underneath, quantized to 16 bits per axis
+// over the root cell and rounded outwards.
+struct SplatTreeNode {
+    uint16_t boundsMin[3];
+    uint16_t boundsMax[3];
+    uint32_t firstChild;
+    uint32_t indexBegin;
+    uint32_t indexEnd;
+    uint32_t parent;
+    uint8_t  childCount;
+    uint8_t  depth;
+    uint16_t reserved;
+
+    bool     isLeaf() const { return childCount == 0; }
+    uint32_t getIndexCount() const { return indexEnd - indexBegin; }
+};
+
+static_assert(sizeof(SplatTreeNode) == 32, "SplatTreeNode should stay 32 bytes");
+
+#endif
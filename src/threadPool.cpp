@@ -0,0 +1,105 @@
+#include "threadPool.h"
+
+#include <algorithm>
+
+static thread_local bool insideWorker = false;
+
+ThreadPool::ThreadPool(size_t threadCount) {
+#if defined(SPLAT_HAS_THREADS)
+  if (threadCount == 0)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t i = 1; i < threadCount; i++)
+    workers.emplace_back(&ThreadPool::workerLoop, this);
+#endif
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread& worker : workers)
+    worker.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+  static ThreadPool pool;
+  return pool;
+}
+
+void ThreadPool::parallelFor(size_t taskCount,
+                             const std::function<void(size_t)>& task) {
+  if (taskCount == 0)
+    return;
+
+  std::unique_lock<std::mutex> dispatch(dispatchMutex, std::try_to_lock);
+  if (workers.empty() || taskCount == 1 || insideWorker ||
+      !dispatch.owns_lock()) {
+    for (size_t i = 0; i < taskCount; i++)
+      task(i);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    currentTask = &task;
+    nextTask = 0;
+    totalTasks = taskCount;
+    pendingWorkers = workers.size();
+    generation++;
+  }
+  wake.notify_all();
+
+  insideWorker = true;
+  runTasks();
+  insideWorker = false;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this] { return pendingWorkers == 0; });
+  currentTask = nullptr;
+}
+
+void ThreadPool::parallelForRange(
+    size_t begin, size_t end, size_t grain,
+    const std::function<void(size_t, size_t)>& task) {
+  if (end <= begin)
+    return;
+
+  const size_t count = end - begin;
+  const size_t chunks = std::max<size_t>(
+      1, std::min(getThreadCount(), count / std::max<size_t>(grain, 1)));
+  const size_t chunkSize = (count + chunks - 1) / chunks;
+
+  parallelFor(chunks, [&](size_t chunk) {
+    const size_t chunkBegin = begin + chunk * chunkSize;
+    const size_t chunkEnd = std::min(end, chunkBegin + chunkSize);
+    if (chunkBegin < chunkEnd)
+      task(chunkBegin, chunkEnd);
+  });
+}
+
+void ThreadPool::runTasks() {
+  size_t i;
+  while ((i = nextTask.fetch_add(1)) < totalTasks)
+    (*currentTask)(i);
+}
+
+void ThreadPool::workerLoop() {
+  insideWorker = true;
+  size_t seen = 0;
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.wait(lock, [&] { return stopping || generation != seen; });
+    if (stopping)
+      return;
+    seen = generation;
+    lock.unlock();
+
+    runTasks();
+
+    lock.lock();
+    if (--pendingWorkers == 0)
+      done.notify_one();
+  }
+}
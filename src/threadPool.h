@@ -0,0 +1,64 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Emscripten is linked with USE_PTHREADS=0 unless explicitly enabled, in that
+// case every parallel loop runs inline on the calling thread.
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#define SPLAT_HAS_THREADS 1
+#endif
+
+// Fixed pool of workers used by the CPU splat kernels. parallelFor() blocks
+// until every task has run; the calling thread takes tasks too. Calls made
+// from inside a task, or while another thread owns the pool, run serially
+// instead of deadlocking.
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t threadCount = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Below this many items per task the threading overhead dominates a
+  // plain per-splat loop. Kernels that measured better grains use those.
+  static constexpr size_t kDefaultGrain = 32768;
+
+  // Workers plus the calling thread.
+  size_t getThreadCount() const { return workers.size() + 1; }
+
+  void parallelFor(size_t taskCount, const std::function<void(size_t)>& task);
+
+  // Splits [begin, end) into at most getThreadCount() ranges of at least
+  // `grain` items each.
+  void parallelForRange(size_t begin, size_t end, size_t grain,
+                        const std::function<void(size_t, size_t)>& task);
+
+  static ThreadPool& shared();
+
+ private:
+  void workerLoop();
+  void runTasks();
+
+  std::vector<std::thread> workers;
+  std::mutex dispatchMutex;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+
+  const std::function<void(size_t)>* currentTask = nullptr;
+  std::atomic<size_t> nextTask{0};
+  size_t totalTasks = 0;
+  size_t pendingWorkers = 0;
+  size_t generation = 0;
+  bool stopping = false;
+};
+
+#endif
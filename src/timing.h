@@ -0,0 +1,14 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <chrono>
+
+using Clock = std::chrono::steady_clock;
+
+// Wall clock since `start` in milliseconds, the unit of every stats struct.
+inline double msSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+#endif